@@ -110,6 +110,46 @@ tracer_result_t decode_tracer_config(const char *config_str, tracer_config_t *co
         config_out.transport_config.file_path = strdup(json_object_get_string(obj));
     }
     
+    if (json_object_object_get_ex(root, "shm_name", &obj)) {
+        config_out.transport_config.shm_name = strdup(json_object_get_string(obj));
+    }
+    
+    if (json_object_object_get_ex(root, "socket_path", &obj)) {
+        config_out.transport_config.socket_path = strdup(json_object_get_string(obj));
+    }
+    
+    if (json_object_object_get_ex(root, "seqpacket", &obj)) {
+        config_out.transport_config.seqpacket = json_object_get_boolean(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "flush_interval_ms", &obj)) {
+        config_out.transport_config.flush_interval_ms = json_object_get_int(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "flush_bytes", &obj)) {
+        config_out.transport_config.flush_bytes = json_object_get_int(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "backpressure", &obj)) {
+        config_out.transport_config.backpressure = json_object_get_int(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "compress", &obj)) {
+        config_out.transport_config.compress = json_object_get_boolean(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "segment_size_mb", &obj)) {
+        config_out.transport_config.segment_size_mb = json_object_get_int(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "max_segments", &obj)) {
+        config_out.transport_config.max_segments = json_object_get_int(obj);
+    }
+    
+    if (json_object_object_get_ex(root, "segment_max_age_s", &obj)) {
+        config_out.transport_config.segment_max_age_s = json_object_get_int(obj);
+    }
+    
     if (json_object_object_get_ex(root, "transport", &obj)) {
         config_out.transport = json_object_get_int(obj);
     }
@@ -163,6 +203,10 @@ tracer_result_t decode_tracer_config(const char *config_str, tracer_config_t *co
         if (json_object_object_get_ex(obj, "include_newline_in_formatted_trace", &format_obj)) {
             format.include_newline_in_formatted_trace = json_object_get_boolean(format_obj);
         }
+        
+        if (json_object_object_get_ex(obj, "output_as_binary", &format_obj)) {
+            format.output_as_binary = json_object_get_boolean(format_obj);
+        }
 
         if (json_object_object_get_ex(obj, "arg_format", &format_obj)) {
             format.args = json_object_get_int(format_obj);
@@ -232,6 +276,18 @@ const char *copy_human_readable_config(tracer_config_t config) {
     else if (config.transport == TRACER_TRANSPORT_FILE) {
         offset += snprintf(formatted + offset, 1024 - offset, "File: %s, ", config.transport_config.file_path);
     }
+    else if (config.transport == TRACER_TRANSPORT_SHM) {
+        offset += snprintf(formatted + offset, 1024 - offset, "Shared memory: %s, ", config.transport_config.shm_name);
+    }
+    else if (config.transport == TRACER_TRANSPORT_UNIX) {
+        offset += snprintf(formatted + offset, 1024 - offset, "Unix socket: %s%s, ", config.transport_config.socket_path, config.transport_config.seqpacket ? " (seqpacket)" : "");
+    }
+    else if (config.transport == TRACER_TRANSPORT_SEGMENTS) {
+        offset += snprintf(formatted + offset, 1024 - offset, "Segments: %s, ", config.transport_config.file_path);
+        offset += snprintf(formatted + offset, 1024 - offset, "Segment size: %u MB, ", config.transport_config.segment_size_mb);
+        offset += snprintf(formatted + offset, 1024 - offset, "Max segments: %u, ", config.transport_config.max_segments);
+        offset += snprintf(formatted + offset, 1024 - offset, "Max segment age: %u s, ", config.transport_config.segment_max_age_s);
+    }
     else if (config.transport == TRACER_TRANSPORT_CUSTOM) {
         offset += snprintf(formatted + offset, 1024 - offset, "Custom transport, ");
     }
@@ -239,6 +295,13 @@ const char *copy_human_readable_config(tracer_config_t config) {
         offset += snprintf(formatted + offset, 1024 - offset, "Stdout transport, ");
     }
     
+    if (config.transport == TRACER_TRANSPORT_SOCKET || config.transport == TRACER_TRANSPORT_UNIX || config.transport == TRACER_TRANSPORT_FILE) {
+        offset += snprintf(formatted + offset, 1024 - offset, "Flush interval: %u ms, ", config.transport_config.flush_interval_ms);
+        offset += snprintf(formatted + offset, 1024 - offset, "Flush bytes: %u, ", config.transport_config.flush_bytes);
+        offset += snprintf(formatted + offset, 1024 - offset, "Backpressure: %d, ", config.transport_config.backpressure);
+        offset += snprintf(formatted + offset, 1024 - offset, "Compressed: %s, ", config.transport_config.compress ? "yes" : "no");
+    }
+    
     offset += snprintf(formatted + offset, 1024 - offset, "Include formatted trace: %d, ", config.format.include_formatted_trace);
     offset += snprintf(formatted + offset, 1024 - offset, "Include event json: %d, ", config.format.include_event_json);
     offset += snprintf(formatted + offset, 1024 - offset, "Output as json: %d, ", config.format.output_as_json);
@@ -251,6 +314,7 @@ const char *copy_human_readable_config(tracer_config_t config) {
     offset += snprintf(formatted + offset, 1024 - offset, "Variable separator spacing: %d, ", config.format.variable_separator_spacing);
     offset += snprintf(formatted + offset, 1024 - offset, "Static separator spacing: %d, ", config.format.static_separator_spacing);
     offset += snprintf(formatted + offset, 1024 - offset, "Include newline in formatted trace: %d, ", config.format.include_newline_in_formatted_trace);
+    offset += snprintf(formatted + offset, 1024 - offset, "Output as binary: %d, ", config.format.output_as_binary);
     offset += snprintf(formatted + offset, 1024 - offset, "Arg format: %d, ", config.format.args);
     
     for (int i = 0; i < config.filter_count; i++) {
@@ -66,6 +66,34 @@ tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_str) {
     if (config->transport_config.file_path) {
         json_object_object_add(root, "file", json_object_new_string(config->transport_config.file_path));
     }
+    if (config->transport_config.shm_name) {
+        json_object_object_add(root, "shm_name", json_object_new_string(config->transport_config.shm_name));
+    }
+    if (config->transport_config.socket_path) {
+        json_object_object_add(root, "socket_path", json_object_new_string(config->transport_config.socket_path));
+    }
+    if (config->transport_config.seqpacket) {
+        json_object_object_add(root, "seqpacket", json_object_new_boolean(config->transport_config.seqpacket));
+    }
+    if (config->transport_config.flush_interval_ms) {
+        json_object_object_add(root, "flush_interval_ms", json_object_new_int(config->transport_config.flush_interval_ms));
+    }
+    if (config->transport_config.flush_bytes) {
+        json_object_object_add(root, "flush_bytes", json_object_new_int(config->transport_config.flush_bytes));
+    }
+    json_object_object_add(root, "backpressure", json_object_new_int(config->transport_config.backpressure));
+    if (config->transport_config.compress) {
+        json_object_object_add(root, "compress", json_object_new_boolean(config->transport_config.compress));
+    }
+    if (config->transport_config.segment_size_mb) {
+        json_object_object_add(root, "segment_size_mb", json_object_new_int(config->transport_config.segment_size_mb));
+    }
+    if (config->transport_config.max_segments) {
+        json_object_object_add(root, "max_segments", json_object_new_int(config->transport_config.max_segments));
+    }
+    if (config->transport_config.segment_max_age_s) {
+        json_object_object_add(root, "segment_max_age_s", json_object_new_int(config->transport_config.segment_max_age_s));
+    }
     json_object_object_add(root, "transport", json_object_new_int(config->transport));
     
     json_object *format = json_object_new_object();
@@ -86,6 +114,7 @@ tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_str) {
     json_object_object_add(format, "variable_separator_spacing", json_object_new_boolean(config->format.variable_separator_spacing));
     json_object_object_add(format, "static_separator_spacing", json_object_new_int(config->format.static_separator_spacing));
     json_object_object_add(format, "include_newline_in_formatted_trace", json_object_new_boolean(config->format.include_newline_in_formatted_trace));
+    json_object_object_add(format, "output_as_binary", json_object_new_boolean(config->format.output_as_binary));
     json_object_object_add(format, "arg_format", json_object_new_int(config->format.args));
     json_object_object_add(root, "format", format);
     
@@ -9,6 +9,22 @@
 #include "tracer_internal.h"
 #include "color_utils.h"
 
+// Longest sequence is "\x1b[38;5;255m" plus a terminator
+#define COLOR_ESCAPE_MAX_LEN 16
+
+static struct {
+    char sequence[COLOR_ESCAPE_MAX_LEN];
+    uint8_t length;
+} color_escape_table[256];
+static pthread_once_t color_escape_table_once = PTHREAD_ONCE_INIT;
+
+static void build_color_escape_table(void) {
+    for (int color = 0; color < 256; color++) {
+        int written = snprintf(color_escape_table[color].sequence, COLOR_ESCAPE_MAX_LEN, "\x1b[38;5;%dm", color);
+        color_escape_table[color].length = (uint8_t)written;
+    }
+}
+
 uint8_t get_consistent_color(const char *str, uint8_t start, uint16_t range) {
     if (str == NULL) {
         return start;
@@ -20,3 +36,11 @@ uint8_t get_consistent_color(const char *str, uint8_t start, uint16_t range) {
 int write_color(char *buffer, uint8_t color) {
     return sprintf(buffer, "\x1b[38;5;%dm", color);
 }
+
+const char *get_color_escape_sequence(uint8_t color, size_t *out_length) {
+    pthread_once(&color_escape_table_once, build_color_escape_table);
+    if (out_length) {
+        *out_length = color_escape_table[color].length;
+    }
+    return color_escape_table[color].sequence;
+}
@@ -25,4 +25,13 @@
 uint8_t get_consistent_color(const char *str, uint8_t start, uint16_t range);
 int write_color(char *buffer, uint8_t color);
 
+/**
+ * @brief Get the pre-rendered "\x1b[38;5;<color>m" escape sequence for a 256-color palette index
+ *
+ * @param color The palette index
+ * @param out_length Receives the length of the sequence. May be NULL
+ * @return The escape sequence. The returned string is static and must not be freed
+ */
+const char *get_color_escape_sequence(uint8_t color, size_t *out_length);
+
 #endif // COLOR_UTILS_H
@@ -6,52 +6,21 @@
 //
 
 #include <CoreFoundation/CoreFoundation.h>
-#include <json-c/json_object.h>
+#include <stdatomic.h>
 #include "tracer_internal.h"
 #include "encoding_description.h"
 #include "color_utils.h"
-#include <dlfcn.h>
+#include "swift_demangle.h"
+#include "method_fragments.h"
+#include "output_buffer.h"
+#include "json_writer.h"
+#include "format.h"
 
 #define STATIC_BUFFER_SIZE 1024
-#define FORMATTED_EVENT_BUF_SIZE 1024
-#define ASSEMBLED_METHOD_BUF_SIZE 1024
-
-
-static inline kern_return_t fast_append(char **ptr, const char *end, const char *format, ...) {
-    if (!ptr || !*ptr || !end || format == NULL) {
-        return KERN_INVALID_ARGUMENT;
-    }
-    
-    ptrdiff_t remaining = end - *ptr;
-    if (remaining < 0 || remaining > FORMATTED_EVENT_BUF_SIZE) {
-        return KERN_NO_SPACE;
-    }
-    
-    va_list args;
-    va_start(args, format);
-    
-    va_list args_copy;
-    va_copy(args_copy, args);
-    
-    int written = vsnprintf(*ptr, remaining, format, args);
-    va_end(args);
-    
-    if (written < 0 || written >= remaining) {
-        va_end(args_copy);
-        return KERN_NO_SPACE;
-    }
-    
-    if (written > 0 && *ptr + written <= end) {
-        *ptr += written;
-    }
-    
-    va_end(args_copy);
-    return KERN_SUCCESS;
-}
-
-static inline kern_return_t fast_write_color(char **ptr, const char *end, uint8_t color) {
-    return fast_append(ptr, end, "\033[38;5;%dm", color);
-}
+// Indent prefixes are pre-rendered for depths below this. Deeper events render their prefix inline
+#define INDENT_CACHE_MAX_DEPTH 64
+// Number of distinct indent configurations that can be cached at once
+#define INDENT_CACHE_SLOTS 4
 
 __unused static char *format_binary_data(const char *data, size_t size) {
     static __thread char hex_buffer[STATIC_BUFFER_SIZE];
@@ -102,272 +71,317 @@ static uint32_t spaces_between_indent_level(uint32_t indent_level) {
     return 0;
 }
 
-static const char *demangle_swift(const char *name) {
-    typedef char *(*swift_demangle_ft)(const char *mangledName, size_t mangledNameLength, char *outputBuffer, size_t *outputBufferSize, uint32_t flags);
-    static swift_demangle_ft swift_demangle_f;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        swift_demangle_f = (swift_demangle_ft) dlsym(RTLD_DEFAULT, "swift_demangle");
-    });
-    
-    if (swift_demangle_f) {
-        return swift_demangle_f(name, strlen(name), 0, 0, 0);
-    }
-    return name;
+static inline void append_color(output_buffer_t *out, uint8_t color) {
+    size_t length = 0;
+    const char *sequence = get_color_escape_sequence(color, &length);
+    output_buffer_append(out, sequence, length);
 }
 
-const char *build_formatted_event_str(const tracer_event_t *event, tracer_format_options_t format) {
-    if (event == NULL || event->class_name == NULL || event->method_name == NULL) {
-        return NULL;
-    }
+static inline void append_reset(output_buffer_t *out) {
+    output_buffer_append(out, COLOR_RESET, sizeof(COLOR_RESET) - 1);
+}
+
+static void append_indent_prefix(output_buffer_t *out, const tracer_format_options_t *format, uint32_t trace_depth) {
+    const char *indent = format->indent_char ? format->indent_char : "";
+    const char *separator = format->indent_separator_char ? format->indent_separator_char : "";
+    size_t indent_len = strlen(indent);
+    size_t separator_len = strlen(separator);
+    uint8_t depth_color = COLOR_DEPTH_START + (trace_depth % (COLOR_DEPTH_END - COLOR_DEPTH_START));
     
-    char formatted_event_buf[FORMATTED_EVENT_BUF_SIZE] = {0};
-    char assembled_method_name_buf[ASSEMBLED_METHOD_BUF_SIZE] = {0};
-    char *ptr = formatted_event_buf;
-    const char *const end = formatted_event_buf + FORMATTED_EVENT_BUF_SIZE;
+    for (uint32_t i = 0; i < trace_depth; i++) {
+        uint32_t spaces = format->variable_separator_spacing ? spaces_between_indent_level(i) : format->static_separator_spacing;
+        for (uint32_t j = 0; j < spaces; j++) {
+            output_buffer_append(out, indent, indent_len);
+        }
+        
+        if (format->include_indent_separators) {
+            if (format->include_colors) {
+                append_color(out, depth_color);
+            }
+            output_buffer_append(out, separator, separator_len);
+            if (format->include_colors) {
+                append_reset(out);
+            }
+        }
+    }
     
-    // Thread ID formatting
-    if (format.include_thread_id) {
-        if (format.include_colors) {
-            uint8_t thread_color = COLOR_THREAD_START + (event->thread_id % (COLOR_THREAD_END - COLOR_THREAD_START));
-            if (fast_write_color(&ptr, end, thread_color) != KERN_SUCCESS) {
-                return NULL;
+    if (trace_depth > 0) {
+        output_buffer_append(out, indent, indent_len);
+    }
+}
+
+// Pre-rendered indent prefixes for one combination of indent options.
+// Slots are claimed once and never released, and each depth's string is published with a CAS
+// and never replaced, so lookups are lock-free and never see a freed string
+typedef struct {
+    _Atomic(bool) claimed;
+    _Atomic(bool) ready;
+    bool include_colors;
+    bool include_indent_separators;
+    bool variable_separator_spacing;
+    uint32_t static_separator_spacing;
+    char *indent_char;
+    char *indent_separator_char;
+    _Atomic(char *) prefixes[INDENT_CACHE_MAX_DEPTH];
+    _Atomic(size_t) prefix_lengths[INDENT_CACHE_MAX_DEPTH];
+} indent_cache_t;
+
+static indent_cache_t indent_caches[INDENT_CACHE_SLOTS];
+
+static bool indent_strings_equal(const char *cached, const char *str) {
+    return strcmp(cached, str ? str : "") == 0;
+}
+
+static bool indent_cache_matches(const indent_cache_t *cache, const tracer_format_options_t *format) {
+    return cache->include_colors == format->include_colors &&
+        cache->include_indent_separators == format->include_indent_separators &&
+        cache->variable_separator_spacing == format->variable_separator_spacing &&
+        (cache->variable_separator_spacing || cache->static_separator_spacing == format->static_separator_spacing) &&
+        indent_strings_equal(cache->indent_char, format->indent_char) &&
+        indent_strings_equal(cache->indent_separator_char, format->indent_separator_char);
+}
+
+static indent_cache_t *get_indent_cache(const tracer_format_options_t *format) {
+    for (int i = 0; i < INDENT_CACHE_SLOTS; i++) {
+        indent_cache_t *cache = &indent_caches[i];
+        if (atomic_load_explicit(&cache->ready, memory_order_acquire)) {
+            if (indent_cache_matches(cache, format)) {
+                return cache;
             }
+            continue;
         }
         
-        if (fast_append(&ptr, end, "[0x%x] ", event->thread_id) != KERN_SUCCESS) {
-            return NULL;
+        bool expected = false;
+        if (!atomic_compare_exchange_strong(&cache->claimed, &expected, true)) {
+            // Another thread is filling this slot in. Don't wait for it
+            continue;
         }
         
-        if (format.include_colors) {
-            if (fast_append(&ptr, end, COLOR_RESET) != KERN_SUCCESS) {
-                return NULL;
-            }
+        cache->indent_char = strdup(format->indent_char ? format->indent_char : "");
+        cache->indent_separator_char = strdup(format->indent_separator_char ? format->indent_separator_char : "");
+        if (cache->indent_char == NULL || cache->indent_separator_char == NULL) {
+            FREE_IF_NOT_NULL(cache->indent_char);
+            FREE_IF_NOT_NULL(cache->indent_separator_char);
+            atomic_store(&cache->claimed, false);
+            return NULL;
         }
+        
+        cache->include_colors = format->include_colors;
+        cache->include_indent_separators = format->include_indent_separators;
+        cache->variable_separator_spacing = format->variable_separator_spacing;
+        cache->static_separator_spacing = format->static_separator_spacing;
+        atomic_store_explicit(&cache->ready, true, memory_order_release);
+        return cache;
     }
     
-    // Indentation
-    if (format.include_indents) {
-        uint8_t depth_color = format.include_colors ? COLOR_DEPTH_START + (event->trace_depth % (COLOR_DEPTH_END - COLOR_DEPTH_START)) : 0;
-        
-        for (uint32_t i = 0; i < event->trace_depth; i++) {
-            uint32_t spaces = format.variable_separator_spacing ? spaces_between_indent_level(i) : format.static_separator_spacing;
-            
-            for (uint32_t j = 0; j < spaces; j++) {
-                if (fast_append(&ptr, end, format.indent_char) != KERN_SUCCESS) {
-                    return NULL;
-                }
-            }
-            
-            if (format.include_indent_separators) {
-                if (format.include_colors) {
-                    if (fast_write_color(&ptr, end, depth_color) != KERN_SUCCESS) {
-                        return NULL;
-                    }
-                }
-                
-                if (fast_append(&ptr, end, format.indent_separator_char) != KERN_SUCCESS) {
-                    return NULL;
-                }
-                
-                if (format.include_colors) {
-                    if (fast_append(&ptr, end, COLOR_RESET) != KERN_SUCCESS) {
-                        return NULL;
-                    }
-                }
-            }
+    return NULL;
+}
+
+static void append_indent(output_buffer_t *out, const tracer_format_options_t *format, uint32_t trace_depth) {
+    indent_cache_t *cache = trace_depth < INDENT_CACHE_MAX_DEPTH ? get_indent_cache(format) : NULL;
+    if (cache == NULL) {
+        append_indent_prefix(out, format, trace_depth);
+        return;
+    }
+    
+    char *prefix = atomic_load_explicit(&cache->prefixes[trace_depth], memory_order_acquire);
+    if (prefix == NULL) {
+        output_buffer_t rendered = {0};
+        append_indent_prefix(&rendered, format, trace_depth);
+        if (rendered.failed || rendered.data == NULL) {
+            output_buffer_free(&rendered);
+            append_indent_prefix(out, format, trace_depth);
+            return;
         }
         
-        if (event->trace_depth > 0) {
-            if (fast_append(&ptr, end, format.indent_char) != KERN_SUCCESS) {
-                return NULL;
-            }
+        // The length is stored before the release CAS that publishes the string. Racing writers all store the same value
+        atomic_store_explicit(&cache->prefix_lengths[trace_depth], rendered.length, memory_order_relaxed);
+        char *expected = NULL;
+        if (atomic_compare_exchange_strong_explicit(&cache->prefixes[trace_depth], &expected, rendered.data, memory_order_acq_rel, memory_order_acquire)) {
+            prefix = rendered.data;
+        }
+        else {
+            output_buffer_free(&rendered);
+            prefix = expected;
         }
     }
     
-    // Class name and method type
-    const char *class_name = event->class_name;
-    if (class_name && strncmp(class_name, "_Tt", 3) == 0) {
-        // Demangle Swift class names
-        const char *demangled = demangle_swift(class_name);
-        if (demangled) {
-            free((void *)class_name);
-            class_name = demangled;
-        }
+    output_buffer_append(out, prefix, atomic_load_explicit(&cache->prefix_lengths[trace_depth], memory_order_relaxed));
+}
+
+static inline void append_fragment(output_buffer_t *out, const method_fragments_t *fragments, method_fragment_span_t span) {
+    output_buffer_append(out, fragments->text + span.offset, span.length);
+}
+
+static void append_argument(output_buffer_t *out, const tracer_argument_t *arg, bool colors) {
+    if (colors) {
+        append_reset(out);
     }
     
-    if (format.include_colors && class_name) {
-        uint8_t class_color = get_consistent_color(class_name, COLOR_CLASS_START, COLOR_CLASS_RANGE);
-        if (fast_write_color(&ptr, end, class_color) != KERN_SUCCESS) {
-            return NULL;
+    const char *type = arg->objc_class_name ? arg->objc_class_name : arg->type_encoding;
+    uint8_t arg_color = colors ? get_consistent_color(type, COLOR_METHOD_START, COLOR_METHOD_RANGE) : 0;
+    
+    if (arg->block_signature) {
+        output_buffer_append_char(out, ' ');
+        if (colors) {
+            append_color(out, arg_color);
         }
+        output_buffer_append_char(out, '(');
+        output_buffer_append_str(out, arg->block_signature);
+        output_buffer_append_char(out, ')');
     }
-    
-    if (fast_append(&ptr, end, "%s[%s ", event->is_class_method ? "+" : "-", class_name) != KERN_SUCCESS) {
-        return NULL;
+    else {
+        if (colors) {
+            append_color(out, arg_color);
+        }
+        output_buffer_append_str(out, arg->description ? arg->description : "nil");
     }
     
-    if (strlcpy(assembled_method_name_buf, event->method_name, ASSEMBLED_METHOD_BUF_SIZE) >= ASSEMBLED_METHOD_BUF_SIZE) {
-        return NULL;
+    if (colors) {
+        append_reset(out);
     }
+}
+
+static void append_method_fragments(output_buffer_t *out, const method_fragments_t *fragments, const tracer_event_t *event, bool colors) {
+    append_fragment(out, fragments, fragments->head);
     
-    // Process method parts and arguments
-    size_t arg_index = 0;
-    char *method_part = strtok(assembled_method_name_buf, ":");
-    while (method_part != NULL) {
-        if (format.include_colors) {
-            uint8_t method_color = get_consistent_color(event->method_name, COLOR_METHOD_START, COLOR_METHOD_RANGE);
-            if (fast_write_color(&ptr, end, method_color) != KERN_SUCCESS) {
-                return NULL;
+    // Each selector part is followed by its argument, if one was captured
+    for (uint32_t i = 0; i < fragments->part_count; i++) {
+        append_fragment(out, fragments, fragments->parts[i]);
+        
+        if (i < event->argument_count) {
+            append_argument(out, &event->arguments[i], colors);
+            if (i + 1 < event->argument_count) {
+                output_buffer_append_char(out, ' ');
             }
         }
-        
-        if (fast_append(&ptr, end, "%s", method_part) != KERN_SUCCESS) {
-            return NULL;
+    }
+    
+    append_fragment(out, fragments, fragments->tail);
+}
+
+kern_return_t append_formatted_event(const tracer_event_t *event, const tracer_format_options_t *format, output_buffer_t *out) {
+    if (event == NULL || format == NULL || out == NULL || event->class_name == NULL || event->method_name == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+    
+    size_t start_length = out->length;
+    bool colors = format->include_colors;
+    
+    // Thread ID formatting
+    if (format->include_thread_id) {
+        if (colors) {
+            append_color(out, COLOR_THREAD_START + (event->thread_id % (COLOR_THREAD_END - COLOR_THREAD_START)));
         }
         
-        const char *remaining = event->method_name + (method_part - assembled_method_name_buf);
-        if (remaining && strchr(remaining, ':')) {
-            if (fast_append(&ptr, end, ":") != KERN_SUCCESS) {
-                return NULL;
-            }
-        }
+        output_buffer_append(out, "[0x", 3);
+        output_buffer_append_hex(out, event->thread_id);
+        output_buffer_append(out, "] ", 2);
         
-        if (arg_index < event->argument_count) {
-            const tracer_argument_t *arg = &event->arguments[arg_index];
-            
-            if (format.include_colors) {
-                if (fast_append(&ptr, end, COLOR_RESET) != KERN_SUCCESS) {
-                    return NULL;
-                }
-            }
-            
-            const char *type = arg->objc_class_name ? arg->objc_class_name : arg->type_encoding;
-            uint8_t arg_color = format.include_colors ? get_consistent_color(type, COLOR_METHOD_START, COLOR_METHOD_RANGE) : 0;
-            
-            if (arg->block_signature) {
-                if (fast_append(&ptr, end, " ") != KERN_SUCCESS) {
-                    return NULL;
-                }
-                if (format.include_colors && fast_write_color(&ptr, end, arg_color) != KERN_SUCCESS) {
-                    return NULL;
-                }
-                if (fast_append(&ptr, end, "(%s)", arg->block_signature) != KERN_SUCCESS) {
-                    return NULL;
-                }
-                if (format.include_colors && fast_append(&ptr, end, COLOR_RESET) != KERN_SUCCESS) {
-                    return NULL;
-                }
-            }
-            else {
-                if (format.include_colors) {
-                    if (fast_write_color(&ptr, end, arg_color) != KERN_SUCCESS) {
-                        return NULL;
-                    }
-                }
-                
-                if (arg->description) {
-                    if (fast_append(&ptr, end, "%s",  arg->description) != KERN_SUCCESS) {
-                        return NULL;
-                    }
-                }
-                else {
-                    if (fast_append(&ptr, end, "nil") != KERN_SUCCESS) {
-                        return NULL;
-                    }
-                }
-                
-                if (format.include_colors) {
-                    if (fast_append(&ptr, end, COLOR_RESET) != KERN_SUCCESS) {
-                        return NULL;
-                    }
-                }
-            }
-            
-            if (arg_index + 1 < event->argument_count) {
-                if (fast_append(&ptr, end, " ") != KERN_SUCCESS) {
-                    return NULL;
-                }
-            }
-            
-            arg_index++;
+        if (colors) {
+            append_reset(out);
         }
-        
-        method_part = strtok(NULL, ":");
     }
     
-    if (format.include_colors) {
-        uint8_t class_color = get_consistent_color(event->class_name, COLOR_CLASS_START, COLOR_CLASS_RANGE);
-        if (fast_write_color(&ptr, end, class_color) != KERN_SUCCESS) {
-            return NULL;
-        }
+    // Indentation
+    if (format->include_indents) {
+        append_indent(out, format, event->trace_depth);
     }
     
-    if (fast_append(&ptr, end, "]") != KERN_SUCCESS) {
-        return NULL;
+    // The class name and selector parts are the same on every call to a method, so they come pre-rendered
+    // (with their colors) from the fragment cache. Only the arguments are formatted per event
+    method_fragments_t *uncached_fragments = NULL;
+    const method_fragments_t *fragments = get_method_fragments(event->class_name, event->method_name, event->is_class_method, colors);
+    if (fragments == NULL) {
+        uncached_fragments = create_method_fragments(event->class_name, event->method_name, event->is_class_method, colors);
+        fragments = uncached_fragments;
     }
     
-    if (format.include_newline_in_formatted_trace) {
-        if (fast_append(&ptr, end, "\n") != KERN_SUCCESS) {
-            return NULL;
-        }
+    if (fragments == NULL) {
+        out->failed = true;
+    }
+    else {
+        append_method_fragments(out, fragments, event, colors);
     }
+    free(uncached_fragments);
     
-    if (format.include_colors) {
-        if (fast_append(&ptr, end, COLOR_RESET) != KERN_SUCCESS) {
-            return NULL;
+    if (format->include_newline_in_formatted_trace) {
+        output_buffer_append_char(out, '\n');
+    }
+    
+    if (colors) {
+        append_reset(out);
+    }
+    
+    if (out->failed) {
+        out->failed = false;
+        out->length = start_length;
+        if (out->data) {
+            out->data[start_length] = '\0';
         }
+        return KERN_RESOURCE_SHORTAGE;
     }
     
-    return strdup(formatted_event_buf);
+    return KERN_SUCCESS;
 }
 
-#define JSON_SAFE_ADD_FUNC(_root, _key, _ptr, _func) if (_ptr) json_object_object_add(_root, _key, _func(_ptr))
-#define JSON_ADD_INT(_root, _key, _ptr) JSON_SAFE_ADD_FUNC(_root, _key, _ptr, json_object_new_int)
-#define JSON_ADD_INT64(_root, _key, _ptr) JSON_SAFE_ADD_FUNC(_root, _key, _ptr, json_object_new_int64)
-#define JSON_ADD_BOOL(_root, _key, _ptr) JSON_SAFE_ADD_FUNC(_root, _key, _ptr, json_object_new_boolean)
-#define JSON_ADD_STRING(_root, _key, _ptr) JSON_SAFE_ADD_FUNC(_root, _key, _ptr, json_object_new_string)
-
-const char *build_json_event_str(const tracer_t *tracer, const tracer_event_t *event) {
-    if (event == NULL || tracer == NULL) {
+char *build_formatted_event_str(const tracer_event_t *event, tracer_format_options_t format) {
+    output_buffer_t out = {0};
+    if (append_formatted_event(event, &format, &out) != KERN_SUCCESS) {
+        output_buffer_free(&out);
         return NULL;
     }
     
-    if (event->class_name == NULL || event->method_name == NULL) {
-        return NULL;
+    return out.data;
+}
+
+// Fields are only written when their value is non-zero/non-NULL, matching the schema consumers expect
+#define JSON_SAFE_ADD_FUNC(_writer, _key, _value, _func) if (_value) { json_writer_key(_writer, _key); _func(_writer, _value); }
+#define JSON_ADD_INT(_writer, _key, _value) JSON_SAFE_ADD_FUNC(_writer, _key, _value, json_writer_int64)
+#define JSON_ADD_INT64(_writer, _key, _value) JSON_SAFE_ADD_FUNC(_writer, _key, (int64_t)(_value), json_writer_int64)
+#define JSON_ADD_BOOL(_writer, _key, _value) JSON_SAFE_ADD_FUNC(_writer, _key, _value, json_writer_bool)
+#define JSON_ADD_STRING(_writer, _key, _value) JSON_SAFE_ADD_FUNC(_writer, _key, _value, json_writer_string)
+
+kern_return_t append_json_event(const tracer_t *tracer, const tracer_event_t *event, output_buffer_t *out, output_buffer_t *scratch) {
+    if (event == NULL || tracer == NULL || out == NULL || scratch == NULL) {
+        return KERN_INVALID_ARGUMENT;
     }
     
-    json_object *root = json_object_new_object();
-    if (root == NULL) {
-        return NULL;
+    if (event->class_name == NULL || event->method_name == NULL) {
+        return KERN_INVALID_ARGUMENT;
     }
     
+    size_t start_length = out->length;
+    json_writer_t writer;
+    json_writer_init(&writer, out);
+    json_writer_begin_object(&writer);
+    
     tracer_format_options_t format = tracer->config.format;
     if (format.include_formatted_trace) {
-        const char *formatted = build_formatted_event_str(event, format);
-        if (formatted) {
-            JSON_ADD_STRING(root, "formatted_output", formatted);
-            free((void *)formatted);
+        output_buffer_reset(scratch);
+        if (append_formatted_event(event, &format, scratch) == KERN_SUCCESS) {
+            json_writer_key(&writer, "formatted_output");
+            json_writer_string_with_length(&writer, scratch->data, scratch->length);
         }
     }
     
     if (format.include_event_json) {
         
-        JSON_ADD_STRING(root, "class", event->class_name);
-        JSON_ADD_STRING(root, "method", event->method_name);
-        JSON_ADD_BOOL(root, "is_class_method", event->is_class_method);
-        JSON_ADD_INT64(root, "thread_id", event->thread_id);
-        JSON_ADD_INT(root, "depth", event->real_depth);
-        JSON_ADD_STRING(root, "signature", event->method_signature);
+        JSON_ADD_STRING(&writer, "class", event->class_name);
+        const char *demangled_class = get_demangled_class_name(event->class_name);
+        if (demangled_class != event->class_name) {
+            JSON_ADD_STRING(&writer, "demangled_class", demangled_class);
+        }
+        JSON_ADD_STRING(&writer, "method", event->method_name);
+        JSON_ADD_BOOL(&writer, "is_class_method", event->is_class_method);
+        JSON_ADD_INT64(&writer, "thread_id", event->thread_id);
+        JSON_ADD_INT(&writer, "depth", event->real_depth);
+        JSON_ADD_STRING(&writer, "signature", event->method_signature);
         
         if (format.args != TRACER_ARG_FORMAT_NONE) {
             if (event->arguments && event->argument_count > 0) {
-                json_object *args_array = json_object_new_array();
-                if (args_array == NULL) {
-                    json_object_put(root);
-                    tracer_set_error((tracer_t *)tracer, "Failed to create JSON array for arguments");
-                    return NULL;
-                }
+                json_writer_key(&writer, "arguments");
+                json_writer_begin_array(&writer);
                 
                 for (size_t i = 0; i < event->argument_count; i++) {
                     const tracer_argument_t *curr_arg = &event->arguments[i];
@@ -375,32 +389,34 @@ const char *build_json_event_str(const tracer_t *tracer, const tracer_event_t *e
                         tracer_set_error((tracer_t *)tracer, "Argument type encoding is NULL");
                         continue;
                     }
-
-                    json_object *arg = json_object_new_object();
-                    if (arg == NULL) {
-                        json_object_put(args_array);
-                        json_object_put(root);
-                        tracer_set_error((tracer_t *)tracer, "Failed to create JSON object for argument");
-                        return NULL;
-                    }
                     
-                    JSON_ADD_STRING(arg, "type", get_name_of_type_from_type_encoding(curr_arg->type_encoding));
-                    JSON_ADD_STRING(arg, "class", curr_arg->objc_class_name);
-                    JSON_ADD_STRING(arg, "block_signature", curr_arg->block_signature);
-                    JSON_ADD_STRING(arg, "description", curr_arg->description);
-                    JSON_ADD_STRING(arg, "objc_class", curr_arg->objc_class_name);
-                    JSON_ADD_INT64(arg, "address", (uint64_t)curr_arg->address);
-                    JSON_ADD_INT64(arg, "size", curr_arg->size);
-                    json_object_array_add(args_array, arg);
+                    json_writer_begin_object(&writer);
+                    JSON_ADD_STRING(&writer, "type", get_name_of_type_from_type_encoding(curr_arg->type_encoding));
+                    JSON_ADD_STRING(&writer, "class", curr_arg->objc_class_name);
+                    JSON_ADD_STRING(&writer, "block_signature", curr_arg->block_signature);
+                    JSON_ADD_STRING(&writer, "description", curr_arg->description);
+                    JSON_ADD_STRING(&writer, "objc_class", curr_arg->objc_class_name);
+                    JSON_ADD_INT64(&writer, "address", (uint64_t)curr_arg->address);
+                    JSON_ADD_INT64(&writer, "size", curr_arg->size);
+                    json_writer_end_object(&writer);
                 }
                 
-                json_object_object_add(root, "arguments", args_array);
+                json_writer_end_array(&writer);
             }
         }
     }
     
-    const char *json_str = json_object_to_json_string(root);
-    char *result = json_str ? strdup(json_str) : NULL;
-    json_object_put(root);
-    return result;
+    json_writer_end_object(&writer);
+    
+    if (out->failed) {
+        out->failed = false;
+        out->length = start_length;
+        if (out->data) {
+            out->data[start_length] = '\0';
+        }
+        tracer_set_error((tracer_t *)tracer, "Failed to allocate memory for event json");
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    
+    return KERN_SUCCESS;
 }
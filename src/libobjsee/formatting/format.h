@@ -11,13 +11,16 @@
 #include "tracer_internal.h"
 
 /**
- * @brief Build a JSON string representation of a trace event. This may include a formatted output string
+ * @brief Write a JSON representation of a trace event to a caller-supplied buffer. This may include a formatted output string
  *
  * @param tracer The tracer instance
- * @param event The event to build a JSON string for
- * @return A JSON string representing the event
+ * @param event The event to write
+ * @param out The buffer to append the JSON object to
+ * @param scratch A buffer to render the formatted output string into before it is escaped. Its contents are overwritten
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT, or KERN_RESOURCE_SHORTAGE if a buffer could not grow
+ * @note The JSON is compact and has no trailing newline. On failure out is restored to its original length
  */
-const char *build_json_event_str(const tracer_t *tracer, const tracer_event_t *event);
+kern_return_t append_json_event(const tracer_t *tracer, const tracer_event_t *event, output_buffer_t *out, output_buffer_t *scratch);
 
 
 /**
@@ -25,9 +28,22 @@ const char *build_json_event_str(const tracer_t *tracer, const tracer_event_t *e
  *
  * @param event The event to format
  * @param format The format options to use for formatting
- * @return A formatted string representing the event
+ * @return A formatted string representing the event. The caller is responsible for freeing it
+ * @note Allocates a new string per call. Hot paths should use append_formatted_event with a reused buffer
  */
 char *build_formatted_event_str(const tracer_event_t *event, tracer_format_options_t format);
 
 
+/**
+ * @brief Format a trace event and append it to a caller-supplied buffer
+ *
+ * @param event The event to format
+ * @param format The format options to use for formatting
+ * @param out The buffer to append to. It grows as needed, so a buffer reused across events stops allocating once it is large enough
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT, or KERN_RESOURCE_SHORTAGE if the buffer could not grow
+ * @note On failure the buffer is restored to its original length
+ */
+kern_return_t append_formatted_event(const tracer_event_t *event, const tracer_format_options_t *format, output_buffer_t *out);
+
+
 #endif // TRACER_FORMAT_H
@@ -0,0 +1,424 @@
+//
+//  json_reader.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "json_reader.h"
+#include "json_writer.h"
+
+// Deeper than this is left to a full parser
+#define JSON_READER_MAX_DEPTH 64
+
+typedef struct {
+    char *cursor;
+    char *end;
+} json_reader_t;
+
+static void skip_whitespace(json_reader_t *reader) {
+    while (reader->cursor < reader->end) {
+        char c = *reader->cursor;
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            return;
+        }
+        reader->cursor++;
+    }
+}
+
+static bool consume(json_reader_t *reader, char c) {
+    skip_whitespace(reader);
+    if (reader->cursor < reader->end && *reader->cursor == c) {
+        reader->cursor++;
+        return true;
+    }
+    return false;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// The code unit of a \u escape's four hex digits, or -1 if they aren't all there
+static int32_t read_code_unit(const char *digits, const char *end) {
+    if (end - digits < 4) {
+        return -1;
+    }
+
+    int32_t unit = 0;
+    for (int i = 0; i < 4; i++) {
+        int value = hex_value(digits[i]);
+        if (value < 0) {
+            return -1;
+        }
+        unit = unit << 4 | value;
+    }
+    return unit;
+}
+
+// A \u escape starting at the backslash. Returns the code point, or -1 if it isn't valid,
+// and sets the escape's length, which is 12 when it's a surrogate pair
+static int32_t read_unicode_escape(const char *escape, const char *end, size_t *escape_length) {
+    int32_t unit = read_code_unit(escape + 2, end);
+    *escape_length = 6;
+    if (unit < 0xd800 || unit > 0xdfff) {
+        return unit;
+    }
+    if (unit > 0xdbff || end - escape < 12 || escape[6] != '\\' || escape[7] != 'u') {
+        // A lone surrogate
+        return -1;
+    }
+
+    int32_t low = read_code_unit(escape + 8, end);
+    if (low < 0xdc00 || low > 0xdfff) {
+        return -1;
+    }
+    *escape_length = 12;
+    return 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+}
+
+// Skip a string, starting after its opening quote. Sets where its contents start and end,
+// and whether there are escapes to undo
+static bool skip_string(json_reader_t *reader, char **start, size_t *length, bool *escaped) {
+    *start = reader->cursor;
+    *escaped = false;
+    while (reader->cursor < reader->end) {
+        reader->cursor += json_unescaped_prefix_length(reader->cursor, reader->end - reader->cursor);
+        if (reader->cursor >= reader->end) {
+            return false;
+        }
+
+        char c = *reader->cursor;
+        if (c == '"') {
+            *length = reader->cursor - *start;
+            reader->cursor++;
+            return true;
+        }
+        if (c != '\\' || reader->end - reader->cursor < 2) {
+            // Control characters must be escaped
+            return false;
+        }
+
+        *escaped = true;
+        switch (reader->cursor[1]) {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                reader->cursor += 2;
+                break;
+            case 'u': {
+                size_t escape_length = 0;
+                if (read_unicode_escape(reader->cursor, reader->end, &escape_length) < 0) {
+                    return false;
+                }
+                reader->cursor += escape_length;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+static bool skip_digits(json_reader_t *reader) {
+    char *start = reader->cursor;
+    while (reader->cursor < reader->end && *reader->cursor >= '0' && *reader->cursor <= '9') {
+        reader->cursor++;
+    }
+    return reader->cursor > start;
+}
+
+// Skip a number, setting its value if it's wanted
+static bool read_number(json_reader_t *reader, int64_t *number) {
+    char *start = reader->cursor;
+    bool negative = reader->cursor < reader->end && *reader->cursor == '-';
+    if (negative) {
+        reader->cursor++;
+    }
+
+    char *digits = reader->cursor;
+    if (!skip_digits(reader) || (*digits == '0' && reader->cursor - digits > 1)) {
+        return false;
+    }
+    char *digits_end = reader->cursor;
+
+    bool whole = true;
+    if (reader->cursor < reader->end && *reader->cursor == '.') {
+        reader->cursor++;
+        whole = false;
+        if (!skip_digits(reader)) {
+            return false;
+        }
+    }
+    if (reader->cursor < reader->end && (*reader->cursor == 'e' || *reader->cursor == 'E')) {
+        reader->cursor++;
+        whole = false;
+        if (reader->cursor < reader->end && (*reader->cursor == '+' || *reader->cursor == '-')) {
+            reader->cursor++;
+        }
+        if (!skip_digits(reader)) {
+            return false;
+        }
+    }
+
+    if (number == NULL) {
+        return true;
+    }
+    if (!whole) {
+        // strtod stops at the delimiter that has to follow a number inside an object
+        double value = strtod(start, NULL);
+        *number = value >= (double)INT64_MAX ? INT64_MAX : value <= (double)INT64_MIN ? INT64_MIN : (int64_t)value;
+        return true;
+    }
+
+    // Saturate on overflow, like json-c
+    uint64_t magnitude = 0;
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    for (char *digit = digits; digit < digits_end; digit++) {
+        uint64_t value = (uint64_t)(*digit - '0');
+        if (magnitude > (limit - value) / 10) {
+            magnitude = limit;
+            break;
+        }
+        magnitude = magnitude * 10 + value;
+    }
+    *number = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    return true;
+}
+
+static bool skip_literal(json_reader_t *reader, const char *literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(reader->end - reader->cursor) < length || memcmp(reader->cursor, literal, length) != 0) {
+        return false;
+    }
+    reader->cursor += length;
+    return true;
+}
+
+static bool skip_value(json_reader_t *reader, int depth);
+
+static bool skip_container(json_reader_t *reader, char close, int depth) {
+    if (depth >= JSON_READER_MAX_DEPTH) {
+        return false;
+    }
+    if (consume(reader, close)) {
+        return true;
+    }
+
+    do {
+        if (close == '}') {
+            char *key = NULL;
+            size_t key_length = 0;
+            bool escaped = false;
+            if (!consume(reader, '"') || !skip_string(reader, &key, &key_length, &escaped) || !consume(reader, ':')) {
+                return false;
+            }
+        }
+        if (!skip_value(reader, depth + 1)) {
+            return false;
+        }
+    } while (consume(reader, ','));
+    return consume(reader, close);
+}
+
+static bool skip_value(json_reader_t *reader, int depth) {
+    skip_whitespace(reader);
+    if (reader->cursor >= reader->end) {
+        return false;
+    }
+
+    char *start = NULL;
+    size_t length = 0;
+    bool escaped = false;
+    switch (*reader->cursor++) {
+        case '"':
+            return skip_string(reader, &start, &length, &escaped);
+        case '{':
+            return skip_container(reader, '}', depth);
+        case '[':
+            return skip_container(reader, ']', depth);
+        case 't':
+            return skip_literal(reader, "rue");
+        case 'f':
+            return skip_literal(reader, "alse");
+        case 'n':
+            return skip_literal(reader, "ull");
+        default:
+            reader->cursor--;
+            return read_number(reader, NULL);
+    }
+}
+
+static void append_utf8(char **out, int32_t code_point) {
+    char *cursor = *out;
+    if (code_point < 0x80) {
+        *cursor++ = (char)code_point;
+    }
+    else if (code_point < 0x800) {
+        *cursor++ = (char)(0xc0 | code_point >> 6);
+        *cursor++ = (char)(0x80 | (code_point & 0x3f));
+    }
+    else if (code_point < 0x10000) {
+        *cursor++ = (char)(0xe0 | code_point >> 12);
+        *cursor++ = (char)(0x80 | (code_point >> 6 & 0x3f));
+        *cursor++ = (char)(0x80 | (code_point & 0x3f));
+    }
+    else {
+        *cursor++ = (char)(0xf0 | code_point >> 18);
+        *cursor++ = (char)(0x80 | (code_point >> 12 & 0x3f));
+        *cursor++ = (char)(0x80 | (code_point >> 6 & 0x3f));
+        *cursor++ = (char)(0x80 | (code_point & 0x3f));
+    }
+    *out = cursor;
+}
+
+// Undo a validated string's escapes where it sits. Every escape is longer than what it stands for,
+// so the unescaped string never catches up with the text still to be read
+static size_t unescape_in_place(char *string, size_t length) {
+    char *in = string;
+    char *end = string + length;
+    char *out = string;
+    while (in < end) {
+        char *escape = memchr(in, '\\', end - in);
+        size_t clean = (escape ? escape : end) - in;
+        memmove(out, in, clean);
+        out += clean;
+        in += clean;
+        if (escape == NULL) {
+            break;
+        }
+
+        switch (in[1]) {
+            case 'b':
+                *out++ = '\b';
+                break;
+            case 'f':
+                *out++ = '\f';
+                break;
+            case 'n':
+                *out++ = '\n';
+                break;
+            case 'r':
+                *out++ = '\r';
+                break;
+            case 't':
+                *out++ = '\t';
+                break;
+            case 'u': {
+                size_t escape_length = 0;
+                append_utf8(&out, read_unicode_escape(in, end, &escape_length));
+                in += escape_length;
+                continue;
+            }
+            default:
+                // '"', '\\' and '/' stand for themselves
+                *out++ = in[1];
+                break;
+        }
+        in += 2;
+    }
+    return out - string;
+}
+
+kern_return_t json_read_fields(char *json, size_t length, json_field_t *fields, size_t field_count) {
+    if (json == NULL || fields == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    // Strings are only unescaped once the whole object is known to be good, so a caller that
+    // falls back to another parser gets the text untouched
+    bool escaped[field_count > 0 ? field_count : 1];
+    for (size_t i = 0; i < field_count; i++) {
+        fields[i].type = JSON_FIELD_MISSING;
+        fields[i].string = NULL;
+        fields[i].length = 0;
+        fields[i].number = 0;
+        escaped[i] = false;
+    }
+
+    json_reader_t reader = { .cursor = json, .end = json + length };
+    if (!consume(&reader, '{')) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    if (!consume(&reader, '}')) {
+        do {
+            char *key = NULL;
+            size_t key_length = 0;
+            bool key_escaped = false;
+            if (!consume(&reader, '"') || !skip_string(&reader, &key, &key_length, &key_escaped) || !consume(&reader, ':')) {
+                return KERN_INVALID_ARGUMENT;
+            }
+
+            json_field_t *field = NULL;
+            bool *field_escaped = NULL;
+            for (size_t i = 0; i < field_count; i++) {
+                if (strncmp(fields[i].name, key, key_length) == 0 && fields[i].name[key_length] == '\0') {
+                    field = &fields[i];
+                    field_escaped = &escaped[i];
+                    break;
+                }
+            }
+
+            skip_whitespace(&reader);
+            if (field == NULL) {
+                if (!skip_value(&reader, 1)) {
+                    return KERN_INVALID_ARGUMENT;
+                }
+                continue;
+            }
+
+            char next = reader.cursor < reader.end ? *reader.cursor : '\0';
+            if (next == '"') {
+                reader.cursor++;
+                field->type = JSON_FIELD_STRING;
+                if (!skip_string(&reader, &field->string, &field->length, field_escaped)) {
+                    return KERN_INVALID_ARGUMENT;
+                }
+            }
+            else if (next == '-' || (next >= '0' && next <= '9')) {
+                field->type = JSON_FIELD_NUMBER;
+                if (!read_number(&reader, &field->number)) {
+                    return KERN_INVALID_ARGUMENT;
+                }
+            }
+            else {
+                field->type = JSON_FIELD_OTHER;
+                if (!skip_value(&reader, 1)) {
+                    return KERN_INVALID_ARGUMENT;
+                }
+            }
+        } while (consume(&reader, ','));
+
+        if (!consume(&reader, '}')) {
+            return KERN_INVALID_ARGUMENT;
+        }
+    }
+
+    skip_whitespace(&reader);
+    if (reader.cursor != reader.end) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    for (size_t i = 0; i < field_count; i++) {
+        if (fields[i].type != JSON_FIELD_STRING) {
+            continue;
+        }
+        if (escaped[i]) {
+            fields[i].length = unescape_in_place(fields[i].string, fields[i].length);
+        }
+        // Over the closing quote at the latest
+        fields[i].string[fields[i].length] = '\0';
+    }
+    return KERN_SUCCESS;
+}
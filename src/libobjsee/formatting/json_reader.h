@@ -0,0 +1,54 @@
+//
+//  json_reader.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Reads a few members out of a JSON object without building an object tree
+
+    Made for the event lines a json stream carries, where only "formatted_output" and a couple of numbers are
+    wanted out of each line. The line is checked from start to end, but nothing is allocated: members that
+    weren't asked for are skipped over, and the strings that were asked for are unescaped where they sit.
+*/
+
+typedef enum {
+    JSON_FIELD_MISSING,
+    JSON_FIELD_STRING,
+    JSON_FIELD_NUMBER,
+    // true, false, null, an object or an array
+    JSON_FIELD_OTHER,
+} json_field_type_t;
+
+typedef struct {
+    // The member to look for. Set by the caller
+    const char *name;
+    json_field_type_t type;
+    // A string's value, unescaped and NUL-terminated inside the line that was read
+    char *string;
+    size_t length;
+    // A number's value, truncated toward zero if it isn't whole
+    int64_t number;
+} json_field_t;
+
+/**
+ * @brief Find the named top-level members of a JSON object
+ * @param json The object. Only modified if it's read successfully
+ * @param length The object's length, not counting any NUL after it
+ * @param fields The members to find. Any that aren't in the object are left JSON_FIELD_MISSING
+ * @return KERN_SUCCESS, or KERN_INVALID_ARGUMENT if the text isn't a well-formed object
+ * @note Names are matched as they're written in the object, without unescaping, and the last of any duplicates wins.
+ * Anything this reader doesn't accept, like control characters inside strings, is left for a full JSON parser
+ */
+kern_return_t json_read_fields(char *json, size_t length, json_field_t *fields, size_t field_count);
+
+#endif // JSON_READER_H
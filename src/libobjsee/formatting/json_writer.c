@@ -0,0 +1,190 @@
+//
+//  json_writer.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/4/25.
+//
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "json_writer.h"
+
+size_t json_unescaped_prefix_length(const char *value, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)value;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    const uint8x16_t control_limit = vdupq_n_u8(0x20);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t chunk = vld1q_u8(bytes + i);
+        uint8x16_t needs_escape = vorrq_u8(vcltq_u8(chunk, control_limit), vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)));
+        if (vmaxvq_u8(needs_escape) != 0) {
+            // Locate the exact byte below
+            break;
+        }
+    }
+#elif defined(__SSE2__)
+    // SSE2 has no unsigned compare, but a byte is below 0x20 exactly when its unsigned max with 0x1f is 0x1f
+    const __m128i control_max = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(bytes + i));
+        __m128i needs_escape = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max), _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+        int mask = _mm_movemask_epi8(needs_escape);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < length; i++) {
+        uint8_t c = bytes[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            break;
+        }
+    }
+    return i;
+}
+
+void json_append_escaped(output_buffer_t *out, const char *value, size_t length) {
+    static const char hex_digits[] = "0123456789abcdef";
+
+    size_t position = 0;
+    while (position < length) {
+        size_t clean = json_unescaped_prefix_length(value + position, length - position);
+        output_buffer_append(out, value + position, clean);
+        position += clean;
+        if (position >= length) {
+            break;
+        }
+
+        uint8_t c = (uint8_t)value[position++];
+        switch (c) {
+            case '"':
+                output_buffer_append(out, "\\\"", 2);
+                break;
+            case '\\':
+                output_buffer_append(out, "\\\\", 2);
+                break;
+            case '\n':
+                output_buffer_append(out, "\\n", 2);
+                break;
+            case '\r':
+                output_buffer_append(out, "\\r", 2);
+                break;
+            case '\t':
+                output_buffer_append(out, "\\t", 2);
+                break;
+            case '\b':
+                output_buffer_append(out, "\\b", 2);
+                break;
+            case '\f':
+                output_buffer_append(out, "\\f", 2);
+                break;
+            default: {
+                char escaped[6] = { '\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xf] };
+                output_buffer_append(out, escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+}
+
+void json_writer_init(json_writer_t *writer, output_buffer_t *out) {
+    memset(writer, 0, sizeof(json_writer_t));
+    writer->out = out;
+}
+
+// Emit the comma that separates this value from the previous member of the enclosing container
+static void json_writer_before_value(json_writer_t *writer) {
+    if (writer->after_key) {
+        writer->after_key = false;
+        return;
+    }
+
+    if (writer->depth > 0 && writer->depth <= JSON_WRITER_MAX_DEPTH) {
+        if (writer->has_members[writer->depth - 1]) {
+            output_buffer_append_char(writer->out, ',');
+        }
+        writer->has_members[writer->depth - 1] = true;
+    }
+}
+
+static void json_writer_begin_container(json_writer_t *writer, char open) {
+    json_writer_before_value(writer);
+    output_buffer_append_char(writer->out, open);
+    if (writer->depth < JSON_WRITER_MAX_DEPTH) {
+        writer->has_members[writer->depth] = false;
+    }
+    writer->depth++;
+}
+
+static void json_writer_end_container(json_writer_t *writer, char close) {
+    if (writer->depth > 0) {
+        writer->depth--;
+    }
+    output_buffer_append_char(writer->out, close);
+}
+
+void json_writer_begin_object(json_writer_t *writer) {
+    json_writer_begin_container(writer, '{');
+}
+
+void json_writer_end_object(json_writer_t *writer) {
+    json_writer_end_container(writer, '}');
+}
+
+void json_writer_begin_array(json_writer_t *writer) {
+    json_writer_begin_container(writer, '[');
+}
+
+void json_writer_end_array(json_writer_t *writer) {
+    json_writer_end_container(writer, ']');
+}
+
+void json_writer_key(json_writer_t *writer, const char *key) {
+    json_writer_before_value(writer);
+    output_buffer_append_char(writer->out, '"');
+    output_buffer_append_str(writer->out, key);
+    output_buffer_append(writer->out, "\":", 2);
+    writer->after_key = true;
+}
+
+void json_writer_string_with_length(json_writer_t *writer, const char *value, size_t length) {
+    json_writer_before_value(writer);
+    output_buffer_append_char(writer->out, '"');
+    json_append_escaped(writer->out, value, length);
+    output_buffer_append_char(writer->out, '"');
+}
+
+void json_writer_string(json_writer_t *writer, const char *value) {
+    json_writer_string_with_length(writer, value, strlen(value));
+}
+
+void json_writer_int64(json_writer_t *writer, int64_t value) {
+    json_writer_before_value(writer);
+    if (value < 0) {
+        output_buffer_append_char(writer->out, '-');
+        // Negate in unsigned space so INT64_MIN doesn't overflow
+        output_buffer_append_uint(writer->out, (uint64_t)0 - (uint64_t)value);
+    }
+    else {
+        output_buffer_append_uint(writer->out, (uint64_t)value);
+    }
+}
+
+void json_writer_bool(json_writer_t *writer, bool value) {
+    json_writer_before_value(writer);
+    if (value) {
+        output_buffer_append(writer->out, "true", 4);
+    }
+    else {
+        output_buffer_append(writer->out, "false", 5);
+    }
+}
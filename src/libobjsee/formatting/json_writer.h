@@ -0,0 +1,60 @@
+//
+//  json_writer.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/4/25.
+//
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "output_buffer.h"
+
+#define JSON_WRITER_MAX_DEPTH 8
+
+/**
+ * @brief Streams compact JSON straight into an output buffer, with no intermediate object tree
+ * @note The writer only tracks where commas go. Callers are responsible for emitting well-formed structure
+ */
+typedef struct {
+    output_buffer_t *out;
+    uint32_t depth;
+    bool after_key;
+    bool has_members[JSON_WRITER_MAX_DEPTH];
+} json_writer_t;
+
+void json_writer_init(json_writer_t *writer, output_buffer_t *out);
+
+void json_writer_begin_object(json_writer_t *writer);
+void json_writer_end_object(json_writer_t *writer);
+void json_writer_begin_array(json_writer_t *writer);
+void json_writer_end_array(json_writer_t *writer);
+
+/**
+ * @brief Write an object key. The next value written belongs to it
+ * @note Keys are written verbatim and must not need escaping
+ */
+void json_writer_key(json_writer_t *writer, const char *key);
+
+void json_writer_string(json_writer_t *writer, const char *value);
+void json_writer_string_with_length(json_writer_t *writer, const char *value, size_t length);
+void json_writer_int64(json_writer_t *writer, int64_t value);
+void json_writer_bool(json_writer_t *writer, bool value);
+
+
+/**
+ * @brief Length of the prefix of a string that can be written into JSON without escaping
+ * @note This is also where a JSON string's contents end or reach their first escape, which is how json_reader uses it
+ */
+size_t json_unescaped_prefix_length(const char *value, size_t length);
+
+/**
+ * @brief Append a string's contents with JSON escaping applied, without surrounding quotes
+ * @note Runs of characters that need no escaping are found 16 bytes at a time and copied with a single memcpy
+ */
+void json_append_escaped(output_buffer_t *out, const char *value, size_t length);
+
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,177 @@
+//
+//  method_fragments.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/3/25.
+//
+
+#include <stdatomic.h>
+#include "tracer_internal.h"
+#include "method_fragments.h"
+#include "output_buffer.h"
+#include "color_utils.h"
+#include "swift_demangle.h"
+
+// (class name, selector name, variant) -> fragments. Slots are claimed with CAS and never reused
+#define METHOD_FRAGMENTS_CACHE_CAPACITY 8192
+#define METHOD_FRAGMENTS_CACHE_MAX_PROBES 32
+
+static _Atomic(method_fragments_t *) g_method_fragments_cache[METHOD_FRAGMENTS_CACHE_CAPACITY];
+
+static size_t method_fragments_index(const char *class_name, const char *method_name, bool is_class_method, bool include_colors) {
+    uint64_t key = ((uint64_t)(uintptr_t)class_name * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)(uintptr_t)method_name;
+    key ^= ((uint64_t)is_class_method << 1) | (uint64_t)include_colors;
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctz(METHOD_FRAGMENTS_CACHE_CAPACITY)));
+}
+
+static bool method_fragments_match(const method_fragments_t *fragments, const char *class_name, const char *method_name, bool is_class_method, bool include_colors) {
+    return fragments->class_name == class_name && fragments->method_name == method_name &&
+        fragments->is_class_method == is_class_method && fragments->include_colors == include_colors;
+}
+
+static method_fragment_span_t span_from(const output_buffer_t *text, size_t start) {
+    return (method_fragment_span_t){ .offset = (uint32_t)start, .length = (uint32_t)(text->length - start) };
+}
+
+static void append_color_escape(output_buffer_t *text, uint8_t color) {
+    size_t length = 0;
+    const char *sequence = get_color_escape_sequence(color, &length);
+    output_buffer_append(text, sequence, length);
+}
+
+method_fragments_t *create_method_fragments(const char *class_name, const char *method_name, bool is_class_method, bool include_colors) {
+    if (class_name == NULL || method_name == NULL) {
+        return NULL;
+    }
+
+    // Empty parts (e.g. from "::") are skipped, so there is at most one part per character
+    uint32_t part_count = 0;
+    for (const char *cursor = method_name; *cursor != '\0'; cursor++) {
+        if (*cursor != ':' && (cursor == method_name || cursor[-1] == ':')) {
+            part_count++;
+        }
+    }
+
+    const char *display_class_name = get_demangled_class_name(class_name);
+    uint8_t class_color = include_colors ? get_consistent_color(display_class_name, COLOR_CLASS_START, COLOR_CLASS_RANGE) : 0;
+    uint8_t method_color = include_colors ? get_consistent_color(method_name, COLOR_METHOD_START, COLOR_METHOD_RANGE) : 0;
+
+    // Render every fragment back to back, recording where each one starts
+    output_buffer_t text = {0};
+    method_fragment_span_t head, tail;
+    method_fragment_span_t *parts = part_count > 0 ? calloc(part_count, sizeof(method_fragment_span_t)) : NULL;
+    if (part_count > 0 && parts == NULL) {
+        return NULL;
+    }
+
+    size_t start = text.length;
+    if (include_colors) {
+        append_color_escape(&text, class_color);
+    }
+    output_buffer_append(&text, is_class_method ? "+[" : "-[", 2);
+    output_buffer_append_str(&text, display_class_name);
+    output_buffer_append_char(&text, ' ');
+    head = span_from(&text, start);
+
+    uint32_t part_index = 0;
+    const char *cursor = method_name;
+    while (*cursor != '\0') {
+        if (*cursor == ':') {
+            cursor++;
+            continue;
+        }
+
+        const char *colon = strchr(cursor, ':');
+        size_t part_len = colon ? (size_t)(colon - cursor) : strlen(cursor);
+
+        start = text.length;
+        if (include_colors) {
+            append_color_escape(&text, method_color);
+        }
+        output_buffer_append(&text, cursor, part_len);
+        if (colon) {
+            output_buffer_append_char(&text, ':');
+        }
+        parts[part_index++] = span_from(&text, start);
+
+        cursor += part_len;
+    }
+
+    start = text.length;
+    if (include_colors) {
+        append_color_escape(&text, class_color);
+    }
+    output_buffer_append_char(&text, ']');
+    tail = span_from(&text, start);
+
+    if (text.failed || text.length > UINT32_MAX) {
+        output_buffer_free(&text);
+        free(parts);
+        return NULL;
+    }
+
+    // One allocation holding the header, the part spans, and the text
+    size_t header_size = sizeof(method_fragments_t) + (size_t)part_count * sizeof(method_fragment_span_t);
+    method_fragments_t *fragments = malloc(header_size + text.length + 1);
+    if (fragments == NULL) {
+        output_buffer_free(&text);
+        free(parts);
+        return NULL;
+    }
+
+    char *fragments_text = (char *)fragments + header_size;
+    memcpy(fragments_text, text.data, text.length + 1);
+
+    fragments->class_name = class_name;
+    fragments->method_name = method_name;
+    fragments->is_class_method = is_class_method;
+    fragments->include_colors = include_colors;
+    fragments->text = fragments_text;
+    fragments->head = head;
+    fragments->tail = tail;
+    fragments->part_count = part_count;
+    if (part_count > 0) {
+        memcpy(fragments->parts, parts, part_count * sizeof(method_fragment_span_t));
+    }
+
+    output_buffer_free(&text);
+    free(parts);
+    return fragments;
+}
+
+__attribute__((hot))
+const method_fragments_t *get_method_fragments(const char *class_name, const char *method_name, bool is_class_method, bool include_colors) {
+    if (class_name == NULL || method_name == NULL) {
+        return NULL;
+    }
+
+    size_t index = method_fragments_index(class_name, method_name, is_class_method, include_colors);
+    method_fragments_t *created = NULL;
+    for (size_t probes = 0; probes < METHOD_FRAGMENTS_CACHE_MAX_PROBES; probes++) {
+        method_fragments_t *stored = atomic_load_explicit(&g_method_fragments_cache[index], memory_order_acquire);
+        if (stored == NULL) {
+            if (created == NULL) {
+                created = create_method_fragments(class_name, method_name, is_class_method, include_colors);
+                if (created == NULL) {
+                    return NULL;
+                }
+            }
+
+            if (atomic_compare_exchange_strong_explicit(&g_method_fragments_cache[index], &stored, created, memory_order_acq_rel, memory_order_acquire)) {
+                return created;
+            }
+            // Lost the race for this slot. The winner may have stored the same method
+        }
+
+        if (method_fragments_match(stored, class_name, method_name, is_class_method, include_colors)) {
+            free(created);
+            return stored;
+        }
+
+        index = (index + 1) & (METHOD_FRAGMENTS_CACHE_CAPACITY - 1);
+    }
+
+    // Cache is saturated around this slot
+    free(created);
+    return NULL;
+}
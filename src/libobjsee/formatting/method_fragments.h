@@ -0,0 +1,60 @@
+//
+//  method_fragments.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/3/25.
+//
+
+#ifndef METHOD_FRAGMENTS_H
+#define METHOD_FRAGMENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} method_fragment_span_t;
+
+/**
+ * @brief The parts of a formatted event that are the same for every call to a method
+ * @note For "-[NSObject initWithFoo:bar:]" the fragments are `-[NSObject `, `initWithFoo:`, `bar:` and `]`.
+ * When colors are enabled each fragment carries its own escape sequences. Arguments are spliced in after each part
+ */
+typedef struct method_fragments {
+    const char *class_name;
+    const char *method_name;
+    bool is_class_method;
+    bool include_colors;
+    const char *text;                   // All spans are offsets into this
+    method_fragment_span_t head;        // Class color, "+[" or "-[", class name, and a space
+    method_fragment_span_t tail;        // Class color and "]"
+    uint32_t part_count;
+    method_fragment_span_t parts[];     // Method color, selector part, and its ':' if there is one after it
+} method_fragments_t;
+
+
+/**
+ * @brief Get the cached fragments for a method
+ *
+ * @param class_name A runtime-owned class name, e.g. from object_getClassName()
+ * @param method_name A runtime-owned selector name, e.g. from sel_getName()
+ * @param is_class_method Whether to render "+[" rather than "-["
+ * @param include_colors Whether to render the colored variant
+ * @return The cached fragments, or NULL if the cache is full or the fragments could not be allocated
+ * @note Fragments are keyed by the name pointers, not their contents, so both strings must be stable for the
+ * lifetime of the process. Cached fragments are never freed
+ */
+const method_fragments_t *get_method_fragments(const char *class_name, const char *method_name, bool is_class_method, bool include_colors);
+
+
+/**
+ * @brief Render a method's fragments without caching them
+ *
+ * @return The fragments in a single allocation that the caller must free(), or NULL on allocation failure
+ * @note This is the fallback for when get_method_fragments() returns NULL. The names don't need to be stable
+ */
+method_fragments_t *create_method_fragments(const char *class_name, const char *method_name, bool is_class_method, bool include_colors);
+
+
+#endif // METHOD_FRAGMENTS_H
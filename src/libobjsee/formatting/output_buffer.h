@@ -0,0 +1,167 @@
+//
+//  output_buffer.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/3/25.
+//
+
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_BUFFER_INITIAL_CAPACITY 1024
+
+/**
+ * @brief A growable byte buffer that is reused across events
+ * @note data is always NUL-terminated once anything has been appended. A failed allocation sets
+ * `failed` and turns later appends into no-ops, so callers only need to check once at the end
+ */
+typedef struct output_buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+    // Set for buffers that wrap memory owned by someone else. These never grow; running out of room fails instead
+    bool fixed;
+} output_buffer_t;
+
+__attribute__((noinline, unused))
+static bool output_buffer_grow(output_buffer_t *buffer, size_t required) {
+    if (buffer->fixed) {
+        buffer->failed = true;
+        return false;
+    }
+    
+    size_t new_capacity = buffer->capacity ? buffer->capacity : OUTPUT_BUFFER_INITIAL_CAPACITY;
+    while (new_capacity < required) {
+        if (__builtin_mul_overflow(new_capacity, 2, &new_capacity)) {
+            buffer->failed = true;
+            return false;
+        }
+    }
+
+    char *new_data = realloc(buffer->data, new_capacity);
+    if (new_data == NULL) {
+        buffer->failed = true;
+        return false;
+    }
+
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+/**
+ * @brief Set up a buffer that writes into existing memory
+ * @param buffer The buffer to initialize
+ * @param data Where to write
+ * @param capacity Bytes available at data, including room for the terminator
+ */
+static inline void output_buffer_wrap(output_buffer_t *buffer, char *data, size_t capacity) {
+    buffer->data = data;
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    buffer->failed = capacity == 0;
+    buffer->fixed = true;
+    if (capacity > 0) {
+        data[0] = '\0';
+    }
+}
+
+/**
+ * @brief Make room for `additional` more bytes plus a terminator
+ */
+__attribute__((always_inline))
+static inline bool output_buffer_reserve(output_buffer_t *buffer, size_t additional) {
+    if (__builtin_expect(buffer->failed, 0)) {
+        return false;
+    }
+
+    size_t required = buffer->length + additional + 1;
+    if (__builtin_expect(required <= buffer->capacity, 1)) {
+        return true;
+    }
+    return output_buffer_grow(buffer, required);
+}
+
+__attribute__((always_inline))
+static inline void output_buffer_append(output_buffer_t *buffer, const char *bytes, size_t length) {
+    if (!output_buffer_reserve(buffer, length)) {
+        return;
+    }
+
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+__attribute__((always_inline))
+static inline void output_buffer_append_str(output_buffer_t *buffer, const char *str) {
+    output_buffer_append(buffer, str, strlen(str));
+}
+
+__attribute__((always_inline))
+static inline void output_buffer_append_char(output_buffer_t *buffer, char c) {
+    if (!output_buffer_reserve(buffer, 1)) {
+        return;
+    }
+
+    buffer->data[buffer->length++] = c;
+    buffer->data[buffer->length] = '\0';
+}
+
+/**
+ * @brief Append an unsigned integer as lowercase hex, without a 0x prefix
+ */
+static inline void output_buffer_append_hex(output_buffer_t *buffer, uint64_t value) {
+    char digits[16];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+
+    output_buffer_append(buffer, digits + sizeof(digits) - count, count);
+}
+
+/**
+ * @brief Append an unsigned integer in decimal
+ */
+static inline void output_buffer_append_uint(output_buffer_t *buffer, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+
+    output_buffer_append(buffer, digits + sizeof(digits) - count, count);
+}
+
+/**
+ * @brief Empty the buffer but keep its allocation
+ */
+static inline void output_buffer_reset(output_buffer_t *buffer) {
+    buffer->length = 0;
+    buffer->failed = false;
+    if (buffer->data != NULL && buffer->capacity > 0) {
+        buffer->data[0] = '\0';
+    }
+}
+
+static inline void output_buffer_free(output_buffer_t *buffer) {
+    if (!buffer->fixed) {
+        free(buffer->data);
+    }
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->failed = false;
+    buffer->fixed = false;
+}
+
+#endif // OUTPUT_BUFFER_H
@@ -0,0 +1,90 @@
+//
+//  swift_demangle.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/2/25.
+//
+
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include "swift_demangle.h"
+
+// Mangled name pointer -> demangled name. Class names are owned by the runtime and never move,
+// so the pointer is a stable key. Slots are claimed with CAS and never reused
+#define DEMANGLE_CACHE_CAPACITY 16384
+#define DEMANGLE_CACHE_MAX_PROBES 64
+
+static struct {
+    _Atomic(uintptr_t) mangled[DEMANGLE_CACHE_CAPACITY];
+    _Atomic(uintptr_t) demangled[DEMANGLE_CACHE_CAPACITY];
+} g_demangle_cache;
+
+static const char *demangle_swift(const char *name) {
+    typedef char *(*swift_demangle_ft)(const char *mangledName, size_t mangledNameLength, char *outputBuffer, size_t *outputBufferSize, uint32_t flags);
+    static swift_demangle_ft swift_demangle_f;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        swift_demangle_f = (swift_demangle_ft) dlsym(RTLD_DEFAULT, "swift_demangle");
+    });
+    
+    if (swift_demangle_f) {
+        return swift_demangle_f(name, strlen(name), 0, 0, 0);
+    }
+    return NULL;
+}
+
+static size_t demangle_cache_index(uintptr_t key) {
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctz(DEMANGLE_CACHE_CAPACITY)));
+}
+
+const char *get_demangled_class_name(const char *class_name) {
+    if (class_name == NULL || strncmp(class_name, "_Tt", 3) != 0) {
+        return class_name;
+    }
+    
+    uintptr_t key = (uintptr_t)class_name;
+    size_t index = demangle_cache_index(key);
+    size_t free_index = DEMANGLE_CACHE_CAPACITY;
+    for (size_t probes = 0; probes < DEMANGLE_CACHE_MAX_PROBES; probes++) {
+        uintptr_t stored = atomic_load_explicit(&g_demangle_cache.mangled[index], memory_order_acquire);
+        if (stored == key) {
+            const char *demangled = (const char *)atomic_load_explicit(&g_demangle_cache.demangled[index], memory_order_acquire);
+            // NULL while the owning thread is still demangling
+            return demangled ? demangled : class_name;
+        }
+        
+        if (stored == 0) {
+            free_index = index;
+            break;
+        }
+        index = (index + 1) & (DEMANGLE_CACHE_CAPACITY - 1);
+    }
+    
+    if (free_index == DEMANGLE_CACHE_CAPACITY) {
+        // Cache is saturated around this slot. Prefer the mangled name over demangling on every event
+        return class_name;
+    }
+    
+    // Claim the slot first so that only one thread pays for (and allocates) the demangled name
+    index = free_index;
+    for (size_t probes = 0; probes < DEMANGLE_CACHE_MAX_PROBES; probes++) {
+        uintptr_t expected = 0;
+        if (atomic_compare_exchange_strong(&g_demangle_cache.mangled[index], &expected, key)) {
+            const char *demangled = demangle_swift(class_name);
+            if (demangled == NULL) {
+                // Remember the failure too
+                demangled = class_name;
+            }
+            atomic_store_explicit(&g_demangle_cache.demangled[index], (uintptr_t)demangled, memory_order_release);
+            return demangled;
+        }
+        
+        if (expected == key) {
+            // Another thread claimed this name
+            return class_name;
+        }
+        index = (index + 1) & (DEMANGLE_CACHE_CAPACITY - 1);
+    }
+    
+    return class_name;
+}
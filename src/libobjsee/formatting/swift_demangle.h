@@ -0,0 +1,24 @@
+//
+//  swift_demangle.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/2/25.
+//
+
+#ifndef SWIFT_DEMANGLE_H
+#define SWIFT_DEMANGLE_H
+
+#include <CoreFoundation/CoreFoundation.h>
+
+/**
+ * @brief Get the display name of a class, demangling Swift class names (_TtC...)
+ *
+ * @param class_name A runtime-owned class name, e.g. from object_getClassName()
+ * @return The demangled name, or class_name itself if it is not a Swift name or could not be demangled
+ * @note Demangled names are cached per class name pointer and live for the lifetime of the process.
+ * The returned string must not be freed
+ */
+const char *get_demangled_class_name(const char *class_name);
+
+
+#endif // SWIFT_DEMANGLE_H
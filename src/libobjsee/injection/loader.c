@@ -58,7 +58,16 @@ OBJC_EXPORT void objsee_main(const char *encoded_config_string) {
         return;
     }
     
-    if (config.transport_config.host && config.transport_config.port) {
+    if (config.transport == TRACER_TRANSPORT_SHM && config.transport_config.shm_name) {
+        tracer_set_output_shm(tracer, config.transport_config.shm_name);
+    }
+    else if (config.transport == TRACER_TRANSPORT_UNIX && config.transport_config.socket_path) {
+        tracer_set_output_unix_socket(tracer, config.transport_config.socket_path, config.transport_config.seqpacket);
+    }
+    else if (config.transport == TRACER_TRANSPORT_SEGMENTS && config.transport_config.file_path) {
+        tracer_set_output_segments(tracer, config.transport_config.file_path);
+    }
+    else if (config.transport_config.host && config.transport_config.port) {
         tracer_set_output_socket(tracer, config.transport_config.host, config.transport_config.port);
     }
     else if (config.transport_config.file_path) {
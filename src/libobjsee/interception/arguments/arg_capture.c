@@ -154,7 +154,7 @@ void capture_arguments(tracer_t *g_tracer_ctx, struct tracer_thread_context_fram
             
             // Interacting with unrealized classes is dangerous.
             // Record the encounter so that it's captured on the next occurrence
-            if (has_seen_class(event_arg->objc_class) == false) {
+            if (has_seen_class(event_arg->objc_class) != KERN_SUCCESS) {
                 record_class_encounter(event_arg->objc_class);
                 continue;
             }
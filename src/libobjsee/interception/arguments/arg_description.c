@@ -9,7 +9,7 @@
 #include <objc/runtime.h>
 #include <mach/mach.h>
 #include "objc_arg_description.h"
-#include "encoding_description.h"
+#include "type_descriptor.h"
 #include "tracer_internal.h"
 #include "blocks.h"
 
@@ -139,60 +139,40 @@ static kern_return_t _description_for_id(const tracer_argument_t *arg, tracer_ar
             // Handle blocks
             if (strcmp(arg->type_encoding, "@?") == 0) {
                 
-                char *decoded_block_signature = NULL;
-                if (get_block_description(*(id *)arg->address, &decoded_block_signature) != KERN_SUCCESS) {
-                    if (snprintf(out_buf, buf_size, "<Block: %p>", arg->address) >= buf_size) {
-                        return KERN_NO_SPACE;
-                    }
+                kern_return_t kr = get_block_description(*(id *)arg->address, out_buf, buf_size);
+                if (kr == KERN_NO_SPACE) {
+                    return KERN_NO_SPACE;
                 }
-                else {
-                    if (snprintf(out_buf, buf_size, "%s", decoded_block_signature) >= buf_size) {
+                else if (kr != KERN_SUCCESS) {
+                    if (snprintf(out_buf, buf_size, "<Block: %p>", arg->address) >= buf_size) {
                         return KERN_NO_SPACE;
                     }
-                    
-                    free(decoded_block_signature);
                 }
                 break;
             }
             
             // Get the result of -description
             __unsafe_unretained id objc_object = *(id *)arg->address;
-            const char *obj_description = lookup_description_for_address(objc_object, arg->objc_class);
+            bool has_description = lookup_description_for_address(objc_object, arg->objc_class, out_buf, buf_size) == KERN_SUCCESS;
             
-            if (obj_description && fmt == TRACER_ARG_FORMAT_DESCRIPTIVE_COMPACT) {
-                if (strchr(obj_description, '\n') != NULL) {
-                    char *sanitized_str = strdup(obj_description);
-                    if (sanitized_str == NULL) {
-                        return KERN_NO_SPACE;
-                    }
-                    
-                    for (size_t i = 0; i < strlen(sanitized_str); i++) {
-                        if (sanitized_str[i] == '\n') {
-                            sanitized_str[i] = ' ';
-                        }
-                    }
-                    
-                    free((void *)obj_description);
-                    obj_description = sanitized_str;
-                }
-                
-                char *last_char = NULL;
-                char *current_char = (char *)obj_description;
-                while (*current_char != '\0') {
-                    if (*current_char == ' ' && last_char != NULL && *last_char == ' ') {
-                        memmove(current_char, current_char + 1, strlen(current_char));
-                    }
-                    else {
-                        last_char = current_char;
-                        current_char++;
+            if (has_description && fmt == TRACER_ARG_FORMAT_DESCRIPTIVE_COMPACT) {
+                // Collapse newlines and runs of spaces in place
+                char *read_char = out_buf;
+                char *write_char = out_buf;
+                char last_char = '\0';
+                while (*read_char != '\0') {
+                    char current_char = (*read_char == '\n') ? ' ' : *read_char;
+                    if (current_char != ' ' || last_char != ' ') {
+                        *write_char++ = current_char;
                     }
+                    last_char = current_char;
+                    read_char++;
                 }
+                *write_char = '\0';
             }
 
-            if (obj_description) {
-                if (strlcpy(out_buf, obj_description, buf_size) >= buf_size) {
-                    return KERN_NO_SPACE;
-                }
+            if (has_description) {
+                break;
             }
             else {
                 // -description did not work, fallback to more basic descriptions.
@@ -367,16 +347,14 @@ static kern_return_t _description_for_struct(const tracer_argument_t *arg, trace
             }
         }
         else {
-            const char *decoded_struct = get_struct_description_from_type_encoding(arg->type_encoding);
-            if (decoded_struct == NULL) {
+            const type_descriptor_t *descriptor = get_type_descriptor(arg->type_encoding);
+            if (descriptor == NULL) {
                 if (snprintf(out_buf, buf_size, "{%p: %s}", arg->address, arg->type_encoding) >= buf_size) {
                     return KERN_NO_SPACE;
                 }
             }
             else {
-                size_t written = snprintf(out_buf, buf_size, "%s", decoded_struct);
-                free((void *)decoded_struct);
-                if (written >= buf_size) {
+                if (strlcpy(out_buf, descriptor->description, buf_size) >= buf_size) {
                     return KERN_NO_SPACE;
                 }
             }
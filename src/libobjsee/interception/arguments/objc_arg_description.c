@@ -6,20 +6,50 @@
 //
 
 #include <objc/runtime.h>
+#include <stdatomic.h>
 #include <os/lock.h>
 #include <string.h>
 #include "msgSend_hook.h"
+#include "objc-internal.h"
 
-// Cache the result of -description calls to avoid repeated calls
-static char *g_description_cache[1024] = {0};
-static size_t g_description_cache_count = 0;
-static os_unfair_lock g_description_cache_lock = OS_UNFAIR_LOCK_INIT;
+// -description results are cached in independently locked shards so that threads
+// describing unrelated objects don't contend. Each shard is set-associative and
+// evicts with CLOCK (second chance), and all shards share a byte budget
+#define DESCRIPTION_CACHE_SHARD_COUNT 16
+#define DESCRIPTION_CACHE_SHARD_ENTRIES 256
+#define DESCRIPTION_CACHE_WAYS 8
+#define DESCRIPTION_CACHE_MAX_BYTES (2 * 1024 * 1024)
+#define DESCRIPTION_CACHE_SHARD_MAX_BYTES (DESCRIPTION_CACHE_MAX_BYTES / DESCRIPTION_CACHE_SHARD_COUNT)
+#define DESCRIPTION_MAX_LEN 1023
 
-// Cache the description IMP for classes to avoid repeated lookups
-static void *g_imp_cache[1024] = {0};
-static size_t g_imp_cache_count = 0;
-static os_unfair_lock g_imp_cache_lock = OS_UNFAIR_LOCK_INIT;
+// Bytes of instance storage (after isa) folded into an object's generation hint
+#define GENERATION_HINT_MAX_BYTES 64
 
+// Class -> -description IMP. Entries are never removed
+#define IMP_CACHE_CAPACITY 4096
+
+typedef struct {
+    uintptr_t address;
+    uintptr_t isa;
+    uint32_t generation;
+    bool referenced;
+    char *description;
+    size_t description_len;
+} description_cache_entry_t;
+
+typedef struct {
+    os_unfair_lock lock;
+    size_t bytes_used;
+    uint32_t clock_hand;
+    description_cache_entry_t entries[DESCRIPTION_CACHE_SHARD_ENTRIES];
+} __attribute__((aligned(64))) description_cache_shard_t;
+
+static description_cache_shard_t g_description_cache[DESCRIPTION_CACHE_SHARD_COUNT];
+
+static struct {
+    _Atomic(uintptr_t) classes[IMP_CACHE_CAPACITY];
+    _Atomic(uintptr_t) imps[IMP_CACHE_CAPACITY];
+} g_imp_cache;
 
 static SEL description_selector(void) {
     static SEL descriptionSel = NULL;
@@ -29,138 +59,251 @@ static SEL description_selector(void) {
     return descriptionSel;
 }
 
+// Fibonacci hashing. The high bits of the product are well mixed, the low bits are not
+__attribute__((always_inline))
+static inline uint64_t pointer_hash(uintptr_t ptr) {
+    return (uint64_t)ptr * 0x9E3779B97F4A7C15ULL;
+}
+
+#define IMP_CACHE_INDEX(hash) ((size_t)((hash) >> (64 - __builtin_ctz(IMP_CACHE_CAPACITY))))
+
 static IMP get_description_imp_for_class(Class cls) {
     if (cls == NULL) {
         return NULL;
     }
-    
-    os_unfair_lock_lock(&g_imp_cache_lock);
-    
-    for (size_t i = 0; i < g_imp_cache_count; i += 2) {
-        if (g_imp_cache[i] == cls) {
-            IMP existingImp = (IMP)g_imp_cache[i + 1];
-            os_unfair_lock_unlock(&g_imp_cache_lock);
-            return existingImp;
+
+    uintptr_t key = (uintptr_t)cls;
+    size_t index = IMP_CACHE_INDEX(pointer_hash(key));
+    for (size_t probes = 0; probes < IMP_CACHE_CAPACITY; probes++) {
+        uintptr_t stored_class = atomic_load_explicit(&g_imp_cache.classes[index], memory_order_acquire);
+        if (stored_class == key) {
+            // The slot may have been claimed but not yet filled in. Fall through to a slow lookup in that case
+            IMP existingImp = (IMP)atomic_load_explicit(&g_imp_cache.imps[index], memory_order_acquire);
+            if (existingImp != NULL) {
+                return existingImp;
+            }
+            break;
+        }
+
+        if (stored_class == 0) {
+            break;
         }
+        index = (index + 1) & (IMP_CACHE_CAPACITY - 1);
     }
-    
+
     SEL descriptionSel = description_selector();
     IMP descriptionImp = NULL;
     if (class_respondsToSelector(cls, descriptionSel)) {
         descriptionImp = class_getMethodImplementation(cls, descriptionSel);
     }
-    
-    if (descriptionImp != NULL && g_imp_cache_count < 1022) {
-        g_imp_cache[g_imp_cache_count] = cls;
-        g_imp_cache[g_imp_cache_count + 1] = descriptionImp;
-        g_imp_cache_count += 2;
+
+    if (descriptionImp == NULL) {
+        return NULL;
     }
-    
-    os_unfair_lock_unlock(&g_imp_cache_lock);
+
+    index = IMP_CACHE_INDEX(pointer_hash(key));
+    for (size_t probes = 0; probes < IMP_CACHE_CAPACITY; probes++) {
+        uintptr_t expected = 0;
+        if (atomic_compare_exchange_strong(&g_imp_cache.classes[index], &expected, key) || expected == key) {
+            atomic_store_explicit(&g_imp_cache.imps[index], (uintptr_t)descriptionImp, memory_order_release);
+            break;
+        }
+        index = (index + 1) & (IMP_CACHE_CAPACITY - 1);
+    }
+
+    // If the map is full the IMP simply isn't cached
     return descriptionImp;
 }
 
-static const char *build_objc_description_for_object(void *address, Class obj_class) {
+/**
+ * @brief Cheap fingerprint of an object's current state, used to detect address reuse
+ * @note Hashes the first few words of instance storage. A different object allocated at the same
+ * address (or a mutated ivar) changes the hint and invalidates the cached description
+ */
+static uint32_t object_generation_hint(void *address, Class obj_class) {
+    if (_objc_isTaggedPointer(address)) {
+        // The payload is the pointer itself
+        return 0;
+    }
+
+    size_t hint_size = class_getInstanceSize(obj_class);
+    size_t allocated_size = malloc_size(address);
+    if (allocated_size > 0 && allocated_size < hint_size) {
+        hint_size = allocated_size;
+    }
+    if (hint_size > GENERATION_HINT_MAX_BYTES) {
+        hint_size = GENERATION_HINT_MAX_BYTES;
+    }
+
+    uint32_t hash = 2166136261u;
+    const uint8_t *bytes = (const uint8_t *)address;
+    for (size_t i = sizeof(Class); i < hint_size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void evict_description_cache_entry(description_cache_shard_t *shard, description_cache_entry_t *entry) {
+    if (entry->description != NULL) {
+        shard->bytes_used -= entry->description_len + 1;
+        free(entry->description);
+    }
+    memset(entry, 0, sizeof(description_cache_entry_t));
+}
+
+static size_t copy_description_out(const description_cache_entry_t *entry, char *out_buf, size_t buf_size) {
+    size_t len = MIN(entry->description_len, buf_size - 1);
+    memcpy(out_buf, entry->description, len);
+    out_buf[len] = '\0';
+    return len;
+}
+
+static kern_return_t build_objc_description_for_object(void *address, Class obj_class, char *out_buf, size_t buf_size) {
     if (address == NULL || obj_class == NULL) {
-        return NULL;
+        return KERN_INVALID_ARGUMENT;
     }
-    
+
     IMP descriptionImp = get_description_imp_for_class(obj_class);
     if (descriptionImp == NULL) {
-        return NULL;
+        return KERN_FAILURE;
     }
-    
+
     id object = (id)address;
     SEL descriptionSel = description_selector();
     id descriptionString = ((id (*)(id, SEL))descriptionImp)(object, descriptionSel);
     if (descriptionString == NULL) {
-        return NULL;
+        return KERN_FAILURE;
     }
-    
+
     void *orig_objc_msgSend = get_original_objc_msgSend();
     if (orig_objc_msgSend == NULL) {
-        return NULL;
+        return KERN_FAILURE;
     }
-    
+
     const char *utf8String = ((const char *(*)(id, SEL))orig_objc_msgSend)(descriptionString, sel_registerName("UTF8String"));
     if (utf8String == NULL) {
-        return NULL;
+        return KERN_FAILURE;
     }
-    
+
     // For string types, use objc style quoting (@"string")
     if (objc_opt_isKindOfClass(object, objc_getClass("NSString"))) {
-        char *quoted_string = malloc(strlen(utf8String) + 3);
-        if (quoted_string == NULL) {
-            return NULL;
-        }
-        
-        quoted_string[0] = '@';
-        quoted_string[1] = '"';
-        strcpy(quoted_string + 2, utf8String);
-        char *newline = strchr(quoted_string, '\n');
-        if (newline != NULL) {
-            newline[0] = '\0';
+        if (buf_size < 4) {
+            return KERN_NO_SPACE;
         }
-        
-        size_t final_len = strlen(quoted_string);
-        quoted_string[final_len] = '"';
-        quoted_string[final_len + 1] = '\0';
-        return quoted_string;
-    }
-    
-    return strdup(utf8String);
+
+        size_t len = strcspn(utf8String, "\n");
+        len = MIN(len, buf_size - 4);
+        out_buf[0] = '@';
+        out_buf[1] = '"';
+        memcpy(out_buf + 2, utf8String, len);
+        out_buf[len + 2] = '"';
+        out_buf[len + 3] = '\0';
+        return KERN_SUCCESS;
+    }
+
+    strlcpy(out_buf, utf8String, buf_size);
+    return KERN_SUCCESS;
 }
 
-const char *lookup_description_for_address(void *address, Class obj_class) {
-    if (address == NULL || obj_class == NULL) {
-        return NULL;
+kern_return_t lookup_description_for_address(void *address, Class obj_class, char *out_buf, size_t buf_size) {
+    if (address == NULL || obj_class == NULL || out_buf == NULL || buf_size == 0) {
+        return KERN_INVALID_ARGUMENT;
     }
-    
-    os_unfair_lock_lock(&g_description_cache_lock);
-    
-    for (size_t i = 0; i < g_description_cache_count; i += 2) {
-        if (g_description_cache[i] == address) {
+
+    uintptr_t key = (uintptr_t)address;
+    uintptr_t isa = (uintptr_t)obj_class;
+    uint32_t generation = object_generation_hint(address, obj_class);
+
+    uint64_t hash = pointer_hash(key);
+    description_cache_shard_t *shard = &g_description_cache[(hash >> 60) % DESCRIPTION_CACHE_SHARD_COUNT];
+    size_t set_start = ((hash >> 40) % (DESCRIPTION_CACHE_SHARD_ENTRIES / DESCRIPTION_CACHE_WAYS)) * DESCRIPTION_CACHE_WAYS;
+
+    os_unfair_lock_lock(&shard->lock);
+    for (size_t way = 0; way < DESCRIPTION_CACHE_WAYS; way++) {
+        description_cache_entry_t *entry = &shard->entries[set_start + way];
+        if (entry->address != key) {
+            continue;
+        }
+
+        if (entry->isa == isa && entry->generation == generation) {
             // Found previously cached description
-            const char *cachedDesc = g_description_cache[i + 1];
-            os_unfair_lock_unlock(&g_description_cache_lock);
-            return cachedDesc;
+            entry->referenced = true;
+            copy_description_out(entry, out_buf, buf_size);
+            os_unfair_lock_unlock(&shard->lock);
+            return KERN_SUCCESS;
         }
+
+        // The address now holds a different object (or the object changed). Drop the stale text
+        evict_description_cache_entry(shard, entry);
+        break;
     }
-    
-    os_unfair_lock_unlock(&g_description_cache_lock);
-    
+    os_unfair_lock_unlock(&shard->lock);
+
     // Build the description outside the lock
-    const char *description = build_objc_description_for_object(address, obj_class);
-    if (description == NULL) {
-        return NULL;
+    char description[DESCRIPTION_MAX_LEN + 1];
+    if (build_objc_description_for_object(address, obj_class, description, sizeof(description)) != KERN_SUCCESS) {
+        return KERN_FAILURE;
+    }
+    strlcpy(out_buf, description, buf_size);
+
+    size_t description_len = strlen(description);
+    char *cached_copy = malloc(description_len + 1);
+    if (cached_copy == NULL) {
+        // Still have a description for the caller, it just won't be cached
+        return KERN_SUCCESS;
     }
-    
-    os_unfair_lock_lock(&g_description_cache_lock);
-    
-    for (size_t i = 0; i < g_description_cache_count; i += 2) {
-        if (g_description_cache[i] == address) {
-            const char *alreadyCached = g_description_cache[i + 1];
-            os_unfair_lock_unlock(&g_description_cache_lock);
-            return alreadyCached;
+    memcpy(cached_copy, description, description_len + 1);
+
+    os_unfair_lock_lock(&shard->lock);
+
+    // Pick a victim within the set: an empty way, the same address (racing insert), or the first
+    // way whose reference bit is clear, giving referenced ways a second chance along the way
+    description_cache_entry_t *victim = NULL;
+    for (size_t way = 0; way < DESCRIPTION_CACHE_WAYS && victim == NULL; way++) {
+        description_cache_entry_t *entry = &shard->entries[set_start + way];
+        if (entry->description == NULL || entry->address == key) {
+            victim = entry;
         }
     }
-    
-    if (g_description_cache_count < 1022) {
-        size_t len = strnlen(description, 1023);
-        char *descBuffer = malloc(len + 1);
-        if (descBuffer) {
-            strncpy(descBuffer, description, len);
-            descBuffer[len] = '\0';
-            
-            g_description_cache[g_description_cache_count]     = address;
-            g_description_cache[g_description_cache_count + 1] = descBuffer;
-            g_description_cache_count += 2;
-            
-            os_unfair_lock_unlock(&g_description_cache_lock);
-            return descBuffer;
+
+    for (size_t sweep = 0; victim == NULL && sweep < DESCRIPTION_CACHE_WAYS * 2; sweep++) {
+        description_cache_entry_t *entry = &shard->entries[set_start + (sweep % DESCRIPTION_CACHE_WAYS)];
+        if (entry->referenced) {
+            entry->referenced = false;
+        }
+        else {
+            victim = entry;
         }
     }
-    
-    os_unfair_lock_unlock(&g_description_cache_lock);
-    return description;
+
+    evict_description_cache_entry(shard, victim);
+    *victim = (description_cache_entry_t){
+        .address = key,
+        .isa = isa,
+        .generation = generation,
+        .referenced = false,
+        .description = cached_copy,
+        .description_len = description_len,
+    };
+    shard->bytes_used += description_len + 1;
+
+    // Enforce the memory cap by sweeping the whole shard with the clock hand
+    for (size_t sweep = 0; shard->bytes_used > DESCRIPTION_CACHE_SHARD_MAX_BYTES && sweep < DESCRIPTION_CACHE_SHARD_ENTRIES * 2; sweep++) {
+        description_cache_entry_t *entry = &shard->entries[shard->clock_hand];
+        shard->clock_hand = (shard->clock_hand + 1) % DESCRIPTION_CACHE_SHARD_ENTRIES;
+        if (entry == victim || entry->description == NULL) {
+            continue;
+        }
+
+        if (entry->referenced) {
+            entry->referenced = false;
+        }
+        else {
+            evict_description_cache_entry(shard, entry);
+        }
+    }
+
+    os_unfair_lock_unlock(&shard->lock);
+    return KERN_SUCCESS;
 }
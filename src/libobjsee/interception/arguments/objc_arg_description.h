@@ -13,11 +13,14 @@
  * @brief Lookup the description of an objective-c object at a given address
  * @param address The address of the object
  * @param obj_class The objective-c class of the object at address
- * @return The description of the object, or NULL if it could not be determined
+ * @param out_buf The buffer to write the description to
+ * @param buf_size The size of the buffer
+ * @return KERN_SUCCESS if a description was written, otherwise an error code
  *
- * @note The returned string is owned by a cache and should not be freed
+ * @note Results are cached per (address, class, object state). A different object later allocated
+ * at the same address will not be served the previous object's description
  */
-const char *lookup_description_for_address(void *address, Class obj_class);
+kern_return_t lookup_description_for_address(void *address, Class obj_class, char *out_buf, size_t buf_size);
 
 
 #endif /* OBJC_ARG_DESCRIPTION_H */
@@ -9,136 +9,246 @@
 #include "tracer_internal.h"
 #include <os/lock.h>
 
-struct class_tracking_state {
-    _Atomic bool initialized;
-    os_unfair_lock lock;
-    _Atomic(Class) *seen_classes;
-    size_t seen_classes_count;
+#define CLASS_SET_MIN_CAPACITY 1024
+// Grow once the table is 3/4 full to keep probe sequences short
+#define CLASS_SET_MAX_LOAD_NUM 3
+#define CLASS_SET_MAX_LOAD_DEN 4
+
+// Open-addressing set of Class pointers (linear probing, slots are never removed).
+// Lookups and inserts are lock-free. Growth is serialized by a lock and publishes the
+// new table before migrating entries into it, so a racing lookup may briefly miss a class
+// that's still being migrated. That only costs one skipped argument description.
+struct class_set_table {
     size_t capacity;
+    size_t mask;
+    unsigned int shift;
+    _Atomic size_t count;
+    // Tables are never freed because lock-free readers may still be walking them.
+    // Since each table is twice the size of the last, retired tables cost less than the live one
+    struct class_set_table *retired;
+    _Atomic(uintptr_t) slots[];
+};
+
+struct class_tracking_state {
+    _Atomic(struct class_set_table *) table;
+    os_unfair_lock grow_lock;
 };
 
 static struct class_tracking_state g_class_tracking = {
-    .initialized = false,
-    .lock = OS_UNFAIR_LOCK_INIT,
-    .seen_classes = NULL,
-    .seen_classes_count = 0,
-    .capacity = 1024
+    .table = NULL,
+    .grow_lock = OS_UNFAIR_LOCK_INIT,
 };
 
-static kern_return_t init_class_tracking(void) {
-    if (atomic_load(&g_class_tracking.initialized) == true) {
-        return KERN_SUCCESS;
-    }
-    
-    os_unfair_lock_lock(&g_class_tracking.lock);
-    
-    if (atomic_load(&g_class_tracking.initialized) == true) {
-        os_unfair_lock_unlock(&g_class_tracking.lock);
-        return KERN_SUCCESS;
-    }
-    
-    size_t initial_size = 0;
-    if (__builtin_mul_overflow(g_class_tracking.capacity, sizeof(_Atomic(Class)), &initial_size)) {
-        os_unfair_lock_unlock(&g_class_tracking.lock);
-        return KERN_FAILURE;
+// Fibonacci hashing. Class pointers share their low (alignment) bits, so index with the well-mixed high bits
+__attribute__((always_inline))
+static inline size_t class_set_index(const struct class_set_table *table, uintptr_t key) {
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> table->shift);
+}
+
+static size_t class_set_capacity_for(size_t count) {
+    size_t capacity = CLASS_SET_MIN_CAPACITY;
+    while (capacity * CLASS_SET_MAX_LOAD_NUM / CLASS_SET_MAX_LOAD_DEN <= count) {
+        if (__builtin_mul_overflow(capacity, 2, &capacity)) {
+            return 0;
+        }
     }
-    
-    g_class_tracking.seen_classes = (_Atomic(Class) *)calloc(g_class_tracking.capacity, sizeof(_Atomic(Class)));
-    if (g_class_tracking.seen_classes == NULL) {
-        os_unfair_lock_unlock(&g_class_tracking.lock);
-        return KERN_FAILURE;
+    return capacity;
+}
+
+static struct class_set_table *class_set_table_create(size_t capacity) {
+    size_t slots_size = 0;
+    if (capacity == 0 || __builtin_mul_overflow(capacity, sizeof(_Atomic(uintptr_t)), &slots_size)) {
+        return NULL;
+    }
+
+    struct class_set_table *table = calloc(1, sizeof(struct class_set_table) + slots_size);
+    if (table == NULL) {
+        return NULL;
     }
-    
-    atomic_thread_fence(memory_order_release);
-    atomic_store(&g_class_tracking.initialized, true);
-    os_unfair_lock_unlock(&g_class_tracking.lock);
-    return KERN_SUCCESS;
+
+    table->capacity = capacity;
+    table->mask = capacity - 1;
+    table->shift = 64 - __builtin_ctzl(capacity);
+    return table;
 }
 
-kern_return_t has_seen_class(Class cls) {
-    if (cls == NULL) {
-        return KERN_FAILURE;
+typedef enum {
+    CLASS_SET_INSERTED,
+    CLASS_SET_ALREADY_PRESENT,
+    CLASS_SET_FULL,
+} class_set_insert_result_t;
+
+static class_set_insert_result_t class_set_table_insert(struct class_set_table *table, uintptr_t key) {
+    size_t index = class_set_index(table, key);
+    for (size_t probes = 0; probes < table->capacity; probes++) {
+        uintptr_t current = atomic_load_explicit(&table->slots[index], memory_order_acquire);
+        if (current == key) {
+            return CLASS_SET_ALREADY_PRESENT;
+        }
+
+        if (current == 0) {
+            uintptr_t expected = 0;
+            if (atomic_compare_exchange_strong(&table->slots[index], &expected, key)) {
+                atomic_fetch_add_explicit(&table->count, 1, memory_order_relaxed);
+                return CLASS_SET_INSERTED;
+            }
+
+            // Lost the race for this slot. If the winner stored the same class we're done
+            if (expected == key) {
+                return CLASS_SET_ALREADY_PRESENT;
+            }
+        }
+
+        index = (index + 1) & table->mask;
     }
-    
-    if (atomic_load(&g_class_tracking.initialized) == false) {
-        kern_return_t init_result = init_class_tracking();
-        if (init_result != KERN_SUCCESS) {
-            return KERN_FAILURE;
+
+    return CLASS_SET_FULL;
+}
+
+static bool class_set_table_contains(struct class_set_table *table, uintptr_t key) {
+    size_t index = class_set_index(table, key);
+    for (size_t probes = 0; probes < table->capacity; probes++) {
+        uintptr_t current = atomic_load_explicit(&table->slots[index], memory_order_acquire);
+        if (current == key) {
+            return true;
+        }
+
+        if (current == 0) {
+            return false;
         }
+
+        index = (index + 1) & table->mask;
     }
-    
-    os_unfair_lock_lock(&g_class_tracking.lock);
-    _Atomic(Class) *classes = g_class_tracking.seen_classes;
-    size_t count = g_class_tracking.seen_classes_count;
-    bool found = false;
-    
-    if (classes != NULL) {
-        for (size_t i = 0; i < count && i < g_class_tracking.capacity; i++) {
-            Class stored_class = atomic_load(&classes[i]);
-            if (stored_class == cls) {
-                found = true;
-                break;
-            }
+
+    return false;
+}
+
+static bool class_set_table_needs_growth(struct class_set_table *table, size_t additional) {
+    size_t count = atomic_load_explicit(&table->count, memory_order_relaxed);
+    return (count + additional) * CLASS_SET_MAX_LOAD_DEN >= table->capacity * CLASS_SET_MAX_LOAD_NUM;
+}
+
+static struct class_set_table *get_class_set_table(void) {
+    struct class_set_table *table = atomic_load(&g_class_tracking.table);
+    if (__builtin_expect(table != NULL, 1)) {
+        return table;
+    }
+
+    os_unfair_lock_lock(&g_class_tracking.grow_lock);
+    table = atomic_load(&g_class_tracking.table);
+    if (table == NULL) {
+        table = class_set_table_create(CLASS_SET_MIN_CAPACITY);
+        if (table != NULL) {
+            atomic_store(&g_class_tracking.table, table);
         }
     }
-    
-    os_unfair_lock_unlock(&g_class_tracking.lock);
-    return found ? KERN_SUCCESS : KERN_FAILURE;
+    os_unfair_lock_unlock(&g_class_tracking.grow_lock);
+    return table;
 }
 
-kern_return_t record_class_encounter(Class cls) {
+/**
+ * @brief Ensure the live table can take `additional` more classes without exceeding the max load factor
+ * @return The live table, or NULL if a larger table could not be allocated
+ */
+static struct class_set_table *reserve_class_set_capacity(size_t additional) {
+    struct class_set_table *table = get_class_set_table();
+    if (table == NULL || !class_set_table_needs_growth(table, additional)) {
+        return table;
+    }
+
+    os_unfair_lock_lock(&g_class_tracking.grow_lock);
+
+    table = atomic_load(&g_class_tracking.table);
+    if (!class_set_table_needs_growth(table, additional)) {
+        os_unfair_lock_unlock(&g_class_tracking.grow_lock);
+        return table;
+    }
+
+    size_t needed = atomic_load_explicit(&table->count, memory_order_relaxed) + additional;
+    struct class_set_table *grown = class_set_table_create(class_set_capacity_for(needed));
+    if (grown == NULL) {
+        os_unfair_lock_unlock(&g_class_tracking.grow_lock);
+        return NULL;
+    }
+
+    // Publish first, then migrate. An insert that lands in the old table after its slot was
+    // migrated will observe the new table on its follow-up check and insert there too
+    grown->retired = table;
+    atomic_store(&g_class_tracking.table, grown);
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        uintptr_t key = atomic_load(&table->slots[i]);
+        if (key != 0) {
+            class_set_table_insert(grown, key);
+        }
+    }
+
+    os_unfair_lock_unlock(&g_class_tracking.grow_lock);
+    return grown;
+}
+
+static kern_return_t class_set_insert(uintptr_t key, struct class_set_table *table) {
+    while (table != NULL) {
+        if (class_set_table_insert(table, key) == CLASS_SET_FULL) {
+            table = reserve_class_set_capacity(1);
+            continue;
+        }
+
+        // A resize may have started after the insert. Make sure the class reaches the live table
+        struct class_set_table *live = atomic_load(&g_class_tracking.table);
+        if (live == table) {
+            return KERN_SUCCESS;
+        }
+        table = live;
+    }
+
+    return KERN_FAILURE;
+}
+
+__attribute__((hot))
+kern_return_t has_seen_class(Class cls) {
     if (cls == NULL) {
         return KERN_FAILURE;
     }
-    
-    if (atomic_load(&g_class_tracking.initialized) == false) {
-        if (init_class_tracking() != KERN_SUCCESS) {
-            return KERN_FAILURE;
-        }
+
+    struct class_set_table *table = atomic_load(&g_class_tracking.table);
+    if (table == NULL) {
+        return KERN_FAILURE;
+    }
+
+    return class_set_table_contains(table, (uintptr_t)cls) ? KERN_SUCCESS : KERN_FAILURE;
+}
+
+kern_return_t record_class_encounter(Class cls) {
+    if (cls == NULL) {
+        return KERN_FAILURE;
     }
-    
-    os_unfair_lock_lock(&g_class_tracking.lock);
-    
-    if (g_class_tracking.seen_classes == NULL) {
-        os_unfair_lock_unlock(&g_class_tracking.lock);
+
+    return class_set_insert((uintptr_t)cls, reserve_class_set_capacity(1));
+}
+
+kern_return_t record_class_encounters(const Class *classes, size_t count) {
+    if (classes == NULL) {
         return KERN_FAILURE;
     }
-    
-    size_t current_count = g_class_tracking.seen_classes_count;
-    if (current_count == SIZE_MAX) {
-        os_unfair_lock_unlock(&g_class_tracking.lock);
+
+    // Size the table once up front rather than growing repeatedly during the startup scan
+    struct class_set_table *table = reserve_class_set_capacity(count);
+    if (table == NULL) {
         return KERN_FAILURE;
     }
-    
-    if (current_count >= g_class_tracking.capacity) {
-        size_t new_capacity = g_class_tracking.capacity;
-        if (__builtin_mul_overflow(new_capacity, 2, &new_capacity)) {
-            os_unfair_lock_unlock(&g_class_tracking.lock);
-            return KERN_FAILURE;
-        }
-        
-        size_t new_size = 0;
-        if (__builtin_mul_overflow(new_capacity, sizeof(_Atomic(Class)), &new_size)) {
-            os_unfair_lock_unlock(&g_class_tracking.lock);
-            return KERN_FAILURE;
+
+    kern_return_t result = KERN_SUCCESS;
+    for (size_t i = 0; i < count; i++) {
+        if (classes[i] == NULL) {
+            continue;
         }
-        
-        _Atomic(Class) *new_array = (_Atomic(Class) *)realloc(g_class_tracking.seen_classes, new_size);
-        if (new_array == NULL) {
-            os_unfair_lock_unlock(&g_class_tracking.lock);
-            return KERN_FAILURE;
+
+        if (class_set_insert((uintptr_t)classes[i], table) != KERN_SUCCESS) {
+            result = KERN_FAILURE;
         }
-        memset(new_array + g_class_tracking.capacity, 0, new_size - (g_class_tracking.capacity * sizeof(_Atomic(Class))));
-        
-        g_class_tracking.seen_classes = new_array;
-        g_class_tracking.capacity = new_capacity;
-    }
-    
-    _Atomic(Class) *target = &g_class_tracking.seen_classes[current_count];
-    
-    atomic_store(target, cls);
-    g_class_tracking.seen_classes_count++;
-    
-    os_unfair_lock_unlock(&g_class_tracking.lock);
-    return KERN_SUCCESS;
+        table = atomic_load(&g_class_tracking.table);
+    }
+
+    return result;
 }
@@ -27,4 +27,13 @@ kern_return_t has_seen_class(Class cls);
  */
 kern_return_t record_class_encounter(Class cls);
 
+/**
+ * @brief Records that a batch of classes has been seen
+ * @param classes The classes to record. NULL entries are skipped
+ * @param count The number of entries in classes
+ * @return KERN_SUCCESS if every class was recorded, otherwise an error code
+ * @note Reserves room for the whole batch up front, so prefer this over repeated calls to record_class_encounter()
+ */
+kern_return_t record_class_encounters(const Class *classes, size_t count);
+
 #endif /* realized_class_tracking_h */
@@ -9,6 +9,7 @@
 #include <mach/mach.h>
 #include <os/log.h>
 #include <dlfcn.h>
+#include <time.h>
 #include "realized_class_tracking.h"
 #include "selector_deny_list.h"
 #include "event_handler.h"
@@ -185,6 +186,7 @@ SEL pre_objc_msgSend_callback(__unsafe_unretained id self, SEL _cmd, uintptr_t l
         .thread_id = ctx->thread_id,
         .trace_depth = ctx->trace_depth,
         .real_depth = ctx->stack_depth,
+        .timestamp = clock_gettime_nsec_np(CLOCK_UPTIME_RAW),
         .arguments = NULL,
         .argument_count = 0,
         .method_signature = NULL,
@@ -312,6 +314,16 @@ tracer_result_t init_message_interception(tracer_t *tracer) {
         return TRACER_ERROR_INITIALIZATION;
     }
 
+    // Every class and its metaclass are realized at this point, so record both in one batch.
+    // Objects passed as arguments resolve to the former, class objects to the latter
+    Class *realized_classes = calloc((size_t)class_count * 2, sizeof(Class));
+    if (realized_classes == NULL) {
+        free(classes);
+        tracer_set_error(g_tracer_ctx, "init_message_interception: Failed to allocate realized class list");
+        return TRACER_ERROR_MEMORY;
+    }
+
+    size_t realized_count = 0;
     for (unsigned int i = 0; i < class_count; i++) {
         Class cls = classes[i];
         if (cls == NULL) {
@@ -319,9 +331,15 @@ tracer_result_t init_message_interception(tracer_t *tracer) {
         }
 
         class_isMetaClass(cls);
-        record_class_encounter(object_getClass((id)cls));
+        realized_classes[realized_count++] = cls;
+        realized_classes[realized_count++] = object_getClass((id)cls);
     }
     free(classes);
+
+    if (record_class_encounters(realized_classes, realized_count) != KERN_SUCCESS) {
+        tracer_set_error(g_tracer_ctx, "init_message_interception: Failed to record realized classes");
+    }
+    free(realized_classes);
     
     if (tracer == NULL) {
         tracer_set_error(g_tracer_ctx, "init_message_interception: Invalid tracer context");
@@ -153,6 +153,28 @@ void tracer_set_output_socket(tracer_t *tracer, const char *host, uint16_t port)
     }
 }
 
+void tracer_set_output_shm(tracer_t *tracer, const char *name) {
+    if (tracer) {
+        tracer->config.transport = TRACER_TRANSPORT_SHM;
+        tracer->config.transport_config.shm_name = strdup(name);
+    }
+}
+
+void tracer_set_output_unix_socket(tracer_t *tracer, const char *path, bool seqpacket) {
+    if (tracer) {
+        tracer->config.transport = TRACER_TRANSPORT_UNIX;
+        tracer->config.transport_config.socket_path = strdup(path);
+        tracer->config.transport_config.seqpacket = seqpacket;
+    }
+}
+
+void tracer_set_output_segments(tracer_t *tracer, const char *path) {
+    if (tracer) {
+        tracer->config.transport = TRACER_TRANSPORT_SEGMENTS;
+        tracer->config.transport_config.file_path = strdup(path);
+    }
+}
+
 void tracer_set_output_handler(tracer_t *tracer, tracer_event_handler_t *handler, void *context) {
     if (tracer == NULL || handler == NULL) {
         return;
@@ -238,6 +260,12 @@ tracer_result_t tracer_internal_init(tracer_t *tracer) {
         return result;
     }
     
+    result = send_event_stream_header(tracer);
+    if (result != TRACER_SUCCESS) {
+        tracer_set_error(tracer, "Failed to send event stream header: %d", result);
+        return result;
+    }
+    
     return TRACER_SUCCESS;
 }
 
@@ -314,7 +342,9 @@ tracer_result_t tracer_stop(tracer_t *tracer) {
     }
     
     tracer->running = false;
-    return TRACER_SUCCESS;
+    
+    // Don't leave events batched up in the transport
+    return transport_flush(tracer);
 }
 
 tracer_result_t tracer_cleanup(tracer_t *tracer) {
@@ -322,16 +352,7 @@ tracer_result_t tracer_cleanup(tracer_t *tracer) {
         return TRACER_SUCCESS;
     }
     
-    if (tracer->transport_context) {
-        transport_context_t *transport_ctx = tracer->transport_context;
-        pthread_mutex_destroy(&transport_ctx->write_lock);
-        if (transport_ctx->fd >= 0) {
-            close(transport_ctx->fd);
-            transport_ctx->fd = -1;
-        }
-        free(transport_ctx);
-        tracer->transport_context = NULL;
-    }
+    transport_cleanup(tracer);
     
     cleanup_event_handler();
     
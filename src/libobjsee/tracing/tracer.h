@@ -27,6 +27,9 @@ void tracer_set_output(tracer_t *tracer, tracer_transport_type_t output);
 void tracer_set_output_stdout(tracer_t *tracer);
 void tracer_set_output_file(tracer_t *tracer, const char *path);
 void tracer_set_output_socket(tracer_t *tracer, const char *host, uint16_t port);
+void tracer_set_output_shm(tracer_t *tracer, const char *name);
+void tracer_set_output_unix_socket(tracer_t *tracer, const char *path, bool seqpacket);
+void tracer_set_output_segments(tracer_t *tracer, const char *path);
 void tracer_set_output_handler(tracer_t *tracer, tracer_event_handler_t *handler, void *context);
 
 void tracer_set_format_options(tracer_t *tracer, tracer_format_options_t format);
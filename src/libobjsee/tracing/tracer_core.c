@@ -8,6 +8,7 @@
 #include <os/log.h>
 #include <arm_neon.h>
 #include "tracer_internal.h"
+#include "event_ring.h"
 
 typedef struct {
     Class isa;
@@ -18,6 +19,14 @@ extern uint64_t objc_debug_isa_magic_value;
 
 static void tracer_thread_destructor(void *ctx) {
     if (ctx) {
+        tracer_thread_context_t *thread_ctx = (tracer_thread_context_t *)ctx;
+        output_buffer_free(&thread_ctx->output_buffer);
+        output_buffer_free(&thread_ctx->scratch_buffer);
+        event_encoder_free(&thread_ctx->encoder);
+        if (thread_ctx->ring) {
+            // Anything already committed is still sent. The ring is reused by the next new thread
+            event_ring_release(thread_ctx->ring);
+        }
         free(ctx);
     }
 }
@@ -84,6 +93,8 @@ tracer_thread_context_t *tracer_get_thread_context(tracer_t *tracer) {
         uint64_t thread_id;
         pthread_threadid_np(NULL, &thread_id);
         ctx->thread_id = (uint16_t)(thread_id ^ (thread_id >> 32));
+        // The thread id can be shared with another thread, its binary stream can't
+        ctx->encoder.stream_id = event_encoder_next_stream_id();
         
         pthread_setspecific(tracer->thread_key, ctx);
     }
@@ -12,6 +12,8 @@
 #include <pthread.h>
 #include "tracer_types.h"
 #include "tracer.h"
+#include "output_buffer.h"
+#include "event_protocol.h"
 
 #define TRACER_MAX_STACK_DEPTH 256
 #define TRACER_BUFFER_SIZE 2048
@@ -72,6 +74,17 @@ typedef struct tracer_thread_context_t {
     } last_sel_cache;
     
     bool capture_arguments;
+    
+    // Reused across events so formatting doesn't allocate once the buffer has grown to fit
+    output_buffer_t output_buffer;
+    // Holds the formatted trace while it is escaped into the json output
+    output_buffer_t scratch_buffer;
+    // String dictionary and delta state for the binary event protocol
+    event_encoder_t encoder;
+    // The thread's staging ring in the transport, claimed on first use
+    struct event_ring *ring;
+    // Segment file the thread's binary stream started in, for TRACER_TRANSPORT_SEGMENTS
+    uint64_t segment_index;
 } __attribute__((aligned(64))) tracer_thread_context_t;
 
 typedef struct tracer_context_t {
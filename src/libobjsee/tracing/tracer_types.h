@@ -78,6 +78,9 @@ typedef struct {
     const char *indent_separator_char;
     // hack
     bool include_newline_in_formatted_trace;
+    // When true, events are sent in the compact binary protocol (see event_protocol.h) instead of text or JSON,
+    // and the consumer is responsible for all formatting. Takes precedence over `output_as_json`
+    bool output_as_binary;
     
 /*
     [thread id] ....{indent_char} |{indent_separator_char}
@@ -99,6 +102,9 @@ typedef enum {
     TRACER_TRANSPORT_FILE,
     TRACER_TRANSPORT_STDOUT,
     TRACER_TRANSPORT_CUSTOM,
+    TRACER_TRANSPORT_SHM,           // Shared memory ring created by the consumer
+    TRACER_TRANSPORT_UNIX,          // Unix domain socket the consumer is listening on
+    TRACER_TRANSPORT_SEGMENTS,      // Memory-mapped segment files, rotated by size or age
 } tracer_transport_type_t;
 
 typedef struct {
@@ -111,11 +117,36 @@ typedef struct {
     size_t size;
 } tracer_argument_t;
 
+// What happens to events when a thread produces them faster than the transport can write them
+typedef enum {
+    TRACER_BACKPRESSURE_DROP_NEWEST,    // Drop events that don't fit. The traced thread never waits
+    TRACER_BACKPRESSURE_BLOCK,          // Wait for room, for up to 2 seconds, then drop the event
+    TRACER_BACKPRESSURE_DROP_OLDEST,    // Discard the thread's unsent backlog to make room for new events
+    TRACER_BACKPRESSURE_SAMPLE,         // Keep a shrinking share of events as the thread's buffer fills up
+} tracer_backpressure_policy_t;
+
 typedef struct {
     const char *host;
     uint32_t port;
     const char *file_path;
     void *custom_context;
+    const char *shm_name;           // Name of the consumer's shared memory ring, for TRACER_TRANSPORT_SHM
+    const char *socket_path;        // Path the consumer is listening on, for TRACER_TRANSPORT_UNIX
+    bool seqpacket;                 // The consumer's socket is SOCK_SEQPACKET. Every write is then a packet of whole events
+    
+    // Flush policy for socket and file output. Events are batched and written once either limit
+    // is reached, and whenever the tracer stops. 0 uses the default
+    uint32_t flush_interval_ms;     // Longest an event may wait before it is written
+    uint32_t flush_bytes;           // Write as soon as this much is waiting
+    // Dropped events are counted per thread and reported to the consumer as "N events dropped" markers
+    tracer_backpressure_policy_t backpressure;
+    // Compress socket and file output in frames, one per batch. See stream_compression.h
+    bool compress;
+    
+    // Segment files for TRACER_TRANSPORT_SEGMENTS, named after file_path. See segment_log.h
+    uint32_t segment_size_mb;       // Size each segment is preallocated to. 0 uses 64MB
+    uint32_t max_segments;          // The oldest segments are deleted beyond this many. 0 keeps them all
+    uint32_t segment_max_age_s;     // Rotate after this long, even if the segment isn't full. 0 rotates on size only
 } tracer_transport_config_t;
 
 typedef struct tracer_event_t {
@@ -125,8 +156,11 @@ typedef struct tracer_event_t {
     bool is_class_method;
     const char *image_path;
     uint16_t thread_id;
+    // Set on events decoded from the binary protocol. Unlike thread_id, no two threads share one
+    uint32_t stream_id;
     uint32_t trace_depth;
     uint32_t real_depth;
+    uint64_t timestamp;             // Nanoseconds, CLOCK_UPTIME_RAW
     const char *method_signature;
     tracer_argument_t *arguments;
     size_t argument_count;
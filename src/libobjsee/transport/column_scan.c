@@ -0,0 +1,165 @@
+//
+//  column_scan.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <string.h>
+#include "column_scan.h"
+
+void column_selection_fill(uint64_t *selection, size_t count) {
+    size_t words = COLUMN_SELECTION_WORDS(count);
+    memset(selection, 0xff, words * sizeof(uint64_t));
+    if (count % 64 != 0) {
+        selection[words - 1] = (1ULL << (count % 64)) - 1;
+    }
+}
+
+size_t column_selection_count(const uint64_t *selection, size_t count) {
+    size_t selected = 0;
+    for (size_t i = 0; i < COLUMN_SELECTION_WORDS(count); i++) {
+        selected += __builtin_popcountll(selection[i]);
+    }
+    return selected;
+}
+
+// Rows past the last full word, one at a time
+static uint64_t u32_range_bits(const uint32_t *values, size_t count, uint32_t min, uint32_t max) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Unsigned wraparound makes this a single comparison
+        bits |= (uint64_t)(values[i] - min <= max - min) << i;
+    }
+    return bits;
+}
+
+void column_filter_u32_range(const uint32_t *values, size_t count, uint32_t min, uint32_t max, uint64_t *selection) {
+    if (min > max) {
+        memset(selection, 0, COLUMN_SELECTION_WORDS(count) * sizeof(uint64_t));
+        return;
+    }
+
+    size_t word = 0;
+#if defined(__ARM_NEON)
+    static const uint32_t lane_bit_values[4] = {1, 2, 4, 8};
+    const uint32x4_t lane_bits = vld1q_u32(lane_bit_values);
+    const uint32x4_t low = vdupq_n_u32(min);
+    const uint32x4_t high = vdupq_n_u32(max);
+    for (; (word + 1) * 64 <= count; word++) {
+        if (selection[word] == 0) {
+            continue;
+        }
+
+        const uint32_t *row = values + word * 64;
+        uint64_t bits = 0;
+        for (unsigned int i = 0; i < 64; i += 4) {
+            uint32x4_t value = vld1q_u32(row + i);
+            uint32x4_t in_range = vandq_u32(vcgeq_u32(value, low), vcleq_u32(value, high));
+            bits |= (uint64_t)vaddvq_u32(vandq_u32(in_range, lane_bits)) << i;
+        }
+        selection[word] &= bits;
+    }
+#else
+    for (; (word + 1) * 64 <= count; word++) {
+        if (selection[word] != 0) {
+            selection[word] &= u32_range_bits(values + word * 64, 64, min, max);
+        }
+    }
+#endif
+
+    if (word * 64 < count) {
+        selection[word] &= u32_range_bits(values + word * 64, count - word * 64, min, max);
+    }
+}
+
+static uint64_t u64_range_bits(const uint64_t *values, size_t count, uint64_t min, uint64_t max) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < count; i++) {
+        bits |= (uint64_t)(values[i] - min <= max - min) << i;
+    }
+    return bits;
+}
+
+void column_filter_u64_range(const uint64_t *values, size_t count, uint64_t min, uint64_t max, uint64_t *selection) {
+    if (min > max) {
+        memset(selection, 0, COLUMN_SELECTION_WORDS(count) * sizeof(uint64_t));
+        return;
+    }
+
+    size_t word = 0;
+#if defined(__ARM_NEON)
+    const uint64x2_t low = vdupq_n_u64(min);
+    const uint64x2_t high = vdupq_n_u64(max);
+    for (; (word + 1) * 64 <= count; word++) {
+        if (selection[word] == 0) {
+            continue;
+        }
+
+        const uint64_t *row = values + word * 64;
+        uint64_t bits = 0;
+        for (unsigned int i = 0; i < 64; i += 2) {
+            uint64x2_t value = vld1q_u64(row + i);
+            uint64x2_t in_range = vshrq_n_u64(vandq_u64(vcgeq_u64(value, low), vcleq_u64(value, high)), 63);
+            bits |= (vgetq_lane_u64(in_range, 0) | (vgetq_lane_u64(in_range, 1) << 1)) << i;
+        }
+        selection[word] &= bits;
+    }
+#else
+    for (; (word + 1) * 64 <= count; word++) {
+        if (selection[word] != 0) {
+            selection[word] &= u64_range_bits(values + word * 64, 64, min, max);
+        }
+    }
+#endif
+
+    if (word * 64 < count) {
+        selection[word] &= u64_range_bits(values + word * 64, count - word * 64, min, max);
+    }
+}
+
+void column_filter_u32_member(const uint32_t *values, size_t count, const uint8_t *members, uint32_t member_count, uint64_t *selection) {
+    for (size_t word = 0; word * 64 < count; word++) {
+        if (selection[word] == 0) {
+            continue;
+        }
+
+        const uint32_t *row = values + word * 64;
+        size_t rows = count - word * 64 < 64 ? count - word * 64 : 64;
+        uint64_t bits = 0;
+        for (size_t i = 0; i < rows; i++) {
+            bits |= (uint64_t)(row[i] < member_count && members[row[i]] != 0) << i;
+        }
+        selection[word] &= bits;
+    }
+}
+
+void column_count_values(const uint32_t *values, size_t count, const uint64_t *selection, uint64_t *counts, uint32_t limit) {
+    for (size_t word = 0; word * 64 < count; word++) {
+        const uint32_t *row = values + word * 64;
+        size_t rows = count - word * 64 < 64 ? count - word * 64 : 64;
+        uint64_t bits = selection ? selection[word] : ~0ULL;
+        if (rows == 64 && bits == ~0ULL) {
+            for (size_t i = 0; i < 64; i++) {
+                if (row[i] < limit) {
+                    counts[row[i]]++;
+                }
+            }
+            continue;
+        }
+
+        if (rows < 64) {
+            bits &= (1ULL << rows) - 1;
+        }
+        while (bits != 0) {
+            uint32_t value = row[__builtin_ctzll(bits)];
+            if (value < limit) {
+                counts[value]++;
+            }
+            bits &= bits - 1;
+        }
+    }
+}
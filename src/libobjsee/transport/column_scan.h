@@ -0,0 +1,52 @@
+//
+//  column_scan.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#ifndef COLUMN_SCAN_H
+#define COLUMN_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Predicates over decoded columns.
+
+    A selection is a bitmap with one bit per row, 64 rows to a word. Filters AND their result into it,
+    so predicates on several columns are combined by applying each in turn to the same selection.
+*/
+
+#define COLUMN_SELECTION_WORDS(count) (((count) + 63) / 64)
+
+/**
+ * @brief Select the first `count` rows, and none after them
+ */
+void column_selection_fill(uint64_t *selection, size_t count);
+
+/**
+ * @brief Number of selected rows
+ */
+size_t column_selection_count(const uint64_t *selection, size_t count);
+
+/**
+ * @brief Keep only rows whose value is in [min, max]. Use min == max for equality
+ */
+void column_filter_u32_range(const uint32_t *values, size_t count, uint32_t min, uint32_t max, uint64_t *selection);
+void column_filter_u64_range(const uint64_t *values, size_t count, uint64_t min, uint64_t max, uint64_t *selection);
+
+/**
+ * @brief Keep only rows whose value is a member of a set
+ * @param members members[value] is non-zero for every value in the set. Values past member_count aren't in it
+ */
+void column_filter_u32_member(const uint32_t *values, size_t count, const uint8_t *members, uint32_t member_count, uint64_t *selection);
+
+/**
+ * @brief Count selected rows by value, adding to counts[value]
+ * @param selection The rows to count, or NULL for all of them
+ * @param limit Size of `counts`. Larger values aren't counted
+ */
+void column_count_values(const uint32_t *values, size_t count, const uint64_t *selection, uint64_t *counts, uint32_t limit);
+
+#endif // COLUMN_SCAN_H
@@ -0,0 +1,539 @@
+//
+//  event_decoder.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/5/25.
+//
+
+#include <pthread.h>
+#include "event_protocol.h"
+
+#define STREAM_TABLE_MIN_CAPACITY 64
+#define INTERNED_STRINGS_MIN_CAPACITY 1024
+// Far above what an encoder defines before it resets its dictionary
+#define EVENT_DECODER_MAX_STRING_ID (1 << 24)
+
+typedef struct {
+    uint32_t stream_id;
+    uint16_t thread_id;
+    const char **strings;
+    uint32_t string_capacity;
+    uint32_t last_trace_depth;
+    uint32_t last_real_depth;
+    uint64_t last_timestamp;
+} decoder_thread_state_t;
+
+struct event_decoder {
+    bool read_preamble;
+    uint8_t version;
+    // Open addressed, keyed by stream id
+    decoder_thread_state_t **streams;
+    size_t stream_capacity;
+    size_t stream_count;
+    tracer_argument_t *arguments;
+    size_t argument_capacity;
+    // Argument descriptions, NUL-terminated back to back
+    output_buffer_t descriptions;
+    size_t *description_offsets;
+    event_decoder_dropped_callback_t dropped_callback;
+    void *dropped_context;
+    event_decoder_main_thread_callback_t main_thread_callback;
+    void *main_thread_context;
+};
+
+// Dictionary strings are interned process-wide and never freed. Every thread (and every decoder)
+// that defines the same string gets the same pointer, so consumers can key caches on it
+static struct {
+    pthread_mutex_t lock;
+    char **entries;
+    size_t capacity;
+    size_t count;
+} interned_strings = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t hash_bytes(const uint8_t *bytes, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool interned_strings_grow(void) {
+    size_t new_capacity = interned_strings.capacity ? interned_strings.capacity * 2 : INTERNED_STRINGS_MIN_CAPACITY;
+    char **new_entries = calloc(new_capacity, sizeof(char *));
+    if (new_entries == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < interned_strings.capacity; i++) {
+        char *entry = interned_strings.entries[i];
+        if (entry == NULL) {
+            continue;
+        }
+
+        size_t index = hash_bytes((const uint8_t *)entry, strlen(entry)) & (new_capacity - 1);
+        while (new_entries[index] != NULL) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        new_entries[index] = entry;
+    }
+
+    free(interned_strings.entries);
+    interned_strings.entries = new_entries;
+    interned_strings.capacity = new_capacity;
+    return true;
+}
+
+static const char *intern_string(const uint8_t *bytes, size_t length) {
+    if (memchr(bytes, '\0', length) != NULL) {
+        return NULL;
+    }
+
+    const char *result = NULL;
+    pthread_mutex_lock(&interned_strings.lock);
+
+    if ((interned_strings.count + 1) * 2 > interned_strings.capacity && !interned_strings_grow()) {
+        pthread_mutex_unlock(&interned_strings.lock);
+        return NULL;
+    }
+
+    size_t mask = interned_strings.capacity - 1;
+    size_t index = hash_bytes(bytes, length) & mask;
+    while (interned_strings.entries[index] != NULL) {
+        char *entry = interned_strings.entries[index];
+        if (strncmp(entry, (const char *)bytes, length) == 0 && entry[length] == '\0') {
+            result = entry;
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (result == NULL) {
+        char *copy = malloc(length + 1);
+        if (copy != NULL) {
+            memcpy(copy, bytes, length);
+            copy[length] = '\0';
+            interned_strings.entries[index] = copy;
+            interned_strings.count++;
+            result = copy;
+        }
+    }
+
+    pthread_mutex_unlock(&interned_strings.lock);
+    return result;
+}
+
+event_decoder_t *event_decoder_create(void) {
+    return calloc(1, sizeof(event_decoder_t));
+}
+
+void event_decoder_set_dropped_callback(event_decoder_t *decoder, event_decoder_dropped_callback_t callback, void *context) {
+    if (decoder == NULL) {
+        return;
+    }
+
+    decoder->dropped_callback = callback;
+    decoder->dropped_context = context;
+}
+
+void event_decoder_set_main_thread_callback(event_decoder_t *decoder, event_decoder_main_thread_callback_t callback, void *context) {
+    if (decoder == NULL) {
+        return;
+    }
+
+    decoder->main_thread_callback = callback;
+    decoder->main_thread_context = context;
+}
+
+static void free_thread_state(decoder_thread_state_t *state) {
+    if (state) {
+        free(state->strings);
+        free(state);
+    }
+}
+
+void event_decoder_free(event_decoder_t *decoder) {
+    if (decoder == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < decoder->stream_capacity; i++) {
+        free_thread_state(decoder->streams[i]);
+    }
+    free(decoder->streams);
+    free(decoder->arguments);
+    free(decoder->description_offsets);
+    output_buffer_free(&decoder->descriptions);
+    free(decoder);
+}
+
+static size_t stream_index(uint32_t stream_id, size_t capacity) {
+    uint64_t value = stream_id * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(value ^ (value >> 32)) & (capacity - 1);
+}
+
+static bool grow_streams(event_decoder_t *decoder) {
+    size_t new_capacity = decoder->stream_capacity ? decoder->stream_capacity * 2 : STREAM_TABLE_MIN_CAPACITY;
+    decoder_thread_state_t **streams = calloc(new_capacity, sizeof(decoder_thread_state_t *));
+    if (streams == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < decoder->stream_capacity; i++) {
+        decoder_thread_state_t *state = decoder->streams[i];
+        if (state == NULL) {
+            continue;
+        }
+
+        size_t index = stream_index(state->stream_id, new_capacity);
+        while (streams[index] != NULL) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        streams[index] = state;
+    }
+
+    free(decoder->streams);
+    decoder->streams = streams;
+    decoder->stream_capacity = new_capacity;
+    return true;
+}
+
+// The state for a stream, or the empty slot it would go in. NULL if there are no slots yet
+static decoder_thread_state_t **stream_slot(const event_decoder_t *decoder, uint32_t stream_id) {
+    if (decoder->stream_capacity == 0) {
+        return NULL;
+    }
+
+    size_t index = stream_index(stream_id, decoder->stream_capacity);
+    while (decoder->streams[index] != NULL && decoder->streams[index]->stream_id != stream_id) {
+        index = (index + 1) & (decoder->stream_capacity - 1);
+    }
+    return &decoder->streams[index];
+}
+
+// Read the stream id a record starts with and find its state. NULL if the id is malformed or its stream hasn't begun
+static decoder_thread_state_t *read_stream(const event_decoder_t *decoder, const uint8_t **cursor, const uint8_t *end) {
+    uint64_t stream_id = 0;
+    if (!protocol_read_varint(cursor, end, &stream_id) || stream_id > UINT32_MAX) {
+        return NULL;
+    }
+
+    decoder_thread_state_t **slot = stream_slot(decoder, (uint32_t)stream_id);
+    return slot ? *slot : NULL;
+}
+
+static const char *lookup_string(const decoder_thread_state_t *state, const uint8_t **cursor, const uint8_t *end) {
+    uint64_t id = 0;
+    if (!protocol_read_varint(cursor, end, &id) || id == 0 || id >= state->string_capacity) {
+        return NULL;
+    }
+    return state->strings[id];
+}
+
+static kern_return_t decode_dropped(event_decoder_t *decoder, const uint8_t *cursor, const uint8_t *end) {
+    uint64_t count = 0;
+    if (!protocol_read_varint(&cursor, end, &count)) {
+        return KERN_FAILURE;
+    }
+
+    if (decoder->dropped_callback) {
+        decoder->dropped_callback(count, decoder->dropped_context);
+    }
+    return KERN_SUCCESS;
+}
+
+static kern_return_t decode_main_thread(event_decoder_t *decoder, const uint8_t *cursor, const uint8_t *end) {
+    uint64_t thread = 0;
+    if (!protocol_read_varint(&cursor, end, &thread) || thread > UINT16_MAX) {
+        return KERN_FAILURE;
+    }
+
+    if (decoder->main_thread_callback) {
+        decoder->main_thread_callback((uint16_t)thread, decoder->main_thread_context);
+    }
+    return KERN_SUCCESS;
+}
+
+static kern_return_t decode_thread_begin(event_decoder_t *decoder, const uint8_t *cursor, const uint8_t *end) {
+    uint64_t stream_id = 0;
+    uint64_t thread = 0;
+    if (!protocol_read_varint(&cursor, end, &stream_id)) {
+        return KERN_FAILURE;
+    }
+
+    // Version 1 streams are named by their thread id, and say nothing else
+    if (decoder->version == 1) {
+        thread = stream_id;
+    }
+    else if (!protocol_read_varint(&cursor, end, &thread)) {
+        return KERN_FAILURE;
+    }
+
+    if (stream_id > UINT32_MAX || thread > UINT16_MAX) {
+        return KERN_FAILURE;
+    }
+
+    if ((decoder->stream_count + 1) * 2 > decoder->stream_capacity && !grow_streams(decoder)) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    decoder_thread_state_t **slot = stream_slot(decoder, (uint32_t)stream_id);
+    decoder_thread_state_t *state = *slot;
+    if (state == NULL) {
+        state = calloc(1, sizeof(decoder_thread_state_t));
+        if (state == NULL) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+        state->stream_id = (uint32_t)stream_id;
+        *slot = state;
+        decoder->stream_count++;
+    }
+    state->thread_id = (uint16_t)thread;
+
+    // Keep the allocation, but forget the old dictionary
+    if (state->strings) {
+        memset(state->strings, 0, state->string_capacity * sizeof(const char *));
+    }
+    state->last_trace_depth = 0;
+    state->last_real_depth = 0;
+    state->last_timestamp = 0;
+    return KERN_SUCCESS;
+}
+
+static kern_return_t decode_string(event_decoder_t *decoder, const uint8_t *cursor, const uint8_t *end) {
+    uint64_t id = 0;
+    decoder_thread_state_t *state = read_stream(decoder, &cursor, end);
+    if (state == NULL || !protocol_read_varint(&cursor, end, &id) || id == 0 || id >= EVENT_DECODER_MAX_STRING_ID) {
+        return KERN_FAILURE;
+    }
+
+    if (id >= state->string_capacity) {
+        uint32_t new_capacity = state->string_capacity ? state->string_capacity : 256;
+        while (new_capacity <= id) {
+            new_capacity *= 2;
+        }
+
+        const char **new_strings = realloc(state->strings, new_capacity * sizeof(const char *));
+        if (new_strings == NULL) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+        memset(new_strings + state->string_capacity, 0, (new_capacity - state->string_capacity) * sizeof(const char *));
+        state->strings = new_strings;
+        state->string_capacity = new_capacity;
+    }
+
+    const char *str = intern_string(cursor, end - cursor);
+    if (str == NULL) {
+        return KERN_FAILURE;
+    }
+    state->strings[id] = str;
+    return KERN_SUCCESS;
+}
+
+static kern_return_t decode_event(event_decoder_t *decoder, const uint8_t *cursor, const uint8_t *end, event_decoder_callback_t callback, void *context) {
+    decoder_thread_state_t *state = read_stream(decoder, &cursor, end);
+    if (state == NULL || cursor >= end) {
+        return KERN_FAILURE;
+    }
+
+    uint8_t flags = *cursor++;
+    tracer_event_t event = {
+        .thread_id = state->thread_id,
+        .stream_id = state->stream_id,
+        .is_class_method = (flags & EVENT_FLAG_CLASS_METHOD) != 0,
+    };
+
+    uint64_t trace_depth_delta = 0;
+    uint64_t real_depth_delta = 0;
+    uint64_t timestamp_delta = 0;
+    event.class_name = lookup_string(state, &cursor, end);
+    event.method_name = lookup_string(state, &cursor, end);
+    if (event.class_name == NULL || event.method_name == NULL ||
+        !protocol_read_varint(&cursor, end, &trace_depth_delta) ||
+        !protocol_read_varint(&cursor, end, &real_depth_delta) ||
+        !protocol_read_varint(&cursor, end, &timestamp_delta)) {
+        return KERN_FAILURE;
+    }
+
+    event.trace_depth = (uint32_t)(state->last_trace_depth + protocol_zigzag_decode(trace_depth_delta));
+    event.real_depth = (uint32_t)(state->last_real_depth + protocol_zigzag_decode(real_depth_delta));
+    event.timestamp = state->last_timestamp + (uint64_t)protocol_zigzag_decode(timestamp_delta);
+
+    if (flags & EVENT_FLAG_HAS_SIGNATURE) {
+        event.method_signature = lookup_string(state, &cursor, end);
+        if (event.method_signature == NULL) {
+            return KERN_FAILURE;
+        }
+    }
+
+    if (flags & EVENT_FLAG_HAS_ARGUMENTS) {
+        uint64_t argument_count = 0;
+        // Every argument takes at least 4 bytes, which bounds the count by what's left of the record
+        if (!protocol_read_varint(&cursor, end, &argument_count) || argument_count > (uint64_t)(end - cursor) / 4) {
+            return KERN_FAILURE;
+        }
+
+        if (argument_count > decoder->argument_capacity) {
+            tracer_argument_t *arguments = realloc(decoder->arguments, argument_count * sizeof(tracer_argument_t));
+            if (arguments == NULL) {
+                return KERN_RESOURCE_SHORTAGE;
+            }
+            decoder->arguments = arguments;
+
+            size_t *offsets = realloc(decoder->description_offsets, argument_count * sizeof(size_t));
+            if (offsets == NULL) {
+                return KERN_RESOURCE_SHORTAGE;
+            }
+            decoder->description_offsets = offsets;
+            decoder->argument_capacity = argument_count;
+        }
+
+        output_buffer_reset(&decoder->descriptions);
+        for (size_t i = 0; i < argument_count; i++) {
+            tracer_argument_t *arg = &decoder->arguments[i];
+            memset(arg, 0, sizeof(tracer_argument_t));
+            decoder->description_offsets[i] = SIZE_MAX;
+
+            uint64_t address = 0;
+            uint64_t size = 0;
+            if (cursor >= end) {
+                return KERN_FAILURE;
+            }
+            uint8_t arg_flags = *cursor++;
+            arg->type_encoding = lookup_string(state, &cursor, end);
+            if (arg->type_encoding == NULL || !protocol_read_varint(&cursor, end, &address) || !protocol_read_varint(&cursor, end, &size)) {
+                return KERN_FAILURE;
+            }
+            arg->address = (void *)(uintptr_t)address;
+            arg->size = (size_t)size;
+
+            if (arg_flags & EVENT_ARG_FLAG_HAS_CLASS) {
+                arg->objc_class_name = lookup_string(state, &cursor, end);
+                if (arg->objc_class_name == NULL) {
+                    return KERN_FAILURE;
+                }
+            }
+
+            if (arg_flags & EVENT_ARG_FLAG_HAS_BLOCK_SIGNATURE) {
+                arg->block_signature = lookup_string(state, &cursor, end);
+                if (arg->block_signature == NULL) {
+                    return KERN_FAILURE;
+                }
+            }
+
+            if (arg_flags & EVENT_ARG_FLAG_HAS_DESCRIPTION) {
+                uint64_t description_length = 0;
+                if (!protocol_read_varint(&cursor, end, &description_length) || description_length > (uint64_t)(end - cursor)) {
+                    return KERN_FAILURE;
+                }
+
+                // Descriptions need terminating, and the buffer may move as it grows, so pointers are set once it's complete
+                decoder->description_offsets[i] = decoder->descriptions.length;
+                output_buffer_append(&decoder->descriptions, (const char *)cursor, (size_t)description_length);
+                output_buffer_append_char(&decoder->descriptions, '\0');
+                cursor += description_length;
+            }
+        }
+
+        if (decoder->descriptions.failed) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+
+        for (size_t i = 0; i < argument_count; i++) {
+            if (decoder->description_offsets[i] != SIZE_MAX) {
+                decoder->arguments[i].description = decoder->descriptions.data + decoder->description_offsets[i];
+            }
+        }
+        event.arguments = decoder->arguments;
+        event.argument_count = (size_t)argument_count;
+    }
+
+    state->last_trace_depth = event.trace_depth;
+    state->last_real_depth = event.real_depth;
+    state->last_timestamp = event.timestamp;
+
+    if (callback) {
+        callback(&event, context);
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t event_decoder_decode(event_decoder_t *decoder, const uint8_t *data, size_t length, size_t *out_consumed, event_decoder_callback_t callback, void *context) {
+    if (decoder == NULL || (data == NULL && length > 0) || out_consumed == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    const uint8_t *position = data;
+    const uint8_t *end = data + length;
+    *out_consumed = 0;
+
+    if (!decoder->read_preamble) {
+        if (length < EVENT_PROTOCOL_PREAMBLE_LENGTH) {
+            // Reject a bad prefix early rather than waiting for the rest of it
+            size_t available = length < EVENT_PROTOCOL_MAGIC_LENGTH ? length : EVENT_PROTOCOL_MAGIC_LENGTH;
+            return memcmp(data, EVENT_PROTOCOL_MAGIC, available) == 0 ? KERN_SUCCESS : KERN_INVALID_ARGUMENT;
+        }
+
+        uint8_t version = data[EVENT_PROTOCOL_MAGIC_LENGTH];
+        if (memcmp(data, EVENT_PROTOCOL_MAGIC, EVENT_PROTOCOL_MAGIC_LENGTH) != 0 || version < EVENT_PROTOCOL_MIN_VERSION || version > EVENT_PROTOCOL_VERSION) {
+            return KERN_INVALID_ARGUMENT;
+        }
+
+        decoder->read_preamble = true;
+        decoder->version = version;
+        position += EVENT_PROTOCOL_PREAMBLE_LENGTH;
+        *out_consumed = EVENT_PROTOCOL_PREAMBLE_LENGTH;
+    }
+
+    while (position < end) {
+        const uint8_t *cursor = position;
+        uint64_t record_length = 0;
+        if (!protocol_read_varint(&cursor, end, &record_length)) {
+            // A complete varint is at most 10 bytes. Fewer than that may just be a partial read
+            return end - position >= 10 ? KERN_FAILURE : KERN_SUCCESS;
+        }
+
+        if (record_length == 0 || record_length > EVENT_PROTOCOL_MAX_RECORD_LENGTH) {
+            return KERN_FAILURE;
+        }
+
+        if ((uint64_t)(end - cursor) < record_length) {
+            // Wait for the rest of the record
+            return KERN_SUCCESS;
+        }
+
+        const uint8_t *record_end = cursor + record_length;
+        uint8_t type = *cursor++;
+        kern_return_t kr = KERN_SUCCESS;
+        switch (type) {
+            case EVENT_RECORD_THREAD_BEGIN:
+                kr = decode_thread_begin(decoder, cursor, record_end);
+                break;
+            case EVENT_RECORD_STRING:
+                kr = decode_string(decoder, cursor, record_end);
+                break;
+            case EVENT_RECORD_EVENT:
+                kr = decode_event(decoder, cursor, record_end, callback, context);
+                break;
+            case EVENT_RECORD_DROPPED:
+                kr = decode_dropped(decoder, cursor, record_end);
+                break;
+            case EVENT_RECORD_MAIN_THREAD:
+                kr = decode_main_thread(decoder, cursor, record_end);
+                break;
+            default:
+                // Unknown record types are skipped
+                break;
+        }
+
+        if (kr != KERN_SUCCESS) {
+            return kr;
+        }
+
+        position = record_end;
+        *out_consumed = position - data;
+    }
+
+    return KERN_SUCCESS;
+}
@@ -0,0 +1,333 @@
+//
+//  event_encoder.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/5/25.
+//
+
+#include <stdatomic.h>
+#include "event_protocol.h"
+
+#define EVENT_STRING_TABLE_MIN_CAPACITY 256
+// Start a fresh dictionary once a thread has defined this many strings, to bound per-thread memory
+#define EVENT_ENCODER_MAX_STRINGS 65536
+
+// 0 is never handed out, it marks an encoder that hasn't been given an ID
+static _Atomic(uint32_t) last_stream_id = 0;
+
+uint32_t event_encoder_next_stream_id(void) {
+    return atomic_fetch_add_explicit(&last_stream_id, 1, memory_order_relaxed) + 1;
+}
+
+static size_t protocol_varint_size(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static uint64_t content_key(const char *str, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 1099511628211ULL;
+    }
+    // 0 marks an empty slot
+    return hash | 1;
+}
+
+static size_t string_table_index(const event_string_table_t *table, uintptr_t key) {
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctzl(table->capacity)));
+}
+
+static uint32_t string_table_lookup(const event_string_table_t *table, uintptr_t key, const char *str, size_t length, bool by_content) {
+    if (table->capacity == 0) {
+        return 0;
+    }
+
+    size_t index = string_table_index(table, key);
+    for (size_t probes = 0; probes < table->capacity; probes++) {
+        const event_string_table_entry_t *entry = &table->entries[index];
+        if (entry->key == 0) {
+            return 0;
+        }
+
+        if (entry->key == key && (!by_content || (entry->length == length && memcmp(entry->copy, str, length) == 0))) {
+            return entry->id;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+    return 0;
+}
+
+static void string_table_place(event_string_table_t *table, event_string_table_entry_t entry) {
+    size_t index = string_table_index(table, entry.key);
+    while (table->entries[index].key != 0) {
+        index = (index + 1) & (table->capacity - 1);
+    }
+    table->entries[index] = entry;
+    table->count++;
+}
+
+static bool string_table_insert(event_string_table_t *table, event_string_table_entry_t entry) {
+    // Keep the load factor at or below 1/2
+    if ((table->count + 1) * 2 > table->capacity) {
+        size_t new_capacity = table->capacity ? table->capacity * 2 : EVENT_STRING_TABLE_MIN_CAPACITY;
+        event_string_table_entry_t *new_entries = calloc(new_capacity, sizeof(event_string_table_entry_t));
+        if (new_entries == NULL) {
+            return false;
+        }
+
+        event_string_table_t grown = { .entries = new_entries, .capacity = new_capacity, .count = 0 };
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->entries[i].key != 0) {
+                string_table_place(&grown, table->entries[i]);
+            }
+        }
+        free(table->entries);
+        *table = grown;
+    }
+
+    string_table_place(table, entry);
+    return true;
+}
+
+static void string_table_free(event_string_table_t *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->entries[i].copy);
+    }
+    free(table->entries);
+    memset(table, 0, sizeof(event_string_table_t));
+}
+
+void event_encoder_free(event_encoder_t *encoder) {
+    if (encoder == NULL) {
+        return;
+    }
+
+    uint32_t stream_id = encoder->stream_id;
+    string_table_free(&encoder->stable_strings);
+    string_table_free(&encoder->content_strings);
+    memset(encoder, 0, sizeof(event_encoder_t));
+    encoder->stream_id = stream_id;
+}
+
+// Prefix the record that starts at record_start with its length
+static void finish_record(output_buffer_t *out, size_t record_start) {
+    if (out->failed) {
+        return;
+    }
+
+    size_t record_length = out->length - record_start;
+    size_t prefix_length = protocol_varint_size(record_length);
+    if (!output_buffer_reserve(out, prefix_length)) {
+        return;
+    }
+
+    uint8_t *record = (uint8_t *)out->data + record_start;
+    memmove(record + prefix_length, record, record_length);
+    for (size_t i = 0; i < prefix_length; i++) {
+        record[i] = (uint8_t)(record_length >> (7 * i)) | (i + 1 < prefix_length ? 0x80 : 0);
+    }
+    out->length += prefix_length;
+    out->data[out->length] = '\0';
+}
+
+static void append_thread_begin(output_buffer_t *out, uint32_t stream_id, uint16_t thread_id) {
+    size_t record_start = out->length;
+    output_buffer_append_char(out, EVENT_RECORD_THREAD_BEGIN);
+    protocol_append_varint(out, stream_id);
+    protocol_append_varint(out, thread_id);
+    finish_record(out, record_start);
+}
+
+/**
+ * @brief Get the thread-local ID for a string, sending its definition first if this thread hasn't used it yet
+ * @return The ID, or 0 if the string could not be added to the dictionary
+ */
+static uint32_t intern_string(event_encoder_t *encoder, const char *str, bool stable, output_buffer_t *out) {
+    size_t length = strlen(str);
+    event_string_table_t *table = stable ? &encoder->stable_strings : &encoder->content_strings;
+    uintptr_t key = stable ? (uintptr_t)str : (uintptr_t)content_key(str, length);
+
+    uint32_t id = string_table_lookup(table, key, str, length, !stable);
+    if (id != 0) {
+        return id;
+    }
+
+    event_string_table_entry_t entry = {
+        .key = key,
+        .id = encoder->next_string_id,
+        .length = (uint32_t)length,
+        .copy = NULL,
+    };
+    if (!stable) {
+        entry.copy = malloc(length + 1);
+        if (entry.copy == NULL) {
+            return 0;
+        }
+        memcpy(entry.copy, str, length + 1);
+    }
+
+    if (!string_table_insert(table, entry)) {
+        free(entry.copy);
+        return 0;
+    }
+    encoder->next_string_id++;
+
+    size_t record_start = out->length;
+    output_buffer_append_char(out, EVENT_RECORD_STRING);
+    protocol_append_varint(out, encoder->stream_id);
+    protocol_append_varint(out, entry.id);
+    output_buffer_append(out, str, length);
+    finish_record(out, record_start);
+    return entry.id;
+}
+
+void append_dropped_record(output_buffer_t *out, uint64_t count) {
+    size_t record_start = out->length;
+    output_buffer_append_char(out, EVENT_RECORD_DROPPED);
+    protocol_append_varint(out, count);
+    finish_record(out, record_start);
+}
+
+void append_main_thread_record(output_buffer_t *out, uint16_t thread_id) {
+    size_t record_start = out->length;
+    output_buffer_append_char(out, EVENT_RECORD_MAIN_THREAD);
+    protocol_append_varint(out, thread_id);
+    finish_record(out, record_start);
+}
+
+void append_event_stream_preamble(output_buffer_t *out) {
+    output_buffer_append(out, EVENT_PROTOCOL_MAGIC, EVENT_PROTOCOL_MAGIC_LENGTH);
+    output_buffer_append_char(out, EVENT_PROTOCOL_VERSION);
+}
+
+static void reset_encoder(event_encoder_t *encoder, uint16_t thread_id, output_buffer_t *out) {
+    event_encoder_free(encoder);
+    if (encoder->stream_id == 0) {
+        encoder->stream_id = event_encoder_next_stream_id();
+    }
+    encoder->started = true;
+    encoder->next_string_id = 1;
+    append_thread_begin(out, encoder->stream_id, thread_id);
+}
+
+kern_return_t append_binary_event(event_encoder_t *encoder, const tracer_event_t *event, output_buffer_t *out) {
+    if (encoder == NULL || event == NULL || out == NULL || event->class_name == NULL || event->method_name == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    size_t start_length = out->length;
+    if (!encoder->started || encoder->next_string_id >= EVENT_ENCODER_MAX_STRINGS) {
+        reset_encoder(encoder, event->thread_id, out);
+    }
+
+    // Definitions must precede the event that uses them, so intern everything first
+    uint32_t class_id = intern_string(encoder, event->class_name, true, out);
+    uint32_t selector_id = intern_string(encoder, event->method_name, true, out);
+    // The tracer hands over a fresh copy of the signature with every event, so it's keyed by content
+    uint32_t signature_id = event->method_signature ? intern_string(encoder, event->method_signature, false, out) : 0;
+    bool interned = class_id != 0 && selector_id != 0 && (event->method_signature == NULL || signature_id != 0);
+
+    size_t argument_count = 0;
+    for (size_t i = 0; i < event->argument_count && event->arguments; i++) {
+        const tracer_argument_t *arg = &event->arguments[i];
+        if (arg->type_encoding == NULL) {
+            continue;
+        }
+
+        // Argument strings are often copies, so they're keyed by content
+        interned &= intern_string(encoder, arg->type_encoding, false, out) != 0;
+        if (arg->objc_class_name) {
+            interned &= intern_string(encoder, arg->objc_class_name, false, out) != 0;
+        }
+        if (arg->block_signature) {
+            interned &= intern_string(encoder, arg->block_signature, false, out) != 0;
+        }
+        argument_count++;
+    }
+
+    uint8_t flags = 0;
+    if (event->is_class_method) {
+        flags |= EVENT_FLAG_CLASS_METHOD;
+    }
+    if (signature_id != 0) {
+        flags |= EVENT_FLAG_HAS_SIGNATURE;
+    }
+    if (argument_count > 0) {
+        flags |= EVENT_FLAG_HAS_ARGUMENTS;
+    }
+
+    size_t record_start = out->length;
+    output_buffer_append_char(out, EVENT_RECORD_EVENT);
+    protocol_append_varint(out, encoder->stream_id);
+    output_buffer_append_char(out, (char)flags);
+    protocol_append_varint(out, class_id);
+    protocol_append_varint(out, selector_id);
+    protocol_append_varint(out, protocol_zigzag_encode((int64_t)event->trace_depth - (int64_t)encoder->last_trace_depth));
+    protocol_append_varint(out, protocol_zigzag_encode((int64_t)event->real_depth - (int64_t)encoder->last_real_depth));
+    protocol_append_varint(out, protocol_zigzag_encode((int64_t)(event->timestamp - encoder->last_timestamp)));
+    if (signature_id != 0) {
+        protocol_append_varint(out, signature_id);
+    }
+
+    if (argument_count > 0) {
+        protocol_append_varint(out, argument_count);
+        for (size_t i = 0; i < event->argument_count; i++) {
+            const tracer_argument_t *arg = &event->arguments[i];
+            if (arg->type_encoding == NULL) {
+                continue;
+            }
+
+            uint8_t arg_flags = 0;
+            if (arg->objc_class_name) {
+                arg_flags |= EVENT_ARG_FLAG_HAS_CLASS;
+            }
+            if (arg->block_signature) {
+                arg_flags |= EVENT_ARG_FLAG_HAS_BLOCK_SIGNATURE;
+            }
+            if (arg->description) {
+                arg_flags |= EVENT_ARG_FLAG_HAS_DESCRIPTION;
+            }
+
+            // These lookups hit, the strings were interned above
+            output_buffer_append_char(out, (char)arg_flags);
+            protocol_append_varint(out, intern_string(encoder, arg->type_encoding, false, out));
+            protocol_append_varint(out, (uint64_t)(uintptr_t)arg->address);
+            protocol_append_varint(out, arg->size);
+            if (arg->objc_class_name) {
+                protocol_append_varint(out, intern_string(encoder, arg->objc_class_name, false, out));
+            }
+            if (arg->block_signature) {
+                protocol_append_varint(out, intern_string(encoder, arg->block_signature, false, out));
+            }
+            if (arg->description) {
+                size_t description_length = strlen(arg->description);
+                protocol_append_varint(out, description_length);
+                output_buffer_append(out, arg->description, description_length);
+            }
+        }
+    }
+    finish_record(out, record_start);
+
+    if (!interned || out->failed) {
+        // Some definitions may not have made it into the output. Start over with a fresh dictionary
+        // on the next event rather than referring to IDs the consumer never saw
+        out->length = start_length;
+        // A buffer over someone else's memory stays failed, so none of this event can be committed from it
+        out->failed = out->fixed;
+        if (out->data && start_length < out->capacity) {
+            out->data[start_length] = '\0';
+        }
+        event_encoder_free(encoder);
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    encoder->last_trace_depth = event->trace_depth;
+    encoder->last_real_depth = event->real_depth;
+    encoder->last_timestamp = event->timestamp;
+    return KERN_SUCCESS;
+}
@@ -11,87 +11,63 @@
 #include "format.h"
 #include "tracer.h"
 
-typedef struct {
-    char **buffers;
-    bool *in_use;
-    size_t size;
-    size_t capacity;
-    pthread_mutex_t lock;
-} event_buffer_pool_t;
-
-static event_buffer_pool_t *buffer_pool = NULL;
-
-static event_buffer_pool_t *get_buffer_pool(void) {
-    if (buffer_pool == NULL) {
-        buffer_pool = calloc(1, sizeof(event_buffer_pool_t));
-        if (buffer_pool == NULL) {
-            return NULL;
+/**
+ * @brief Write an event's output in the configured format
+ * @param out_error If not NULL, receives a description of what went wrong on failure
+ */
+static kern_return_t build_event_output(tracer_t *tracer, tracer_thread_context_t *thread_ctx, tracer_event_t *event, const tracer_format_options_t *format, output_buffer_t *output, const char **out_error) {
+    const char *error = NULL;
+    
+    if (format->output_as_binary) {
+        // Raw event data only. Indents, colors and layout are left to the consumer
+        if (append_binary_event(&thread_ctx->encoder, event, output) != KERN_SUCCESS) {
+            error = "Failed to encode an event";
         }
-        
-        buffer_pool->capacity = 2048;
-        buffer_pool->buffers = calloc(buffer_pool->capacity, sizeof(char *));
-        buffer_pool->in_use = calloc(buffer_pool->capacity, sizeof(bool));
-        
-        if (buffer_pool->buffers == NULL || !buffer_pool->in_use) {
-            free(buffer_pool->buffers);
-            free(buffer_pool->in_use);
-            free(buffer_pool);
-            buffer_pool = NULL;
-            return NULL;
-        }
-        
-        pthread_mutex_init(&buffer_pool->lock, NULL);
     }
-
-    return buffer_pool;
-}
-
-static char *get_buffer_from_pool(void) {
-    event_buffer_pool_t *pool = get_buffer_pool();
-    if (pool == NULL) {
-        return NULL;
+    else if (!format->include_event_json && format->include_formatted_trace && !format->output_as_json) {
+        // Json is disabled, formatted trace is enabled.
+        // Build the string then write it directly to the transport
+        if (append_formatted_event(event, format, output) != KERN_SUCCESS) {
+            error = "Failed to build formatted string for an event";
+        }
     }
-    
-    pthread_mutex_lock(&pool->lock);
-    
-    char *buffer = NULL;
-    for (size_t i = 0; i < pool->size; i++) {
-        if (!pool->in_use[i]) {
-            pool->in_use[i] = true;
-            buffer = pool->buffers[i];
-            break;
+    else if (format->output_as_json) {
+        // Json is enabled. Build the json string for the event, then write it to the transport.
+        // It may include a formatted string field depending on format options
+        kern_return_t kr = KERN_FAILURE;
+        WHILE_IGNORING_SIGNALS({
+            kr = append_json_event(tracer, event, output, &thread_ctx->scratch_buffer);
+        });
+        
+        if (kr != KERN_SUCCESS) {
+            error = "Failed to build json string for an event";
         }
     }
     
-    if (buffer == NULL && pool->size < pool->capacity) {
-        buffer = malloc(1024 * 4);
-        if (buffer) {
-            pool->buffers[pool->size] = buffer;
-            pool->in_use[pool->size] = true;
-            pool->size++;
-        }
+    if (error == NULL && output->length == 0) {
+        error = "Failed to build event output. No data to send to transport";
     }
     
-    pthread_mutex_unlock(&pool->lock);
-    return buffer;
-}
-
-static void return_buffer_to_pool(char *buffer) {
-    event_buffer_pool_t *pool = get_buffer_pool();
-    if (pool == NULL) {
-        return;
+    if (error == NULL && !format->output_as_binary && output->data[output->length - 1] != '\n') {
+        output_buffer_append_char(output, '\n');
     }
     
-    pthread_mutex_lock(&pool->lock);
+    if (error == NULL && output->failed) {
+        error = "Failed to allocate event output buffer";
+    }
     
-    for (size_t i = 0; i < pool->size; i++) {
-        if (pool->buffers[i] == buffer) {
-            pool->in_use[i] = false;
-            break;
+    if (error) {
+        if (out_error) {
+            *out_error = error;
         }
+        return KERN_FAILURE;
     }
     
-    pthread_mutex_unlock(&pool->lock);
+    if (!format->output_as_json && !format->output_as_binary) {
+        // Borrowed from the output buffer. Only valid until this thread handles its next event
+        event->formatted_output = output->data;
+    }
+    return KERN_SUCCESS;
 }
 
 void tracer_handle_event(tracer_t *tracer, tracer_event_t *event) {
@@ -122,84 +98,69 @@ void tracer_handle_event(tracer_t *tracer, tracer_event_t *event) {
         format.include_formatted_trace = false;
     }
     
-    const char *event_transport_output = NULL;
-    if (!format.include_event_json && format.include_formatted_trace && !format.output_as_json) {
-        // Json is disabled, formatted trace is enabled.
-        // Build the string then write it directly to the transport
-        event_transport_output = build_formatted_event_str(event, format);
-        if (event_transport_output == NULL) {
-            tracer_set_error(tracer, "Failed to build formatted string for an event");
-            return;
-        }
-        
-        event->formatted_output = strdup(event_transport_output);
+    if (!transport_admit_event(tracer, thread_ctx)) {
+        // Dropped by the backpressure policy before any work is spent formatting it
+        return;
     }
-    else if (format.output_as_json) {
-        // Json is enabled. Build the json string for the event, then write it to the transport.
-        // It may include a formatted string field depending on format options
-        WHILE_IGNORING_SIGNALS({
-            event_transport_output = build_json_event_str(tracer, event);
-        });
-        
-        if (event_transport_output == NULL) {
-            tracer_set_error(tracer, "Failed to build json string for an event");
+    
+    // Format straight into the thread's transport ring when there is one, so nothing is copied on the way out
+    output_buffer_t ring_output;
+    if (transport_begin_event(tracer, thread_ctx, &ring_output) == TRACER_SUCCESS) {
+        if (build_event_output(tracer, thread_ctx, event, &format, &ring_output, NULL) == KERN_SUCCESS) {
+            transport_commit_event(tracer, thread_ctx, &ring_output);
             return;
         }
+        // Not enough free space in the ring. Build it on the side and let transport_send wait for room
     }
     
-    if (event_transport_output == NULL) {
-        tracer_set_error(tracer, "Failed to build event output. No data to send to transport");
-        return;
-    }
+    // The thread's buffer is reused for every event, so steady-state formatting doesn't allocate.
+    // transport_send copies what it needs, so the buffer is free again as soon as it returns
+    output_buffer_t *output = &thread_ctx->output_buffer;
+    output_buffer_reset(output);
     
-    char *buffer = get_buffer_from_pool();
-    if (buffer == NULL) {
-        tracer_set_error(tracer, "Event buffer pool exhausted");
+    const char *error = NULL;
+    if (build_event_output(tracer, thread_ctx, event, &format, output, &error) != KERN_SUCCESS) {
+        tracer_set_error(tracer, "%s", error);
         return;
     }
     
-    size_t output_len = strlen(event_transport_output);
-    if (output_len > 0 && event_transport_output[output_len - 1] != '\n') {
-        snprintf(buffer, 4096, "%s\n", event_transport_output);
-    }
-    else {
-        strncpy(buffer, event_transport_output, 4096);
-    }
-    
-    free((void *)event_transport_output);
-    
-    transport_send(tracer, buffer, output_len + 1);
-    return_buffer_to_pool(buffer);
+    transport_send(tracer, output->data, output->length);
 }
 
-void cleanup_event_handler(void) {
-    if (buffer_pool == NULL) {
-        return;
+tracer_result_t send_event_stream_header(tracer_t *tracer) {
+    if (tracer == NULL) {
+        return TRACER_ERROR_INVALID_ARGUMENT;
     }
     
-    pthread_mutex_lock(&buffer_pool->lock);
-    if (buffer_pool->buffers) {
-        for (size_t i = 0; i < buffer_pool->size; i++) {
-            free(buffer_pool->buffers[i]);
-        }
-        free(buffer_pool->buffers);
+    if (!tracer->config.format.output_as_binary || tracer->config.transport == TRACER_TRANSPORT_CUSTOM) {
+        return TRACER_SUCCESS;
     }
     
-    if (buffer_pool->in_use) {
-        free(buffer_pool->in_use);
+    output_buffer_t preamble = {0};
+    append_event_stream_preamble(&preamble);
+    // So consumers don't have to guess which thread is main from whichever one traced first
+    uint64_t main_thread_id = 0;
+    if (pthread_threadid_np(pthread_main_thread_np(), &main_thread_id) == 0) {
+        append_main_thread_record(&preamble, (uint16_t)(main_thread_id ^ (main_thread_id >> 32)));
+    }
+    if (preamble.failed) {
+        output_buffer_free(&preamble);
+        return TRACER_ERROR_MEMORY;
     }
     
-    pthread_mutex_unlock(&buffer_pool->lock);
-    pthread_mutex_destroy(&buffer_pool->lock);
-    free(buffer_pool);
-    buffer_pool = NULL;
+    // Written ahead of the transport's rings, so it precedes every event from every thread
+    tracer_result_t result = transport_write_direct(tracer, preamble.data, preamble.length);
+    output_buffer_free(&preamble);
+    return result;
+}
+
+void cleanup_event_handler(void) {
+    // Output buffers are owned by each thread's tracer context and released with it
 }
 
 tracer_result_t init_event_handler(tracer_t *tracer) {
-    event_buffer_pool_t *pool = get_buffer_pool();
-    if (pool == NULL) {
-        tracer_set_error(tracer, "Failed to initialize event buffer pool");
-        return TRACER_ERROR_INITIALIZATION;
+    if (tracer == NULL) {
+        return TRACER_ERROR_INVALID_ARGUMENT;
     }
 
     return TRACER_SUCCESS;
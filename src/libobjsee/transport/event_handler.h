@@ -9,6 +9,12 @@
 
 void tracer_handle_event(tracer_t *tracer, tracer_event_t *event);
 
+/**
+ * @brief Send the binary protocol preamble, if the tracer is configured for binary output
+ * @note Must be called once the transport is up and before any events are handled
+ */
+tracer_result_t send_event_stream_header(tracer_t *tracer);
+
 void cleanup_event_handler(void);
 tracer_result_t init_event_handler(tracer_t *tracer);
 
@@ -0,0 +1,255 @@
+//
+//  event_protocol.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/5/25.
+//
+
+#ifndef EVENT_PROTOCOL_H
+#define EVENT_PROTOCOL_H
+
+#include <mach/mach.h>
+#include "tracer_types.h"
+#include "output_buffer.h"
+
+/*
+    Compact binary event protocol
+
+    The stream starts with an 8 byte preamble: EVENT_PROTOCOL_MAGIC followed by a version byte.
+    Everything after it is a sequence of records:
+
+        varint length       Length of everything after this field
+        u8 type             EVENT_RECORD_*
+        payload
+
+    Records of unknown types are skipped, so new record types don't break older consumers.
+
+    Each sending thread writes its own stream, named by a stream ID that is unique for the life of the
+    process. Thread IDs are a 16 bit hash of the system thread ID, so two threads can share one; stream IDs
+    can't collide, and are what everything per-thread is keyed on, by the decoder and by consumers.
+
+    Class names, selectors, type encodings and other repeated strings are sent once as STRING records
+    and referred to by varint IDs afterwards. Dictionaries are scoped to the stream, so records from
+    different threads can be interleaved (or reordered) without a string being used before it's defined.
+    Depths and timestamps are delta-encoded against the previous event in the same stream.
+
+    THREAD_BEGIN    varint stream, varint thread    Reset the stream's dictionary and delta state, and give its thread ID
+    STRING          varint stream, varint id, bytes Define a string in the stream's dictionary
+    DROPPED         varint count                    That many events were dropped because the consumer fell behind
+    MAIN_THREAD     varint thread                   The thread ID of the traced process's main thread. Sent after the preamble
+    EVENT           varint stream
+                    u8 flags                        EVENT_FLAG_*
+                    varint class id
+                    varint selector id
+                    zigzag trace depth delta
+                    zigzag real depth delta
+                    zigzag timestamp delta          Nanoseconds
+                    [varint signature id]           If EVENT_FLAG_HAS_SIGNATURE
+                    [varint argument count          If EVENT_FLAG_HAS_ARGUMENTS
+                     arguments...]
+
+    Each argument:  u8 flags                        EVENT_ARG_FLAG_*
+                    varint type encoding id
+                    varint address
+                    varint size
+                    [varint class name id]          If EVENT_ARG_FLAG_HAS_CLASS
+                    [varint block signature id]     If EVENT_ARG_FLAG_HAS_BLOCK_SIGNATURE
+                    [varint length, bytes]          If EVENT_ARG_FLAG_HAS_DESCRIPTION
+
+    Indentation, colors and layout are left to the consumer.
+
+    Version 1 streams had no stream IDs: records carried the thread ID where the stream ID is now, and
+    THREAD_BEGIN had nothing after it. They're still decoded, with each thread ID taken as a stream ID.
+*/
+
+#define EVENT_PROTOCOL_MAGIC "\0OBJSEE"
+#define EVENT_PROTOCOL_MAGIC_LENGTH 7
+#define EVENT_PROTOCOL_VERSION 2
+// Oldest version a decoder still accepts
+#define EVENT_PROTOCOL_MIN_VERSION 1
+#define EVENT_PROTOCOL_PREAMBLE_LENGTH (EVENT_PROTOCOL_MAGIC_LENGTH + 1)
+
+// Largest record a decoder will accept. Anything bigger is treated as corruption
+#define EVENT_PROTOCOL_MAX_RECORD_LENGTH (16 * 1024 * 1024)
+
+typedef enum {
+    EVENT_RECORD_THREAD_BEGIN = 1,
+    EVENT_RECORD_STRING = 2,
+    EVENT_RECORD_EVENT = 3,
+    EVENT_RECORD_DROPPED = 4,
+    EVENT_RECORD_MAIN_THREAD = 5,
+} event_record_type_t;
+
+#define EVENT_FLAG_CLASS_METHOD         (1 << 0)
+#define EVENT_FLAG_HAS_SIGNATURE        (1 << 1)
+#define EVENT_FLAG_HAS_ARGUMENTS        (1 << 2)
+
+#define EVENT_ARG_FLAG_HAS_CLASS            (1 << 0)
+#define EVENT_ARG_FLAG_HAS_BLOCK_SIGNATURE  (1 << 1)
+#define EVENT_ARG_FLAG_HAS_DESCRIPTION      (1 << 2)
+
+static inline void protocol_append_varint(output_buffer_t *out, uint64_t value) {
+    uint8_t bytes[10];
+    size_t count = 0;
+    while (value >= 0x80) {
+        bytes[count++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[count++] = (uint8_t)value;
+    output_buffer_append(out, (const char *)bytes, count);
+}
+
+static inline uint64_t protocol_zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t protocol_zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * @brief Read a varint, advancing cursor past it
+ * @return false if the varint is truncated or longer than 10 bytes
+ */
+static inline bool protocol_read_varint(const uint8_t **cursor, const uint8_t *end, uint64_t *out_value) {
+    uint64_t value = 0;
+    const uint8_t *position = *cursor;
+    for (unsigned int shift = 0; shift < 70 && position < end; shift += 7) {
+        uint8_t byte = *position++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *cursor = position;
+            *out_value = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+typedef struct {
+    uintptr_t key;
+    uint32_t id;
+    uint32_t length;
+    char *copy;
+} event_string_table_entry_t;
+
+typedef struct {
+    event_string_table_entry_t *entries;
+    size_t capacity;
+    size_t count;
+} event_string_table_t;
+
+/**
+ * @brief Per-thread encoder state. Zero-initialize before first use
+ */
+typedef struct {
+    // The stream this encoder writes. Given the next unused ID on first use if it's still 0
+    uint32_t stream_id;
+    bool started;
+    uint32_t next_string_id;
+    // Strings owned by the runtime (class names and selectors) are keyed by pointer
+    event_string_table_t stable_strings;
+    // Everything else is keyed by content
+    event_string_table_t content_strings;
+    uint32_t last_trace_depth;
+    uint32_t last_real_depth;
+    uint64_t last_timestamp;
+} event_encoder_t;
+
+
+/**
+ * @brief Take a stream ID no other encoder in the process has
+ */
+uint32_t event_encoder_next_stream_id(void);
+
+
+/**
+ * @brief Append the stream preamble. This must be sent once, before any records
+ */
+void append_event_stream_preamble(output_buffer_t *out);
+
+
+/**
+ * @brief Encode an event, along with definitions for any strings the thread hasn't sent yet
+ *
+ * @param encoder The calling thread's encoder
+ * @param event The event to encode. Its stream ID is ignored, the encoder's own is sent
+ * @param out The buffer to append records to
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT, or KERN_RESOURCE_SHORTAGE if a buffer could not grow
+ * @note The encoder must only be used by one thread. On failure the encoder is reset so no record
+ * can refer to a definition that was never sent
+ */
+kern_return_t append_binary_event(event_encoder_t *encoder, const tracer_event_t *event, output_buffer_t *out);
+
+
+/**
+ * @brief Append a record reporting that `count` events were dropped
+ * @note Doesn't depend on any thread's encoder state, so it can be sent from any thread
+ */
+void append_dropped_record(output_buffer_t *out, uint64_t count);
+
+
+/**
+ * @brief Append a record naming the traced process's main thread
+ * @param thread_id The main thread's ID, hashed the same way as event thread IDs
+ */
+void append_main_thread_record(output_buffer_t *out, uint16_t thread_id);
+
+
+/**
+ * @brief Release an encoder's dictionaries. Its stream ID is kept, so its next event starts the same stream over
+ */
+void event_encoder_free(event_encoder_t *encoder);
+
+
+typedef struct event_decoder event_decoder_t;
+
+/**
+ * @brief Called for each decoded event
+ * @note The event and everything it points to is only valid for the duration of the call, except for strings
+ * from the dictionary (class, method, signature, type encodings, argument class names and block signatures).
+ * Those are interned and live for the lifetime of the process, so they can be used as cache keys
+ */
+typedef void (*event_decoder_callback_t)(const tracer_event_t *event, void *context);
+
+/**
+ * @brief Called when the sender reports that events were dropped
+ */
+typedef void (*event_decoder_dropped_callback_t)(uint64_t count, void *context);
+
+/**
+ * @brief Called when the sender says which thread is its main thread
+ */
+typedef void (*event_decoder_main_thread_callback_t)(uint16_t thread_id, void *context);
+
+event_decoder_t *event_decoder_create(void);
+void event_decoder_free(event_decoder_t *decoder);
+
+/**
+ * @brief Set the callback for DROPPED records. They're skipped if there isn't one
+ */
+void event_decoder_set_dropped_callback(event_decoder_t *decoder, event_decoder_dropped_callback_t callback, void *context);
+
+/**
+ * @brief Set the callback for MAIN_THREAD records. They're skipped if there isn't one
+ */
+void event_decoder_set_main_thread_callback(event_decoder_t *decoder, event_decoder_main_thread_callback_t callback, void *context);
+
+
+/**
+ * @brief Decode as many complete records as are available
+ *
+ * @param decoder The decoder
+ * @param data Stream bytes, starting at the first byte not yet consumed
+ * @param length Number of bytes available
+ * @param out_consumed Receives the number of bytes consumed. Unconsumed bytes belong to an incomplete record
+ * and must be passed again once more data has arrived
+ * @param callback Called for each event
+ * @param context Passed to callback
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the stream doesn't start with a supported preamble,
+ * or KERN_FAILURE if the stream is corrupt
+ */
+kern_return_t event_decoder_decode(event_decoder_t *decoder, const uint8_t *data, size_t length, size_t *out_consumed, event_decoder_callback_t callback, void *context);
+
+#endif // EVENT_PROTOCOL_H
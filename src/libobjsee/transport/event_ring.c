@@ -0,0 +1,83 @@
+//
+//  event_ring.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/6/25.
+//
+
+#include <mach/mach.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event_ring.h"
+
+#define MIRROR_MAPPING_ATTEMPTS 3
+
+// Map `capacity` bytes twice, back to back
+static char *allocate_mirrored_region(size_t capacity) {
+    for (int attempt = 0; attempt < MIRROR_MAPPING_ATTEMPTS; attempt++) {
+        vm_address_t address = 0;
+        if (vm_allocate(mach_task_self(), &address, capacity * 2, VM_FLAGS_ANYWHERE) != KERN_SUCCESS) {
+            return NULL;
+        }
+
+        // Free the upper half, then map the lower half into its place
+        vm_address_t mirror = address + capacity;
+        if (vm_deallocate(mach_task_self(), mirror, capacity) != KERN_SUCCESS) {
+            vm_deallocate(mach_task_self(), address, capacity * 2);
+            return NULL;
+        }
+
+        vm_prot_t current_protection = VM_PROT_NONE;
+        vm_prot_t max_protection = VM_PROT_NONE;
+        kern_return_t kr = vm_remap(mach_task_self(), &mirror, capacity, 0, VM_FLAGS_FIXED, mach_task_self(), address, FALSE, &current_protection, &max_protection, VM_INHERIT_DEFAULT);
+        if (kr == KERN_SUCCESS && mirror == address + capacity) {
+            return (char *)address;
+        }
+
+        // Another thread took the freed half before it could be remapped. Try again somewhere else
+        if (kr == KERN_SUCCESS) {
+            vm_deallocate(mach_task_self(), mirror, capacity);
+        }
+        vm_deallocate(mach_task_self(), address, capacity);
+    }
+
+    return NULL;
+}
+
+event_ring_t *event_ring_create(size_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || (capacity % vm_page_size) != 0) {
+        return NULL;
+    }
+
+    // Keep head and tail on their own cache lines
+    event_ring_t *ring = NULL;
+    if (posix_memalign((void **)&ring, 64, sizeof(event_ring_t)) != 0) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(event_ring_t));
+
+    ring->data = allocate_mirrored_region(capacity);
+    if (ring->data == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->in_use, false);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->discarded, 0);
+    atomic_init(&ring->reported, 0);
+    atomic_init(&ring->discard_requested, false);
+    return ring;
+}
+
+void event_ring_destroy(event_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    vm_deallocate(mach_task_self(), (vm_address_t)ring->data, ring->capacity * 2);
+    free(ring);
+}
@@ -0,0 +1,118 @@
+//
+//  event_ring.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/6/25.
+//
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A single-producer, single-consumer byte ring
+ * @note The ring's memory is mapped twice, back to back, so any span of up to `capacity` bytes starting
+ * anywhere in the first mapping is contiguous. Producers can format straight into it and the consumer
+ * can hand it to write() in one piece, without either side handling the wrap
+ */
+typedef struct event_ring {
+    // Written only by the producer
+    _Atomic(uint64_t) head __attribute__((aligned(64)));
+    // Written only by the consumer
+    _Atomic(uint64_t) tail __attribute__((aligned(64)));
+
+    char *data;
+    size_t capacity;
+    // Set while a thread owns the producer side. A released ring can be claimed by a new thread
+    _Atomic(bool) in_use;
+    struct event_ring *next;
+
+    // Backpressure accounting, kept by the transport. Counts are totals since the ring was created
+    _Atomic(uint64_t) dropped;          // Events the producer gave up on
+    _Atomic(uint64_t) discarded;        // Events the consumer threw away unsent, when asked to
+    _Atomic(uint64_t) reported;         // Drops already reported to the consumer
+    // Set by the producer to have the consumer throw away everything unsent. Cleared once that's done
+    _Atomic(bool) discard_requested;
+    // Producer side only
+    bool awaiting_discard;
+    uint32_t sample_count;
+    uint64_t last_report;
+} event_ring_t;
+
+
+/**
+ * @brief Create a ring
+ * @param capacity Size in bytes. Must be a power of two and a multiple of the page size
+ * @return The ring, or NULL if memory could not be mapped
+ */
+event_ring_t *event_ring_create(size_t capacity);
+void event_ring_destroy(event_ring_t *ring);
+
+
+/**
+ * @brief Get the contiguous free space at the producer's position
+ * @param ring The ring
+ * @param out_available Receives the number of bytes that can be written
+ * @return Where to write. Nothing is visible to the consumer until event_ring_commit
+ * @note Producer side only
+ */
+static inline char *event_ring_reserve(event_ring_t *ring, size_t *out_available) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    *out_available = ring->capacity - (size_t)(head - tail);
+    return ring->data + (head & (ring->capacity - 1));
+}
+
+/**
+ * @brief Publish `length` bytes written at the reserved position
+ * @note Producer side only
+ */
+static inline void event_ring_commit(event_ring_t *ring, size_t length) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + length, memory_order_release);
+}
+
+/**
+ * @brief Get everything committed that hasn't been consumed yet
+ * @param ring The ring
+ * @param out_length Receives the number of readable bytes
+ * @return The readable bytes, which are always contiguous
+ * @note Consumer side only
+ */
+static inline const char *event_ring_peek(event_ring_t *ring, size_t *out_length) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    *out_length = (size_t)(head - tail);
+    return ring->data + (tail & (ring->capacity - 1));
+}
+
+/**
+ * @brief Release `length` bytes back to the producer
+ * @note Consumer side only
+ */
+static inline void event_ring_consume(event_ring_t *ring, size_t length) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + length, memory_order_release);
+}
+
+/**
+ * @brief Take ownership of the producer side of a ring that isn't in use
+ * @return true if the caller is now the ring's producer
+ */
+static inline bool event_ring_try_claim(event_ring_t *ring) {
+    bool expected = false;
+    return atomic_compare_exchange_strong_explicit(&ring->in_use, &expected, true, memory_order_acquire, memory_order_relaxed);
+}
+
+/**
+ * @brief Give up the producer side so another thread can claim the ring. Anything committed is still drained
+ */
+static inline void event_ring_release(event_ring_t *ring) {
+    atomic_store_explicit(&ring->in_use, false, memory_order_release);
+}
+
+#endif // EVENT_RING_H
@@ -0,0 +1,496 @@
+//
+//  folded_stacks.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/12/25.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "folded_stacks.h"
+#include "output_buffer.h"
+
+// Deeper events are rejected rather than growing a stack without bound. The tracer stops well short of this
+#define FOLDED_STACKS_MAX_DEPTH 4096
+#define FOLDED_STACKS_MIN_THREADS 64
+// Returned in place of a node when memory ran out
+#define NO_NODE UINT32_MAX
+
+// One distinct call path: a call, and the node for the path it was made from
+typedef struct {
+    // NULL for a stack's open bottom: the calls below `open_depth` on `stream_id` that were running before the
+    // table's first event. These are filled in by merging onto an earlier table
+    const char *class_name;
+    const char *method_name;
+    uint64_t count;
+    // Nanoseconds between each counted call and the next event on its thread
+    uint64_t duration;
+    uint32_t parent;
+    uint32_t open_depth;
+    uint32_t stream_id;
+    bool is_class_method;
+} stack_node_t;
+
+typedef struct {
+    uint32_t stream_id;
+    // Node at each depth, or 0 where no event was seen
+    uint32_t *nodes;
+    uint32_t size;
+    uint32_t capacity;
+    // Shallowest depth of any event on the thread. The calls below it are from before the table's first event
+    uint32_t low;
+    // Timestamps of the thread's first and latest events, or 0 if they had none. The latest event's call is the
+    // one at the top of the stack, and its duration isn't known until the thread's next event
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    bool last_counted;
+    bool started;
+} thread_stack_t;
+
+struct folded_stacks {
+    // Node 0 is the empty path, which every stack starts from
+    stack_node_t *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    // Node indices, keyed by parent and call
+    uint32_t *slots;
+    size_t slot_capacity;
+    // Open addressed, keyed by stream id
+    thread_stack_t **threads;
+    size_t thread_capacity;
+    size_t thread_count;
+};
+
+typedef struct {
+    char *path;
+    uint64_t weight;
+} folded_line_t;
+
+static size_t hash_node(const stack_node_t *node) {
+    uint64_t value = (uint64_t)(uintptr_t)node->class_name * 0x9e3779b97f4a7c15ULL;
+    value ^= (uint64_t)(uintptr_t)node->method_name * 0xc2b2ae3d27d4eb4fULL;
+    value ^= ((uint64_t)node->parent << 32 | (uint64_t)node->open_depth << 1 | node->is_class_method) * 0x165667b19e3779f9ULL;
+    value ^= (uint64_t)node->stream_id * 0x27d4eb2f165667c5ULL;
+    return (size_t)(value ^ (value >> 29));
+}
+
+static bool nodes_equal(const stack_node_t *a, const stack_node_t *b) {
+    return a->parent == b->parent && a->class_name == b->class_name && a->method_name == b->method_name &&
+        a->is_class_method == b->is_class_method && a->stream_id == b->stream_id && a->open_depth == b->open_depth;
+}
+
+folded_stacks_t *folded_stacks_create(void) {
+    folded_stacks_t *stacks = calloc(1, sizeof(folded_stacks_t));
+    if (stacks == NULL) {
+        return NULL;
+    }
+
+    stacks->node_capacity = 1024;
+    stacks->nodes = calloc(stacks->node_capacity, sizeof(stack_node_t));
+    stacks->slot_capacity = 2048;
+    stacks->slots = calloc(stacks->slot_capacity, sizeof(uint32_t));
+    stacks->thread_capacity = FOLDED_STACKS_MIN_THREADS;
+    stacks->threads = calloc(stacks->thread_capacity, sizeof(thread_stack_t *));
+    if (stacks->nodes == NULL || stacks->slots == NULL || stacks->threads == NULL) {
+        folded_stacks_destroy(stacks);
+        return NULL;
+    }
+
+    stacks->node_count = 1;
+    return stacks;
+}
+
+void folded_stacks_destroy(folded_stacks_t *stacks) {
+    if (stacks == NULL) {
+        return;
+    }
+
+    if (stacks->threads != NULL) {
+        for (size_t i = 0; i < stacks->thread_capacity; i++) {
+            thread_stack_t *thread = stacks->threads[i];
+            if (thread != NULL) {
+                free(thread->nodes);
+                free(thread);
+            }
+        }
+    }
+    free(stacks->threads);
+    free(stacks->nodes);
+    free(stacks->slots);
+    free(stacks);
+}
+
+size_t folded_stacks_count(const folded_stacks_t *stacks) {
+    return stacks->node_count - 1;
+}
+
+static bool grow_slots(folded_stacks_t *stacks) {
+    size_t new_capacity = stacks->slot_capacity * 2;
+    uint32_t *slots = calloc(new_capacity, sizeof(uint32_t));
+    if (slots == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < stacks->slot_capacity; i++) {
+        uint32_t node = stacks->slots[i];
+        if (node == 0) {
+            continue;
+        }
+
+        size_t index = hash_node(&stacks->nodes[node]) & (new_capacity - 1);
+        while (slots[index] != 0) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        slots[index] = node;
+    }
+
+    free(stacks->slots);
+    stacks->slots = slots;
+    stacks->slot_capacity = new_capacity;
+    return true;
+}
+
+// The node for `key`, added if it's new
+static uint32_t find_node(folded_stacks_t *stacks, const stack_node_t *key) {
+    if ((stacks->node_count + 1) * 2 > stacks->slot_capacity && !grow_slots(stacks)) {
+        return NO_NODE;
+    }
+
+    size_t mask = stacks->slot_capacity - 1;
+    size_t index = hash_node(key) & mask;
+    while (stacks->slots[index] != 0) {
+        if (nodes_equal(&stacks->nodes[stacks->slots[index]], key)) {
+            return stacks->slots[index];
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (stacks->node_count >= NO_NODE) {
+        return NO_NODE;
+    }
+
+    if (stacks->node_count == stacks->node_capacity) {
+        stack_node_t *nodes = realloc(stacks->nodes, stacks->node_capacity * 2 * sizeof(stack_node_t));
+        if (nodes == NULL) {
+            return NO_NODE;
+        }
+        stacks->nodes = nodes;
+        stacks->node_capacity *= 2;
+    }
+
+    uint32_t node = (uint32_t)stacks->node_count++;
+    stacks->nodes[node] = *key;
+    stacks->nodes[node].count = 0;
+    stacks->nodes[node].duration = 0;
+    stacks->slots[index] = node;
+    return node;
+}
+
+static uint32_t open_bottom(folded_stacks_t *stacks, uint32_t stream_id, uint32_t depth) {
+    if (depth == 0) {
+        return 0;
+    }
+
+    stack_node_t key = {
+        .stream_id = stream_id,
+        .open_depth = depth,
+    };
+    return find_node(stacks, &key);
+}
+
+static size_t thread_index(uint32_t stream_id, size_t capacity) {
+    uint64_t value = stream_id * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(value ^ (value >> 32)) & (capacity - 1);
+}
+
+// The stack for a stream, or the empty slot it would go in
+static thread_stack_t **thread_slot(thread_stack_t **threads, size_t capacity, uint32_t stream_id) {
+    size_t index = thread_index(stream_id, capacity);
+    while (threads[index] != NULL && threads[index]->stream_id != stream_id) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &threads[index];
+}
+
+static bool grow_threads(folded_stacks_t *stacks) {
+    size_t new_capacity = stacks->thread_capacity * 2;
+    thread_stack_t **threads = calloc(new_capacity, sizeof(thread_stack_t *));
+    if (threads == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < stacks->thread_capacity; i++) {
+        if (stacks->threads[i] != NULL) {
+            *thread_slot(threads, new_capacity, stacks->threads[i]->stream_id) = stacks->threads[i];
+        }
+    }
+
+    free(stacks->threads);
+    stacks->threads = threads;
+    stacks->thread_capacity = new_capacity;
+    return true;
+}
+
+static thread_stack_t *thread_stack(folded_stacks_t *stacks, uint32_t stream_id, uint32_t low) {
+    thread_stack_t *thread = *thread_slot(stacks->threads, stacks->thread_capacity, stream_id);
+    if (thread != NULL) {
+        thread->low = MIN(thread->low, low);
+        return thread;
+    }
+
+    if ((stacks->thread_count + 1) * 2 > stacks->thread_capacity && !grow_threads(stacks)) {
+        return NULL;
+    }
+
+    thread = calloc(1, sizeof(thread_stack_t));
+    if (thread == NULL) {
+        return NULL;
+    }
+
+    thread->stream_id = stream_id;
+    thread->low = low;
+    *thread_slot(stacks->threads, stacks->thread_capacity, stream_id) = thread;
+    stacks->thread_count++;
+    return thread;
+}
+
+// Make room for depths up to `size`, with nothing at the ones that are new
+static bool reserve_depths(thread_stack_t *thread, uint32_t size) {
+    if (size > thread->capacity) {
+        uint32_t new_capacity = MAX(thread->capacity * 2, MAX(size, 32));
+        uint32_t *nodes = realloc(thread->nodes, new_capacity * sizeof(uint32_t));
+        if (nodes == NULL) {
+            return false;
+        }
+        thread->nodes = nodes;
+        thread->capacity = new_capacity;
+    }
+
+    if (thread->size < size) {
+        memset(thread->nodes + thread->size, 0, (size - thread->size) * sizeof(uint32_t));
+    }
+    return true;
+}
+
+// The node for the path below `depth` on a thread: the nearest call under it, or the open bottom if there's none
+static uint32_t path_below(folded_stacks_t *stacks, uint32_t stream_id, uint32_t depth) {
+    const thread_stack_t *thread = *thread_slot(stacks->threads, stacks->thread_capacity, stream_id);
+    if (thread == NULL) {
+        return open_bottom(stacks, stream_id, depth);
+    }
+
+    for (uint32_t i = MIN(depth, thread->size); i > thread->low; i--) {
+        if (thread->nodes[i - 1] != 0) {
+            return thread->nodes[i - 1];
+        }
+    }
+    return open_bottom(stacks, stream_id, MIN(depth, thread->low));
+}
+
+// The call at the top of a thread's stack ran until `timestamp`, when the thread's next event happened
+static void end_top_call(folded_stacks_t *stacks, thread_stack_t *thread, uint64_t timestamp) {
+    if (thread->last_counted && thread->last_timestamp != 0 && timestamp > thread->last_timestamp && thread->size > 0) {
+        uint32_t top = thread->nodes[thread->size - 1];
+        if (top != 0) {
+            stacks->nodes[top].duration += timestamp - thread->last_timestamp;
+        }
+    }
+}
+
+kern_return_t folded_stacks_add_event(folded_stacks_t *stacks, const tracer_event_t *event, bool counted) {
+    if (event->class_name == NULL || event->method_name == NULL || event->trace_depth >= FOLDED_STACKS_MAX_DEPTH) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    uint32_t depth = event->trace_depth;
+    thread_stack_t *thread = thread_stack(stacks, event->stream_id, depth);
+    if (thread == NULL || !reserve_depths(thread, depth + 1)) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    if (event->timestamp != 0) {
+        end_top_call(stacks, thread, event->timestamp);
+    }
+
+    // Everything at this depth and above has returned
+    thread->size = depth;
+    stack_node_t key = {
+        .class_name = event->class_name,
+        .method_name = event->method_name,
+        .is_class_method = event->is_class_method,
+        .parent = path_below(stacks, event->stream_id, depth),
+    };
+    uint32_t node = key.parent == NO_NODE ? NO_NODE : find_node(stacks, &key);
+    if (node == NO_NODE) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    thread->nodes[depth] = node;
+    thread->size = depth + 1;
+    if (counted) {
+        stacks->nodes[node].count++;
+    }
+
+    thread->last_counted = counted;
+    thread->last_timestamp = event->timestamp;
+    if (!thread->started) {
+        thread->started = true;
+        thread->first_timestamp = event->timestamp;
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t folded_stacks_merge(folded_stacks_t *stacks, const folded_stacks_t *later) {
+    uint32_t *map = calloc(later->node_count, sizeof(uint32_t));
+    if (map == NULL) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    // Parents are always added before their children, so one pass in order maps every node
+    kern_return_t kr = KERN_SUCCESS;
+    for (size_t i = 1; i < later->node_count && kr == KERN_SUCCESS; i++) {
+        const stack_node_t *node = &later->nodes[i];
+        if (node->class_name == NULL) {
+            // The calls that were running when `later` started are the ones on this table's stack now
+            map[i] = path_below(stacks, node->stream_id, node->open_depth);
+        }
+        else {
+            stack_node_t key = *node;
+            key.parent = map[node->parent];
+            map[i] = key.parent == NO_NODE ? NO_NODE : find_node(stacks, &key);
+        }
+
+        if (map[i] == NO_NODE) {
+            kr = KERN_RESOURCE_SHORTAGE;
+        }
+        else {
+            stacks->nodes[map[i]].count += node->count;
+            stacks->nodes[map[i]].duration += node->duration;
+        }
+    }
+
+    // Every thread's stack is now as it was at the end of `later`, down to the shallowest depth `later` saw
+    for (size_t i = 0; i < later->thread_capacity && kr == KERN_SUCCESS; i++) {
+        const thread_stack_t *later_thread = later->threads[i];
+        if (later_thread == NULL) {
+            continue;
+        }
+
+        thread_stack_t *thread = thread_stack(stacks, later_thread->stream_id, later_thread->low);
+        if (thread == NULL || !reserve_depths(thread, later_thread->size)) {
+            kr = KERN_RESOURCE_SHORTAGE;
+            break;
+        }
+
+        // The call this table ended on ran until the thread's first event in `later`
+        end_top_call(stacks, thread, later_thread->first_timestamp);
+        thread->last_counted = later_thread->last_counted;
+        thread->last_timestamp = later_thread->last_timestamp;
+        if (!thread->started) {
+            thread->started = true;
+            thread->first_timestamp = later_thread->first_timestamp;
+        }
+        
+        thread->size = MAX(thread->size, later_thread->low);
+        for (uint32_t depth = later_thread->low; depth < later_thread->size; depth++) {
+            thread->nodes[depth] = map[later_thread->nodes[depth]];
+        }
+        thread->size = later_thread->size;
+    }
+
+    free(map);
+    return kr;
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(((const folded_line_t *)a)->path, ((const folded_line_t *)b)->path);
+}
+
+static void append_path(const folded_stacks_t *stacks, uint32_t node, output_buffer_t *path) {
+    // Root first, so the path is built from the deepest call back up
+    uint32_t frames[FOLDED_STACKS_MAX_DEPTH];
+    size_t frame_count = 0;
+    for (; node != 0 && frame_count < FOLDED_STACKS_MAX_DEPTH; node = stacks->nodes[node].parent) {
+        if (stacks->nodes[node].class_name != NULL) {
+            frames[frame_count++] = node;
+        }
+    }
+
+    output_buffer_reset(path);
+    while (frame_count > 0) {
+        const stack_node_t *frame = &stacks->nodes[frames[--frame_count]];
+        output_buffer_append_char(path, frame->is_class_method ? '+' : '-');
+        output_buffer_append_char(path, '[');
+        output_buffer_append(path, frame->class_name, strlen(frame->class_name));
+        output_buffer_append_char(path, ' ');
+        output_buffer_append(path, frame->method_name, strlen(frame->method_name));
+        output_buffer_append_char(path, ']');
+        if (frame_count > 0) {
+            output_buffer_append_char(path, ';');
+        }
+    }
+}
+
+static uint64_t node_weight(const stack_node_t *node, folded_stacks_weight_t weight) {
+    return weight == FOLDED_STACKS_WEIGHT_DURATION ? node->duration : node->count;
+}
+
+bool folded_stacks_has_durations(const folded_stacks_t *stacks) {
+    for (size_t i = 1; i < stacks->node_count; i++) {
+        if (stacks->nodes[i].duration > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+kern_return_t folded_stacks_write(const folded_stacks_t *stacks, folded_stacks_weight_t weight, FILE *file) {
+    size_t line_count = 0;
+    for (size_t i = 1; i < stacks->node_count; i++) {
+        line_count += node_weight(&stacks->nodes[i], weight) > 0;
+    }
+
+    folded_line_t *lines = calloc(line_count ? line_count : 1, sizeof(folded_line_t));
+    if (lines == NULL) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    kern_return_t kr = KERN_SUCCESS;
+    output_buffer_t path = {0};
+    size_t built = 0;
+    for (size_t i = 1; i < stacks->node_count && kr == KERN_SUCCESS; i++) {
+        if (node_weight(&stacks->nodes[i], weight) == 0) {
+            continue;
+        }
+
+        append_path(stacks, (uint32_t)i, &path);
+        lines[built].path = path.failed ? NULL : strdup(path.data);
+        lines[built].weight = node_weight(&stacks->nodes[i], weight);
+        if (lines[built++].path == NULL) {
+            kr = KERN_RESOURCE_SHORTAGE;
+        }
+    }
+    output_buffer_free(&path);
+
+    if (kr == KERN_SUCCESS) {
+        qsort(lines, built, sizeof(folded_line_t), compare_lines);
+        for (size_t i = 0; i < built; i++) {
+            // Stacks that only differ in what was running before the first event read the same
+            uint64_t total = lines[i].weight;
+            while (i + 1 < built && strcmp(lines[i].path, lines[i + 1].path) == 0) {
+                total += lines[++i].weight;
+            }
+            if (fprintf(file, "%s %llu\n", lines[i].path, (unsigned long long)total) < 0) {
+                kr = KERN_FAILURE;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < built; i++) {
+        free(lines[i].path);
+    }
+    free(lines);
+    return kr;
+}
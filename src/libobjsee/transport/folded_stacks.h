@@ -0,0 +1,91 @@
+//
+//  folded_stacks.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/12/25.
+//
+
+#ifndef FOLDED_STACKS_H
+#define FOLDED_STACKS_H
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "tracer_types.h"
+
+/*
+    Call counts and times by call stack, for flame graphs
+
+    Each thread's stack is rebuilt from the depth of its events: an event at depth N replaces whatever was at
+    depth N and above. Distinct stacks are kept as a tree, so memory grows with the number of distinct call
+    paths rather than the number of events.
+
+    Events only mark when calls start, so a call's time is taken to run until the next event on its thread,
+    whether that's a call it made or one made after it returned. That's the time spent in the call itself,
+    not counting the calls it made, which is what each line of a flame graph's input holds.
+
+    A table can be built from any contiguous run of events, like one worker's share of a recording's chunks.
+    Calls that were already running when the run started aren't known yet, so stacks that reach below the
+    run's shallowest event on a thread are left open at the bottom. Merging the table onto one built from the
+    events before it fills those in from that table's stacks as they were at the end of its run.
+*/
+
+typedef struct folded_stacks folded_stacks_t;
+
+typedef enum {
+    // Number of calls
+    FOLDED_STACKS_WEIGHT_CALLS,
+    // Nanoseconds, from the events' timestamps
+    FOLDED_STACKS_WEIGHT_DURATION,
+} folded_stacks_weight_t;
+
+/**
+ * @brief Create an empty table
+ * @return The table, or NULL if memory ran out
+ */
+folded_stacks_t *folded_stacks_create(void);
+void folded_stacks_destroy(folded_stacks_t *stacks);
+
+/**
+ * @brief Push an event onto its thread's stack
+ * @param stacks The table
+ * @param event The event, placed on the stack for its stream_id. Its class name and selector are kept by pointer and must outlive the table
+ * @param counted Whether to count the call. Events that are filtered out should still be added uncounted,
+ * so the stacks of the events after them stay right
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the event has no class or selector, or KERN_RESOURCE_SHORTAGE
+ */
+kern_return_t folded_stacks_add_event(folded_stacks_t *stacks, const tracer_event_t *event, bool counted);
+
+/**
+ * @brief Add the counts from a table built from the events immediately after this one's
+ * @param stacks The table built from the earlier events. Its stacks are left as they were at the end of `later`
+ * @param later The table to merge in. It isn't changed
+ * @return KERN_SUCCESS, or KERN_RESOURCE_SHORTAGE
+ * @note Merging tables in the order their events were recorded gives the same counts as building one table from
+ * every event
+ */
+kern_return_t folded_stacks_merge(folded_stacks_t *stacks, const folded_stacks_t *later);
+
+/**
+ * @brief Write every stack with a non-zero weight, one per line in flame graph "folded" form:
+ *
+ *     -[UIApplication sendEvent:];-[UIWindow sendEvent:];-[UIView layoutSubviews] 12
+ *
+ * Lines are sorted by stack, so a table's output doesn't depend on how it was built
+ * @param weight Whether the number after each stack is its calls or their time
+ * @return KERN_SUCCESS, KERN_RESOURCE_SHORTAGE, or KERN_FAILURE if writing failed
+ */
+kern_return_t folded_stacks_write(const folded_stacks_t *stacks, folded_stacks_weight_t weight, FILE *file);
+
+/**
+ * @brief Whether any call has a time, which it won't if the events had no timestamps
+ */
+bool folded_stacks_has_durations(const folded_stacks_t *stacks);
+
+/**
+ * @brief Number of distinct stacks, including ones that were only ever passed through
+ */
+size_t folded_stacks_count(const folded_stacks_t *stacks);
+
+#endif // FOLDED_STACKS_H
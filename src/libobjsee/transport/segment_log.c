@@ -0,0 +1,406 @@
+//
+//  segment_log.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/9/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "segment_log.h"
+
+// segment_log_begin_event rotates once less than this share of a segment is left, so an event that has
+// started formatting for one segment almost never has to spill into the next
+#define SEGMENT_LOG_HEADROOM_DIVISOR 16
+
+typedef struct segment {
+    struct segment *next;
+    uint64_t index;
+    int fd;
+    char *base;
+    // Bytes available for messages, after the header and leaving room for the footer
+    size_t capacity;
+    uint64_t opened_at;
+
+    // Next free byte of the data, claimed by producers
+    _Atomic(uint64_t) reserved __attribute__((aligned(64)));
+    // Where the first message that didn't fit would have started. Nothing at or past it is written
+    _Atomic(uint64_t) data_end;
+    // Producers that have claimed, or are about to claim, space in this segment
+    _Atomic(uint32_t) writers;
+
+    _Atomic(uint64_t) event_count __attribute__((aligned(64)));
+    _Atomic(uint64_t) first_timestamp;
+    _Atomic(uint64_t) last_timestamp;
+} segment_t;
+
+struct segment_log {
+    char path[SEGMENT_LOG_PATH_MAX];
+    size_t segment_size;
+    uint32_t max_segments;
+    uint64_t max_age_ns;
+
+    _Atomic(segment_t *) current;
+    // Events dropped since the last segment was closed
+    _Atomic(uint64_t) dropped;
+
+    // Serializes rotation
+    pthread_mutex_t lock;
+    // Closed segments. Their files are unmapped, but a producer may still be checking whether one is current,
+    // so they're kept until the log is closed
+    segment_t *retired;
+
+    void *prologue;
+    size_t prologue_length;
+};
+
+void segment_log_segment_path(const char *path, uint64_t index, char *out, size_t size) {
+    snprintf(out, size, "%s.%06llu", path, (unsigned long long)index);
+}
+
+// Reserve the blocks up front. Writing to a mapped page with no disk space behind it would crash the traced process
+static bool preallocate_segment(int fd, size_t size) {
+#if defined(__APPLE__)
+    fstore_t store = {
+        .fst_flags = F_ALLOCATEALL,
+        .fst_posmode = F_PEOFPOSMODE,
+        .fst_offset = 0,
+        .fst_length = (off_t)size,
+    };
+    if (fcntl(fd, F_PREALLOCATE, &store) < 0 && errno != ENOTSUP) {
+        return false;
+    }
+#else
+    int error = posix_fallocate(fd, 0, (off_t)size);
+    if (error != 0 && error != EOPNOTSUPP) {
+        return false;
+    }
+#endif
+    return ftruncate(fd, (off_t)size) == 0;
+}
+
+static segment_t *open_segment(segment_log_t *log, uint64_t index) {
+    char path[SEGMENT_LOG_PATH_MAX];
+    segment_log_segment_path(log->path, index, path, sizeof(path));
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (!preallocate_segment(fd, log->segment_size)) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    char *base = mmap(NULL, log->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    segment_t *segment = calloc(1, sizeof(segment_t));
+    if (segment == NULL) {
+        munmap(base, log->segment_size);
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    segment->index = index;
+    segment->fd = fd;
+    segment->base = base;
+    segment->capacity = log->segment_size - SEGMENT_LOG_HEADER_SIZE - sizeof(segment_footer_t);
+    segment->opened_at = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    atomic_init(&segment->data_end, UINT64_MAX);
+
+    segment_header_t header = {
+        .version = SEGMENT_LOG_VERSION,
+        .header_length = SEGMENT_LOG_HEADER_SIZE,
+        .index = index,
+        .created_at = (uint64_t)time(NULL),
+        .created_uptime_ns = segment->opened_at,
+    };
+    memcpy(header.magic, SEGMENT_LOG_MAGIC, SEGMENT_LOG_MAGIC_LENGTH);
+    memcpy(base, &header, sizeof(header));
+
+    if (log->prologue_length > 0) {
+        memcpy(base + SEGMENT_LOG_HEADER_SIZE, log->prologue, log->prologue_length);
+        atomic_init(&segment->reserved, log->prologue_length);
+    }
+    return segment;
+}
+
+// Wait for the segment's last producer, then write its footer and trim it down to what was written
+static void finish_segment(segment_log_t *log, segment_t *segment) {
+    while (atomic_load(&segment->writers) != 0) {
+        sched_yield();
+    }
+
+    uint64_t data_length = atomic_load_explicit(&segment->reserved, memory_order_acquire);
+    uint64_t data_end = atomic_load_explicit(&segment->data_end, memory_order_relaxed);
+    if (data_length > data_end) {
+        data_length = data_end;
+    }
+    if (data_length > segment->capacity) {
+        data_length = segment->capacity;
+    }
+
+    segment_footer_t footer = {
+        .data_length = data_length,
+        .event_count = atomic_load_explicit(&segment->event_count, memory_order_relaxed),
+        .dropped = atomic_exchange_explicit(&log->dropped, 0, memory_order_relaxed),
+        .first_timestamp = atomic_load_explicit(&segment->first_timestamp, memory_order_relaxed),
+        .last_timestamp = atomic_load_explicit(&segment->last_timestamp, memory_order_relaxed),
+        .version = SEGMENT_LOG_VERSION,
+    };
+    memcpy(footer.magic, SEGMENT_LOG_MAGIC, SEGMENT_LOG_MAGIC_LENGTH);
+    memcpy(segment->base + SEGMENT_LOG_HEADER_SIZE + data_length, &footer, sizeof(footer));
+
+    munmap(segment->base, log->segment_size);
+    segment->base = NULL;
+    ftruncate(segment->fd, (off_t)(SEGMENT_LOG_HEADER_SIZE + data_length + sizeof(footer)));
+    close(segment->fd);
+    segment->fd = -1;
+
+    segment->next = log->retired;
+    log->retired = segment;
+}
+
+// Replace `full` with the next segment, unless another thread already has
+static void rotate_segment(segment_log_t *log, segment_t *full) {
+    pthread_mutex_lock(&log->lock);
+    if (atomic_load(&log->current) == full) {
+        // Once a segment can't be created nothing more is written, rather than retrying for every event
+        segment_t *next = open_segment(log, full->index + 1);
+        atomic_store(&log->current, next);
+        finish_segment(log, full);
+
+        if (next && log->max_segments > 0 && next->index > log->max_segments) {
+            char path[SEGMENT_LOG_PATH_MAX];
+            segment_log_segment_path(log->path, next->index - log->max_segments, path, sizeof(path));
+            unlink(path);
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+segment_log_t *segment_log_open(const char *path, const segment_log_options_t *options) {
+    if (path == NULL || strlen(path) + 8 >= SEGMENT_LOG_PATH_MAX) {
+        return NULL;
+    }
+
+    segment_log_t *log = calloc(1, sizeof(segment_log_t));
+    if (log == NULL) {
+        return NULL;
+    }
+
+    strlcpy(log->path, path, sizeof(log->path));
+    log->segment_size = SEGMENT_LOG_DEFAULT_SIZE;
+    if (options) {
+        if (options->segment_size > 0) {
+            log->segment_size = options->segment_size < SEGMENT_LOG_MIN_SIZE ? SEGMENT_LOG_MIN_SIZE : options->segment_size;
+        }
+        log->max_segments = options->max_segments;
+        log->max_age_ns = (uint64_t)options->max_age_s * 1000000000ULL;
+    }
+
+    if (pthread_mutex_init(&log->lock, NULL) != 0) {
+        free(log);
+        return NULL;
+    }
+
+    // Numbering starts over, so segments from an earlier run would otherwise be mixed in with this one's
+    char segment_path[SEGMENT_LOG_PATH_MAX];
+    for (uint64_t index = 1;; index++) {
+        segment_log_segment_path(path, index, segment_path, sizeof(segment_path));
+        if (unlink(segment_path) != 0) {
+            break;
+        }
+    }
+
+    segment_t *first = open_segment(log, 1);
+    if (first == NULL) {
+        pthread_mutex_destroy(&log->lock);
+        free(log);
+        return NULL;
+    }
+
+    atomic_init(&log->current, first);
+    return log;
+}
+
+void segment_log_close(segment_log_t *log) {
+    if (log == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    segment_t *segment = atomic_exchange(&log->current, NULL);
+    if (segment) {
+        finish_segment(log, segment);
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    while (log->retired) {
+        segment_t *next = log->retired->next;
+        free(log->retired);
+        log->retired = next;
+    }
+
+    pthread_mutex_destroy(&log->lock);
+    free(log->prologue);
+    free(log);
+}
+
+kern_return_t segment_log_set_prologue(segment_log_t *log, const void *data, size_t length) {
+    if (log == NULL || data == NULL || length == 0) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    segment_t *segment = atomic_load(&log->current);
+    if (segment == NULL || log->prologue != NULL || atomic_load(&segment->reserved) != 0 || length > segment->capacity / 2) {
+        pthread_mutex_unlock(&log->lock);
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    log->prologue = malloc(length);
+    if (log->prologue == NULL) {
+        pthread_mutex_unlock(&log->lock);
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    memcpy(log->prologue, data, length);
+    log->prologue_length = length;
+    memcpy(segment->base + SEGMENT_LOG_HEADER_SIZE, data, length);
+    atomic_store(&segment->reserved, length);
+    pthread_mutex_unlock(&log->lock);
+    return KERN_SUCCESS;
+}
+
+// Claim `segment` for an append. Fails if it's no longer current, in which case it may already be unmapped
+static bool enter_segment(segment_log_t *log, segment_t *segment) {
+    // Sequentially consistent on both sides: either rotate_segment sees this writer, or this sees the rotation
+    atomic_fetch_add(&segment->writers, 1);
+    if (atomic_load(&log->current) != segment) {
+        atomic_fetch_sub_explicit(&segment->writers, 1, memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+static void record_event(segment_t *segment, uint64_t now) {
+    atomic_fetch_add_explicit(&segment->event_count, 1, memory_order_relaxed);
+
+    uint64_t first = 0;
+    if (atomic_load_explicit(&segment->first_timestamp, memory_order_relaxed) == 0) {
+        atomic_compare_exchange_strong_explicit(&segment->first_timestamp, &first, now, memory_order_relaxed, memory_order_relaxed);
+    }
+
+    uint64_t last = atomic_load_explicit(&segment->last_timestamp, memory_order_relaxed);
+    while (last < now && !atomic_compare_exchange_weak_explicit(&segment->last_timestamp, &last, now, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+uint64_t segment_log_begin_event(segment_log_t *log) {
+    while (true) {
+        segment_t *segment = atomic_load_explicit(&log->current, memory_order_acquire);
+        if (segment == NULL) {
+            return 0;
+        }
+
+        uint64_t reserved = atomic_load_explicit(&segment->reserved, memory_order_relaxed);
+        bool nearly_full = reserved + segment->capacity / SEGMENT_LOG_HEADROOM_DIVISOR > segment->capacity;
+        bool expired = log->max_age_ns > 0 && clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - segment->opened_at >= log->max_age_ns;
+        if (!nearly_full && !expired) {
+            return segment->index;
+        }
+
+        rotate_segment(log, segment);
+    }
+}
+
+kern_return_t segment_log_append(segment_log_t *log, const void *data, size_t length, uint64_t segment_index) {
+    uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    while (true) {
+        segment_t *segment = atomic_load_explicit(&log->current, memory_order_acquire);
+        kern_return_t error = KERN_SUCCESS;
+        if (segment == NULL) {
+            error = KERN_RESOURCE_SHORTAGE;
+        }
+        else if (segment_index != 0 && segment->index != segment_index) {
+            error = KERN_ABORTED;
+        }
+        else if (length > segment->capacity - log->prologue_length) {
+            error = KERN_INVALID_ARGUMENT;
+        }
+
+        if (error != KERN_SUCCESS) {
+            atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+            return error;
+        }
+
+        if (!enter_segment(log, segment)) {
+            continue;
+        }
+
+        uint64_t offset = atomic_fetch_add_explicit(&segment->reserved, length, memory_order_relaxed);
+        if (offset + length <= segment->capacity) {
+            memcpy(segment->base + SEGMENT_LOG_HEADER_SIZE + offset, data, length);
+            record_event(segment, now);
+            atomic_fetch_sub_explicit(&segment->writers, 1, memory_order_release);
+            return KERN_SUCCESS;
+        }
+
+        // Everything claimed before this offset fits, and everything claimed after it doesn't
+        uint64_t data_end = atomic_load_explicit(&segment->data_end, memory_order_relaxed);
+        while (offset < data_end && !atomic_compare_exchange_weak_explicit(&segment->data_end, &data_end, offset, memory_order_relaxed, memory_order_relaxed)) {
+        }
+        atomic_fetch_sub_explicit(&segment->writers, 1, memory_order_release);
+        rotate_segment(log, segment);
+    }
+}
+
+kern_return_t segment_file_data(const uint8_t *file, size_t size, size_t *out_offset, size_t *out_length, segment_footer_t *out_footer) {
+    segment_header_t header;
+    if (file == NULL || size < SEGMENT_LOG_HEADER_SIZE || memcmp(file, SEGMENT_LOG_MAGIC, SEGMENT_LOG_MAGIC_LENGTH) != 0) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    memcpy(&header, file, sizeof(header));
+    if (header.version != SEGMENT_LOG_VERSION || header.header_length < sizeof(header) || header.header_length > size) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    *out_offset = header.header_length;
+    memset(out_footer, 0, sizeof(*out_footer));
+    if (size - header.header_length >= sizeof(segment_footer_t)) {
+        segment_footer_t footer;
+        memcpy(&footer, file + size - sizeof(footer), sizeof(footer));
+        if (memcmp(footer.magic, SEGMENT_LOG_MAGIC, SEGMENT_LOG_MAGIC_LENGTH) == 0 && footer.version == SEGMENT_LOG_VERSION &&
+            footer.data_length == size - header.header_length - sizeof(footer)) {
+            *out_length = footer.data_length;
+            *out_footer = footer;
+            return KERN_SUCCESS;
+        }
+    }
+
+    // Never closed. The preallocated space after the data is still zeroed
+    size_t end = size;
+    while (end > header.header_length && file[end - 1] == 0) {
+        end--;
+    }
+    *out_length = end - header.header_length;
+    return KERN_ABORTED;
+}
@@ -0,0 +1,145 @@
+//
+//  segment_log.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/9/25.
+//
+
+#ifndef SEGMENT_LOG_H
+#define SEGMENT_LOG_H
+
+#include <mach/mach.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    A trace log written as a series of memory-mapped segment files.
+
+    Each segment is preallocated on disk at its full size and mapped, and producer threads copy messages straight
+    into the mapping. Space is claimed with an atomic add, so appending never takes a lock or makes a syscall.
+    When a message doesn't fit, or the segment has been open longer than the configured age, the thread that
+    notices closes it and opens the next. Once there are more segments than the configured maximum, the oldest is deleted.
+
+    Segments are named `path.000001`, `path.000002` and so on. Layout of a closed segment:
+
+        [0, SEGMENT_LOG_HEADER_SIZE)        segment_header_t
+        data                                Messages, back to back, in the order their space was claimed
+        segment_footer_t                    Event count and time range, ending with SEGMENT_LOG_MAGIC
+
+    A closed segment is truncated to exactly that length, so its footer is the last thing in the file. A segment
+    that was never closed is still at its preallocated size with zeroes after the data, and has no footer.
+
+    Every segment starts with the log's prologue, such as the binary protocol preamble, so each one can be read on its own.
+*/
+
+#define SEGMENT_LOG_MAGIC "\0OBJSEG"
+#define SEGMENT_LOG_MAGIC_LENGTH 7
+#define SEGMENT_LOG_VERSION 1
+#define SEGMENT_LOG_HEADER_SIZE 64
+#define SEGMENT_LOG_DEFAULT_SIZE (64 * 1024 * 1024)
+#define SEGMENT_LOG_MIN_SIZE (64 * 1024)
+// Room for the index suffix appended to the log's path
+#define SEGMENT_LOG_PATH_MAX 1024
+
+typedef struct {
+    char magic[SEGMENT_LOG_MAGIC_LENGTH];
+    uint8_t version;
+    uint32_t header_length;         // Offset of the data
+    uint32_t reserved;
+    uint64_t index;                 // Starts at 1
+    uint64_t created_at;            // Wall clock, in seconds since 1970
+    uint64_t created_uptime_ns;     // CLOCK_UPTIME_RAW when it was created, to relate the footer's times to created_at
+} segment_header_t;
+
+typedef struct {
+    uint64_t data_length;
+    uint64_t event_count;
+    // Events that couldn't be written since the previous segment was closed
+    uint64_t dropped;
+    // CLOCK_UPTIME_RAW when the first and last events were appended. 0 if there were none
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    char magic[SEGMENT_LOG_MAGIC_LENGTH];
+    uint8_t version;
+} segment_footer_t;
+
+typedef struct {
+    // Size each segment is preallocated to, header and footer included. 0 uses SEGMENT_LOG_DEFAULT_SIZE
+    size_t segment_size;
+    // Once there are more segments than this, the oldest is deleted. 0 keeps them all
+    uint32_t max_segments;
+    // Close a segment once it has been open this long, even if it isn't full. 0 rotates on size only
+    uint32_t max_age_s;
+} segment_log_options_t;
+
+typedef struct segment_log segment_log_t;
+
+
+/**
+ * @brief Open a log and its first segment
+ *
+ * @param path Path the segment names are built from
+ * @param options How segments are sized and rotated, or NULL for the defaults
+ * @return The log, or NULL if the first segment couldn't be created
+ * @note Segments left at the same path by an earlier run are deleted first
+ */
+segment_log_t *segment_log_open(const char *path, const segment_log_options_t *options);
+
+/**
+ * @brief Close the current segment with its footer and release the log
+ * @note No thread may be appending
+ */
+void segment_log_close(segment_log_t *log);
+
+/**
+ * @brief Set what every segment starts with, and write it to the current one
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if anything has been appended already or it's too large,
+ * or KERN_RESOURCE_SHORTAGE if it couldn't be copied
+ */
+kern_return_t segment_log_set_prologue(segment_log_t *log, const void *data, size_t length);
+
+
+/**
+ * @brief Copy one event into the current segment, moving on to the next if it doesn't fit
+ *
+ * @param log The log
+ * @param data The event
+ * @param length Length of the event
+ * @param segment_index If not 0, the event is only written to this segment. Output that depends on what came
+ * before it in the same segment, like a binary encoder's string dictionary, passes the index it started in
+ * @return KERN_SUCCESS, KERN_ABORTED if `segment_index` has been closed, KERN_INVALID_ARGUMENT if the event is
+ * larger than a segment, or KERN_RESOURCE_SHORTAGE if a new segment couldn't be created. The event is counted
+ * as dropped on failure
+ * @note Safe to call from any number of threads at once
+ */
+kern_return_t segment_log_append(segment_log_t *log, const void *data, size_t length, uint64_t segment_index);
+
+/**
+ * @brief Rotate now if the current segment is nearly full or older than `max_age_s`, before an event is formatted
+ * @return Index of the segment the event should be appended to, or 0 if no segment could be created
+ * @note The segment's age is only checked here. Without it, segments rotate only once they're full
+ */
+uint64_t segment_log_begin_event(segment_log_t *log);
+
+
+/**
+ * @brief Build the path of one segment
+ */
+void segment_log_segment_path(const char *path, uint64_t index, char *out, size_t size);
+
+/**
+ * @brief Find the data in a segment file
+ *
+ * @param file The whole file
+ * @param size Size of the file
+ * @param out_offset Receives the offset of the data
+ * @param out_length Receives the length of the data
+ * @param out_footer Receives the footer. Zeroed if the segment was never closed
+ * @return KERN_SUCCESS for a closed segment, KERN_ABORTED for one that was never closed, in which case the data
+ * runs up to the zeroes after it and may end part way through a message, or KERN_INVALID_ARGUMENT if it isn't a segment file
+ */
+kern_return_t segment_file_data(const uint8_t *file, size_t size, size_t *out_offset, size_t *out_length, segment_footer_t *out_footer);
+
+#endif // SEGMENT_LOG_H
@@ -0,0 +1,258 @@
+//
+//  shm_ring.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/7/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "shm_ring.h"
+
+#if defined(__APPLE__)
+// Private, but stable since macOS 10.12 / iOS 10. The SHARED variants work on memory mapped into several processes
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout_us);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+#define UL_COMPARE_AND_WAIT_SHARED 3
+#define ULF_WAKE_ALL 0x00000100
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static void doorbell_wait(_Atomic(uint32_t) *doorbell, uint32_t expected, uint32_t timeout_ms) {
+#if defined(__APPLE__)
+    __ulock_wait(UL_COMPARE_AND_WAIT_SHARED, (void *)doorbell, expected, timeout_ms * 1000);
+#elif defined(__linux__)
+    struct timespec timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000L,
+    };
+    syscall(SYS_futex, (void *)doorbell, FUTEX_WAIT, expected, &timeout, NULL, 0);
+#else
+    usleep(timeout_ms * 1000);
+#endif
+}
+
+static void doorbell_ring(_Atomic(uint32_t) *doorbell) {
+    atomic_fetch_add_explicit(doorbell, 1, memory_order_release);
+#if defined(__APPLE__)
+    __ulock_wake(UL_COMPARE_AND_WAIT_SHARED | ULF_WAKE_ALL, (void *)doorbell, 0);
+#elif defined(__linux__)
+    syscall(SYS_futex, (void *)doorbell, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+static size_t record_size(size_t length) {
+    return (sizeof(shm_record_header_t) + length + 7) & ~(size_t)7;
+}
+
+// Map the record area twice, back to back, so a record that runs off the end continues at the start
+static char *map_mirrored_records(int fd, size_t capacity) {
+    char *region = mmap(NULL, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (mmap(region + capacity * i, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, SHM_RING_HEADER_SIZE) == MAP_FAILED) {
+            munmap(region, capacity * 2);
+            return NULL;
+        }
+    }
+
+    return region;
+}
+
+static shm_ring_t *map_ring(int fd, const char *name, size_t capacity) {
+    shm_ring_t *ring = calloc(1, sizeof(shm_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->header = mmap(NULL, SHM_RING_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring->header == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->data = map_mirrored_records(fd, capacity);
+    if (ring->data == NULL) {
+        munmap(ring->header, SHM_RING_HEADER_SIZE);
+        free(ring);
+        return NULL;
+    }
+
+    ring->capacity = capacity;
+    strlcpy(ring->name, name, sizeof(ring->name));
+    return ring;
+}
+
+shm_ring_t *shm_ring_create(const char *name, size_t capacity) {
+    if (name == NULL || strlen(name) >= SHM_RING_NAME_MAX) {
+        return NULL;
+    }
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || (capacity % getpagesize()) != 0) {
+        return NULL;
+    }
+
+    // Owner only. Anyone else who could open the ring could read the trace or corrupt its records
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        // Left behind by an earlier run that didn't exit cleanly
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (ftruncate(fd, SHM_RING_HEADER_SIZE + capacity) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shm_ring_t *ring = map_ring(fd, name, capacity);
+    close(fd);
+    if (ring == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The object starts out zeroed, so every record tag is unpublished
+    ring->owner = true;
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->capacity = capacity;
+    atomic_thread_fence(memory_order_release);
+    ring->header->magic = SHM_RING_MAGIC;
+    return ring;
+}
+
+shm_ring_t *shm_ring_attach(const char *name) {
+    if (name == NULL || strlen(name) >= SHM_RING_NAME_MAX) {
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    shm_ring_header_t *header = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size >= SHM_RING_HEADER_SIZE) {
+        header = mmap(NULL, SHM_RING_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (header == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    uint64_t capacity = header->capacity;
+    bool valid = header->magic == SHM_RING_MAGIC && header->version == SHM_RING_VERSION;
+    valid &= capacity != 0 && (capacity & (capacity - 1)) == 0 && (capacity % getpagesize()) == 0;
+    valid &= (uint64_t)info.st_size >= SHM_RING_HEADER_SIZE + capacity;
+    munmap(header, SHM_RING_HEADER_SIZE);
+
+    shm_ring_t *ring = valid ? map_ring(fd, name, capacity) : NULL;
+    close(fd);
+    if (ring) {
+        atomic_fetch_add_explicit(&ring->header->producers, 1, memory_order_relaxed);
+    }
+    return ring;
+}
+
+void shm_ring_close(shm_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->owner) {
+        shm_unlink(ring->name);
+    }
+    munmap(ring->data, ring->capacity * 2);
+    munmap(ring->header, SHM_RING_HEADER_SIZE);
+    free(ring);
+}
+
+bool shm_ring_write(shm_ring_t *ring, const void *data, size_t length) {
+    size_t size = record_size(length);
+    if (size > ring->capacity) {
+        return false;
+    }
+
+    shm_ring_header_t *header = ring->header;
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    do {
+        // Acquire pairs with the consumer clearing what it read, before it moved the tail past it
+        uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+        if (head + size - tail > ring->capacity) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&header->head, &head, head + size, memory_order_relaxed, memory_order_relaxed));
+
+    shm_record_header_t *record = (shm_record_header_t *)(ring->data + (head & (ring->capacity - 1)));
+    record->length = (uint32_t)length;
+    memcpy(record + 1, data, length);
+    atomic_store_explicit(&record->tag, head | 1, memory_order_release);
+
+    // Pairs with the fence in shm_ring_wait. Either the consumer sees this record before it sleeps,
+    // or this sees that it's asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&header->consumer_waiting, memory_order_relaxed)) {
+        doorbell_ring(&header->doorbell);
+    }
+    return true;
+}
+
+static bool record_published(shm_ring_t *ring, uint64_t position) {
+    shm_record_header_t *record = (shm_record_header_t *)(ring->data + (position & (ring->capacity - 1)));
+    return atomic_load_explicit(&record->tag, memory_order_acquire) == (position | 1);
+}
+
+size_t shm_ring_read(shm_ring_t *ring, output_buffer_t *out) {
+    shm_ring_header_t *header = ring->header;
+    uint64_t start = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    uint64_t tail = start;
+    size_t appended = 0;
+
+    while (record_published(ring, tail)) {
+        shm_record_header_t *record = (shm_record_header_t *)(ring->data + (tail & (ring->capacity - 1)));
+        size_t size = record_size(record->length);
+        if (size > ring->capacity - (tail - start)) {
+            // Corrupt. Leave it for the next read rather than running past the end of the mapping
+            break;
+        }
+
+        output_buffer_append(out, (const char *)(record + 1), record->length);
+        appended += record->length;
+        tail += size;
+    }
+
+    if (tail != start) {
+        // Clear what was read, so stale bytes from this lap can never look like a published tag on the next
+        memset(ring->data + (start & (ring->capacity - 1)), 0, tail - start);
+        atomic_store_explicit(&header->tail, tail, memory_order_release);
+    }
+    return appended;
+}
+
+void shm_ring_wait(shm_ring_t *ring, uint32_t timeout_ms) {
+    shm_ring_header_t *header = ring->header;
+    uint32_t doorbell = atomic_load_explicit(&header->doorbell, memory_order_acquire);
+    atomic_store_explicit(&header->consumer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!record_published(ring, atomic_load_explicit(&header->tail, memory_order_relaxed))) {
+        doorbell_wait(&header->doorbell, doorbell, timeout_ms);
+    }
+    atomic_store_explicit(&header->consumer_waiting, 0, memory_order_relaxed);
+}
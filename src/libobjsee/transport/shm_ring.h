@@ -0,0 +1,121 @@
+//
+//  shm_ring.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/7/25.
+//
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "output_buffer.h"
+
+/*
+    A multi-producer, single-consumer ring of messages in a named shared memory object.
+
+    The CLI creates the object and passes its name to the traced process in the encoded config. Threads in
+    the traced process copy messages straight into it, and the CLI reads them out, without a syscall on either
+    side while both are busy. When the ring runs dry the consumer sleeps on a doorbell word in the header, and
+    producers only make the wake syscall when they see it sleeping.
+
+    Layout of the object:
+
+        [0, SHM_RING_HEADER_SIZE)                   shm_ring_header_t
+        [SHM_RING_HEADER_SIZE, + capacity)          Records, mapped twice back to back so none ever wraps
+
+    Each record is a shm_record_header_t followed by the message, padded to 8 bytes. Producers claim space
+    by advancing `head`, fill it in, then publish it by setting the record's tag to its own position | 1.
+    Records can be published out of order, and the consumer stops at the first one that isn't published yet.
+    The consumer zeroes what it has read before moving `tail`, so leftover bytes from an earlier lap can
+    never be mistaken for a published tag.
+*/
+
+#define SHM_RING_MAGIC 0x4f424a53       // 'OBJS'
+#define SHM_RING_VERSION 1
+// Large enough to keep the data page-aligned on every supported page size
+#define SHM_RING_HEADER_SIZE (16 * 1024)
+#define SHM_RING_DEFAULT_CAPACITY (8 * 1024 * 1024)
+// Darwin limits shared memory names to 31 characters
+#define SHM_RING_NAME_MAX 32
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    // Total events producers dropped because the ring was full. The consumer reports them
+    _Atomic(uint64_t) dropped;
+    // Number of producer processes that have mapped the ring
+    _Atomic(uint32_t) producers;
+
+    // Next byte to be claimed by a producer
+    _Atomic(uint64_t) head __attribute__((aligned(64)));
+    // Next record for the consumer. Written only by the consumer
+    _Atomic(uint64_t) tail __attribute__((aligned(64)));
+
+    // Bumped by producers to wake the consumer, which sleeps on it while `consumer_waiting` is set
+    _Atomic(uint32_t) doorbell __attribute__((aligned(64)));
+    _Atomic(uint32_t) consumer_waiting;
+} shm_ring_header_t;
+
+typedef struct {
+    _Atomic(uint64_t) tag;
+    uint32_t length;
+    uint32_t reserved;
+} shm_record_header_t;
+
+typedef struct {
+    shm_ring_header_t *header;
+    char *data;
+    size_t capacity;
+    bool owner;
+    char name[SHM_RING_NAME_MAX];
+} shm_ring_t;
+
+
+/**
+ * @brief Create a ring for other processes to attach to
+ * @param name Shared memory name, starting with '/'
+ * @param capacity Size of the record area. Must be a power of two and a multiple of the page size
+ * @return The ring, or NULL on failure. The shared memory object is removed when the ring is closed
+ * @note The object is only accessible to the creating user, so only processes running as that user can attach
+ */
+shm_ring_t *shm_ring_create(const char *name, size_t capacity);
+
+/**
+ * @brief Map a ring created by another process
+ * @return The ring, or NULL if it doesn't exist or isn't a ring this version understands
+ */
+shm_ring_t *shm_ring_attach(const char *name);
+
+/**
+ * @brief Unmap the ring. The creator also removes the shared memory object
+ */
+void shm_ring_close(shm_ring_t *ring);
+
+
+/**
+ * @brief Copy a message into the ring and wake the consumer if it's waiting
+ * @return false if there isn't room for it right now
+ * @note Safe to call from any number of threads and processes at once
+ */
+bool shm_ring_write(shm_ring_t *ring, const void *data, size_t length);
+
+
+/**
+ * @brief Append every published message, in order, to `out`
+ * @return The number of bytes appended
+ * @note Consumer side only
+ */
+size_t shm_ring_read(shm_ring_t *ring, output_buffer_t *out);
+
+/**
+ * @brief Sleep until a producer publishes something, or `timeout_ms` passes
+ * @note Consumer side only. Returns straight away if anything is already waiting to be read
+ */
+void shm_ring_wait(shm_ring_t *ring, uint32_t timeout_ms);
+
+#endif // SHM_RING_H
@@ -0,0 +1,359 @@
+//
+//  stream_compression.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/8/25.
+//
+
+#include "stream_compression.h"
+#include "event_protocol.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+// The block format requires the last 5 bytes to be literals, and no match to start in the last 12
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_START_LIMIT 12
+// After this many consecutive misses, start skipping ahead faster through data that isn't compressing
+#define LZ_SKIP_TRIGGER 6
+
+// Longest frame header: kind, then two varints
+#define COMPRESSED_FRAME_MAX_HEADER_LENGTH 21
+
+// Primes every block. Later entries are cheaper to refer to, so the most common strings go last
+static const char compression_dictionary[] =
+    "\"block_signature\":\"\"objc_class\":\"\"demangled_class\":\"\"arguments\":[{\"type\":\"\"description\":\""
+    "\"address\":\"size\":\"signature\":\"v16@0:8\"@16@0:8\"B16@0:8\"Q16@0:8\"v24@0:8@16\"v20@0:8B16"
+    "NSConcreteNSObjectNSStringNSArrayNSDictionaryNSNumberNSMutableNSDataNSURLNSBundleNSUserDefaultsNSNotificationCenter"
+    "CFBundleCFStringCALayerCAAnimationUIViewControllerUIApplicationUIWindowUIScreenUIColorUIFontUIImageUILabel"
+    "UIViewUITraitCollection_UI_NSSwiftUI.NWConcrete_nw_OS_dispatch_OS_xpc_"
+    "initWithFrame:initWithCoder:initWithObjects:count:initWithString:initWithFormat:init"
+    "objectForKey:setObject:forKey:objectAtIndex:addObject:removeObject:valueForKey:setValue:forKey:"
+    "respondsToSelector:isKindOfClass:isEqual:isEqualToString:conformsToProtocol:performSelector:"
+    "copyWithZone:mutableCopycopydescriptionhashlengthcountclass_isDeallocatingautoreleaseretainreleasedealloc"
+    "allocWithZone:allocnew"
+    "\x1b[0m\x1b[38;5;"
+    "{\"formatted_output\":\"\",\"class\":\"\",\"method\":\"\",\"is_class_method\":false,\"thread_id\":\",\"depth\":"
+    "\n    |  -[  +[";
+
+#define COMPRESSION_DICTIONARY_LENGTH (sizeof(compression_dictionary) - 1)
+
+struct stream_compressor {
+    // The dictionary followed by the batch being compressed, so matches can reach back into the dictionary
+    output_buffer_t input;
+    output_buffer_t block;
+};
+
+static inline uint32_t lz_read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t *lz_write_length(uint8_t *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t *lz_write_sequence(uint8_t *op, const uint8_t *literals, size_t literal_length, size_t offset, size_t match_length) {
+    uint8_t *token = op++;
+    *token = (uint8_t)((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15) {
+        op = lz_write_length(op, literal_length - 15);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (offset == 0) {
+        // The last sequence is literals only
+        return op;
+    }
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    size_t extra = match_length - LZ_MIN_MATCH;
+    *token |= (uint8_t)(extra >= 15 ? 15 : extra);
+    if (extra >= 15) {
+        op = lz_write_length(op, extra - 15);
+    }
+    return op;
+}
+
+size_t lz_compress_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+size_t lz_compress_block(const uint8_t *base, size_t dictionary_length, size_t length, uint8_t *out) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    // Positions are stored relative to base, so entries from the dictionary and the input look the same
+    if (dictionary_length >= LZ_MIN_MATCH) {
+        size_t start = dictionary_length > LZ_MAX_OFFSET ? dictionary_length - LZ_MAX_OFFSET : 0;
+        for (size_t i = start; i + LZ_MIN_MATCH <= dictionary_length; i++) {
+            table[lz_hash(lz_read32(base + i))] = (uint32_t)i;
+        }
+    }
+
+    const uint8_t *ip = base + dictionary_length;
+    const uint8_t *anchor = ip;
+    const uint8_t *end = ip + length;
+    uint8_t *op = out;
+
+    if (length > LZ_MATCH_START_LIMIT) {
+        const uint8_t *match_start_limit = end - LZ_MATCH_START_LIMIT;
+        const uint8_t *match_end_limit = end - LZ_LAST_LITERALS;
+        uint32_t misses = 0;
+
+        while (ip < match_start_limit) {
+            uint32_t sequence = lz_read32(ip);
+            uint32_t *slot = &table[lz_hash(sequence)];
+            const uint8_t *match = base + *slot;
+            *slot = (uint32_t)(ip - base);
+
+            if (match >= ip || ip - match > LZ_MAX_OFFSET || lz_read32(match) != sequence) {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            // Take in any matching bytes just before the hash hit
+            while (ip > anchor && match > base && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+
+            size_t match_length = LZ_MIN_MATCH;
+            while (ip + match_length < match_end_limit && ip[match_length] == match[match_length]) {
+                match_length++;
+            }
+
+            op = lz_write_sequence(op, anchor, ip - anchor, ip - match, match_length);
+            ip += match_length;
+            anchor = ip;
+
+            // Index a position inside the match too, so the next one is found sooner
+            if (ip - 2 >= base + dictionary_length && ip < match_start_limit) {
+                table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+            }
+        }
+    }
+
+    return lz_write_sequence(op, anchor, end - anchor, 0, 0) - out;
+}
+
+static bool lz_read_length(const uint8_t **ip, const uint8_t *end, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+kern_return_t lz_decompress_block(const uint8_t *block, size_t block_length, const uint8_t *dictionary, size_t dictionary_length, uint8_t *out, size_t length) {
+    const uint8_t *ip = block;
+    const uint8_t *block_end = block + block_length;
+    uint8_t *op = out;
+    uint8_t *out_end = out + length;
+
+    while (ip < block_end) {
+        uint8_t token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz_read_length(&ip, block_end, &literal_length)) {
+            return KERN_FAILURE;
+        }
+
+        if (literal_length > (size_t)(block_end - ip) || literal_length > (size_t)(out_end - op)) {
+            return KERN_FAILURE;
+        }
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == block_end) {
+            // The last sequence has no match
+            break;
+        }
+
+        if (block_end - ip < 2) {
+            return KERN_FAILURE;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !lz_read_length(&ip, block_end, &match_length)) {
+            return KERN_FAILURE;
+        }
+        match_length += LZ_MIN_MATCH;
+
+        size_t produced = op - out;
+        if (offset == 0 || offset > produced + dictionary_length || match_length > (size_t)(out_end - op)) {
+            return KERN_FAILURE;
+        }
+
+        if (offset > produced) {
+            // Starts in the dictionary, and may run on into the output
+            size_t from_dictionary = offset - produced;
+            const uint8_t *source = dictionary + dictionary_length - from_dictionary;
+            size_t count = from_dictionary < match_length ? from_dictionary : match_length;
+            memcpy(op, source, count);
+            op += count;
+            match_length -= count;
+            if (match_length == 0) {
+                continue;
+            }
+            offset = op - out;
+        }
+
+        const uint8_t *source = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, source, match_length);
+            op += match_length;
+        }
+        else {
+            // Overlapping copies repeat the last `offset` bytes
+            while (match_length-- > 0) {
+                *op++ = *source++;
+            }
+        }
+    }
+
+    return op == out_end ? KERN_SUCCESS : KERN_FAILURE;
+}
+
+stream_compressor_t *stream_compressor_create(void) {
+    return calloc(1, sizeof(stream_compressor_t));
+}
+
+void stream_compressor_free(stream_compressor_t *compressor) {
+    if (compressor == NULL) {
+        return;
+    }
+
+    output_buffer_free(&compressor->input);
+    output_buffer_free(&compressor->block);
+    free(compressor);
+}
+
+void append_compressed_stream_preamble(output_buffer_t *out) {
+    output_buffer_append(out, COMPRESSED_STREAM_MAGIC, COMPRESSED_STREAM_MAGIC_LENGTH);
+    output_buffer_append_char(out, COMPRESSED_STREAM_VERSION);
+}
+
+kern_return_t append_compressed_frame(stream_compressor_t *compressor, const struct iovec *spans, int count, output_buffer_t *out) {
+    if (compressor == NULL || (spans == NULL && count > 0) || out == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    output_buffer_t *input = &compressor->input;
+    output_buffer_reset(input);
+    output_buffer_append(input, compression_dictionary, COMPRESSION_DICTIONARY_LENGTH);
+    for (int i = 0; i < count; i++) {
+        output_buffer_append(input, spans[i].iov_base, spans[i].iov_len);
+    }
+
+    size_t raw_length = input->length - COMPRESSION_DICTIONARY_LENGTH;
+    if (raw_length > COMPRESSED_STREAM_MAX_FRAME_LENGTH) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    output_buffer_t *block = &compressor->block;
+    output_buffer_reset(block);
+    if (input->failed || !output_buffer_reserve(block, lz_compress_bound(raw_length))) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    block->length = lz_compress_block((const uint8_t *)input->data, COMPRESSION_DICTIONARY_LENGTH, raw_length, (uint8_t *)block->data);
+
+    bool compressed = block->length < raw_length;
+    const char *data = compressed ? block->data : input->data + COMPRESSION_DICTIONARY_LENGTH;
+    size_t data_length = compressed ? block->length : raw_length;
+
+    if (!output_buffer_reserve(out, COMPRESSED_FRAME_MAX_HEADER_LENGTH + data_length)) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    output_buffer_append_char(out, compressed ? COMPRESSED_FRAME_LZ : COMPRESSED_FRAME_STORED);
+    protocol_append_varint(out, raw_length);
+    protocol_append_varint(out, data_length);
+    output_buffer_append(out, data, data_length);
+    return out->failed ? KERN_RESOURCE_SHORTAGE : KERN_SUCCESS;
+}
+
+kern_return_t stream_decompress(stream_decompressor_t *decompressor, const uint8_t *data, size_t length, size_t *out_consumed, output_buffer_t *out) {
+    if (decompressor == NULL || (data == NULL && length > 0) || out_consumed == NULL || out == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    const uint8_t *position = data;
+    const uint8_t *end = data + length;
+    *out_consumed = 0;
+
+    if (!decompressor->read_preamble) {
+        if (length < COMPRESSED_STREAM_PREAMBLE_LENGTH) {
+            // Reject a bad prefix early rather than waiting for the rest of it
+            size_t available = length < COMPRESSED_STREAM_MAGIC_LENGTH ? length : COMPRESSED_STREAM_MAGIC_LENGTH;
+            return memcmp(data, COMPRESSED_STREAM_MAGIC, available) == 0 ? KERN_SUCCESS : KERN_INVALID_ARGUMENT;
+        }
+
+        if (memcmp(data, COMPRESSED_STREAM_MAGIC, COMPRESSED_STREAM_MAGIC_LENGTH) != 0 || data[COMPRESSED_STREAM_MAGIC_LENGTH] != COMPRESSED_STREAM_VERSION) {
+            return KERN_INVALID_ARGUMENT;
+        }
+
+        decompressor->read_preamble = true;
+        position += COMPRESSED_STREAM_PREAMBLE_LENGTH;
+        *out_consumed = COMPRESSED_STREAM_PREAMBLE_LENGTH;
+    }
+
+    while (position < end) {
+        const uint8_t *cursor = position;
+        uint8_t kind = *cursor++;
+        uint64_t raw_length = 0;
+        uint64_t data_length = 0;
+        if (!protocol_read_varint(&cursor, end, &raw_length) || !protocol_read_varint(&cursor, end, &data_length)) {
+            // A complete header is at most 21 bytes. Fewer than that may just be a partial read
+            return end - position >= COMPRESSED_FRAME_MAX_HEADER_LENGTH ? KERN_FAILURE : KERN_SUCCESS;
+        }
+
+        if (kind > COMPRESSED_FRAME_LZ || raw_length > COMPRESSED_STREAM_MAX_FRAME_LENGTH || data_length > COMPRESSED_STREAM_MAX_FRAME_LENGTH) {
+            return KERN_FAILURE;
+        }
+
+        if ((uint64_t)(end - cursor) < data_length) {
+            // Wait for the rest of the frame
+            return KERN_SUCCESS;
+        }
+
+        if (!output_buffer_reserve(out, raw_length)) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+
+        if (kind == COMPRESSED_FRAME_STORED) {
+            if (data_length != raw_length) {
+                return KERN_FAILURE;
+            }
+            memcpy(out->data + out->length, cursor, raw_length);
+        }
+        else if (lz_decompress_block(cursor, data_length, (const uint8_t *)compression_dictionary, COMPRESSION_DICTIONARY_LENGTH, (uint8_t *)out->data + out->length, raw_length) != KERN_SUCCESS) {
+            return KERN_FAILURE;
+        }
+        out->length += raw_length;
+        out->data[out->length] = '\0';
+
+        position = cursor + data_length;
+        *out_consumed = position - data;
+    }
+
+    return KERN_SUCCESS;
+}
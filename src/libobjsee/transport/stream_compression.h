@@ -0,0 +1,123 @@
+//
+//  stream_compression.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/8/25.
+//
+
+#ifndef STREAM_COMPRESSION_H
+#define STREAM_COMPRESSION_H
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "output_buffer.h"
+
+/*
+    Framed stream compression
+
+    Socket and file output can be wrapped in a compressed stream. It starts with an 8 byte preamble,
+    COMPRESSED_STREAM_MAGIC followed by a version byte, and continues as a sequence of frames:
+
+        u8 kind             COMPRESSED_FRAME_*
+        varint raw length   Length once decompressed
+        varint length       Length of the frame's data
+        data
+
+    Each frame holds one batch from the transport and is compressed on its own, so a reader can start
+    decoding at any frame boundary. Frames use the LZ4 block format, with a built-in dictionary of
+    common class name prefixes, selectors and json keys in front of every block. Matches may reach back
+    into it, which is what makes small batches worth compressing. A frame that wouldn't get smaller is stored as-is.
+
+    What's inside is the stream that would otherwise have been sent: binary protocol records or lines of text.
+*/
+
+#define COMPRESSED_STREAM_MAGIC "\0OBJSLZ"
+#define COMPRESSED_STREAM_MAGIC_LENGTH 7
+#define COMPRESSED_STREAM_VERSION 1
+#define COMPRESSED_STREAM_PREAMBLE_LENGTH (COMPRESSED_STREAM_MAGIC_LENGTH + 1)
+
+// Largest frame a decompressor will accept, before or after decompression. Anything bigger is treated as corruption
+#define COMPRESSED_STREAM_MAX_FRAME_LENGTH (16 * 1024 * 1024)
+
+typedef enum {
+    COMPRESSED_FRAME_STORED = 0,
+    COMPRESSED_FRAME_LZ = 1,
+} compressed_frame_kind_t;
+
+typedef struct stream_compressor stream_compressor_t;
+
+/**
+ * @brief Per-stream decompressor state. Zero-initialize before first use
+ */
+typedef struct {
+    bool read_preamble;
+} stream_decompressor_t;
+
+
+stream_compressor_t *stream_compressor_create(void);
+void stream_compressor_free(stream_compressor_t *compressor);
+
+/**
+ * @brief Append the stream preamble. This must be sent once, before any frames
+ */
+void append_compressed_stream_preamble(output_buffer_t *out);
+
+/**
+ * @brief Compress a batch into a single frame
+ *
+ * @param compressor The compressor. It keeps scratch space between calls, so it must only be used by one thread at a time
+ * @param spans The batch, which may be spread over several buffers
+ * @param count Number of spans
+ * @param out The buffer to append the frame to
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the batch is too large for one frame,
+ * or KERN_RESOURCE_SHORTAGE if a buffer could not grow
+ */
+kern_return_t append_compressed_frame(stream_compressor_t *compressor, const struct iovec *spans, int count, output_buffer_t *out);
+
+
+/**
+ * @brief Decompress as many complete frames as are available
+ *
+ * @param decompressor The decompressor
+ * @param data Stream bytes, starting at the first byte not yet consumed
+ * @param length Number of bytes available
+ * @param out_consumed Receives the number of bytes consumed. Unconsumed bytes belong to an incomplete frame
+ * and must be passed again once more data has arrived
+ * @param out The buffer to append decompressed bytes to
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the stream doesn't start with a supported preamble,
+ * KERN_FAILURE if the stream is corrupt, or KERN_RESOURCE_SHORTAGE if `out` could not grow
+ */
+kern_return_t stream_decompress(stream_decompressor_t *decompressor, const uint8_t *data, size_t length, size_t *out_consumed, output_buffer_t *out);
+
+
+/**
+ * @brief Compress one block in the LZ4 block format
+ *
+ * @param base The dictionary followed immediately by the data to compress
+ * @param dictionary_length Length of the dictionary at `base`. Matches may refer back into it
+ * @param length Length of the data after the dictionary
+ * @param out Where to write the block. Must have room for lz_compress_bound(length) bytes
+ * @return The length of the block
+ */
+size_t lz_compress_block(const uint8_t *base, size_t dictionary_length, size_t length, uint8_t *out);
+
+/**
+ * @brief Largest block lz_compress_block can produce for `length` bytes of input
+ */
+size_t lz_compress_bound(size_t length);
+
+/**
+ * @brief Decompress one block produced by lz_compress_block
+ *
+ * @param block The block
+ * @param block_length Length of the block
+ * @param dictionary The dictionary it was compressed with, or NULL
+ * @param dictionary_length Length of the dictionary
+ * @param out Where to write the data
+ * @param length Exact length of the data once decompressed
+ * @return KERN_SUCCESS, or KERN_FAILURE if the block is corrupt or doesn't decompress to exactly `length` bytes
+ */
+kern_return_t lz_decompress_block(const uint8_t *block, size_t block_length, const uint8_t *dictionary, size_t dictionary_length, uint8_t *out, size_t length);
+
+#endif // STREAM_COMPRESSION_H
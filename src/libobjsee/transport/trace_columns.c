@@ -0,0 +1,686 @@
+//
+//  trace_columns.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "event_protocol.h"
+#include "trace_columns.h"
+
+// Full blocks held back, waiting for the durations of their calls, before they're written regardless
+#define COLUMNS_PENDING_BLOCKS 4
+#define COLUMNS_BLOCK_SLOTS (COLUMNS_PENDING_BLOCKS + 1)
+
+typedef struct {
+    uint32_t count;
+    // Rows whose call hasn't returned yet
+    uint32_t unresolved;
+    uint64_t *timestamps;
+    uint64_t *durations;
+    uint32_t *classes;
+    uint32_t *selectors;
+    uint32_t *threads;
+    uint32_t *depths;
+    // Names first used in this block
+    output_buffer_t class_names;
+    uint32_t new_class_count;
+    output_buffer_t selector_names;
+    uint32_t new_selector_count;
+} column_block_t;
+
+typedef struct {
+    uint64_t block;                 // Sequence number of the block the call is in
+    uint32_t row;
+    uint32_t depth;
+    uint64_t timestamp;
+} open_call_t;
+
+typedef struct {
+    uint32_t stream_id;
+    open_call_t *calls;
+    size_t count;
+    size_t capacity;
+} column_thread_t;
+
+typedef struct {
+    const char **keys;
+    uint32_t *ids;
+    size_t capacity;
+    size_t count;
+} name_ids_t;
+
+struct trace_column_writer {
+    int fd;
+    bool failed;
+    // Blocks first_block through current_block are in memory, in block_slots[sequence % COLUMNS_BLOCK_SLOTS]
+    column_block_t block_slots[COLUMNS_BLOCK_SLOTS];
+    uint64_t first_block;
+    uint64_t current_block;
+    column_thread_t *threads;
+    size_t thread_count;
+    size_t thread_capacity;
+    name_ids_t classes;
+    name_ids_t selectors;
+    output_buffer_t encoded;
+};
+
+static size_t hash_pointer(const void *pointer) {
+    uint64_t value = (uint64_t)(uintptr_t)pointer * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(value ^ (value >> 32));
+}
+
+static bool name_ids_grow(name_ids_t *table) {
+    size_t new_capacity = table->capacity ? table->capacity * 2 : 1024;
+    const char **keys = calloc(new_capacity, sizeof(const char *));
+    uint32_t *ids = calloc(new_capacity, sizeof(uint32_t));
+    if (keys == NULL || ids == NULL) {
+        free(keys);
+        free(ids);
+        return false;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->keys[i] == NULL) {
+            continue;
+        }
+
+        size_t index = hash_pointer(table->keys[i]) & (new_capacity - 1);
+        while (keys[index] != NULL) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        keys[index] = table->keys[i];
+        ids[index] = table->ids[i];
+    }
+
+    free(table->keys);
+    free(table->ids);
+    table->keys = keys;
+    table->ids = ids;
+    table->capacity = new_capacity;
+    return true;
+}
+
+// Look up a name's id, giving it the next one and listing it in `names` if it's new. UINT32_MAX if memory ran out
+static uint32_t name_id(name_ids_t *table, const char *name, output_buffer_t *names, uint32_t *new_count) {
+    if ((table->count + 1) * 2 > table->capacity && !name_ids_grow(table)) {
+        return UINT32_MAX;
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t index = hash_pointer(name) & mask;
+    while (table->keys[index] != NULL) {
+        if (table->keys[index] == name) {
+            return table->ids[index];
+        }
+        index = (index + 1) & mask;
+    }
+
+    output_buffer_append(names, name, strlen(name) + 1);
+    if (names->failed) {
+        return UINT32_MAX;
+    }
+
+    table->keys[index] = name;
+    table->ids[index] = (uint32_t)table->count++;
+    (*new_count)++;
+    return table->ids[index];
+}
+
+static column_block_t *block_for_sequence(trace_column_writer_t *writer, uint64_t sequence) {
+    return &writer->block_slots[sequence % COLUMNS_BLOCK_SLOTS];
+}
+
+static column_thread_t *column_thread(trace_column_writer_t *writer, uint32_t stream_id) {
+    for (size_t i = 0; i < writer->thread_count; i++) {
+        if (writer->threads[i].stream_id == stream_id) {
+            return &writer->threads[i];
+        }
+    }
+
+    if (writer->thread_count == writer->thread_capacity) {
+        size_t new_capacity = writer->thread_capacity ? writer->thread_capacity * 2 : 16;
+        column_thread_t *threads = realloc(writer->threads, new_capacity * sizeof(column_thread_t));
+        if (threads == NULL) {
+            return NULL;
+        }
+        writer->threads = threads;
+        writer->thread_capacity = new_capacity;
+    }
+
+    column_thread_t *thread = &writer->threads[writer->thread_count++];
+    memset(thread, 0, sizeof(*thread));
+    thread->stream_id = stream_id;
+    return thread;
+}
+
+static bool write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+static void append_ids(output_buffer_t *out, const uint32_t *ids, uint32_t count, column_extent_t *extent) {
+    uint32_t largest = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        largest = ids[i] > largest ? ids[i] : largest;
+    }
+    extent->width = largest <= UINT8_MAX ? 1 : largest <= UINT16_MAX ? 2 : 4;
+
+    if (!output_buffer_reserve(out, (size_t)count * extent->width)) {
+        return;
+    }
+
+    uint8_t *packed = (uint8_t *)out->data + out->length;
+    for (uint32_t i = 0; i < count; i++) {
+        // Little-endian, whatever the width
+        for (uint32_t byte = 0; byte < extent->width; byte++) {
+            packed[i * extent->width + byte] = (uint8_t)(ids[i] >> (byte * 8));
+        }
+    }
+    out->length += (size_t)count * extent->width;
+    out->data[out->length] = '\0';
+}
+
+static void append_runs(output_buffer_t *out, const uint32_t *values, uint32_t count) {
+    for (uint32_t i = 0; i < count;) {
+        uint32_t run = 1;
+        while (i + run < count && values[i + run] == values[i]) {
+            run++;
+        }
+        protocol_append_varint(out, values[i]);
+        protocol_append_varint(out, run);
+        i += run;
+    }
+}
+
+static kern_return_t write_block(trace_column_writer_t *writer, column_block_t *block) {
+    column_block_header_t header = {
+        .magic = COLUMNS_BLOCK_MAGIC,
+        .event_count = block->count,
+        .first_timestamp = UINT64_MAX,
+        .new_class_count = block->new_class_count,
+        .new_selector_count = block->new_selector_count,
+    };
+    header.names_length = (uint32_t)(block->class_names.length + block->selector_names.length);
+
+    output_buffer_t *encoded = &writer->encoded;
+    output_buffer_reset(encoded);
+    size_t data_offset = sizeof(header) + header.names_length;
+
+    for (trace_column_t column = 0; column < TRACE_COLUMN_COUNT; column++) {
+        size_t start = encoded->length;
+        switch (column) {
+            case TRACE_COLUMN_TIMESTAMP: {
+                uint64_t previous = 0;
+                for (uint32_t i = 0; i < block->count; i++) {
+                    uint64_t timestamp = block->timestamps[i];
+                    header.first_timestamp = timestamp < header.first_timestamp ? timestamp : header.first_timestamp;
+                    header.last_timestamp = timestamp > header.last_timestamp ? timestamp : header.last_timestamp;
+                    protocol_append_varint(encoded, protocol_zigzag_encode((int64_t)(timestamp - previous)));
+                    previous = timestamp;
+                }
+                break;
+            }
+            case TRACE_COLUMN_DURATION:
+                for (uint32_t i = 0; i < block->count; i++) {
+                    protocol_append_varint(encoded, block->durations[i]);
+                }
+                break;
+            case TRACE_COLUMN_CLASS:
+                append_ids(encoded, block->classes, block->count, &header.columns[column]);
+                break;
+            case TRACE_COLUMN_SELECTOR:
+                append_ids(encoded, block->selectors, block->count, &header.columns[column]);
+                break;
+            case TRACE_COLUMN_THREAD:
+                append_runs(encoded, block->threads, block->count);
+                break;
+            case TRACE_COLUMN_DEPTH:
+                append_runs(encoded, block->depths, block->count);
+                break;
+            default:
+                break;
+        }
+        header.columns[column].offset = (uint32_t)(data_offset + start);
+        header.columns[column].length = (uint32_t)(encoded->length - start);
+    }
+
+    if (encoded->failed) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    if (block->count == 0) {
+        header.first_timestamp = 0;
+    }
+
+    static const uint8_t padding[8] = {0};
+    size_t length = data_offset + encoded->length;
+    size_t padding_length = (8 - length % 8) % 8;
+    header.block_length = (uint32_t)(length + padding_length);
+    struct iovec iov[] = {
+        { &header, sizeof(header) },
+        { block->class_names.data, block->class_names.length },
+        { block->selector_names.data, block->selector_names.length },
+        { encoded->data, encoded->length },
+        { (void *)padding, padding_length },
+    };
+    if (!write_all(writer->fd, iov, sizeof(iov) / sizeof(iov[0]))) {
+        writer->failed = true;
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+static void reset_block(column_block_t *block) {
+    block->count = 0;
+    block->unresolved = 0;
+    block->new_class_count = 0;
+    block->new_selector_count = 0;
+    output_buffer_reset(&block->class_names);
+    output_buffer_reset(&block->selector_names);
+}
+
+// Write out the oldest blocks once their durations are all known, or once too many are waiting
+static kern_return_t write_ready_blocks(trace_column_writer_t *writer, bool everything) {
+    while (writer->first_block < writer->current_block) {
+        column_block_t *block = block_for_sequence(writer, writer->first_block);
+        if (!everything && block->unresolved > 0 && writer->current_block - writer->first_block <= COLUMNS_PENDING_BLOCKS) {
+            break;
+        }
+
+        kern_return_t kr = write_block(writer, block);
+        if (kr != KERN_SUCCESS) {
+            return kr;
+        }
+        reset_block(block);
+        writer->first_block++;
+    }
+    return KERN_SUCCESS;
+}
+
+static columns_header_t make_header(uint16_t flags, uint16_t main_thread_id) {
+    columns_header_t header = {
+        .version = COLUMNS_VERSION,
+        .header_length = sizeof(columns_header_t),
+        .flags = flags,
+        .main_thread_id = main_thread_id,
+    };
+    memcpy(header.magic, COLUMNS_MAGIC, COLUMNS_MAGIC_LENGTH);
+    return header;
+}
+
+trace_column_writer_t *trace_column_writer_create(const char *path) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    trace_column_writer_t *writer = calloc(1, sizeof(trace_column_writer_t));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    // Every column of every slot in one allocation
+    size_t row_size = 2 * sizeof(uint64_t) + 4 * sizeof(uint32_t);
+    uint8_t *storage = malloc(COLUMNS_BLOCK_SLOTS * COLUMNS_BLOCK_EVENTS * row_size);
+    if (storage == NULL) {
+        free(writer);
+        return NULL;
+    }
+
+    for (int i = 0; i < COLUMNS_BLOCK_SLOTS; i++) {
+        column_block_t *block = &writer->block_slots[i];
+        block->timestamps = (uint64_t *)storage;
+        block->durations = block->timestamps + COLUMNS_BLOCK_EVENTS;
+        block->classes = (uint32_t *)(block->durations + COLUMNS_BLOCK_EVENTS);
+        block->selectors = block->classes + COLUMNS_BLOCK_EVENTS;
+        block->threads = block->selectors + COLUMNS_BLOCK_EVENTS;
+        block->depths = block->threads + COLUMNS_BLOCK_EVENTS;
+        storage += COLUMNS_BLOCK_EVENTS * row_size;
+    }
+
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    columns_header_t header = make_header(0, 0);
+    struct iovec iov = { &header, sizeof(header) };
+    if (writer->fd < 0 || !write_all(writer->fd, &iov, 1)) {
+        if (writer->fd >= 0) {
+            close(writer->fd);
+        }
+        free(writer->block_slots[0].timestamps);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+kern_return_t trace_column_writer_add_event(trace_column_writer_t *writer, const tracer_event_t *event) {
+    if (writer == NULL || event == NULL || event->class_name == NULL || event->method_name == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    if (writer->failed) {
+        return KERN_FAILURE;
+    }
+
+    column_block_t *block = block_for_sequence(writer, writer->current_block);
+    column_thread_t *thread = column_thread(writer, event->stream_id);
+    uint32_t class_id = name_id(&writer->classes, event->class_name, &block->class_names, &block->new_class_count);
+    uint32_t selector_id = name_id(&writer->selectors, event->method_name, &block->selector_names, &block->new_selector_count);
+    if (thread == NULL || class_id == UINT32_MAX || selector_id == UINT32_MAX) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    if (thread->count == thread->capacity) {
+        size_t new_capacity = thread->capacity ? thread->capacity * 2 : 64;
+        open_call_t *calls = realloc(thread->calls, new_capacity * sizeof(open_call_t));
+        if (calls == NULL) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+        thread->calls = calls;
+        thread->capacity = new_capacity;
+    }
+
+    // Calls at this depth or deeper on the same thread have returned by now
+    uint32_t depth = event->trace_depth;
+    while (thread->count > 0 && thread->calls[thread->count - 1].depth >= depth) {
+        open_call_t *call = &thread->calls[--thread->count];
+        if (call->block >= writer->first_block) {
+            column_block_t *call_block = block_for_sequence(writer, call->block);
+            call_block->durations[call->row] = event->timestamp > call->timestamp ? event->timestamp - call->timestamp : 0;
+            call_block->unresolved--;
+        }
+    }
+
+    uint32_t row = block->count++;
+    block->timestamps[row] = event->timestamp;
+    block->durations[row] = 0;
+    block->classes[row] = class_id;
+    block->selectors[row] = selector_id;
+    block->threads[row] = event->thread_id;
+    block->depths[row] = depth;
+    block->unresolved++;
+    thread->calls[thread->count++] = (open_call_t){
+        .block = writer->current_block,
+        .row = row,
+        .depth = depth,
+        .timestamp = event->timestamp,
+    };
+
+    if (block->count < COLUMNS_BLOCK_EVENTS) {
+        return KERN_SUCCESS;
+    }
+
+    writer->current_block++;
+    return write_ready_blocks(writer, false);
+}
+
+kern_return_t trace_column_writer_set_main_thread(trace_column_writer_t *writer, uint16_t thread_id) {
+    if (writer == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    if (writer->failed) {
+        return KERN_FAILURE;
+    }
+
+    // pwrite leaves the file position alone, so blocks carry on from where they were
+    columns_header_t header = make_header(COLUMNS_FLAG_MAIN_THREAD, thread_id);
+    if (pwrite(writer->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        writer->failed = true;
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t trace_column_writer_close(trace_column_writer_t *writer) {
+    if (writer == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    kern_return_t kr = KERN_FAILURE;
+    if (!writer->failed) {
+        if (block_for_sequence(writer, writer->current_block)->count > 0) {
+            writer->current_block++;
+        }
+        kr = write_ready_blocks(writer, true);
+    }
+
+    if (close(writer->fd) != 0 && kr == KERN_SUCCESS) {
+        kr = KERN_FAILURE;
+    }
+
+    for (int i = 0; i < COLUMNS_BLOCK_SLOTS; i++) {
+        output_buffer_free(&writer->block_slots[i].class_names);
+        output_buffer_free(&writer->block_slots[i].selector_names);
+    }
+    for (size_t i = 0; i < writer->thread_count; i++) {
+        free(writer->threads[i].calls);
+    }
+    free(writer->block_slots[0].timestamps);
+    free(writer->threads);
+    free(writer->classes.keys);
+    free(writer->classes.ids);
+    free(writer->selectors.keys);
+    free(writer->selectors.ids);
+    output_buffer_free(&writer->encoded);
+    free(writer);
+    return kr;
+}
+
+
+bool trace_columns_matches(const uint8_t *file, size_t size) {
+    return size >= sizeof(columns_header_t) && memcmp(file, COLUMNS_MAGIC, COLUMNS_MAGIC_LENGTH) == 0;
+}
+
+static bool append_names(const char ***names, uint32_t *count, size_t *capacity, const char **cursor, const char *end, uint32_t new_count) {
+    for (uint32_t i = 0; i < new_count; i++) {
+        const char *terminator = *cursor < end ? memchr(*cursor, '\0', end - *cursor) : NULL;
+        if (terminator == NULL) {
+            return false;
+        }
+
+        if (*count == *capacity) {
+            size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+            const char **grown = realloc(*names, new_capacity * sizeof(const char *));
+            if (grown == NULL) {
+                return false;
+            }
+            *names = grown;
+            *capacity = new_capacity;
+        }
+
+        (*names)[(*count)++] = *cursor;
+        *cursor = terminator + 1;
+    }
+    return true;
+}
+
+static bool block_is_valid(const column_block_header_t *block, size_t available) {
+    if (available < sizeof(*block) || block->magic != COLUMNS_BLOCK_MAGIC || block->block_length < sizeof(*block) ||
+        block->block_length > available || block->block_length % 8 != 0 || block->names_length > block->block_length - sizeof(*block)) {
+        return false;
+    }
+
+    for (trace_column_t column = 0; column < TRACE_COLUMN_COUNT; column++) {
+        const column_extent_t *extent = &block->columns[column];
+        if (extent->offset > block->block_length || extent->length > block->block_length - extent->offset) {
+            return false;
+        }
+    }
+
+    // Packed ids are the only columns with a fixed size
+    for (trace_column_t column = TRACE_COLUMN_CLASS; column <= TRACE_COLUMN_SELECTOR; column++) {
+        const column_extent_t *extent = &block->columns[column];
+        if ((extent->width != 1 && extent->width != 2 && extent->width != 4) || extent->length != (uint64_t)extent->width * block->event_count) {
+            return false;
+        }
+    }
+    return block->event_count <= COLUMNS_BLOCK_EVENTS;
+}
+
+trace_columns_t *trace_columns_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(columns_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)file_stat.st_size;
+    const uint8_t *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    columns_header_t header;
+    memcpy(&header, base, sizeof(header));
+    trace_columns_t *columns = calloc(1, sizeof(trace_columns_t));
+    if (columns == NULL || !trace_columns_matches(base, size) || header.version != COLUMNS_VERSION ||
+        header.header_length < sizeof(header) || header.header_length > size || header.header_length % 8 != 0) {
+        munmap((void *)base, size);
+        free(columns);
+        return NULL;
+    }
+    columns->base = base;
+    columns->size = size;
+    columns->has_main_thread = (header.flags & COLUMNS_FLAG_MAIN_THREAD) != 0;
+    columns->main_thread_id = header.main_thread_id;
+
+    size_t block_capacity = 0;
+    size_t class_capacity = 0;
+    size_t selector_capacity = 0;
+    // Stop at the first block that's missing or cut short
+    for (size_t offset = header.header_length; block_is_valid((const column_block_header_t *)(base + offset), size - offset);) {
+        const column_block_header_t *block = (const column_block_header_t *)(base + offset);
+        const char *names = (const char *)(block + 1);
+        const char *names_end = names + block->names_length;
+        if (!append_names(&columns->class_names, &columns->class_count, &class_capacity, &names, names_end, block->new_class_count) ||
+            !append_names(&columns->selectors, &columns->selector_count, &selector_capacity, &names, names_end, block->new_selector_count)) {
+            break;
+        }
+
+        if (columns->block_count == block_capacity) {
+            block_capacity = block_capacity ? block_capacity * 2 : 64;
+            const column_block_header_t **blocks = realloc(columns->blocks, block_capacity * sizeof(column_block_header_t *));
+            if (blocks == NULL) {
+                trace_columns_close(columns);
+                return NULL;
+            }
+            columns->blocks = blocks;
+        }
+
+        columns->blocks[columns->block_count++] = block;
+        columns->event_count += block->event_count;
+        offset += block->block_length;
+    }
+    return columns;
+}
+
+void trace_columns_close(trace_columns_t *columns) {
+    if (columns == NULL) {
+        return;
+    }
+
+    munmap((void *)columns->base, columns->size);
+    free(columns->blocks);
+    free(columns->class_names);
+    free(columns->selectors);
+    free(columns);
+}
+
+kern_return_t trace_columns_decode_u32(const column_block_header_t *block, trace_column_t column, uint32_t *out) {
+    if (column != TRACE_COLUMN_CLASS && column != TRACE_COLUMN_SELECTOR && column != TRACE_COLUMN_THREAD && column != TRACE_COLUMN_DEPTH) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    const column_extent_t *extent = &block->columns[column];
+    const uint8_t *data = (const uint8_t *)block + extent->offset;
+    uint32_t count = block->event_count;
+    if (column == TRACE_COLUMN_CLASS || column == TRACE_COLUMN_SELECTOR) {
+        if (extent->width == 1) {
+            for (uint32_t i = 0; i < count; i++) {
+                out[i] = data[i];
+            }
+        }
+        else if (extent->width == 2) {
+            for (uint32_t i = 0; i < count; i++) {
+                out[i] = (uint32_t)data[i * 2] | ((uint32_t)data[i * 2 + 1] << 8);
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < count; i++) {
+                const uint8_t *value = data + i * 4;
+                out[i] = (uint32_t)value[0] | ((uint32_t)value[1] << 8) | ((uint32_t)value[2] << 16) | ((uint32_t)value[3] << 24);
+            }
+        }
+        return KERN_SUCCESS;
+    }
+
+    const uint8_t *cursor = data;
+    const uint8_t *end = data + extent->length;
+    uint32_t filled = 0;
+    while (filled < count) {
+        uint64_t value = 0;
+        uint64_t run = 0;
+        if (!protocol_read_varint(&cursor, end, &value) || !protocol_read_varint(&cursor, end, &run) || run == 0 || run > count - filled) {
+            return KERN_FAILURE;
+        }
+        for (uint64_t i = 0; i < run; i++) {
+            out[filled++] = (uint32_t)value;
+        }
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t trace_columns_decode_u64(const column_block_header_t *block, trace_column_t column, uint64_t *out) {
+    if (column != TRACE_COLUMN_TIMESTAMP && column != TRACE_COLUMN_DURATION) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    const column_extent_t *extent = &block->columns[column];
+    const uint8_t *cursor = (const uint8_t *)block + extent->offset;
+    const uint8_t *end = cursor + extent->length;
+    uint64_t previous = 0;
+    for (uint32_t i = 0; i < block->event_count; i++) {
+        uint64_t value = 0;
+        if (!protocol_read_varint(&cursor, end, &value)) {
+            return KERN_FAILURE;
+        }
+
+        if (column == TRACE_COLUMN_TIMESTAMP) {
+            previous += (uint64_t)protocol_zigzag_decode(value);
+            value = previous;
+        }
+        out[i] = value;
+    }
+    return KERN_SUCCESS;
+}
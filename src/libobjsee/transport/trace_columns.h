@@ -0,0 +1,169 @@
+//
+//  trace_columns.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#ifndef TRACE_COLUMNS_H
+#define TRACE_COLUMNS_H
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "tracer_types.h"
+
+/*
+    Columnar trace storage
+
+    For analysis, where only a few fields of every event are read. Events are stored in blocks of up to
+    COLUMNS_BLOCK_EVENTS, and each block stores every column separately, so a reader decodes only the
+    columns it needs:
+
+        columns_header_t
+        block               column_block_header_t
+                            Class names, then selectors, first used in this block. Each NUL-terminated
+                            Each column, where the header's extents say
+                            Padding to 8 bytes
+        block ...
+
+    Columns and their encodings:
+
+        TIMESTAMP           Zigzag varint delta from the previous event in the block (the first from 0)
+        DURATION            Varint. Time until the thread's next event at the same or a shallower depth, so an
+                            upper bound on how long the call ran. 0 if the call was still running when the
+                            block was written
+        CLASS, SELECTOR     Dictionary ids, packed at the smallest byte width that holds the block's largest id
+        THREAD, DEPTH       Runs of (varint value, varint length)
+
+    Ids index a dictionary that grows through the file: each block lists the names it uses for the first time,
+    and ids are assigned in the order names appear. Blocks are only appended, so a file that was never
+    closed can be read up to its last complete block.
+*/
+
+#define COLUMNS_MAGIC "\0OBJCOL"
+#define COLUMNS_MAGIC_LENGTH 7
+#define COLUMNS_VERSION 1
+#define COLUMNS_BLOCK_MAGIC 0x4b4c4243     // 'CBLK'
+#define COLUMNS_BLOCK_EVENTS 65536
+
+// columns_header_t flags
+#define COLUMNS_FLAG_MAIN_THREAD        (1 << 0)    // main_thread_id is set
+
+typedef enum {
+    TRACE_COLUMN_TIMESTAMP,
+    TRACE_COLUMN_DURATION,
+    TRACE_COLUMN_CLASS,
+    TRACE_COLUMN_SELECTOR,
+    TRACE_COLUMN_THREAD,
+    TRACE_COLUMN_DEPTH,
+    TRACE_COLUMN_COUNT,
+} trace_column_t;
+
+typedef struct {
+    char magic[COLUMNS_MAGIC_LENGTH];
+    uint8_t version;
+    uint32_t header_length;         // Offset of the first block
+    uint16_t flags;                 // COLUMNS_FLAG_*
+    uint16_t main_thread_id;        // The traced process's main thread, if COLUMNS_FLAG_MAIN_THREAD
+} columns_header_t;
+
+typedef struct {
+    uint32_t offset;                // From the start of the block
+    uint32_t length;
+    uint32_t width;                 // Bytes per id, for CLASS and SELECTOR
+    uint32_t reserved;
+} column_extent_t;
+
+typedef struct {
+    uint32_t magic;                 // COLUMNS_BLOCK_MAGIC
+    uint32_t block_length;          // Everything up to the next block
+    uint32_t event_count;
+    uint32_t names_length;          // Bytes of names after the header
+    // Earliest and latest event, CLOCK_UPTIME_RAW nanoseconds
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    // Names first used in this block, which follow the header
+    uint32_t new_class_count;
+    uint32_t new_selector_count;
+    column_extent_t columns[TRACE_COLUMN_COUNT];
+} column_block_header_t;
+
+
+typedef struct trace_column_writer trace_column_writer_t;
+
+/**
+ * @brief Create a columnar trace, replacing anything at `path`
+ * @return The writer, or NULL if the file couldn't be created
+ */
+trace_column_writer_t *trace_column_writer_create(const char *path);
+
+/**
+ * @brief Add an event. Blocks are written once they're full and their calls' durations are known
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the event has no class or selector,
+ * KERN_RESOURCE_SHORTAGE if memory ran out, or KERN_FAILURE if writing failed
+ * @note Class names and selectors are keyed by pointer, like in the binary encoder, so they must not change for
+ * the life of the writer. Threads are told apart by stream_id. Events from an event_decoder_t are fine as they are
+ */
+kern_return_t trace_column_writer_add_event(trace_column_writer_t *writer, const tracer_event_t *event);
+
+/**
+ * @brief Record which thread is the traced process's main thread. The header is rewritten straight away,
+ * so a file that's never closed still has it
+ * @return KERN_SUCCESS, or KERN_FAILURE if the header couldn't be written
+ */
+kern_return_t trace_column_writer_set_main_thread(trace_column_writer_t *writer, uint16_t thread_id);
+
+/**
+ * @brief Write every remaining block and release the writer
+ * @return KERN_SUCCESS, or KERN_FAILURE if anything couldn't be written
+ */
+kern_return_t trace_column_writer_close(trace_column_writer_t *writer);
+
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    const column_block_header_t **blocks;
+    size_t block_count;
+    uint64_t event_count;
+    // Indexed by id
+    const char **class_names;
+    uint32_t class_count;
+    const char **selectors;
+    uint32_t selector_count;
+    // Whether the file says which thread is main, and which one it is
+    bool has_main_thread;
+    uint16_t main_thread_id;
+} trace_columns_t;
+
+/**
+ * @brief Map a columnar trace and read its dictionaries
+ * @return The trace, or NULL if it can't be read or isn't a columnar trace
+ * @note Blocks are validated here, so decoding them later can't read outside the file
+ */
+trace_columns_t *trace_columns_open(const char *path);
+void trace_columns_close(trace_columns_t *columns);
+
+/**
+ * @brief Whether `file` starts like a columnar trace
+ */
+bool trace_columns_matches(const uint8_t *file, size_t size);
+
+/**
+ * @brief Decode one of a block's id, thread or depth columns
+ * @param block The block
+ * @param column TRACE_COLUMN_CLASS, TRACE_COLUMN_SELECTOR, TRACE_COLUMN_THREAD or TRACE_COLUMN_DEPTH
+ * @param out Receives event_count values
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT for a 64-bit column, or KERN_FAILURE if the column is corrupt
+ */
+kern_return_t trace_columns_decode_u32(const column_block_header_t *block, trace_column_t column, uint32_t *out);
+
+/**
+ * @brief Decode a block's timestamp or duration column
+ * @param out Receives event_count values
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT for a 32-bit column, or KERN_FAILURE if the column is corrupt
+ */
+kern_return_t trace_columns_decode_u64(const column_block_header_t *block, trace_column_t column, uint64_t *out);
+
+#endif // TRACE_COLUMNS_H
@@ -0,0 +1,520 @@
+//
+//  trace_export.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+#include "json_writer.h"
+#include "output_buffer.h"
+#include "trace_export.h"
+
+// Output is written to the file whenever this much has built up
+#define EXPORT_FLUSH_SIZE (1024 * 1024)
+// Deeper events are rejected rather than growing a thread's open slices without bound
+#define EXPORT_MAX_DEPTH 4096
+#define EXPORT_MIN_THREADS 64
+// Everything is attributed to one process, since a trace only ever comes from one
+#define EXPORT_PID 1
+
+// Perfetto field numbers, from protos/perfetto/trace
+#define TRACE_PACKET_FIELD 1
+#define PACKET_TIMESTAMP 8
+#define PACKET_SEQUENCE_ID 10
+#define PACKET_TRACK_EVENT 11
+#define PACKET_INTERNED_DATA 12
+#define PACKET_SEQUENCE_FLAGS 13
+#define PACKET_TRACK_DESCRIPTOR 60
+#define TRACK_EVENT_TYPE 9
+#define TRACK_EVENT_NAME_IID 10
+#define TRACK_EVENT_TRACK_UUID 11
+#define TRACK_DESCRIPTOR_UUID 1
+#define TRACK_DESCRIPTOR_PROCESS 3
+#define TRACK_DESCRIPTOR_THREAD 4
+#define TRACK_DESCRIPTOR_PARENT_UUID 5
+#define PROCESS_PID 1
+#define PROCESS_NAME 6
+#define THREAD_PID 1
+#define THREAD_TID 2
+#define THREAD_NAME 5
+#define INTERNED_EVENT_NAMES 2
+#define EVENT_NAME_IID 1
+#define EVENT_NAME_NAME 2
+
+#define SEQ_INCREMENTAL_STATE_CLEARED 1
+#define SEQ_NEEDS_INCREMENTAL_STATE 2
+#define SLICE_BEGIN 1
+#define SLICE_END 2
+
+#define WIRE_VARINT 0
+#define WIRE_LENGTH 2
+
+// Every packet is from one writer, so they share a sequence and its interned names
+#define EXPORT_SEQUENCE_ID 1
+#define PROCESS_TRACK_UUID 1
+#define THREAD_TRACK_UUID(_stream_id) (0x10000ULL + (_stream_id))
+
+// Threads are exported by stream id, which is also their tid, so two threads that share a thread id still get
+// tracks of their own. The thread id is only used in the track's name
+typedef struct {
+    uint32_t stream_id;
+    uint16_t thread_id;
+    // Depths of the calls that haven't ended, shallowest first
+    uint32_t *depths;
+    uint32_t count;
+    uint32_t capacity;
+} export_thread_t;
+
+typedef struct {
+    const char *class_name;
+    const char *method_name;
+    bool is_class_method;
+    uint64_t iid;
+} name_entry_t;
+
+struct trace_exporter {
+    int fd;
+    trace_export_format_t format;
+    bool failed;
+    bool wrote_event;
+    uint64_t last_timestamp;
+    output_buffer_t out;
+    // Open addressed, keyed by stream id
+    export_thread_t **threads;
+    size_t thread_capacity;
+    // The same threads, in the order they were first seen
+    export_thread_t **thread_order;
+    size_t thread_count;
+    // Perfetto names, by class, selector and kind
+    name_entry_t *names;
+    size_t name_capacity;
+    size_t name_count;
+    // Perfetto messages are built inside out, then copied into the one around them
+    output_buffer_t packet;
+    output_buffer_t message;
+    output_buffer_t inner;
+};
+
+trace_export_format_t trace_export_format_for_path(const char *path) {
+    size_t length = path ? strlen(path) : 0;
+    if (length >= 5 && strcmp(path + length - 5, ".json") == 0) {
+        return TRACE_EXPORT_CHROME_JSON;
+    }
+    return TRACE_EXPORT_PERFETTO;
+}
+
+static bool flush_output(trace_exporter_t *exporter) {
+    const char *data = exporter->out.data;
+    size_t remaining = exporter->out.length;
+    while (remaining > 0) {
+        ssize_t written = write(exporter->fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            exporter->failed = true;
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    output_buffer_reset(&exporter->out);
+    return true;
+}
+
+static void pb_varint(output_buffer_t *out, uint64_t value) {
+    char bytes[10];
+    size_t length = 0;
+    while (value >= 0x80) {
+        bytes[length++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (char)value;
+    output_buffer_append(out, bytes, length);
+}
+
+static void pb_uint(output_buffer_t *out, uint32_t field, uint64_t value) {
+    pb_varint(out, (uint64_t)field << 3 | WIRE_VARINT);
+    pb_varint(out, value);
+}
+
+static void pb_bytes(output_buffer_t *out, uint32_t field, const char *bytes, size_t length) {
+    pb_varint(out, (uint64_t)field << 3 | WIRE_LENGTH);
+    pb_varint(out, length);
+    output_buffer_append(out, bytes, length);
+}
+
+static void pb_message(output_buffer_t *out, uint32_t field, const output_buffer_t *message) {
+    pb_bytes(out, field, message->data, message->length);
+}
+
+// Wrap the packet built so far as one entry of the Trace message the file holds
+static void finish_packet(trace_exporter_t *exporter) {
+    pb_uint(&exporter->packet, PACKET_SEQUENCE_ID, EXPORT_SEQUENCE_ID);
+    pb_message(&exporter->out, TRACE_PACKET_FIELD, &exporter->packet);
+    output_buffer_reset(&exporter->packet);
+}
+
+static void append_method_name(output_buffer_t *out, const char *class_name, const char *method_name, bool is_class_method) {
+    output_buffer_append_char(out, is_class_method ? '+' : '-');
+    output_buffer_append_char(out, '[');
+    output_buffer_append_str(out, class_name);
+    output_buffer_append_char(out, ' ');
+    output_buffer_append_str(out, method_name);
+    output_buffer_append_char(out, ']');
+}
+
+// Chrome timestamps are in microseconds, with nanoseconds after the point
+static void append_chrome_event(trace_exporter_t *exporter, char phase, uint32_t stream_id, uint64_t timestamp, const tracer_event_t *event) {
+    output_buffer_t *out = &exporter->out;
+    output_buffer_append_str(out, exporter->wrote_event ? ",\n{" : "{");
+    exporter->wrote_event = true;
+    if (event) {
+        output_buffer_append_str(out, "\"name\":\"");
+        output_buffer_reset(&exporter->inner);
+        append_method_name(&exporter->inner, event->class_name, event->method_name, event->is_class_method);
+        json_append_escaped(out, exporter->inner.data, exporter->inner.length);
+        output_buffer_append_str(out, "\",\"cat\":\"objc\",");
+    }
+
+    char fraction[4] = {
+        (char)('0' + timestamp % 1000 / 100),
+        (char)('0' + timestamp % 100 / 10),
+        (char)('0' + timestamp % 10),
+    };
+    output_buffer_append_str(out, "\"ph\":\"");
+    output_buffer_append_char(out, phase);
+    output_buffer_append_str(out, "\",\"ts\":");
+    output_buffer_append_uint(out, timestamp / 1000);
+    output_buffer_append_char(out, '.');
+    output_buffer_append(out, fraction, 3);
+    output_buffer_append_str(out, ",\"pid\":");
+    output_buffer_append_uint(out, EXPORT_PID);
+    output_buffer_append_str(out, ",\"tid\":");
+    output_buffer_append_uint(out, stream_id);
+    output_buffer_append_char(out, '}');
+}
+
+static void append_thread_track(trace_exporter_t *exporter, const export_thread_t *thread) {
+    char name[32];
+    int name_length = snprintf(name, sizeof(name), "Thread %u", thread->thread_id);
+    if (exporter->format == TRACE_EXPORT_CHROME_JSON) {
+        output_buffer_t *out = &exporter->out;
+        output_buffer_append_str(out, exporter->wrote_event ? ",\n{" : "{");
+        exporter->wrote_event = true;
+        output_buffer_append_str(out, "\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":");
+        output_buffer_append_uint(out, EXPORT_PID);
+        output_buffer_append_str(out, ",\"tid\":");
+        output_buffer_append_uint(out, thread->stream_id);
+        output_buffer_append_str(out, ",\"args\":{\"name\":\"");
+        output_buffer_append(out, name, name_length);
+        output_buffer_append_str(out, "\"}}");
+        return;
+    }
+
+    output_buffer_reset(&exporter->inner);
+    pb_uint(&exporter->inner, THREAD_PID, EXPORT_PID);
+    pb_uint(&exporter->inner, THREAD_TID, thread->stream_id);
+    pb_bytes(&exporter->inner, THREAD_NAME, name, name_length);
+    output_buffer_reset(&exporter->message);
+    pb_uint(&exporter->message, TRACK_DESCRIPTOR_UUID, THREAD_TRACK_UUID(thread->stream_id));
+    pb_uint(&exporter->message, TRACK_DESCRIPTOR_PARENT_UUID, PROCESS_TRACK_UUID);
+    pb_message(&exporter->message, TRACK_DESCRIPTOR_THREAD, &exporter->inner);
+    pb_message(&exporter->packet, PACKET_TRACK_DESCRIPTOR, &exporter->message);
+    finish_packet(exporter);
+}
+
+static size_t hash_name(const char *class_name, const char *method_name, bool is_class_method) {
+    uint64_t value = (uint64_t)(uintptr_t)class_name * 0x9e3779b97f4a7c15ULL;
+    value ^= ((uint64_t)(uintptr_t)method_name + is_class_method) * 0xc2b2ae3d27d4eb4fULL;
+    return (size_t)(value ^ (value >> 29));
+}
+
+static bool grow_names(trace_exporter_t *exporter) {
+    size_t new_capacity = exporter->name_capacity ? exporter->name_capacity * 2 : 1024;
+    name_entry_t *names = calloc(new_capacity, sizeof(name_entry_t));
+    if (names == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < exporter->name_capacity; i++) {
+        const name_entry_t *entry = &exporter->names[i];
+        if (entry->iid == 0) {
+            continue;
+        }
+
+        size_t index = hash_name(entry->class_name, entry->method_name, entry->is_class_method) & (new_capacity - 1);
+        while (names[index].iid != 0) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        names[index] = *entry;
+    }
+
+    free(exporter->names);
+    exporter->names = names;
+    exporter->name_capacity = new_capacity;
+    return true;
+}
+
+// The interned id of an event's name. A name that's new is added to `interned`, for the packet that first uses it.
+// 0 if memory ran out
+static uint64_t name_iid(trace_exporter_t *exporter, const tracer_event_t *event, output_buffer_t *interned) {
+    if ((exporter->name_count + 1) * 2 > exporter->name_capacity && !grow_names(exporter)) {
+        return 0;
+    }
+
+    size_t mask = exporter->name_capacity - 1;
+    size_t index = hash_name(event->class_name, event->method_name, event->is_class_method) & mask;
+    for (; exporter->names[index].iid != 0; index = (index + 1) & mask) {
+        const name_entry_t *entry = &exporter->names[index];
+        if (entry->class_name == event->class_name && entry->method_name == event->method_name && entry->is_class_method == event->is_class_method) {
+            return entry->iid;
+        }
+    }
+
+    name_entry_t *entry = &exporter->names[index];
+    entry->class_name = event->class_name;
+    entry->method_name = event->method_name;
+    entry->is_class_method = event->is_class_method;
+    entry->iid = ++exporter->name_count;
+
+    output_buffer_reset(&exporter->message);
+    append_method_name(&exporter->message, event->class_name, event->method_name, event->is_class_method);
+    output_buffer_reset(&exporter->inner);
+    pb_uint(&exporter->inner, EVENT_NAME_IID, entry->iid);
+    pb_message(&exporter->inner, EVENT_NAME_NAME, &exporter->message);
+    pb_message(interned, INTERNED_EVENT_NAMES, &exporter->inner);
+    return entry->iid;
+}
+
+static void append_slice_end(trace_exporter_t *exporter, uint32_t stream_id, uint64_t timestamp) {
+    if (exporter->format == TRACE_EXPORT_CHROME_JSON) {
+        append_chrome_event(exporter, 'E', stream_id, timestamp, NULL);
+        return;
+    }
+
+    output_buffer_reset(&exporter->message);
+    pb_uint(&exporter->message, TRACK_EVENT_TYPE, SLICE_END);
+    pb_uint(&exporter->message, TRACK_EVENT_TRACK_UUID, THREAD_TRACK_UUID(stream_id));
+    pb_uint(&exporter->packet, PACKET_TIMESTAMP, timestamp);
+    pb_message(&exporter->packet, PACKET_TRACK_EVENT, &exporter->message);
+    pb_uint(&exporter->packet, PACKET_SEQUENCE_FLAGS, SEQ_NEEDS_INCREMENTAL_STATE);
+    finish_packet(exporter);
+}
+
+static bool append_slice_begin(trace_exporter_t *exporter, const tracer_event_t *event) {
+    if (exporter->format == TRACE_EXPORT_CHROME_JSON) {
+        append_chrome_event(exporter, 'B', event->stream_id, event->timestamp, event);
+        return true;
+    }
+
+    output_buffer_t interned = {0};
+    uint64_t iid = name_iid(exporter, event, &interned);
+    if (iid == 0) {
+        output_buffer_free(&interned);
+        return false;
+    }
+
+    output_buffer_reset(&exporter->message);
+    pb_uint(&exporter->message, TRACK_EVENT_TYPE, SLICE_BEGIN);
+    pb_uint(&exporter->message, TRACK_EVENT_TRACK_UUID, THREAD_TRACK_UUID(event->stream_id));
+    pb_uint(&exporter->message, TRACK_EVENT_NAME_IID, iid);
+    pb_uint(&exporter->packet, PACKET_TIMESTAMP, event->timestamp);
+    pb_message(&exporter->packet, PACKET_TRACK_EVENT, &exporter->message);
+    if (interned.length > 0) {
+        pb_message(&exporter->packet, PACKET_INTERNED_DATA, &interned);
+    }
+    pb_uint(&exporter->packet, PACKET_SEQUENCE_FLAGS, SEQ_NEEDS_INCREMENTAL_STATE);
+    finish_packet(exporter);
+    output_buffer_free(&interned);
+    return true;
+}
+
+trace_exporter_t *trace_exporter_create(const char *path, trace_export_format_t format) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    trace_exporter_t *exporter = calloc(1, sizeof(trace_exporter_t));
+    if (exporter == NULL) {
+        return NULL;
+    }
+
+    exporter->format = format;
+    exporter->thread_capacity = EXPORT_MIN_THREADS;
+    exporter->threads = calloc(exporter->thread_capacity, sizeof(export_thread_t *));
+    exporter->thread_order = calloc(exporter->thread_capacity / 2, sizeof(export_thread_t *));
+    exporter->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (exporter->fd < 0 || exporter->threads == NULL || exporter->thread_order == NULL) {
+        if (exporter->fd >= 0) {
+            close(exporter->fd);
+        }
+        free(exporter->threads);
+        free(exporter->thread_order);
+        free(exporter);
+        return NULL;
+    }
+
+    if (format == TRACE_EXPORT_CHROME_JSON) {
+        output_buffer_append_str(&exporter->out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        return exporter;
+    }
+
+    // The process track every thread's track sits under, and the start of the sequence's interned names
+    const char *process_name = "objsee";
+    pb_uint(&exporter->inner, PROCESS_PID, EXPORT_PID);
+    pb_bytes(&exporter->inner, PROCESS_NAME, process_name, strlen(process_name));
+    pb_uint(&exporter->message, TRACK_DESCRIPTOR_UUID, PROCESS_TRACK_UUID);
+    pb_message(&exporter->message, TRACK_DESCRIPTOR_PROCESS, &exporter->inner);
+    pb_message(&exporter->packet, PACKET_TRACK_DESCRIPTOR, &exporter->message);
+    pb_uint(&exporter->packet, PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+    finish_packet(exporter);
+    return exporter;
+}
+
+// The thread for a stream, or the empty slot it would go in
+static export_thread_t **thread_slot(export_thread_t **threads, size_t capacity, uint32_t stream_id) {
+    uint64_t value = stream_id * 0x9e3779b97f4a7c15ULL;
+    size_t index = (size_t)(value ^ (value >> 32)) & (capacity - 1);
+    while (threads[index] != NULL && threads[index]->stream_id != stream_id) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &threads[index];
+}
+
+// Double the table, and the list, which is always half its size
+static bool grow_threads(trace_exporter_t *exporter) {
+    size_t new_capacity = exporter->thread_capacity * 2;
+    export_thread_t **order = realloc(exporter->thread_order, new_capacity / 2 * sizeof(export_thread_t *));
+    if (order == NULL) {
+        return false;
+    }
+    exporter->thread_order = order;
+
+    export_thread_t **threads = calloc(new_capacity, sizeof(export_thread_t *));
+    if (threads == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < exporter->thread_count; i++) {
+        *thread_slot(threads, new_capacity, order[i]->stream_id) = order[i];
+    }
+    free(exporter->threads);
+    exporter->threads = threads;
+    exporter->thread_capacity = new_capacity;
+    return true;
+}
+
+static export_thread_t *export_thread(trace_exporter_t *exporter, const tracer_event_t *event) {
+    export_thread_t *thread = *thread_slot(exporter->threads, exporter->thread_capacity, event->stream_id);
+    if (thread != NULL) {
+        return thread;
+    }
+
+    if ((exporter->thread_count + 1) * 2 > exporter->thread_capacity && !grow_threads(exporter)) {
+        return NULL;
+    }
+
+    thread = calloc(1, sizeof(export_thread_t));
+    if (thread == NULL) {
+        return NULL;
+    }
+
+    thread->stream_id = event->stream_id;
+    thread->thread_id = event->thread_id;
+    *thread_slot(exporter->threads, exporter->thread_capacity, event->stream_id) = thread;
+    exporter->thread_order[exporter->thread_count++] = thread;
+    append_thread_track(exporter, thread);
+    return thread;
+}
+
+kern_return_t trace_exporter_add_event(trace_exporter_t *exporter, const tracer_event_t *event) {
+    if (exporter->failed) {
+        return KERN_FAILURE;
+    }
+
+    if (event->class_name == NULL || event->method_name == NULL || event->trace_depth >= EXPORT_MAX_DEPTH) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    export_thread_t *thread = export_thread(exporter, event);
+    if (thread == NULL) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    if (thread->count == thread->capacity) {
+        uint32_t new_capacity = thread->capacity ? thread->capacity * 2 : 32;
+        uint32_t *depths = realloc(thread->depths, new_capacity * sizeof(uint32_t));
+        if (depths == NULL) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+        thread->depths = depths;
+        thread->capacity = new_capacity;
+    }
+
+    // A call at this depth or shallower means everything that was running at this depth and deeper has returned
+    while (thread->count > 0 && thread->depths[thread->count - 1] >= event->trace_depth) {
+        append_slice_end(exporter, event->stream_id, event->timestamp);
+        thread->count--;
+    }
+
+    if (!append_slice_begin(exporter, event)) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    thread->depths[thread->count++] = event->trace_depth;
+    exporter->last_timestamp = MAX(exporter->last_timestamp, event->timestamp);
+
+    if (exporter->out.failed) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    if (exporter->out.length >= EXPORT_FLUSH_SIZE && !flush_output(exporter)) {
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t trace_exporter_close(trace_exporter_t *exporter) {
+    if (exporter == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    // Calls that never saw a later event on their thread ran until the end of the trace, as far as it shows
+    for (size_t i = 0; i < exporter->thread_count; i++) {
+        export_thread_t *thread = exporter->thread_order[i];
+        for (; thread->count > 0; thread->count--) {
+            append_slice_end(exporter, thread->stream_id, exporter->last_timestamp);
+        }
+        free(thread->depths);
+        free(thread);
+    }
+
+    if (exporter->format == TRACE_EXPORT_CHROME_JSON) {
+        output_buffer_append_str(&exporter->out, "\n]}\n");
+    }
+
+    kern_return_t kr = KERN_SUCCESS;
+    if (exporter->failed || exporter->out.failed || !flush_output(exporter)) {
+        kr = KERN_FAILURE;
+    }
+    if (close(exporter->fd) != 0) {
+        kr = KERN_FAILURE;
+    }
+
+    free(exporter->threads);
+    free(exporter->thread_order);
+    free(exporter->names);
+    output_buffer_free(&exporter->out);
+    output_buffer_free(&exporter->packet);
+    output_buffer_free(&exporter->message);
+    output_buffer_free(&exporter->inner);
+    free(exporter);
+    return kr;
+}
@@ -0,0 +1,62 @@
+//
+//  trace_export.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#ifndef TRACE_EXPORT_H
+#define TRACE_EXPORT_H
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "tracer_types.h"
+
+/*
+    Timeline export, for Chrome's trace viewer and Perfetto
+
+    Each call becomes a slice on its thread's track. Events only mark when calls start, so a call's slice is
+    ended by the next event on its thread at the same depth or shallower, or by the end of the trace if there
+    isn't one. A call that made calls of its own ends no earlier than they do, so slices always nest.
+
+    The file is written as events arrive. Only the calls that haven't ended yet and the names that have been
+    used are kept, so memory doesn't grow with the length of the trace.
+*/
+
+typedef enum {
+    // Chrome's JSON trace event format, which chrome://tracing and Perfetto both open
+    TRACE_EXPORT_CHROME_JSON,
+    // Perfetto's protobuf TracePacket format. Much smaller than json, with each name written once
+    TRACE_EXPORT_PERFETTO,
+} trace_export_format_t;
+
+typedef struct trace_exporter trace_exporter_t;
+
+/**
+ * @brief The format a path's extension suggests: Chrome json for ".json", Perfetto for anything else
+ */
+trace_export_format_t trace_export_format_for_path(const char *path);
+
+/**
+ * @brief Create an export, replacing anything at `path`
+ * @return The exporter, or NULL if the file couldn't be created
+ */
+trace_exporter_t *trace_exporter_create(const char *path, trace_export_format_t format);
+
+/**
+ * @brief Add an event, ending the slices it shows have returned and starting its own
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the event has no class or selector or is too deep,
+ * KERN_RESOURCE_SHORTAGE if memory ran out, or KERN_FAILURE if writing failed
+ * @note Names are keyed by pointer, like in the binary encoder, so they must not change for the life of
+ * the exporter. Threads are told apart by stream_id. Events from an event_decoder_t are fine as they are
+ */
+kern_return_t trace_exporter_add_event(trace_exporter_t *exporter, const tracer_event_t *event);
+
+/**
+ * @brief End every slice that's still open at the last timestamp seen, finish the file and release the exporter
+ * @return KERN_SUCCESS, or KERN_FAILURE if anything couldn't be written
+ */
+kern_return_t trace_exporter_close(trace_exporter_t *exporter);
+
+#endif // TRACE_EXPORT_H
@@ -0,0 +1,542 @@
+//
+//  trace_recording.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/10/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "trace_recording.h"
+
+#define NAME_SET_MIN_CAPACITY 256
+
+typedef struct {
+    uint32_t stream_id;
+    event_encoder_t encoder;
+} recorder_thread_t;
+
+// Distinct names in the chunk being built. Keyed by pointer, like the encoder's runtime strings
+typedef struct {
+    const char **entries;
+    size_t capacity;
+    size_t count;
+    // The names, NUL-terminated, in the order they were first seen
+    output_buffer_t names;
+} recorder_name_set_t;
+
+struct trace_recorder {
+    int fd;
+    size_t chunk_size;
+    // Where the next chunk will be written
+    uint64_t offset;
+    uint64_t *chunk_offsets;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    bool failed;
+
+    // The chunk being built. Encoders start over with every chunk
+    recording_chunk_header_t chunk;
+    output_buffer_t payload;
+    recorder_thread_t *threads;
+    size_t thread_count;
+    size_t thread_capacity;
+    recorder_name_set_t classes;
+    recorder_name_set_t selectors;
+};
+
+static size_t hash_pointer(const void *pointer) {
+    uint64_t value = (uint64_t)(uintptr_t)pointer * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(value ^ (value >> 32));
+}
+
+static bool name_set_grow(recorder_name_set_t *set) {
+    size_t new_capacity = set->capacity ? set->capacity * 2 : NAME_SET_MIN_CAPACITY;
+    const char **new_entries = calloc(new_capacity, sizeof(const char *));
+    if (new_entries == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->entries[i] == NULL) {
+            continue;
+        }
+
+        size_t index = hash_pointer(set->entries[i]) & (new_capacity - 1);
+        while (new_entries[index] != NULL) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        new_entries[index] = set->entries[i];
+    }
+
+    free(set->entries);
+    set->entries = new_entries;
+    set->capacity = new_capacity;
+    return true;
+}
+
+static bool name_set_add(recorder_name_set_t *set, const char *name) {
+    if ((set->count + 1) * 2 > set->capacity && !name_set_grow(set)) {
+        return false;
+    }
+
+    size_t mask = set->capacity - 1;
+    size_t index = hash_pointer(name) & mask;
+    while (set->entries[index] != NULL) {
+        if (set->entries[index] == name) {
+            return true;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // Including the NUL
+    output_buffer_append(&set->names, name, strlen(name) + 1);
+    if (set->names.failed) {
+        return false;
+    }
+
+    set->entries[index] = name;
+    set->count++;
+    return true;
+}
+
+static void name_set_reset(recorder_name_set_t *set) {
+    if (set->entries) {
+        memset(set->entries, 0, set->capacity * sizeof(const char *));
+    }
+    set->count = 0;
+    output_buffer_reset(&set->names);
+}
+
+static void name_set_free(recorder_name_set_t *set) {
+    free(set->entries);
+    output_buffer_free(&set->names);
+}
+
+static void start_chunk(trace_recorder_t *recorder) {
+    recorder->chunk = (recording_chunk_header_t){
+        .magic = RECORDING_CHUNK_MAGIC,
+        .first_timestamp = UINT64_MAX,
+        .min_depth = UINT32_MAX,
+    };
+    output_buffer_reset(&recorder->payload);
+    name_set_reset(&recorder->classes);
+    name_set_reset(&recorder->selectors);
+    for (size_t i = 0; i < recorder->thread_count; i++) {
+        event_encoder_free(&recorder->threads[i].encoder);
+    }
+    recorder->thread_count = 0;
+}
+
+// Each stream is re-encoded under the id it arrived with, so a thread keeps one stream across chunks
+static event_encoder_t *thread_encoder(trace_recorder_t *recorder, uint32_t stream_id) {
+    for (size_t i = 0; i < recorder->thread_count; i++) {
+        if (recorder->threads[i].stream_id == stream_id) {
+            return &recorder->threads[i].encoder;
+        }
+    }
+
+    if (recorder->thread_count == recorder->thread_capacity) {
+        size_t new_capacity = recorder->thread_capacity ? recorder->thread_capacity * 2 : 16;
+        recorder_thread_t *threads = realloc(recorder->threads, new_capacity * sizeof(recorder_thread_t));
+        if (threads == NULL) {
+            return NULL;
+        }
+        recorder->threads = threads;
+        recorder->thread_capacity = new_capacity;
+    }
+
+    recorder_thread_t *thread = &recorder->threads[recorder->thread_count++];
+    memset(thread, 0, sizeof(*thread));
+    thread->stream_id = stream_id;
+    thread->encoder.stream_id = stream_id;
+    return &thread->encoder;
+}
+
+static bool write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+static kern_return_t write_chunk(trace_recorder_t *recorder) {
+    if (recorder->payload.length == 0) {
+        return KERN_SUCCESS;
+    }
+
+    if (recorder->chunk_count == recorder->chunk_capacity) {
+        size_t new_capacity = recorder->chunk_capacity ? recorder->chunk_capacity * 2 : 64;
+        uint64_t *offsets = realloc(recorder->chunk_offsets, new_capacity * sizeof(uint64_t));
+        if (offsets == NULL) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+        recorder->chunk_offsets = offsets;
+        recorder->chunk_capacity = new_capacity;
+    }
+
+    recording_chunk_header_t *chunk = &recorder->chunk;
+    chunk->header_length = (uint32_t)(sizeof(*chunk) + recorder->classes.names.length + recorder->selectors.names.length);
+    chunk->payload_length = recorder->payload.length;
+    chunk->class_count = (uint32_t)recorder->classes.count;
+    chunk->selector_count = (uint32_t)recorder->selectors.count;
+    if (chunk->event_count == 0) {
+        chunk->first_timestamp = 0;
+        chunk->min_depth = 0;
+    }
+
+    // Every chunk starts 8-byte aligned, so its header can be read in place
+    static const uint8_t padding[8] = {0};
+    size_t length = chunk->header_length + chunk->payload_length;
+    size_t padding_length = (8 - length % 8) % 8;
+    struct iovec iov[] = {
+        { chunk, sizeof(*chunk) },
+        { recorder->classes.names.data, recorder->classes.names.length },
+        { recorder->selectors.names.data, recorder->selectors.names.length },
+        { recorder->payload.data, recorder->payload.length },
+        { (void *)padding, padding_length },
+    };
+    if (!write_all(recorder->fd, iov, sizeof(iov) / sizeof(iov[0]))) {
+        recorder->failed = true;
+        return KERN_FAILURE;
+    }
+
+    recorder->chunk_offsets[recorder->chunk_count++] = recorder->offset;
+    recorder->offset += length + padding_length;
+    start_chunk(recorder);
+    return KERN_SUCCESS;
+}
+
+static recording_header_t make_header(uint16_t flags, uint16_t main_thread_id) {
+    recording_header_t header = {
+        .version = RECORDING_VERSION,
+        .header_length = sizeof(recording_header_t),
+        .flags = flags,
+        .main_thread_id = main_thread_id,
+    };
+    memcpy(header.magic, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH);
+    return header;
+}
+
+trace_recorder_t *trace_recorder_create(const char *path, size_t chunk_size) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    trace_recorder_t *recorder = calloc(1, sizeof(trace_recorder_t));
+    if (recorder == NULL) {
+        return NULL;
+    }
+
+    recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (recorder->fd < 0) {
+        free(recorder);
+        return NULL;
+    }
+
+    recording_header_t header = make_header(0, 0);
+    struct iovec iov = { &header, sizeof(header) };
+    if (!write_all(recorder->fd, &iov, 1)) {
+        close(recorder->fd);
+        free(recorder);
+        return NULL;
+    }
+
+    recorder->offset = sizeof(header);
+    recorder->chunk_size = chunk_size ? chunk_size : RECORDING_DEFAULT_CHUNK_SIZE;
+    start_chunk(recorder);
+    return recorder;
+}
+
+kern_return_t trace_recorder_add_event(trace_recorder_t *recorder, const tracer_event_t *event) {
+    if (recorder == NULL || event == NULL || event->class_name == NULL || event->method_name == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    if (recorder->failed) {
+        return KERN_FAILURE;
+    }
+
+    if (recorder->payload.length == 0) {
+        append_event_stream_preamble(&recorder->payload);
+    }
+
+    // Names go in the index before the event goes in the payload, so a failure can't hide an event from readers
+    event_encoder_t *encoder = thread_encoder(recorder, event->stream_id);
+    if (encoder == NULL || !name_set_add(&recorder->classes, event->class_name) || !name_set_add(&recorder->selectors, event->method_name)) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    kern_return_t kr = append_binary_event(encoder, event, &recorder->payload);
+    if (kr != KERN_SUCCESS) {
+        return kr;
+    }
+
+    recording_chunk_header_t *chunk = &recorder->chunk;
+    chunk->event_count++;
+    if (event->timestamp < chunk->first_timestamp) {
+        chunk->first_timestamp = event->timestamp;
+    }
+    if (event->timestamp > chunk->last_timestamp) {
+        chunk->last_timestamp = event->timestamp;
+    }
+    if (event->trace_depth < chunk->min_depth) {
+        chunk->min_depth = event->trace_depth;
+    }
+    if (event->trace_depth > chunk->max_depth) {
+        chunk->max_depth = event->trace_depth;
+    }
+    uint32_t bit = event->thread_id % RECORDING_THREAD_FILTER_BITS;
+    chunk->thread_filter[bit / 64] |= 1ULL << (bit % 64);
+
+    if (recorder->payload.length >= recorder->chunk_size) {
+        return write_chunk(recorder);
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t trace_recorder_add_dropped(trace_recorder_t *recorder, uint64_t count) {
+    if (recorder == NULL || recorder->failed) {
+        return KERN_FAILURE;
+    }
+
+    if (recorder->payload.length == 0) {
+        append_event_stream_preamble(&recorder->payload);
+    }
+
+    append_dropped_record(&recorder->payload, count);
+    recorder->chunk.dropped += count;
+    return recorder->payload.failed ? KERN_RESOURCE_SHORTAGE : KERN_SUCCESS;
+}
+
+kern_return_t trace_recorder_set_main_thread(trace_recorder_t *recorder, uint16_t thread_id) {
+    if (recorder == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    if (recorder->failed) {
+        return KERN_FAILURE;
+    }
+
+    // pwrite leaves the file position alone, so chunks carry on from where they were
+    recording_header_t header = make_header(RECORDING_FLAG_MAIN_THREAD, thread_id);
+    if (pwrite(recorder->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        recorder->failed = true;
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+kern_return_t trace_recorder_close(trace_recorder_t *recorder) {
+    if (recorder == NULL) {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    kern_return_t kr = recorder->failed ? KERN_FAILURE : write_chunk(recorder);
+    if (kr == KERN_SUCCESS) {
+        recording_trailer_t trailer = {
+            .directory_offset = recorder->offset,
+            .chunk_count = recorder->chunk_count,
+            .version = RECORDING_VERSION,
+        };
+        memcpy(trailer.magic, RECORDING_TRAILER_MAGIC, RECORDING_MAGIC_LENGTH);
+        struct iovec iov[] = {
+            { recorder->chunk_offsets, recorder->chunk_count * sizeof(uint64_t) },
+            { &trailer, sizeof(trailer) },
+        };
+        if (!write_all(recorder->fd, iov, 2)) {
+            kr = KERN_FAILURE;
+        }
+    }
+
+    if (close(recorder->fd) != 0 && kr == KERN_SUCCESS) {
+        kr = KERN_FAILURE;
+    }
+
+    start_chunk(recorder);
+    free(recorder->threads);
+    free(recorder->chunk_offsets);
+    name_set_free(&recorder->classes);
+    name_set_free(&recorder->selectors);
+    output_buffer_free(&recorder->payload);
+    free(recorder);
+    return kr;
+}
+
+
+bool trace_recording_matches(const uint8_t *file, size_t size) {
+    return size >= sizeof(recording_header_t) && memcmp(file, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH) == 0;
+}
+
+// Check that a chunk, including every name its index claims to have, lies inside the file
+static bool chunk_is_valid(const uint8_t *base, size_t size, uint64_t offset) {
+    if (offset % 8 != 0 || offset > size || size - offset < sizeof(recording_chunk_header_t)) {
+        return false;
+    }
+
+    const recording_chunk_header_t *chunk = (const recording_chunk_header_t *)(base + offset);
+    if (chunk->magic != RECORDING_CHUNK_MAGIC || chunk->header_length < sizeof(*chunk) || chunk->header_length > size - offset ||
+        chunk->payload_length > size - offset - chunk->header_length) {
+        return false;
+    }
+
+    const char *name = recording_chunk_names(chunk);
+    const char *names_end = (const char *)chunk + chunk->header_length;
+    for (uint64_t i = 0; i < (uint64_t)chunk->class_count + chunk->selector_count; i++) {
+        const char *terminator = name < names_end ? memchr(name, '\0', names_end - name) : NULL;
+        if (terminator == NULL) {
+            return false;
+        }
+        name = terminator + 1;
+    }
+    return true;
+}
+
+// Use the offsets written when the recording was closed, if they're there
+static bool read_chunk_directory(trace_recording_t *recording, size_t header_length) {
+    if (recording->size < header_length + sizeof(recording_trailer_t)) {
+        return false;
+    }
+
+    recording_trailer_t trailer;
+    memcpy(&trailer, recording->base + recording->size - sizeof(trailer), sizeof(trailer));
+    if (memcmp(trailer.magic, RECORDING_TRAILER_MAGIC, RECORDING_MAGIC_LENGTH) != 0 || trailer.version != RECORDING_VERSION) {
+        return false;
+    }
+
+    size_t directory_end = recording->size - sizeof(trailer);
+    if (trailer.directory_offset % 8 != 0 || trailer.directory_offset > directory_end || trailer.chunk_count != (directory_end - trailer.directory_offset) / sizeof(uint64_t)) {
+        return false;
+    }
+
+    const uint64_t *offsets = (const uint64_t *)(recording->base + trailer.directory_offset);
+    recording->chunk_offsets = malloc((trailer.chunk_count ? trailer.chunk_count : 1) * sizeof(uint64_t));
+    if (recording->chunk_offsets == NULL) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < trailer.chunk_count; i++) {
+        if (!chunk_is_valid(recording->base, trailer.directory_offset, offsets[i])) {
+            free(recording->chunk_offsets);
+            recording->chunk_offsets = NULL;
+            return false;
+        }
+        recording->chunk_offsets[i] = offsets[i];
+    }
+    recording->chunk_count = trailer.chunk_count;
+    return true;
+}
+
+// Without a directory, step from chunk to chunk until one is missing or cut short
+static bool walk_chunks(trace_recording_t *recording, size_t header_length) {
+    size_t capacity = 0;
+    uint64_t offset = header_length;
+    while (chunk_is_valid(recording->base, recording->size, offset)) {
+        if (recording->chunk_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            uint64_t *offsets = realloc(recording->chunk_offsets, capacity * sizeof(uint64_t));
+            if (offsets == NULL) {
+                return false;
+            }
+            recording->chunk_offsets = offsets;
+        }
+
+        const recording_chunk_header_t *chunk = (const recording_chunk_header_t *)(recording->base + offset);
+        recording->chunk_offsets[recording->chunk_count++] = offset;
+        offset += (chunk->header_length + chunk->payload_length + 7) & ~(uint64_t)7;
+    }
+    return true;
+}
+
+trace_recording_t *trace_recording_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(recording_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    const uint8_t *base = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    recording_header_t header;
+    memcpy(&header, base, sizeof(header));
+    trace_recording_t *recording = calloc(1, sizeof(trace_recording_t));
+    if (recording == NULL || !trace_recording_matches(base, (size_t)file_stat.st_size) || header.version != RECORDING_VERSION ||
+        header.header_length < sizeof(header) || header.header_length > (size_t)file_stat.st_size) {
+        munmap((void *)base, (size_t)file_stat.st_size);
+        free(recording);
+        return NULL;
+    }
+
+    recording->base = base;
+    recording->size = (size_t)file_stat.st_size;
+    recording->has_main_thread = (header.flags & RECORDING_FLAG_MAIN_THREAD) != 0;
+    recording->main_thread_id = header.main_thread_id;
+    recording->complete = read_chunk_directory(recording, header.header_length);
+    if (!recording->complete && !walk_chunks(recording, header.header_length)) {
+        trace_recording_close(recording);
+        return NULL;
+    }
+    return recording;
+}
+
+void trace_recording_close(trace_recording_t *recording) {
+    if (recording == NULL) {
+        return;
+    }
+
+    munmap((void *)recording->base, recording->size);
+    free(recording->chunk_offsets);
+    free(recording);
+}
+
+kern_return_t trace_recording_decode_chunk(const recording_chunk_header_t *chunk, event_decoder_callback_t callback, event_decoder_dropped_callback_t dropped_callback, void *context) {
+    event_decoder_t *decoder = event_decoder_create();
+    if (decoder == NULL) {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    if (dropped_callback) {
+        event_decoder_set_dropped_callback(decoder, dropped_callback, context);
+    }
+
+    size_t consumed = 0;
+    const uint8_t *payload = (const uint8_t *)chunk + chunk->header_length;
+    kern_return_t kr = event_decoder_decode(decoder, payload, chunk->payload_length, &consumed, callback, context);
+    event_decoder_free(decoder);
+    if (kr == KERN_SUCCESS && consumed != chunk->payload_length) {
+        // Chunks only ever hold complete records
+        kr = KERN_FAILURE;
+    }
+    return kr != KERN_SUCCESS ? KERN_FAILURE : KERN_SUCCESS;
+}
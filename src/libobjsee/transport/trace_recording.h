@@ -0,0 +1,177 @@
+//
+//  trace_recording.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/10/25.
+//
+
+#ifndef TRACE_RECORDING_H
+#define TRACE_RECORDING_H
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "event_protocol.h"
+
+/*
+    Indexed trace recordings
+
+    A recording is a sequence of chunks, each holding about RECORDING_DEFAULT_CHUNK_SIZE bytes of events
+    behind a small index, so a reader can rule out whole chunks without decoding them:
+
+        recording_header_t
+        chunk               recording_chunk_header_t
+                            Distinct class names, then distinct selectors, each NUL-terminated
+                            Payload, padded to 8 bytes
+        chunk ...
+        u64 offsets         Where each chunk starts
+        recording_trailer_t
+
+    A chunk's payload is a complete binary protocol stream, preamble included, with dictionaries that start
+    over in every chunk. Chunks can be decoded on their own, in any order and on any thread.
+
+    The offsets and trailer are written when the recording is closed. A recording that wasn't closed can still
+    be read by walking the chunks from the start; only a chunk that was cut short is lost.
+*/
+
+#define RECORDING_MAGIC "\0OBJREC"
+#define RECORDING_TRAILER_MAGIC "\0OBJIDX"
+#define RECORDING_MAGIC_LENGTH 7
+#define RECORDING_VERSION 1
+#define RECORDING_CHUNK_MAGIC 0x4b4e4843     // 'CHNK'
+#define RECORDING_DEFAULT_CHUNK_SIZE (1024 * 1024)
+// Bits in a chunk's thread filter
+#define RECORDING_THREAD_FILTER_BITS 256
+
+// recording_header_t flags
+#define RECORDING_FLAG_MAIN_THREAD      (1 << 0)    // main_thread_id is set
+
+typedef struct {
+    char magic[RECORDING_MAGIC_LENGTH];
+    uint8_t version;
+    uint32_t header_length;         // Offset of the first chunk
+    uint16_t flags;                 // RECORDING_FLAG_*
+    uint16_t main_thread_id;        // The traced process's main thread, if RECORDING_FLAG_MAIN_THREAD
+} recording_header_t;
+
+typedef struct {
+    uint32_t magic;                 // RECORDING_CHUNK_MAGIC
+    uint32_t header_length;         // Offset of the payload: this header and the name tables
+    uint64_t payload_length;
+    uint64_t event_count;
+    uint64_t dropped;               // Events the traced process reported dropping
+    // Earliest and latest event, CLOCK_UPTIME_RAW nanoseconds
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    // Shallowest and deepest trace depth
+    uint32_t min_depth;
+    uint32_t max_depth;
+    uint32_t class_count;
+    uint32_t selector_count;
+    // Bit (thread_id % RECORDING_THREAD_FILTER_BITS) is set for every thread with events in the chunk
+    uint64_t thread_filter[RECORDING_THREAD_FILTER_BITS / 64];
+} recording_chunk_header_t;
+
+typedef struct {
+    uint64_t directory_offset;
+    uint64_t chunk_count;
+    char magic[RECORDING_MAGIC_LENGTH];
+    uint8_t version;
+} recording_trailer_t;
+
+
+typedef struct trace_recorder trace_recorder_t;
+
+/**
+ * @brief Create a recording, replacing anything at `path`
+ * @param path Where to write it
+ * @param chunk_size Payload bytes per chunk, or 0 for RECORDING_DEFAULT_CHUNK_SIZE
+ * @return The recorder, or NULL if the file couldn't be created
+ */
+trace_recorder_t *trace_recorder_create(const char *path, size_t chunk_size);
+
+/**
+ * @brief Add an event to the current chunk, writing the chunk out once it's full
+ * @return KERN_SUCCESS, KERN_INVALID_ARGUMENT if the event has no class or selector,
+ * KERN_RESOURCE_SHORTAGE if a buffer couldn't grow, or KERN_FAILURE if writing failed
+ * @note Class names and selectors are keyed by pointer, like in the binary encoder, so they must
+ * not change for the life of the recorder. Each stream_id is recorded as its own stream. Events from an event_decoder_t
+ * are fine as they are
+ */
+kern_return_t trace_recorder_add_event(trace_recorder_t *recorder, const tracer_event_t *event);
+
+/**
+ * @brief Note that the traced process dropped `count` events at this point
+ */
+kern_return_t trace_recorder_add_dropped(trace_recorder_t *recorder, uint64_t count);
+
+/**
+ * @brief Record which thread is the traced process's main thread. The header is rewritten straight away,
+ * so a recording that's never closed still has it
+ * @return KERN_SUCCESS, or KERN_FAILURE if the header couldn't be written
+ */
+kern_return_t trace_recorder_set_main_thread(trace_recorder_t *recorder, uint16_t thread_id);
+
+/**
+ * @brief Write the last chunk and the chunk offsets, then release the recorder
+ * @return KERN_SUCCESS, or KERN_FAILURE if anything couldn't be written
+ */
+kern_return_t trace_recorder_close(trace_recorder_t *recorder);
+
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    uint64_t *chunk_offsets;
+    size_t chunk_count;
+    // The recording was closed, and its chunk offsets were read from the end of the file
+    bool complete;
+    // Whether the recording says which thread is main, and which one it is
+    bool has_main_thread;
+    uint16_t main_thread_id;
+} trace_recording_t;
+
+/**
+ * @brief Map a recording for reading
+ * @return The recording, or NULL if it can't be read or isn't a recording
+ */
+trace_recording_t *trace_recording_open(const char *path);
+void trace_recording_close(trace_recording_t *recording);
+
+/**
+ * @brief Whether `file` starts like a recording
+ */
+bool trace_recording_matches(const uint8_t *file, size_t size);
+
+static inline const recording_chunk_header_t *trace_recording_chunk(const trace_recording_t *recording, size_t index) {
+    return (const recording_chunk_header_t *)(recording->base + recording->chunk_offsets[index]);
+}
+
+/**
+ * @brief The chunk's class names, followed by its selectors. Each is NUL-terminated
+ */
+static inline const char *recording_chunk_names(const recording_chunk_header_t *chunk) {
+    return (const char *)(chunk + 1);
+}
+
+/**
+ * @brief Whether the chunk may have events from `thread_id`. False positives are possible, false negatives aren't
+ */
+static inline bool recording_chunk_may_have_thread(const recording_chunk_header_t *chunk, uint16_t thread_id) {
+    uint32_t bit = thread_id % RECORDING_THREAD_FILTER_BITS;
+    return (chunk->thread_filter[bit / 64] & (1ULL << (bit % 64))) != 0;
+}
+
+/**
+ * @brief Decode every event in one chunk
+ *
+ * @param chunk The chunk
+ * @param callback Called for each event
+ * @param dropped_callback Called for each report of dropped events, or NULL to skip them
+ * @param context Passed to both callbacks
+ * @return KERN_SUCCESS, KERN_RESOURCE_SHORTAGE if a decoder couldn't be created, or KERN_FAILURE if the chunk is corrupt
+ * @note Safe to call for different chunks from several threads at once
+ */
+kern_return_t trace_recording_decode_chunk(const recording_chunk_header_t *chunk, event_decoder_callback_t callback, event_decoder_dropped_callback_t dropped_callback, void *context);
+
+#endif // TRACE_RECORDING_H
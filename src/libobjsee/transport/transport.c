@@ -7,110 +7,467 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <time.h>
 #include "tracer_internal.h"
 #include "transport.h"
 #include <os/log.h>
 
 #define MAX_RETRIES 3
-#define RETRY_BASE_DELAY_MS 100
+// How long the transport thread sleeps when there is nothing due to be written
+#define TRANSPORT_IDLE_SLEEP_US 500
+// How long to wait for a full socket to become writable before checking whether the transport is shutting down
+#define TRANSPORT_POLL_TIMEOUT_MS 100
+// Once shutting down, how long a consumer may go without accepting any data before the rest is abandoned
+#define TRANSPORT_SHUTDOWN_WRITE_TIMEOUT_NS (2 * 1000 * 1000 * 1000ULL)
+// How long transport_send waits for room in a full ring
+#define TRANSPORT_SEND_TIMEOUT_US (2 * 1000 * 1000)
+#define TRANSPORT_SEND_RETRY_US 100
+#define TRANSPORT_FLUSH_TIMEOUT_US (1000 * 1000)
+// How long to wait for the CLI to create the shared memory ring. When it launches the app, it only learns
+// which user to create the ring as once the app is running
+#define TRANSPORT_SHM_ATTACH_TIMEOUT_US (5 * 1000 * 1000)
+#define TRANSPORT_SHM_ATTACH_RETRY_US (10 * 1000)
 
-static void *transport_thread(void *tracer_arg) {
-    tracer_t *tracer = (tracer_t *)tracer_arg;
-    transport_context_t *ctx = (transport_context_t *)tracer->transport_context;
-    
-    while (ctx->running) {
-        pthread_mutex_lock(&ctx->queue.lock);
-        
-        struct timespec timeout;
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += 1;
-        
-        while (ctx->queue.count == 0 && ctx->running) {
-            int rc = pthread_cond_timedwait(&ctx->queue.not_empty, &ctx->queue.lock, &timeout);
-            if (rc == ETIMEDOUT) {
+#define TRANSPORT_DEFAULT_FLUSH_INTERVAL_MS 5
+#define TRANSPORT_DEFAULT_FLUSH_BYTES (64 * 1024)
+// Most ring spans gathered into a single writev
+#define TRANSPORT_MAX_BATCH_SPANS 64
+#define TRANSPORT_SOCKET_BUFFER_SIZE (1024 * 1024)
+// Local sockets never leave the machine, so a deeper send buffer just absorbs bursts while the CLI catches up
+#define TRANSPORT_UNIX_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+// Largest batch sent as one SOCK_SEQPACKET packet. A single larger message still goes out on its own
+#define TRANSPORT_MAX_PACKET_SIZE (64 * 1024)
+
+// Shortest time between two drop markers from the same thread
+#define TRANSPORT_DROP_REPORT_INTERVAL_NS (100 * 1000 * 1000ULL)
+// How long a thread waits for its backlog to be discarded under TRACER_BACKPRESSURE_DROP_OLDEST
+#define TRANSPORT_DISCARD_WAIT_US 1000
+#define TRANSPORT_TEXT_DROP_MARKER "[objsee] dropped "
+#define TRANSPORT_JSON_DROP_MARKER "{\"dropped_events\":"
+
+// A compressed batch is cut short so it fits in one frame, which only works if any one ring's contents do
+_Static_assert(TRANSPORT_RING_CAPACITY <= COMPRESSED_STREAM_MAX_FRAME_LENGTH, "A ring's contents must fit in one compressed frame");
+
+static bool transport_uses_rings(const transport_context_t *ctx) {
+    return ctx->type == TRACER_TRANSPORT_SOCKET || ctx->type == TRACER_TRANSPORT_UNIX || ctx->type == TRACER_TRANSPORT_FILE;
+}
+
+// Append a marker reporting `count` dropped events, in the same format as the events around it
+static void append_drop_marker(const transport_context_t *ctx, output_buffer_t *out, uint64_t count) {
+    if (ctx->binary_framing) {
+        append_dropped_record(out, count);
+    }
+    else if (ctx->json_framing) {
+        output_buffer_append_str(out, TRANSPORT_JSON_DROP_MARKER);
+        output_buffer_append_uint(out, count);
+        output_buffer_append_str(out, "}\n");
+    }
+    else {
+        output_buffer_append_str(out, TRANSPORT_TEXT_DROP_MARKER);
+        output_buffer_append_uint(out, count);
+        output_buffer_append_str(out, " events\n");
+    }
+}
+
+// Count the events in staged output that's about to be thrown away, along with any drops its markers reported
+static uint64_t count_staged_events(const transport_context_t *ctx, const char *data, size_t length) {
+    uint64_t count = 0;
+    if (ctx->binary_framing) {
+        const uint8_t *position = (const uint8_t *)data;
+        const uint8_t *end = position + length;
+        while (position < end) {
+            uint64_t record_length = 0;
+            if (!protocol_read_varint(&position, end, &record_length) || record_length == 0 || record_length > (uint64_t)(end - position)) {
                 break;
             }
+            
+            const uint8_t *record_end = position + record_length;
+            uint8_t type = *position++;
+            uint64_t dropped = 0;
+            if (type == EVENT_RECORD_EVENT) {
+                count++;
+            }
+            else if (type == EVENT_RECORD_DROPPED && protocol_read_varint(&position, record_end, &dropped)) {
+                count += dropped;
+            }
+            position = record_end;
         }
-        
-        if (!ctx->running) {
-            pthread_mutex_unlock(&ctx->queue.lock);
-            break;
+        return count;
+    }
+    
+    // One event per line
+    const char *marker = ctx->json_framing ? TRANSPORT_JSON_DROP_MARKER : TRANSPORT_TEXT_DROP_MARKER;
+    size_t marker_length = strlen(marker);
+    const char *end = data + length;
+    for (const char *line = data; line < end;) {
+        const char *line_end = memchr(line, '\n', end - line);
+        if (line_end == NULL) {
+            line_end = end;
         }
         
-        // No messages to process
-        if (ctx->queue.count == 0) {
-            pthread_mutex_unlock(&ctx->queue.lock);
+        if ((size_t)(line_end - line) > marker_length && memcmp(line, marker, marker_length) == 0) {
+            count += strtoull(line + marker_length, NULL, 10);
+        }
+        else {
+            count++;
+        }
+        line = line_end + 1;
+    }
+    return count;
+}
+
+// Length of the whole messages at the start of `data` that fit in `limit` bytes. If even the first doesn't fit, its length
+static size_t packet_prefix_length(const transport_context_t *ctx, const char *data, size_t length, size_t limit) {
+    if (length <= limit) {
+        return length;
+    }
+    
+    size_t prefix = 0;
+    if (ctx->binary_framing) {
+        const uint8_t *start = (const uint8_t *)data;
+        const uint8_t *position = start;
+        const uint8_t *end = start + length;
+        while (position < end) {
+            uint64_t record_length = 0;
+            if (!protocol_read_varint(&position, end, &record_length) || record_length > (uint64_t)(end - position)) {
+                // Not a complete record, which can't happen for staged output. Send the rest as it is
+                return prefix > 0 ? prefix : length;
+            }
+            
+            size_t record_end = (position + record_length) - start;
+            if (record_end > limit) {
+                return prefix > 0 ? prefix : record_end;
+            }
+            prefix = record_end;
+            position += record_length;
+        }
+        return prefix;
+    }
+    
+    // One message per line. Find the last line that ends within the limit
+    size_t search = limit;
+    while (search > 0 && data[search - 1] != '\n') {
+        search--;
+    }
+    if (search > 0) {
+        return search;
+    }
+    
+    const char *line_end = memchr(data, '\n', length);
+    return line_end ? (size_t)(line_end - data) + 1 : length;
+}
+
+// Write every buffer in iov, waiting out a full socket for as long as the transport is running
+static bool writev_all(transport_context_t *ctx, struct iovec *iov, int count) {
+    uint64_t last_progress = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    while (count > 0) {
+        ssize_t result = writev(ctx->fd, iov, count);
+        if (result > 0) {
+            last_progress = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+            // Skip whatever was fully written, and trim the buffer that was cut short
+            size_t written = result;
+            while (count > 0 && written >= iov->iov_len) {
+                written -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = (char *)iov->iov_base + written;
+                iov->iov_len -= written;
+            }
             continue;
         }
         
-        // Get next message
-        queued_message_t msg = ctx->queue.messages[0];
-        memmove(&ctx->queue.messages[0], &ctx->queue.messages[1], (ctx->queue.count - 1) * sizeof(queued_message_t));
-        ctx->queue.count--;
-        
-        pthread_cond_signal(&ctx->queue.not_full);
-        pthread_mutex_unlock(&ctx->queue.lock);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
         
-        char *send_buffer = NULL;
-        size_t send_length = msg.length;
-        if (msg.length > 0 && msg.data[msg.length - 1] != '\n') {
-            send_buffer = malloc(msg.length + 1);
-            if (send_buffer) {
-                memcpy(send_buffer, msg.data, msg.length);
-                send_buffer[msg.length] = '\n';
-                send_length = msg.length + 1;
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {
+                .fd = ctx->fd,
+                .events = POLLOUT,
+            };
+            if (poll(&pfd, 1, TRANSPORT_POLL_TIMEOUT_MS) == 0 && !atomic_load_explicit(&ctx->running, memory_order_relaxed)) {
+                // A deep socket buffer can take a while to become writable again even while the consumer is reading,
+                // so only give up once it has stopped taking data altogether
+                if (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - last_progress >= TRANSPORT_SHUTDOWN_WRITE_TIMEOUT_NS) {
+                    return false;
+                }
             }
+            continue;
         }
         
-        size_t total_sent = 0;
-        int retry_count = 0;
-        int consecutive_wouldblock = 0;
-        while (total_sent < send_length) {
+        return false;
+    }
+    
+    return true;
+}
+
+// Write a batch, as a single compressed frame when compression is on. Callers hold write_lock
+static bool write_output(transport_context_t *ctx, struct iovec *iov, int count) {
+    if (ctx->compressor == NULL) {
+        return writev_all(ctx, iov, count);
+    }
+    
+    output_buffer_reset(&ctx->compressed_frame);
+    if (append_compressed_frame(ctx->compressor, iov, count, &ctx->compressed_frame) != KERN_SUCCESS) {
+        errno = ENOMEM;
+        return false;
+    }
+    
+    struct iovec frame = {
+        .iov_base = ctx->compressed_frame.data,
+        .iov_len = ctx->compressed_frame.length,
+    };
+    return writev_all(ctx, &frame, 1);
+}
+
+// Write a marker for drops that no producer has reported yet. Used as the transport shuts down
+static void report_remaining_drops(transport_context_t *ctx) {
+    uint64_t unreported = 0;
+    for (event_ring_t *ring = atomic_load_explicit(&ctx->rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed) + atomic_load_explicit(&ring->discarded, memory_order_relaxed);
+        unreported += dropped - atomic_exchange_explicit(&ring->reported, dropped, memory_order_relaxed);
+    }
+    
+    if (unreported == 0 || atomic_load_explicit(&ctx->failed, memory_order_relaxed)) {
+        return;
+    }
+    
+    char storage[64];
+    output_buffer_t marker;
+    output_buffer_wrap(&marker, storage, sizeof(storage));
+    append_drop_marker(ctx, &marker, unreported);
+    struct iovec iov = {
+        .iov_base = marker.data,
+        .iov_len = marker.length,
+    };
+    pthread_mutex_lock(&ctx->write_lock);
+    write_output(ctx, &iov, 1);
+    pthread_mutex_unlock(&ctx->write_lock);
+}
+
+static void *transport_thread(void *tracer_arg) {
+    tracer_t *tracer = (tracer_t *)tracer_arg;
+    transport_context_t *ctx = (transport_context_t *)tracer->transport_context;
+    
+    struct iovec iov[TRANSPORT_MAX_BATCH_SPANS];
+    event_ring_t *batch_rings[TRANSPORT_MAX_BATCH_SPANS];
+    // When the oldest unwritten data was first seen, or 0 if nothing is waiting
+    uint64_t pending_since = 0;
+    
+    while (true) {
+        // Both are sampled before the rings, so everything committed before a shutdown or flush request is seen this pass
+        bool running = atomic_load_explicit(&ctx->running, memory_order_acquire);
+        uint64_t flush_request = atomic_load_explicit(&ctx->flush_requests, memory_order_acquire);
+        bool flush_requested = flush_request != atomic_load_explicit(&ctx->flushes_completed, memory_order_relaxed);
+        
+        // Gather what each ring has committed. Rings only hold whole messages, so any span can be written as-is
+        int span_count = 0;
+        size_t pending = 0;
+        bool gathered_all = true;
+        for (event_ring_t *ring = atomic_load_explicit(&ctx->rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+            size_t length = 0;
+            const char *data = NULL;
+            if (atomic_load_explicit(&ring->discard_requested, memory_order_acquire)) {
+                // The producer stops staging until this is cleared, so everything it asked to be thrown away is here
+                data = event_ring_peek(ring, &length);
+                atomic_fetch_add_explicit(&ring->discarded, count_staged_events(ctx, data, length), memory_order_relaxed);
+                event_ring_consume(ring, length);
+                atomic_store_explicit(&ring->discard_requested, false, memory_order_release);
+                continue;
+            }
             
-            const void *curr_buf = send_buffer ? send_buffer : msg.data;
-            ssize_t sent = send(ctx->fd, curr_buf + total_sent, send_length - total_sent, 0);
-            if (sent > 0) {
-                total_sent += sent;
-                consecutive_wouldblock = 0;
+            data = event_ring_peek(ring, &length);
+            if (length == 0) {
                 continue;
             }
             
-            if (sent == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    consecutive_wouldblock++;
-                    
-                    // If buffer is consistently full, increase backoff
-                    unsigned int sleep_ms = RETRY_BASE_DELAY_MS * (1 << MIN(consecutive_wouldblock, 6));
-                    usleep(sleep_ms * 1000);
-                    
-                    if (consecutive_wouldblock > 3) {
-                        retry_count++;
-                    }
-                    
-                    if (retry_count >= MAX_RETRIES) {
-                        tracer_set_error(tracer, "Max retries exceeded while sending");
-                        break;
-                    }
-                    continue;
+            // A compressed batch goes out as one frame, which can't be larger than the decoder accepts
+            if (span_count == TRANSPORT_MAX_BATCH_SPANS || (ctx->compressor && pending + length > COMPRESSED_STREAM_MAX_FRAME_LENGTH)) {
+                gathered_all = false;
+                break;
+            }
+            
+            if (ctx->packet_size > 0) {
+                // Every write is one packet, so a batch has to end on a message boundary and fit in a packet
+                size_t room = pending < ctx->packet_size ? ctx->packet_size - pending : 0;
+                size_t packet_length = packet_prefix_length(ctx, data, length, room);
+                if (room == 0 || (packet_length > room && pending > 0)) {
+                    gathered_all = false;
+                    break;
                 }
                 
-                tracer_set_error(tracer, "Send failed: %s", strerror(errno));
+                if (packet_length < length) {
+                    gathered_all = false;
+                    length = packet_length;
+                }
+            }
+            
+            iov[span_count] = (struct iovec){
+                .iov_base = (void *)data,
+                .iov_len = length,
+            };
+            batch_rings[span_count++] = ring;
+            pending += length;
+        }
+        
+        uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        if (pending > 0 && pending_since == 0) {
+            pending_since = now;
+        }
+        
+        bool due = pending > 0 && (!running || flush_requested || pending >= ctx->flush_bytes || now - pending_since >= ctx->flush_interval_ns);
+        if (due) {
+            // writev trims iov as it goes, so remember the lengths to consume first
+            size_t lengths[TRANSPORT_MAX_BATCH_SPANS];
+            for (int i = 0; i < span_count; i++) {
+                lengths[i] = iov[i].iov_len;
+            }
+            
+            if (!atomic_load_explicit(&ctx->failed, memory_order_relaxed)) {
+                pthread_mutex_lock(&ctx->write_lock);
+                bool written = write_output(ctx, iov, span_count);
+                pthread_mutex_unlock(&ctx->write_lock);
                 
-                free(send_buffer);
-                free(msg.data);
-                return NULL;
+                if (!written) {
+                    tracer_set_error(tracer, "Send failed: %s", strerror(errno));
+                    atomic_store_explicit(&ctx->failed, true, memory_order_relaxed);
+                }
             }
+            
+            for (int i = 0; i < span_count; i++) {
+                event_ring_consume(batch_rings[i], lengths[i]);
+            }
+            pending_since = gathered_all ? 0 : now;
         }
         
-        free(send_buffer);
-        free(msg.data);
+        if (pending == 0 || (due && gathered_all)) {
+            // Everything committed before the flush request has been written
+            atomic_store_explicit(&ctx->flushes_completed, flush_request, memory_order_release);
+        }
+        
+        if (pending == 0 && !running) {
+            report_remaining_drops(ctx);
+            break;
+        }
+        
+        if (!due) {
+            usleep(TRANSPORT_IDLE_SLEEP_US);
+        }
     }
     
     return NULL;
 }
 
+// Get the calling thread's ring, claiming or creating one on first use
+static event_ring_t *thread_ring(transport_context_t *ctx, tracer_thread_context_t *thread_ctx) {
+    if (thread_ctx->ring) {
+        return thread_ctx->ring;
+    }
+    
+    // Reuse a ring left behind by a thread that has exited
+    event_ring_t *head = atomic_load_explicit(&ctx->rings, memory_order_acquire);
+    for (event_ring_t *ring = head; ring != NULL; ring = ring->next) {
+        if (event_ring_try_claim(ring)) {
+            thread_ctx->ring = ring;
+            return ring;
+        }
+    }
+    
+    event_ring_t *ring = event_ring_create(TRANSPORT_RING_CAPACITY);
+    if (ring == NULL) {
+        return NULL;
+    }
+    atomic_store_explicit(&ring->in_use, true, memory_order_relaxed);
+    
+    do {
+        ring->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&ctx->rings, &head, ring, memory_order_release, memory_order_acquire));
+    
+    thread_ctx->ring = ring;
+    return ring;
+}
+
+// Count an event the calling thread had to give up on
+static void record_drop(event_ring_t *ring) {
+    uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+}
+
+// Something this thread encoded won't be sent, so its next binary event has to start from a clean dictionary
+static void restart_thread_stream(transport_context_t *ctx, tracer_thread_context_t *thread_ctx) {
+    if (ctx->binary_framing) {
+        event_encoder_free(&thread_ctx->encoder);
+    }
+}
+
+// Keep every event while the ring is under half full, then 1 in 2 at three quarters, 1 in 4 at seven eighths, and so on
+static bool sample_event(event_ring_t *ring) {
+    size_t available = 0;
+    event_ring_reserve(ring, &available);
+    if (available >= ring->capacity / 2) {
+        return true;
+    }
+    
+    size_t keep_one_in = (ring->capacity / 2) / (available > 0 ? available : 1);
+    return ring->sample_count++ % keep_one_in == 0;
+}
+
+// Stage a marker for drops this thread hasn't reported yet. Markers are rate limited so a long overload doesn't flood the output
+static void report_drops(transport_context_t *ctx, event_ring_t *ring) {
+    uint64_t reported = atomic_load_explicit(&ring->reported, memory_order_relaxed);
+    uint64_t unreported = atomic_load_explicit(&ring->dropped, memory_order_relaxed) + atomic_load_explicit(&ring->discarded, memory_order_relaxed) - reported;
+    if (unreported == 0) {
+        return;
+    }
+    
+    uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    if (now - ring->last_report < TRANSPORT_DROP_REPORT_INTERVAL_NS) {
+        return;
+    }
+    
+    size_t available = 0;
+    char *data = event_ring_reserve(ring, &available);
+    output_buffer_t marker;
+    output_buffer_wrap(&marker, data, available);
+    append_drop_marker(ctx, &marker, unreported);
+    if (marker.failed) {
+        return;
+    }
+    
+    // Counted before the marker is published, so the transport thread never reports the same drops again
+    atomic_store_explicit(&ring->reported, reported + unreported, memory_order_relaxed);
+    event_ring_commit(ring, marker.length);
+    ring->last_report = now;
+}
+
+// Have the transport thread throw away everything this thread has staged, waiting briefly for it to happen
+static bool discard_backlog(transport_context_t *ctx, tracer_thread_context_t *thread_ctx, event_ring_t *ring) {
+    if (!ring->awaiting_discard) {
+        ring->awaiting_discard = true;
+        atomic_store_explicit(&ring->discard_requested, true, memory_order_release);
+    }
+    
+    for (uint32_t waited = 0; atomic_load_explicit(&ring->discard_requested, memory_order_acquire); waited += TRANSPORT_SEND_RETRY_US) {
+        if (waited >= TRANSPORT_DISCARD_WAIT_US) {
+            // transport_admit_event finishes up once it's done
+            return false;
+        }
+        usleep(TRANSPORT_SEND_RETRY_US);
+    }
+    
+    ring->awaiting_discard = false;
+    restart_thread_stream(ctx, thread_ctx);
+    return true;
+}
+
 static tracer_result_t init_socket_transport(tracer_t *tracer, const tracer_transport_config_t *config) {
     bool connected = false;
     int sockfd = -1;
@@ -155,6 +512,16 @@ static tracer_result_t init_socket_transport(tracer_t *tracer, const tracer_tran
         return TRACER_ERROR_INITIALIZATION;
     }
     
+    // Writes are already batched, so Nagle's algorithm would only add latency
+    int enable = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+#ifdef SO_NOSIGPIPE
+    // Don't let the process die from SIGPIPE if the CLI goes away mid-write
+    setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+    int buffer_size = TRANSPORT_SOCKET_BUFFER_SIZE;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    
     int flags = fcntl(sockfd, F_GETFL, 0);
     fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
     
@@ -163,6 +530,82 @@ static tracer_result_t init_socket_transport(tracer_t *tracer, const tracer_tran
     return TRACER_SUCCESS;
 }
 
+static tracer_result_t init_unix_transport(tracer_t *tracer, const tracer_transport_config_t *config) {
+    struct sockaddr_un server_addr = {
+        .sun_family = AF_UNIX,
+    };
+    if (strlcpy(server_addr.sun_path, config->socket_path, sizeof(server_addr.sun_path)) >= sizeof(server_addr.sun_path)) {
+        tracer_set_error(tracer, "Socket path is too long: %s", config->socket_path);
+        return TRACER_ERROR_INVALID_ARGUMENT;
+    }
+    
+    int sockfd = socket(AF_UNIX, config->seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        tracer_set_error(tracer, "Failed to create socket: %s", strerror(errno));
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+    // The consumer is already listening by the time the config reaches us, so there's nothing to wait or retry for
+    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        tracer_set_error(tracer, "Failed to connect to %s: %s", config->socket_path, strerror(errno));
+        close(sockfd);
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+    int buffer_size = TRANSPORT_UNIX_SOCKET_BUFFER_SIZE;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    
+    transport_context_t *ctx = tracer->transport_context;
+    ctx->fd = sockfd;
+    if (config->seqpacket) {
+        ctx->packet_size = TRANSPORT_MAX_PACKET_SIZE;
+        // A batch can't grow past one packet, so don't wait for more than that
+        if (ctx->flush_bytes > ctx->packet_size) {
+            ctx->flush_bytes = ctx->packet_size;
+        }
+    }
+    return TRACER_SUCCESS;
+}
+
+static tracer_result_t init_shm_transport(tracer_t *tracer, const tracer_transport_config_t *config) {
+    transport_context_t *ctx = tracer->transport_context;
+    ctx->shm = shm_ring_attach(config->shm_name);
+    for (uint32_t waited = 0; ctx->shm == NULL && waited < TRANSPORT_SHM_ATTACH_TIMEOUT_US; waited += TRANSPORT_SHM_ATTACH_RETRY_US) {
+        usleep(TRANSPORT_SHM_ATTACH_RETRY_US);
+        ctx->shm = shm_ring_attach(config->shm_name);
+    }
+    if (ctx->shm == NULL) {
+        tracer_set_error(tracer, "Failed to map shared memory ring %s", config->shm_name);
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+    return TRACER_SUCCESS;
+}
+
+static tracer_result_t init_segment_transport(tracer_t *tracer, const tracer_transport_config_t *config) {
+    segment_log_options_t options = {
+        .segment_size = (size_t)config->segment_size_mb * 1024 * 1024,
+        .max_segments = config->max_segments,
+        .max_age_s = config->segment_max_age_s,
+    };
+    
+    transport_context_t *ctx = tracer->transport_context;
+    ctx->segments = segment_log_open(config->file_path, &options);
+    if (ctx->segments == NULL) {
+        tracer_set_error(tracer, "Failed to create trace segment for %s: %s", config->file_path, strerror(errno));
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+    return TRACER_SUCCESS;
+}
+
 static tracer_result_t init_file_transport(tracer_t *tracer, const tracer_transport_config_t *config) {
     transport_context_t *ctx = tracer->transport_context;
     if (ctx->type == TRACER_TRANSPORT_STDOUT || config->file_path == NULL) {
@@ -180,6 +623,31 @@ static tracer_result_t init_file_transport(tracer_t *tracer, const tracer_transp
     return TRACER_SUCCESS;
 }
 
+// Compressed output starts with its own preamble, ahead of anything else
+static tracer_result_t start_compression(tracer_t *tracer, transport_context_t *ctx) {
+    ctx->compressor = stream_compressor_create();
+    if (ctx->compressor == NULL) {
+        return TRACER_ERROR_MEMORY;
+    }
+    
+    char storage[COMPRESSED_STREAM_PREAMBLE_LENGTH + 1];
+    output_buffer_t preamble;
+    output_buffer_wrap(&preamble, storage, sizeof(storage));
+    append_compressed_stream_preamble(&preamble);
+    struct iovec iov = {
+        .iov_base = preamble.data,
+        .iov_len = preamble.length,
+    };
+    if (!writev_all(ctx, &iov, 1)) {
+        tracer_set_error(tracer, "Send failed: %s", strerror(errno));
+        stream_compressor_free(ctx->compressor);
+        ctx->compressor = NULL;
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+    return TRACER_SUCCESS;
+}
+
 tracer_result_t transport_init(tracer_t *tracer, const tracer_transport_config_t *config) {
     if (tracer == NULL || config == NULL) {
         return TRACER_ERROR_INVALID_ARGUMENT;
@@ -198,31 +666,18 @@ tracer_result_t transport_init(tracer_t *tracer, const tracer_transport_config_t
     if (pthread_mutex_init(&ctx->write_lock, NULL) != 0) {
         os_log(OS_LOG_DEFAULT, "Failed to create write lock");
         free(ctx);
+        tracer->transport_context = NULL;
         return TRACER_ERROR_INITIALIZATION;
     }
     
     ctx->type = tracer->config.transport;
-    ctx->queue.capacity = 10000;
-    ctx->queue.messages = calloc(ctx->queue.capacity, sizeof(queued_message_t));
-    if (ctx->queue.messages == NULL) {
-        pthread_mutex_destroy(&ctx->write_lock);
-        free(ctx);
-        return TRACER_ERROR_MEMORY;
-    }
-
-    pthread_mutex_init(&ctx->queue.lock, NULL);
-    pthread_cond_init(&ctx->queue.not_full, NULL);
-    pthread_cond_init(&ctx->queue.not_empty, NULL);
+    ctx->binary_framing = tracer->config.format.output_as_binary;
+    ctx->json_framing = !ctx->binary_framing && tracer->config.format.output_as_json;
+    ctx->backpressure = config->backpressure;
     
-    ctx->running = true;
-    int thread_err = pthread_create(&ctx->transport_thread, NULL, transport_thread, tracer);
-    if (thread_err != 0) {
-        os_log(OS_LOG_DEFAULT, "Failed to create transport thread: %s", strerror(thread_err));
-        free(ctx->queue.messages);
-        free(ctx);
-        return TRACER_ERROR_INITIALIZATION;
-    }
-    pthread_detach(ctx->transport_thread);
+    uint32_t flush_interval_ms = config->flush_interval_ms ? config->flush_interval_ms : TRANSPORT_DEFAULT_FLUSH_INTERVAL_MS;
+    ctx->flush_interval_ns = (uint64_t)flush_interval_ms * 1000000ULL;
+    ctx->flush_bytes = config->flush_bytes ? config->flush_bytes : TRANSPORT_DEFAULT_FLUSH_BYTES;
     
     tracer_result_t result;
     switch (ctx->type) {
@@ -231,10 +686,19 @@ tracer_result_t transport_init(tracer_t *tracer, const tracer_transport_config_t
                 result = TRACER_ERROR_INVALID_ARGUMENT;
                 break;
             }
-    
+            
             result = init_socket_transport(tracer, config);
             break;
         }
+        case TRACER_TRANSPORT_UNIX: {
+            if (config->socket_path == NULL) {
+                result = TRACER_ERROR_INVALID_ARGUMENT;
+                break;
+            }
+            
+            result = init_unix_transport(tracer, config);
+            break;
+        }
         case TRACER_TRANSPORT_STDOUT:
         case TRACER_TRANSPORT_FILE:
             result = init_file_transport(tracer, config);
@@ -244,65 +708,249 @@ tracer_result_t transport_init(tracer_t *tracer, const tracer_transport_config_t
             result = TRACER_SUCCESS;
             break;
         }
+        case TRACER_TRANSPORT_SHM: {
+            if (config->shm_name == NULL) {
+                result = TRACER_ERROR_INVALID_ARGUMENT;
+                break;
+            }
+            
+            result = init_shm_transport(tracer, config);
+            break;
+        }
+        case TRACER_TRANSPORT_SEGMENTS: {
+            if (config->file_path == NULL) {
+                result = TRACER_ERROR_INVALID_ARGUMENT;
+                break;
+            }
+            
+            result = init_segment_transport(tracer, config);
+            break;
+        }
         default:
             result = TRACER_ERROR_INVALID_ARGUMENT;
     }
     
+    if (result == TRACER_SUCCESS && config->compress && transport_uses_rings(ctx)) {
+        result = start_compression(tracer, ctx);
+        if (result != TRACER_SUCCESS && ctx->fd != STDOUT_FILENO) {
+            close(ctx->fd);
+        }
+    }
+    
+    if (result == TRACER_SUCCESS && transport_uses_rings(ctx)) {
+        atomic_store(&ctx->running, true);
+        int thread_err = pthread_create(&ctx->transport_thread, NULL, transport_thread, tracer);
+        if (thread_err != 0) {
+            os_log(OS_LOG_DEFAULT, "Failed to create transport thread: %s", strerror(thread_err));
+            if (ctx->fd != STDOUT_FILENO) {
+                close(ctx->fd);
+            }
+            stream_compressor_free(ctx->compressor);
+            result = TRACER_ERROR_INITIALIZATION;
+        }
+        ctx->has_transport_thread = thread_err == 0;
+    }
+    
     if (result != TRACER_SUCCESS) {
         pthread_mutex_destroy(&ctx->write_lock);
-        free(ctx->queue.messages);
         free(ctx);
+        tracer->transport_context = NULL;
         return result;
     }
     
     return TRACER_SUCCESS;
 }
 
+bool transport_admit_event(tracer_t *tracer, tracer_thread_context_t *thread_ctx) {
+    transport_context_t *ctx = tracer->transport_context;
+    if (ctx && thread_ctx && ctx->segments) {
+        // Each segment is read on its own, so a thread's binary stream starts over in every segment it writes to
+        uint64_t segment_index = segment_log_begin_event(ctx->segments);
+        if (segment_index != thread_ctx->segment_index) {
+            restart_thread_stream(ctx, thread_ctx);
+            thread_ctx->segment_index = segment_index;
+        }
+        return segment_index != 0;
+    }
+    
+    if (ctx == NULL || thread_ctx == NULL || !transport_uses_rings(ctx)) {
+        return true;
+    }
+    
+    if (atomic_load_explicit(&ctx->failed, memory_order_relaxed)) {
+        return false;
+    }
+    
+    event_ring_t *ring = thread_ring(ctx, thread_ctx);
+    if (ring == NULL) {
+        // Let transport_send report it
+        return true;
+    }
+    
+    if (ring->awaiting_discard) {
+        if (atomic_load_explicit(&ring->discard_requested, memory_order_acquire)) {
+            // Nothing can be staged until the transport thread has thrown away the backlog
+            record_drop(ring);
+            return false;
+        }
+        
+        ring->awaiting_discard = false;
+        restart_thread_stream(ctx, thread_ctx);
+    }
+    
+    if (ctx->backpressure == TRACER_BACKPRESSURE_SAMPLE && !sample_event(ring)) {
+        record_drop(ring);
+        return false;
+    }
+    
+    report_drops(ctx, ring);
+    return true;
+}
+
+tracer_result_t transport_begin_event(tracer_t *tracer, tracer_thread_context_t *thread_ctx, output_buffer_t *out) {
+    transport_context_t *ctx = tracer->transport_context;
+    if (ctx == NULL || thread_ctx == NULL || !transport_uses_rings(ctx)) {
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+    if (atomic_load_explicit(&ctx->failed, memory_order_relaxed)) {
+        return TRACER_ERROR_RUNTIME;
+    }
+    
+    event_ring_t *ring = thread_ring(ctx, thread_ctx);
+    if (ring == NULL) {
+        return TRACER_ERROR_MEMORY;
+    }
+    
+    size_t available = 0;
+    char *data = event_ring_reserve(ring, &available);
+    if (available == 0) {
+        // A full ring's reserve position is the oldest byte not yet written. The caller formats on the heap instead
+        return TRACER_ERROR_MEMORY;
+    }
+    output_buffer_wrap(out, data, available);
+    return TRACER_SUCCESS;
+}
+
+void transport_commit_event(tracer_t *tracer, tracer_thread_context_t *thread_ctx, const output_buffer_t *out) {
+    if (thread_ctx == NULL || thread_ctx->ring == NULL || out->failed || out->length == 0) {
+        return;
+    }
+    
+    event_ring_commit(thread_ctx->ring, out->length);
+}
+
+// Copy a message into the calling thread's ring. If it's full, the backpressure policy decides whether to wait,
+// make room or drop the message
+static tracer_result_t stage_message(tracer_t *tracer, transport_context_t *ctx, const void *data, size_t length) {
+    if (atomic_load_explicit(&ctx->failed, memory_order_relaxed)) {
+        return TRACER_ERROR_RUNTIME;
+    }
+    
+    tracer_thread_context_t *thread_ctx = tracer_get_thread_context(tracer);
+    event_ring_t *ring = thread_ctx ? thread_ring(ctx, thread_ctx) : NULL;
+    if (ring == NULL) {
+        tracer_set_error(tracer, "Failed to allocate transport ring");
+        return TRACER_ERROR_MEMORY;
+    }
+    
+    if (length >= ring->capacity) {
+        tracer_set_error(tracer, "Message of %zu bytes is too large to send", length);
+        restart_thread_stream(ctx, thread_ctx);
+        return TRACER_ERROR_INVALID_ARGUMENT;
+    }
+    
+    size_t available = 0;
+    char *destination = ring->awaiting_discard ? NULL : event_ring_reserve(ring, &available);
+    if (available < length && ctx->backpressure == TRACER_BACKPRESSURE_BLOCK) {
+        for (uint32_t waited = 0; available < length && waited < TRANSPORT_SEND_TIMEOUT_US; waited += TRANSPORT_SEND_RETRY_US) {
+            usleep(TRANSPORT_SEND_RETRY_US);
+            destination = event_ring_reserve(ring, &available);
+        }
+    }
+    else if (available < length && ctx->backpressure == TRACER_BACKPRESSURE_DROP_OLDEST && discard_backlog(ctx, thread_ctx, ring) && !ctx->binary_framing) {
+        // A binary message may refer to string definitions that were just thrown away, so only text can still be sent
+        destination = event_ring_reserve(ring, &available);
+    }
+    
+    if (available < length) {
+        record_drop(ring);
+        restart_thread_stream(ctx, thread_ctx);
+        return TRACER_ERROR_TIMEOUT;
+    }
+    
+    memcpy(destination, data, length);
+    event_ring_commit(ring, length);
+    return TRACER_SUCCESS;
+}
+
+// Copy a message into the shared memory ring. Threads share it, so the only choices when it's full are to wait or drop
+static tracer_result_t send_shm_message(tracer_t *tracer, transport_context_t *ctx, const void *data, size_t length) {
+    if (shm_ring_write(ctx->shm, data, length)) {
+        return TRACER_SUCCESS;
+    }
+    
+    if (ctx->backpressure == TRACER_BACKPRESSURE_BLOCK) {
+        for (uint32_t waited = 0; waited < TRANSPORT_SEND_TIMEOUT_US; waited += TRANSPORT_SEND_RETRY_US) {
+            usleep(TRANSPORT_SEND_RETRY_US);
+            if (shm_ring_write(ctx->shm, data, length)) {
+                return TRACER_SUCCESS;
+            }
+        }
+    }
+    
+    // The consumer reads the drop count straight from the ring
+    atomic_fetch_add_explicit(&ctx->shm->header->dropped, 1, memory_order_relaxed);
+    tracer_thread_context_t *thread_ctx = tracer_get_thread_context(tracer);
+    if (thread_ctx) {
+        restart_thread_stream(ctx, thread_ctx);
+    }
+    return TRACER_ERROR_TIMEOUT;
+}
+
+// Copy a message into the current segment file. It never waits, so the backpressure policy doesn't apply
+static tracer_result_t send_segment_message(tracer_t *tracer, transport_context_t *ctx, const void *data, size_t length) {
+    tracer_thread_context_t *thread_ctx = tracer_get_thread_context(tracer);
+    // Binary output refers back to strings defined earlier in the segment, so it can't move on to the next one
+    uint64_t segment_index = ctx->binary_framing && thread_ctx ? thread_ctx->segment_index : 0;
+    kern_return_t kr = segment_log_append(ctx->segments, data, length, segment_index);
+    if (kr == KERN_SUCCESS) {
+        return TRACER_SUCCESS;
+    }
+    
+    // The drop is recorded in the segment's footer
+    if (thread_ctx) {
+        restart_thread_stream(ctx, thread_ctx);
+    }
+    if (kr == KERN_RESOURCE_SHORTAGE) {
+        tracer_set_error(tracer, "Failed to create the next trace segment");
+        return TRACER_ERROR_RUNTIME;
+    }
+    return kr == KERN_INVALID_ARGUMENT ? TRACER_ERROR_INVALID_ARGUMENT : TRACER_ERROR_TIMEOUT;
+}
+
 tracer_result_t transport_send(tracer_t *tracer, const void *data, size_t length) {
     transport_context_t *ctx = tracer->transport_context;
     if (ctx == NULL || data == NULL || length == 0) {
         return TRACER_ERROR_INITIALIZATION;
     }
     
+    if (transport_uses_rings(ctx)) {
+        return stage_message(tracer, ctx, data, length);
+    }
+    
+    if (ctx->type == TRACER_TRANSPORT_SHM) {
+        return send_shm_message(tracer, ctx, data, length);
+    }
+    
+    if (ctx->type == TRACER_TRANSPORT_SEGMENTS) {
+        return send_segment_message(tracer, ctx, data, length);
+    }
+    
     pthread_mutex_lock(&ctx->write_lock);
     tracer_result_t result = TRACER_SUCCESS;
     
     switch (ctx->type) {
-        case TRACER_TRANSPORT_SOCKET:
-        case TRACER_TRANSPORT_FILE: {
-            char *data_copy = malloc(length);
-            if (data_copy == NULL) {
-                
-                pthread_mutex_unlock(&ctx->write_lock);
-                tracer_set_error(tracer, "Failed to allocate memory");
-                return TRACER_ERROR_MEMORY;
-            }
-            memcpy(data_copy, data, length);
-            
-            struct timespec timeout;
-            clock_gettime(CLOCK_REALTIME, &timeout);
-            timeout.tv_sec += 2;
-            pthread_mutex_lock(&ctx->queue.lock);
-            
-            while (ctx->queue.count >= ctx->queue.capacity) {
-                int rc = pthread_cond_timedwait(&ctx->queue.not_full, &ctx->queue.lock, &timeout);
-                if (rc == ETIMEDOUT) {
-                    pthread_mutex_unlock(&ctx->queue.lock);
-                    pthread_mutex_unlock(&ctx->write_lock);
-                    free(data_copy);
-                    return TRACER_ERROR_TIMEOUT;
-                }
-            }
-            
-            ctx->queue.messages[ctx->queue.count++] = (queued_message_t){
-                .data = data_copy,
-                .length = length
-            };
-            
-            pthread_cond_signal(&ctx->queue.not_empty);
-            pthread_mutex_unlock(&ctx->queue.lock);
-            break;
-        }
         case TRACER_TRANSPORT_CUSTOM: {
             if (tracer->config.event_handler) {
                 tracer->config.event_handler(data, tracer->config.event_handler_context);
@@ -314,12 +962,104 @@ tracer_result_t transport_send(tracer_t *tracer, const void *data, size_t length
             if (tracer->transport_context) {
                 transport_context_t *transport = tracer->transport_context;
                 write(transport->fd, data, length);
-                os_log(OS_LOG_DEFAULT, "%s", (const char *)data);
+                if (!transport->binary_framing) {
+                    os_log(OS_LOG_DEFAULT, "%s", (const char *)data);
+                }
             }
             break;
         }
+        
+        default:
+            result = TRACER_ERROR_INVALID_ARGUMENT;
+            break;
     }
     
     pthread_mutex_unlock(&ctx->write_lock);
     return result;
 }
+
+tracer_result_t transport_write_direct(tracer_t *tracer, const void *data, size_t length) {
+    transport_context_t *ctx = tracer->transport_context;
+    if (ctx == NULL || data == NULL || length == 0) {
+        return TRACER_ERROR_INITIALIZATION;
+    }
+    
+    if (ctx->type == TRACER_TRANSPORT_CUSTOM) {
+        return TRACER_SUCCESS;
+    }
+    
+    if (ctx->type == TRACER_TRANSPORT_SHM) {
+        return shm_ring_write(ctx->shm, data, length) ? TRACER_SUCCESS : TRACER_ERROR_RUNTIME;
+    }
+    
+    if (ctx->type == TRACER_TRANSPORT_SEGMENTS) {
+        // Repeated at the start of every segment
+        return segment_log_set_prologue(ctx->segments, data, length) == KERN_SUCCESS ? TRACER_SUCCESS : TRACER_ERROR_RUNTIME;
+    }
+    
+    struct iovec iov = {
+        .iov_base = (void *)data,
+        .iov_len = length,
+    };
+    pthread_mutex_lock(&ctx->write_lock);
+    bool written = write_output(ctx, &iov, 1);
+    pthread_mutex_unlock(&ctx->write_lock);
+    
+    if (!written) {
+        tracer_set_error(tracer, "Send failed: %s", strerror(errno));
+        return TRACER_ERROR_RUNTIME;
+    }
+    return TRACER_SUCCESS;
+}
+
+tracer_result_t transport_flush(tracer_t *tracer) {
+    transport_context_t *ctx = tracer->transport_context;
+    if (ctx == NULL || !ctx->has_transport_thread) {
+        // Nothing is staged for other transports
+        return TRACER_SUCCESS;
+    }
+    
+    uint64_t request = atomic_fetch_add_explicit(&ctx->flush_requests, 1, memory_order_acq_rel) + 1;
+    for (uint32_t waited = 0; atomic_load_explicit(&ctx->flushes_completed, memory_order_acquire) < request; waited += TRANSPORT_SEND_RETRY_US) {
+        if (waited >= TRANSPORT_FLUSH_TIMEOUT_US) {
+            tracer_set_error(tracer, "Timed out flushing transport");
+            return TRACER_ERROR_TIMEOUT;
+        }
+        usleep(TRANSPORT_SEND_RETRY_US);
+    }
+    
+    return TRACER_SUCCESS;
+}
+
+void transport_cleanup(tracer_t *tracer) {
+    transport_context_t *ctx = tracer->transport_context;
+    if (ctx == NULL) {
+        return;
+    }
+    
+    if (ctx->has_transport_thread) {
+        // The thread makes a final pass over the rings before it exits
+        atomic_store_explicit(&ctx->running, false, memory_order_release);
+        pthread_join(ctx->transport_thread, NULL);
+    }
+    
+    event_ring_t *ring = atomic_load_explicit(&ctx->rings, memory_order_acquire);
+    while (ring) {
+        event_ring_t *next = ring->next;
+        event_ring_destroy(ring);
+        ring = next;
+    }
+    
+    pthread_mutex_destroy(&ctx->write_lock);
+    shm_ring_close(ctx->shm);
+    // Writes the last segment's footer
+    segment_log_close(ctx->segments);
+    stream_compressor_free(ctx->compressor);
+    output_buffer_free(&ctx->compressed_frame);
+    if (ctx->type != TRACER_TRANSPORT_CUSTOM && ctx->type != TRACER_TRANSPORT_SHM && ctx->type != TRACER_TRANSPORT_SEGMENTS && ctx->fd >= 0 && ctx->fd != STDOUT_FILENO) {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+    free(ctx);
+    tracer->transport_context = NULL;
+}
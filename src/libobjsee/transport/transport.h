@@ -6,12 +6,14 @@
 //
 
 #include "tracer_internal.h"
+#include "event_ring.h"
+#include "shm_ring.h"
+#include "segment_log.h"
+#include "stream_compression.h"
 #include <pthread.h>
 
-typedef struct {
-    char *data;
-    size_t length;
-} queued_message_t;
+// Size of each producer thread's ring
+#define TRANSPORT_RING_CAPACITY (512 * 1024)
 
 
 typedef struct {
@@ -19,22 +21,92 @@ typedef struct {
         int fd;
         void *custom_handle;
     };
-    
-    struct {
-        queued_message_t *messages;
-        size_t capacity;
-        size_t count;
-        pthread_mutex_t lock;
-        pthread_cond_t not_full;
-        pthread_cond_t not_empty;
-    } queue;
-    
-    bool running;
+
+    // Socket and file output is staged in one ring per producer thread, newest first.
+    // Rings are only ever added. When a thread exits its ring is released for the next new thread to claim
+    _Atomic(event_ring_t *) rings;
+    // Mapped from the consumer for TRACER_TRANSPORT_SHM. Every thread writes to it directly
+    shm_ring_t *shm;
+    // Segment files for TRACER_TRANSPORT_SEGMENTS. Threads append to the mapped segment directly too
+    segment_log_t *segments;
+
+    _Atomic(bool) running;
     pthread_t transport_thread;
+    bool has_transport_thread;
+    // Set after a write fails for good. Staged output is discarded from then on so producers never wait on it
+    _Atomic(bool) failed;
     
+    // Flush policy, resolved from the transport config
+    uint64_t flush_interval_ns;
+    size_t flush_bytes;
+    // Largest batch for a SOCK_SEQPACKET socket, where each write is delivered as one packet. 0 for byte streams
+    size_t packet_size;
+    // transport_flush bumps `flush_requests`. The transport thread catches `flushes_completed` up to it
+    // once everything that was committed before the request has been written
+    _Atomic(uint64_t) flush_requests;
+    _Atomic(uint64_t) flushes_completed;
+
     tracer_transport_type_t type;
     pthread_mutex_t write_lock;
+
+    // Binary protocol output isn't text, so it's kept out of os_log
+    bool binary_framing;
+    // Output is one json object per line. Drop markers are written to match
+    bool json_framing;
+    tracer_backpressure_policy_t backpressure;
+    
+    // Set when output is compressed. Each batch is compressed into `compressed_frame` under write_lock
+    stream_compressor_t *compressor;
+    output_buffer_t compressed_frame;
 } transport_context_t;
 
 tracer_result_t transport_init(tracer_t *tracer, const tracer_transport_config_t *config);
 tracer_result_t transport_send(tracer_t *tracer, const void *data, size_t length);
+
+
+/**
+ * @brief Apply the backpressure policy before an event is formatted
+ *
+ * @param tracer The tracer
+ * @param thread_ctx The calling thread's context
+ * @return false if the event should be skipped. It has already been counted as dropped
+ * @note Also stages a marker for any drops the calling thread hasn't reported yet
+ */
+bool transport_admit_event(tracer_t *tracer, tracer_thread_context_t *thread_ctx);
+
+/**
+ * @brief Point `out` at free space in the calling thread's ring, so an event can be formatted in place
+ *
+ * @param tracer The tracer
+ * @param thread_ctx The calling thread's context
+ * @param out Receives a fixed-size buffer over the ring. If the event doesn't fit, `out->failed` is set
+ * @return TRACER_SUCCESS, TRACER_ERROR_MEMORY if the ring has no free space at all, or another error if the
+ * transport doesn't stage output in rings. Callers should fall back to transport_send in every case but success
+ * @note Nothing is sent until transport_commit_event
+ */
+tracer_result_t transport_begin_event(tracer_t *tracer, tracer_thread_context_t *thread_ctx, output_buffer_t *out);
+
+/**
+ * @brief Publish an event formatted into the buffer from transport_begin_event
+ */
+void transport_commit_event(tracer_t *tracer, tracer_thread_context_t *thread_ctx, const output_buffer_t *out);
+
+
+/**
+ * @brief Write straight to the output, ahead of anything staged
+ * @note Only for data that must precede every event, such as a stream header, and only before events are handled
+ */
+tracer_result_t transport_write_direct(tracer_t *tracer, const void *data, size_t length);
+
+
+/**
+ * @brief Write out everything committed so far, ignoring the flush policy's limits
+ * @return TRACER_SUCCESS once it has been written, or TRACER_ERROR_TIMEOUT if that took too long
+ */
+tracer_result_t transport_flush(tracer_t *tracer);
+
+
+/**
+ * @brief Drain anything staged, stop the transport thread and release the transport
+ */
+void transport_cleanup(tracer_t *tracer);
@@ -5,13 +5,30 @@
 //  Created by Ethan Arbuckle on 12/10/24.
 //
 
+#include <stdatomic.h>
 #include "blocks.h"
 #include "tracer_internal.h"
+#include "type_descriptor.h"
 
 #define MAX_TYPE_LEN 1024
 #define IS_VALID_ADDR(addr) ((addr) && ((addr) & 0x7) == 0 && (addr) >= 0x100000000 && (addr) <= 0x2000000000)
 #define MAX_PARAMS 32
 
+// Decoded signatures, keyed by the block's (static) descriptor. Slots are claimed with CAS and
+// never reused, so the cache is bounded by its capacity rather than by eviction
+#define BLOCK_DESCRIPTION_CACHE_CAPACITY 4096
+#define BLOCK_DESCRIPTION_CACHE_MAX_PROBES 32
+
+typedef struct {
+    const char *signature;
+    char description[];
+} block_description_entry_t;
+
+static struct {
+    _Atomic(uintptr_t) descriptors[BLOCK_DESCRIPTION_CACHE_CAPACITY];
+    _Atomic(block_description_entry_t *) entries[BLOCK_DESCRIPTION_CACHE_CAPACITY];
+} g_block_description_cache;
+
 static size_t append_to_block(char *dest, size_t dest_size, size_t current_pos, const char *src) {
     if (dest == NULL || src == NULL || current_pos >= dest_size) {
         return current_pos;
@@ -26,182 +43,186 @@ static size_t append_to_block(char *dest, size_t dest_size, size_t current_pos,
     return current_pos + written;
 }
 
-static size_t decode_block_type(char *output, size_t output_size, size_t current_pos, const char **cursor, int nesting) {
-    if (output == NULL || cursor == NULL || *cursor == NULL || current_pos >= output_size || nesting > 32) {
+static size_t append_block_type_name(char *output, size_t output_size, size_t current_pos, const type_descriptor_t *descriptor) {
+    if (output == NULL || descriptor == NULL || current_pos >= output_size) {
         return current_pos;
     }
     
-    while (**cursor != '\0' && strchr("rnNoORV", **cursor) != NULL) {
-        (*cursor)++;
-    }
-    
-    if (**cursor == '@') {
-        (*cursor)++;
-        if (**cursor == '?') {
-            (*cursor)++;
-            current_pos = append_to_block(output, output_size, current_pos, "^");
-        }
-        else if (**cursor == '"') {
-            (*cursor)++;
-            const char *end = strchr(*cursor, '"');
-            if (end != NULL) {
-                size_t len = (size_t)(end - *cursor);
-                if (len < (output_size - current_pos - 1)) {
-                    strncpy(output + current_pos, *cursor, len);
-                    current_pos += len;
-                    output[current_pos] = '\0';
-                }
-                *cursor = end + 1;
+    switch (descriptor->kind) {
+        case TYPE_DESCRIPTOR_KIND_BLOCK:
+            // Block parameters are marked with a lone "^" and rendered as (^) by the caller
+            return append_to_block(output, output_size, current_pos, "^");
+        case TYPE_DESCRIPTOR_KIND_OBJECT:
+            return append_to_block(output, output_size, current_pos, descriptor->name ? descriptor->name : "id");
+        case TYPE_DESCRIPTOR_KIND_POINTER:
+            if (descriptor->element != NULL) {
+                current_pos = append_block_type_name(output, output_size, current_pos, descriptor->element);
             }
             else {
-                current_pos = append_to_block(output, output_size, current_pos, "id");
+                current_pos = append_to_block(output, output_size, current_pos, "void");
             }
-        }
-        else {
-            current_pos = append_to_block(output, output_size, current_pos, "id");
-        }
-        return current_pos;
-    }
-    
-    switch (**cursor) {
-        case '@':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "id");
-        case 'v':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "void");
-        case 'i':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "int");
-        case 'f':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "float");
-        case 'l':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "long");
-        case 'q':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "long long");
-        case 'B':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "BOOL");
-        case '*':
-            (*cursor)++;
-            return append_to_block(output, output_size, current_pos, "char *");
-        case '^':
-            (*cursor)++;
-            current_pos = decode_block_type(output, output_size, current_pos, cursor, nesting + 1);
-            if (output[current_pos - 1] != '*') {
+            if (current_pos > 0 && current_pos < output_size && output[current_pos - 1] != '*') {
                 current_pos = append_to_block(output, output_size, current_pos, " ");
             }
             return append_to_block(output, output_size, current_pos, "*");
-        default:
-            if (isdigit(**cursor) != 0) {
-                while (**cursor != '\0' && isdigit(**cursor) != 0) {
-                    (*cursor)++;
-                }
-                return current_pos;
+        case TYPE_DESCRIPTOR_KIND_PRIMITIVE:
+            if (descriptor->code == 'B') {
+                return append_to_block(output, output_size, current_pos, "BOOL");
             }
-            (*cursor)++;
-            char encoding_unknown[8];
-            snprintf(encoding_unknown, sizeof(encoding_unknown), "%c", **cursor);
-            return append_to_block(output, output_size, current_pos, encoding_unknown);
+            return append_to_block(output, output_size, current_pos, descriptor->description);
+        default:
+            return append_to_block(output, output_size, current_pos, descriptor->description);
     }
 }
 
-kern_return_t get_block_description(id block, char **out_description) {
-    if (block == NULL || out_description == NULL || IS_VALID_ADDR((uintptr_t)block) == 0) {
-        return KERN_INVALID_ARGUMENT;
-    }
-    
-    struct BlockLiteral *literal = (struct BlockLiteral *)block;
-    if (IS_VALID_ADDR((uintptr_t)literal->descriptor) == 0) {
-        return KERN_INVALID_ADDRESS;
-    }
-    
-    const char *signature = _Block_signature(block);
-    if (signature == NULL) {
-        return KERN_FAILURE;
-    }
-    
-    char *result = calloc(MAX_TYPE_LEN, 1);
-    if (result == NULL) {
-        return KERN_RESOURCE_SHORTAGE;
+static const char *skip_frame_offset(const char *cursor) {
+    while (*cursor != '\0' && isdigit(*cursor) != 0) {
+        cursor++;
     }
-    
+    return cursor;
+}
+
+static void decode_block_signature(const char *signature, char *result, size_t result_size) {
     size_t pos = 0;
-    const char *cursor = signature;
+    result[0] = '\0';
     
-    while (*cursor != '\0' && strchr("rnNoORV", *cursor) != NULL) {
-        cursor++;
-    }
+    const char *cursor = signature;
+    const type_descriptor_t *return_type = get_type_descriptor_and_advance(&cursor);
     
-    pos = append_to_block(result, MAX_TYPE_LEN, pos, "(");
-    pos = decode_block_type(result, MAX_TYPE_LEN, pos, &cursor, 0);
-    pos = append_to_block(result, MAX_TYPE_LEN, pos, " (^)");
+    pos = append_to_block(result, result_size, pos, "(");
+    pos = append_block_type_name(result, result_size, pos, return_type);
+    pos = append_to_block(result, result_size, pos, " (^)");
     
-    while (*cursor != '\0' && isdigit(*cursor) != 0) {
-        cursor++;
-    }
+    cursor = skip_frame_offset(cursor);
     
+    // Skip the block literal itself
     if (*cursor == '@' && *(cursor + 1) == '?') {
-        cursor += 2;
-        while (*cursor != '\0' && isdigit(*cursor) != 0) {
-            cursor++;
-        }
+        cursor = skip_frame_offset(cursor + 2);
     }
     
-    char param_encodings[MAX_PARAMS][MAX_TYPE_LEN];
-    memset(param_encodings, 0, sizeof(param_encodings));
+    const type_descriptor_t *params[MAX_PARAMS];
     int param_count = 0;
     
     while (*cursor != '\0' && param_count < MAX_PARAMS) {
-        size_t local_pos = 0;
-        local_pos = decode_block_type(param_encodings[param_count], MAX_TYPE_LEN, local_pos, &cursor, 0);
+        const type_descriptor_t *param = get_type_descriptor_and_advance(&cursor);
+        cursor = skip_frame_offset(cursor);
         
-        while (*cursor != '\0' && isdigit(*cursor) != 0) {
-            cursor++;
-        }
-        
-        if (local_pos > 0) {
-            param_count++;
+        if (param != NULL) {
+            params[param_count++] = param;
         }
     }
     
     if (param_count == 0) {
-        pos = append_to_block(result, MAX_TYPE_LEN, pos, "(void)");
-        pos = append_to_block(result, MAX_TYPE_LEN, pos, ")");
-        *out_description = result;
-        return KERN_SUCCESS;
+        pos = append_to_block(result, result_size, pos, "(void)");
+        append_to_block(result, result_size, pos, ")");
+        return;
     }
     
     int i = 0;
     while (i < param_count) {
-        const char *t = param_encodings[i];
-        if (strcmp(t, "^") == 0) {
-            pos = append_to_block(result, MAX_TYPE_LEN, pos, "(^)");
+        if (params[i]->kind == TYPE_DESCRIPTOR_KIND_BLOCK) {
+            pos = append_to_block(result, result_size, pos, "(^)");
             i++;
         }
         else {
-            char group[MAX_TYPE_LEN];
-            size_t gpos = 0;
-            group[0] = '\0';
-            gpos = append_to_block(group, MAX_TYPE_LEN, gpos, "(");
-            gpos = append_to_block(group, MAX_TYPE_LEN, gpos, t);
+            pos = append_to_block(result, result_size, pos, "(");
+            pos = append_block_type_name(result, result_size, pos, params[i]);
             i++;
             
-            while (i < param_count && strcmp(param_encodings[i], "^") != 0) {
-                gpos = append_to_block(group, MAX_TYPE_LEN, gpos, ", ");
-                gpos = append_to_block(group, MAX_TYPE_LEN, gpos, param_encodings[i]);
+            while (i < param_count && params[i]->kind != TYPE_DESCRIPTOR_KIND_BLOCK) {
+                pos = append_to_block(result, result_size, pos, ", ");
+                pos = append_block_type_name(result, result_size, pos, params[i]);
                 i++;
             }
-            gpos = append_to_block(group, MAX_TYPE_LEN, gpos, ")");
-            pos = append_to_block(result, MAX_TYPE_LEN, pos, group);
+            pos = append_to_block(result, result_size, pos, ")");
+        }
+    }
+    
+    append_to_block(result, result_size, pos, ")");
+}
+
+static size_t block_description_cache_index(uintptr_t descriptor) {
+    return (size_t)(((uint64_t)descriptor * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctz(BLOCK_DESCRIPTION_CACHE_CAPACITY)));
+}
+
+static const block_description_entry_t *find_cached_block_description(uintptr_t descriptor, const char *signature) {
+    size_t index = block_description_cache_index(descriptor);
+    for (size_t probes = 0; probes < BLOCK_DESCRIPTION_CACHE_MAX_PROBES; probes++) {
+        uintptr_t stored = atomic_load_explicit(&g_block_description_cache.descriptors[index], memory_order_acquire);
+        if (stored == descriptor) {
+            // NULL while another thread is still filling the slot. A signature mismatch means
+            // the descriptor's image was unloaded and the address reused
+            const block_description_entry_t *entry = atomic_load_explicit(&g_block_description_cache.entries[index], memory_order_acquire);
+            if (entry != NULL && entry->signature == signature) {
+                return entry;
+            }
+            return NULL;
+        }
+        
+        if (stored == 0) {
+            return NULL;
+        }
+        index = (index + 1) & (BLOCK_DESCRIPTION_CACHE_CAPACITY - 1);
+    }
+    return NULL;
+}
+
+static void cache_block_description(uintptr_t descriptor, const char *signature, const char *description) {
+    size_t index = block_description_cache_index(descriptor);
+    for (size_t probes = 0; probes < BLOCK_DESCRIPTION_CACHE_MAX_PROBES; probes++) {
+        uintptr_t expected = 0;
+        if (atomic_compare_exchange_strong(&g_block_description_cache.descriptors[index], &expected, descriptor)) {
+            size_t description_len = strlen(description);
+            block_description_entry_t *entry = malloc(sizeof(block_description_entry_t) + description_len + 1);
+            if (entry != NULL) {
+                entry->signature = signature;
+                memcpy(entry->description, description, description_len + 1);
+                atomic_store_explicit(&g_block_description_cache.entries[index], entry, memory_order_release);
+            }
+            return;
+        }
+        
+        if (expected == descriptor) {
+            // Another thread is caching the same descriptor
+            return;
+        }
+        index = (index + 1) & (BLOCK_DESCRIPTION_CACHE_CAPACITY - 1);
+    }
+    
+    // No free slot near the home index. The cache is bounded, so this descriptor just isn't cached
+}
+
+kern_return_t get_block_description(id block, char *out_buf, size_t buf_size) {
+    if (block == NULL || out_buf == NULL || buf_size == 0 || IS_VALID_ADDR((uintptr_t)block) == 0) {
+        return KERN_INVALID_ARGUMENT;
+    }
+    
+    struct BlockLiteral *literal = (struct BlockLiteral *)block;
+    if (IS_VALID_ADDR((uintptr_t)literal->descriptor) == 0) {
+        return KERN_INVALID_ADDRESS;
+    }
+    
+    const char *signature = _Block_signature(block);
+    if (signature == NULL) {
+        return KERN_FAILURE;
+    }
+    
+    uintptr_t descriptor = (uintptr_t)literal->descriptor;
+    const block_description_entry_t *entry = find_cached_block_description(descriptor, signature);
+    if (entry != NULL) {
+        if (strlcpy(out_buf, entry->description, buf_size) >= buf_size) {
+            return KERN_NO_SPACE;
         }
+        return KERN_SUCCESS;
     }
     
-    pos = append_to_block(result, MAX_TYPE_LEN, pos, ")");
+    char description[MAX_TYPE_LEN];
+    decode_block_signature(signature, description, sizeof(description));
     
-    *out_description = result;
+    cache_block_description(descriptor, signature, description);
+    
+    if (strlcpy(out_buf, description, buf_size) >= buf_size) {
+        return KERN_NO_SPACE;
+    }
     return KERN_SUCCESS;
 }
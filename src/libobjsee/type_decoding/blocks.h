@@ -15,10 +15,12 @@
  * @brief Describe a block's type signature in a human-readable format
  *
  * @param block The block to describe
- * @return The description of the block
- * @note The returned string is malloc'd and must be freed by the caller
+ * @param out_buf The buffer to write the description to
+ * @param buf_size The size of the buffer
+ * @return KERN_SUCCESS on success, KERN_NO_SPACE if the description was truncated, or an error code on failure
+ * @note Decoded signatures are cached per block descriptor, so repeat calls from the same call site don't re-decode
  */
-kern_return_t get_block_description(id block, char **out_description);
+kern_return_t get_block_description(id block, char *out_buf, size_t buf_size);
 
 
 #endif /* BLOCKS_H */
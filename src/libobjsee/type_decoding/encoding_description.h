@@ -16,7 +16,8 @@
  *
  * @param encoding The encoding to parse
  * @return The description of the struct
- * @note The returned string is malloc'd and must be freed by the caller
+ * @note The returned string is malloc'd and must be freed by the caller.
+ * Hot paths should read get_type_descriptor(encoding)->description instead, which is not copied
  */
 char *get_struct_description_from_type_encoding(const char *encoding);
 
@@ -0,0 +1,552 @@
+//
+//  type_descriptor.c
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/1/25.
+//
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "type_descriptor.h"
+
+// Interned descriptors are chained off a fixed bucket array. Entries are pushed with CAS and
+// never removed, so readers walk the chains without locking
+#define TYPE_DESCRIPTOR_BUCKET_BITS 12
+#define TYPE_DESCRIPTOR_BUCKET_COUNT (1 << TYPE_DESCRIPTOR_BUCKET_BITS)
+#define TYPE_DESCRIPTOR_MAX_DEPTH 32
+
+typedef struct interned_type_descriptor {
+    type_descriptor_t descriptor;
+    uint64_t hash;
+    size_t encoding_length;
+    // Set when something was cut off at TYPE_DESCRIPTOR_MAX_DEPTH. The result then depends on the depth
+    // it was compiled at, so it's only shared with lookups from that same depth
+    bool truncated;
+    int depth;
+    struct interned_type_descriptor *next;
+    char encoding[];
+} interned_type_descriptor_t;
+
+static _Atomic(interned_type_descriptor_t *) g_type_descriptors[TYPE_DESCRIPTOR_BUCKET_COUNT];
+
+typedef struct {
+    char code;
+    size_t size;
+    size_t alignment;
+    const char *name;
+} primitive_type_info_t;
+
+static const primitive_type_info_t g_primitive_types[] = {
+    {'c', sizeof(char), _Alignof(char), "char"},
+    {'i', sizeof(int), _Alignof(int), "int"},
+    {'s', sizeof(short), _Alignof(short), "short"},
+    {'l', sizeof(long), _Alignof(long), "long"},
+    {'q', sizeof(long long), _Alignof(long long), "long long"},
+    {'C', sizeof(unsigned char), _Alignof(unsigned char), "unsigned char"},
+    {'I', sizeof(unsigned int), _Alignof(unsigned int), "unsigned int"},
+    {'S', sizeof(unsigned short), _Alignof(unsigned short), "unsigned short"},
+    {'L', sizeof(unsigned long), _Alignof(unsigned long), "unsigned long"},
+    {'Q', sizeof(unsigned long long), _Alignof(unsigned long long), "unsigned long long"},
+    {'f', sizeof(float), _Alignof(float), "float"},
+    {'d', sizeof(double), _Alignof(double), "double"},
+    {'B', sizeof(bool), _Alignof(bool), "bool"},
+    {'*', sizeof(char *), _Alignof(char *), "char *"},
+    {'#', sizeof(void *), _Alignof(void *), "Class"},
+    {':', sizeof(void *), _Alignof(void *), "SEL"},
+};
+
+typedef struct {
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} description_builder_t;
+
+static void description_append(description_builder_t *builder, const char *str, size_t len) {
+    if (builder->failed) {
+        return;
+    }
+
+    if (builder->length + len + 1 > builder->capacity) {
+        size_t new_capacity = builder->capacity ? builder->capacity : 64;
+        while (builder->length + len + 1 > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        char *new_buffer = realloc(builder->buffer, new_capacity);
+        if (new_buffer == NULL) {
+            builder->failed = true;
+            return;
+        }
+        builder->buffer = new_buffer;
+        builder->capacity = new_capacity;
+    }
+
+    memcpy(builder->buffer + builder->length, str, len);
+    builder->length += len;
+    builder->buffer[builder->length] = '\0';
+}
+
+static void description_append_str(description_builder_t *builder, const char *str) {
+    description_append(builder, str, strlen(str));
+}
+
+static bool is_type_qualifier(char c) {
+    switch (c) {
+        case 'r': case 'n': case 'N': case 'o': case 'O': case 'R': case 'V':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static const primitive_type_info_t *primitive_type_info(char code) {
+    for (size_t i = 0; i < sizeof(g_primitive_types) / sizeof(g_primitive_types[0]); i++) {
+        if (g_primitive_types[i].code == code) {
+            return &g_primitive_types[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Skip a bracketed section ({...}, (...), [...] or <...>), including anything nested inside it
+ * @return Pointer just past the matching close bracket, or end if it's unterminated
+ */
+static const char *skip_bracketed(const char *cursor, const char *end) {
+    int depth = 0;
+    while (cursor < end) {
+        switch (*cursor) {
+            case '{': case '(': case '[': case '<':
+                depth++;
+                break;
+            case '}': case ')': case ']': case '>':
+                depth--;
+                break;
+            case '"': {
+                // Quoted field or class names may contain anything
+                const char *close = memchr(cursor + 1, '"', end - cursor - 1);
+                cursor = close ? close : end - 1;
+                break;
+            }
+        }
+        cursor++;
+
+        if (depth == 0) {
+            break;
+        }
+    }
+    return cursor;
+}
+
+/**
+ * @brief Measure the first complete type in an encoding, including its qualifiers
+ */
+static size_t type_encoding_extent(const char *encoding, const char *end) {
+    const char *cursor = encoding;
+    while (cursor < end && (is_type_qualifier(*cursor) || *cursor == '^')) {
+        cursor++;
+    }
+
+    if (cursor >= end) {
+        return cursor - encoding;
+    }
+
+    switch (*cursor) {
+        case '{': case '(': case '[':
+            cursor = skip_bracketed(cursor, end);
+            break;
+
+        case '@':
+            cursor++;
+            if (cursor < end && *cursor == '?') {
+                // Extended block encodings carry their signature in <...>
+                cursor++;
+                if (cursor < end && *cursor == '<') {
+                    cursor = skip_bracketed(cursor, end);
+                }
+            }
+            else if (cursor < end && *cursor == '"') {
+                const char *close = memchr(cursor + 1, '"', end - cursor - 1);
+                cursor = close ? close + 1 : end;
+            }
+            break;
+
+        case 'b':
+            cursor++;
+            while (cursor < end && isdigit((unsigned char)*cursor)) {
+                cursor++;
+            }
+            break;
+
+        default:
+            cursor++;
+            break;
+    }
+
+    return cursor - encoding;
+}
+
+static uint64_t hash_encoding(const char *encoding, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)encoding[i];
+        hash *= 1099511628211ULL;
+    }
+    // Bucket selection uses the high bits, make sure they depend on every byte
+    return hash * 0x9E3779B97F4A7C15ULL;
+}
+
+static void free_compiled_descriptor(interned_type_descriptor_t *interned) {
+    // Children are interned separately and must not be freed here
+    free((void *)interned->descriptor.name);
+    free((void *)interned->descriptor.description);
+    free((void *)interned->descriptor.fields);
+    free((void *)interned->descriptor.field_offsets);
+    free(interned);
+}
+
+static bool descriptor_is_truncated(const type_descriptor_t *descriptor) {
+    return descriptor != NULL && ((const interned_type_descriptor_t *)descriptor)->truncated;
+}
+
+static const type_descriptor_t *intern_type(const char *encoding, size_t length, int depth);
+
+static bool compile_aggregate(type_descriptor_t *descriptor, description_builder_t *description, const char *cursor, const char *end, int depth) {
+    bool is_union = (*cursor == '(');
+    char close_delim = is_union ? ')' : '}';
+    cursor++;
+
+    bool terminated = (end > cursor && *(end - 1) == close_delim);
+    const char *body_end = terminated ? end - 1 : end;
+
+    const char *name_start = cursor;
+    while (cursor < body_end && *cursor != '=') {
+        cursor++;
+    }
+
+    size_t name_length = cursor - name_start;
+    bool has_fields = (cursor < body_end);
+    bool is_anonymous = (name_length == 0 || (name_length == 1 && *name_start == '?'));
+
+    descriptor->kind = is_union ? TYPE_DESCRIPTOR_KIND_UNION : TYPE_DESCRIPTOR_KIND_STRUCT;
+    if (is_anonymous) {
+        description_append_str(description, is_union ? "union" : "struct");
+    }
+    else {
+        descriptor->name = strndup(name_start, name_length);
+        if (descriptor->name == NULL) {
+            return false;
+        }
+        description_append(description, name_start, name_length);
+    }
+
+    if (!has_fields) {
+        // Opaque, size unknown
+        return true;
+    }
+
+    cursor++;
+    description_append_str(description, " { ");
+
+    size_t field_capacity = 0;
+    const type_descriptor_t **fields = NULL;
+    while (cursor < body_end) {
+        if (*cursor == '"') {
+            // Ivar layouts name their fields: {CGPoint="x"d"y"d}
+            const char *close = memchr(cursor + 1, '"', body_end - cursor - 1);
+            cursor = close ? close + 1 : body_end;
+            continue;
+        }
+
+        size_t field_length = type_encoding_extent(cursor, body_end);
+        if (field_length == 0) {
+            break;
+        }
+
+        const type_descriptor_t *field = intern_type(cursor, field_length, depth + 1);
+        if (field == NULL) {
+            free(fields);
+            return false;
+        }
+        cursor += field_length;
+
+        if (descriptor->field_count == field_capacity) {
+            field_capacity = field_capacity ? field_capacity * 2 : 8;
+            const type_descriptor_t **grown = realloc(fields, field_capacity * sizeof(*fields));
+            if (grown == NULL) {
+                free(fields);
+                return false;
+            }
+            fields = grown;
+        }
+
+        if (descriptor->field_count > 0) {
+            description_append_str(description, ", ");
+        }
+        description_append_str(description, field->description);
+        fields[descriptor->field_count++] = field;
+    }
+    description_append_str(description, "}");
+    descriptor->fields = fields;
+
+    if (descriptor->field_count == 0) {
+        return true;
+    }
+
+    size_t *offsets = calloc(descriptor->field_count, sizeof(size_t));
+    if (offsets == NULL) {
+        return false;
+    }
+    descriptor->field_offsets = offsets;
+
+    // Natural C layout. Any unsized field leaves the whole aggregate unsized
+    bool sized = terminated;
+    size_t offset = 0;
+    size_t largest_field = 0;
+    size_t max_alignment = 1;
+    for (size_t i = 0; i < descriptor->field_count; i++) {
+        const type_descriptor_t *field = fields[i];
+        if (field->size == 0) {
+            sized = false;
+        }
+
+        size_t field_alignment = field->alignment ? field->alignment : 1;
+        if (field_alignment > max_alignment) {
+            max_alignment = field_alignment;
+        }
+
+        if (is_union) {
+            offsets[i] = 0;
+            if (field->size > largest_field) {
+                largest_field = field->size;
+            }
+        }
+        else {
+            offsets[i] = (offset + field_alignment - 1) & ~(field_alignment - 1);
+            offset = offsets[i] + field->size;
+        }
+    }
+
+    size_t total = is_union ? largest_field : offset;
+    descriptor->alignment = max_alignment;
+    descriptor->size = sized ? (total + max_alignment - 1) & ~(max_alignment - 1) : 0;
+    return true;
+}
+
+static bool compile_array(type_descriptor_t *descriptor, description_builder_t *description, const char *cursor, const char *end, int depth) {
+    descriptor->kind = TYPE_DESCRIPTOR_KIND_ARRAY;
+    cursor++;
+
+    const char *body_end = (end > cursor && *(end - 1) == ']') ? end - 1 : end;
+    size_t count = 0;
+    while (cursor < body_end && isdigit((unsigned char)*cursor)) {
+        count = (count * 10) + (*cursor - '0');
+        cursor++;
+    }
+    descriptor->element_count = count;
+
+    size_t element_length = type_encoding_extent(cursor, body_end);
+    if (element_length > 0) {
+        descriptor->element = intern_type(cursor, element_length, depth + 1);
+        if (descriptor->element == NULL) {
+            return false;
+        }
+    }
+
+    const type_descriptor_t *element = descriptor->element;
+    description_append_str(description, element ? element->description : "unknown_type");
+
+    char count_str[32];
+    int count_len = snprintf(count_str, sizeof(count_str), "[%zu]", count);
+    description_append(description, count_str, (size_t)count_len);
+
+    if (element != NULL && element->size > 0 && !__builtin_mul_overflow(element->size, count, &descriptor->size)) {
+        descriptor->alignment = element->alignment;
+    }
+    return true;
+}
+
+static interned_type_descriptor_t *compile_type(const char *encoding, size_t length, int depth) {
+    interned_type_descriptor_t *interned = calloc(1, sizeof(interned_type_descriptor_t) + length + 1);
+    if (interned == NULL) {
+        return NULL;
+    }
+
+    memcpy(interned->encoding, encoding, length);
+    interned->encoding_length = length;
+
+    type_descriptor_t *descriptor = &interned->descriptor;
+    descriptor->alignment = 1;
+
+    const char *cursor = encoding;
+    const char *end = encoding + length;
+    description_builder_t description = {0};
+
+    while (cursor < end && is_type_qualifier(*cursor)) {
+        if (*cursor == 'r') {
+            descriptor->is_const = true;
+        }
+        cursor++;
+    }
+
+    if (descriptor->is_const) {
+        description_append_str(&description, "const ");
+    }
+
+    descriptor->code = (cursor < end) ? *cursor : '\0';
+    bool compiled = true;
+
+    if (depth > TYPE_DESCRIPTOR_MAX_DEPTH) {
+        descriptor->kind = TYPE_DESCRIPTOR_KIND_UNKNOWN;
+        description_append_str(&description, "unknown_type");
+    }
+    else {
+        switch (descriptor->code) {
+            case 'v':
+                descriptor->kind = TYPE_DESCRIPTOR_KIND_VOID;
+                description_append_str(&description, "void");
+                break;
+
+            case '@':
+                descriptor->size = sizeof(void *);
+                descriptor->alignment = _Alignof(void *);
+                if (cursor + 1 < end && cursor[1] == '?') {
+                    descriptor->kind = TYPE_DESCRIPTOR_KIND_BLOCK;
+                }
+                else {
+                    descriptor->kind = TYPE_DESCRIPTOR_KIND_OBJECT;
+                    if (cursor + 2 < end && cursor[1] == '"') {
+                        const char *name_start = cursor + 2;
+                        const char *name_end = memchr(name_start, '"', end - name_start);
+                        descriptor->name = strndup(name_start, (name_end ? name_end : end) - name_start);
+                        compiled = (descriptor->name != NULL);
+                    }
+                }
+                description_append_str(&description, "id");
+                break;
+
+            case '^':
+                descriptor->kind = TYPE_DESCRIPTOR_KIND_POINTER;
+                descriptor->size = sizeof(void *);
+                descriptor->alignment = _Alignof(void *);
+                if (cursor + 1 < end) {
+                    descriptor->element = intern_type(cursor + 1, end - (cursor + 1), depth + 1);
+                    compiled = (descriptor->element != NULL);
+                }
+
+                if (descriptor->element != NULL) {
+                    description_append_str(&description, descriptor->element->description);
+                    description_append_str(&description, " *");
+                }
+                else {
+                    description_append_str(&description, "pointer");
+                }
+                break;
+
+            case '[':
+                compiled = compile_array(descriptor, &description, cursor, end, depth);
+                break;
+
+            case '{': case '(':
+                compiled = compile_aggregate(descriptor, &description, cursor, end, depth);
+                break;
+
+            default: {
+                const primitive_type_info_t *primitive = primitive_type_info(descriptor->code);
+                if (primitive == NULL) {
+                    descriptor->kind = TYPE_DESCRIPTOR_KIND_UNKNOWN;
+                    description_append_str(&description, "unknown_type");
+                    break;
+                }
+
+                descriptor->kind = TYPE_DESCRIPTOR_KIND_PRIMITIVE;
+                descriptor->size = primitive->size;
+                descriptor->alignment = primitive->alignment;
+                description_append_str(&description, primitive->name);
+                break;
+            }
+        }
+    }
+
+    descriptor->description = description.buffer;
+    if (!compiled || description.failed || descriptor->description == NULL) {
+        free_compiled_descriptor(interned);
+        return NULL;
+    }
+
+    interned->depth = depth;
+    interned->truncated = (depth > TYPE_DESCRIPTOR_MAX_DEPTH) || descriptor_is_truncated(descriptor->element);
+    for (size_t i = 0; i < descriptor->field_count && !interned->truncated; i++) {
+        interned->truncated = descriptor_is_truncated(descriptor->fields[i]);
+    }
+
+    return interned;
+}
+
+static interned_type_descriptor_t *find_interned_type(interned_type_descriptor_t *head, interned_type_descriptor_t *stop, const char *encoding, size_t length, uint64_t hash, int depth) {
+    for (interned_type_descriptor_t *entry = head; entry != NULL && entry != stop; entry = entry->next) {
+        if (entry->truncated && entry->depth != depth) {
+            continue;
+        }
+        if (entry->hash == hash && entry->encoding_length == length && memcmp(entry->encoding, encoding, length) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static const type_descriptor_t *intern_type(const char *encoding, size_t length, int depth) {
+    uint64_t hash = hash_encoding(encoding, length);
+    _Atomic(interned_type_descriptor_t *) *bucket = &g_type_descriptors[hash >> (64 - TYPE_DESCRIPTOR_BUCKET_BITS)];
+
+    interned_type_descriptor_t *head = atomic_load_explicit(bucket, memory_order_acquire);
+    interned_type_descriptor_t *existing = find_interned_type(head, NULL, encoding, length, hash, depth);
+    if (existing != NULL) {
+        return &existing->descriptor;
+    }
+
+    interned_type_descriptor_t *compiled = compile_type(encoding, length, depth);
+    if (compiled == NULL) {
+        return NULL;
+    }
+    compiled->hash = hash;
+
+    while (true) {
+        compiled->next = head;
+        if (atomic_compare_exchange_weak_explicit(bucket, &head, compiled, memory_order_release, memory_order_acquire)) {
+            return &compiled->descriptor;
+        }
+
+        // Another thread pushed first. Only the entries added since our last look need checking
+        existing = find_interned_type(head, compiled->next, encoding, length, hash, depth);
+        if (existing != NULL) {
+            free_compiled_descriptor(compiled);
+            return &existing->descriptor;
+        }
+    }
+}
+
+const type_descriptor_t *get_type_descriptor(const char *type_encoding) {
+    if (type_encoding == NULL || *type_encoding == '\0') {
+        return NULL;
+    }
+
+    const char *cursor = type_encoding;
+    return get_type_descriptor_and_advance(&cursor);
+}
+
+const type_descriptor_t *get_type_descriptor_and_advance(const char **cursor) {
+    if (cursor == NULL || *cursor == NULL || **cursor == '\0') {
+        return NULL;
+    }
+
+    const char *encoding = *cursor;
+    size_t length = type_encoding_extent(encoding, encoding + strlen(encoding));
+    *cursor = encoding + length;
+    return intern_type(encoding, length, 0);
+}
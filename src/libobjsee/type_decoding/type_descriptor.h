@@ -0,0 +1,65 @@
+//
+//  type_descriptor.h
+//  libobjsee
+//
+//  Created by Ethan Arbuckle on 3/1/25.
+//
+
+#ifndef type_descriptor_h
+#define type_descriptor_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    TYPE_DESCRIPTOR_KIND_UNKNOWN,
+    TYPE_DESCRIPTOR_KIND_VOID,
+    TYPE_DESCRIPTOR_KIND_PRIMITIVE,
+    TYPE_DESCRIPTOR_KIND_OBJECT,
+    TYPE_DESCRIPTOR_KIND_BLOCK,
+    TYPE_DESCRIPTOR_KIND_POINTER,
+    TYPE_DESCRIPTOR_KIND_ARRAY,
+    TYPE_DESCRIPTOR_KIND_STRUCT,
+    TYPE_DESCRIPTOR_KIND_UNION,
+} type_descriptor_kind_t;
+
+/**
+ * @brief A compiled objc type encoding
+ * @note Descriptors are interned and immutable. They live for the lifetime of the process and must not be freed
+ */
+typedef struct type_descriptor {
+    type_descriptor_kind_t kind;
+    char code;                                  // The encoding character, after any qualifiers
+    bool is_const;
+    size_t size;                                // 0 for void, unknown, or malformed types
+    size_t alignment;
+    const char *name;                           // Struct/union tag or object class name. NULL if anonymous or not applicable
+    const char *description;                    // Human-readable type, e.g. "CGPoint { double, double}"
+    const struct type_descriptor *element;      // Pointee or array element. NULL otherwise
+    size_t element_count;                       // Array length
+    size_t field_count;
+    const struct type_descriptor *const *fields;
+    const size_t *field_offsets;
+} type_descriptor_t;
+
+
+/**
+ * @brief Get the compiled descriptor for the first type in an encoding
+ *
+ * @param type_encoding The type encoding. Anything after the first complete type (e.g. frame offsets) is ignored
+ * @return The interned descriptor, or NULL if type_encoding is NULL/empty or the descriptor could not be allocated
+ * @note Lookups are lock-free. An encoding is only parsed the first time it is seen
+ */
+const type_descriptor_t *get_type_descriptor(const char *type_encoding);
+
+
+/**
+ * @brief Get the compiled descriptor for the type at cursor, then advance cursor past it
+ *
+ * @param cursor Pointer to the current position in a type encoding or method signature
+ * @return The interned descriptor, or NULL at the end of the string or if the descriptor could not be allocated
+ * @note Trailing frame offsets are not consumed
+ */
+const type_descriptor_t *get_type_descriptor_and_advance(const char **cursor);
+
+#endif /* type_descriptor_h */
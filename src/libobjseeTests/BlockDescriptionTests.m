@@ -14,10 +14,9 @@
 @implementation BlockDescriptionTests
 
 - (void)_assertBlock:(id)block matches:(const char *)expected {
-    char *decoded_block_signature = NULL;
-    XCTAssertEqual(get_block_description(block, &decoded_block_signature), KERN_SUCCESS);
+    char decoded_block_signature[1024];
+    XCTAssertEqual(get_block_description(block, decoded_block_signature, sizeof(decoded_block_signature)), KERN_SUCCESS);
     XCTAssertEqualObjects(@(decoded_block_signature), @(expected));
-    free(decoded_block_signature);
 }
 
 - (void)testBasicBlock {
@@ -41,12 +40,16 @@
 }
 
 - (void)testNullBlock {
-    XCTAssertEqual(get_block_description(NULL, NULL), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(get_block_description(NULL, NULL, 0), KERN_INVALID_ARGUMENT);
+    
+    char decoded_block_signature[64];
+    XCTAssertEqual(get_block_description(^{}, NULL, sizeof(decoded_block_signature)), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(get_block_description(^{}, decoded_block_signature, 0), KERN_INVALID_ARGUMENT);
 }
 
 - (void)testInvalidBlock {
-    char *decoded_block_signature = NULL;
-    XCTAssertEqual(get_block_description((__bridge id)((void *)0x1), &decoded_block_signature), KERN_INVALID_ARGUMENT);
+    char decoded_block_signature[64];
+    XCTAssertEqual(get_block_description((__bridge id)((void *)0x1), decoded_block_signature, sizeof(decoded_block_signature)), KERN_INVALID_ARGUMENT);
 }
 
 - (void)testLongTypes {
@@ -59,4 +62,37 @@
     [self _assertBlock:block matches:"(BOOL (^)(BOOL))"];
 }
 
+- (void)testCachedDescriptionIsReused {
+    // Every block created here shares one descriptor. The first call decodes, the rest hit the cache
+    for (int i = 0; i < 100; i++) {
+        int captured = i;
+        int (^block)(int, float) = ^(int x, float y) { return x + captured; };
+        [self _assertBlock:block matches:"(int (^)(int, float))"];
+    }
+    
+    // A different call site must not be served the cached description
+    void (^other)(id, NSString *) = ^(id obj, NSString *str) {};
+    [self _assertBlock:other matches:"(void (^)(id, NSString))"];
+}
+
+- (void)testTruncatedDescription {
+    int (^block)(int, float) = ^(int x, float y) { return x; };
+    char decoded_block_signature[8];
+    XCTAssertEqual(get_block_description(block, decoded_block_signature, sizeof(decoded_block_signature)), KERN_NO_SPACE);
+    XCTAssertEqual(strlen(decoded_block_signature), sizeof(decoded_block_signature) - 1);
+    
+    // Truncating the caller's copy must not truncate the cached one
+    [self _assertBlock:block matches:"(int (^)(int, float))"];
+}
+
+- (void)testCachedDescriptionPerformance {
+    void (^completion)(NSData *, NSURLResponse *, NSError *) = ^(NSData *data, NSURLResponse *response, NSError *error) {};
+    [self measureBlock:^{
+        char decoded_block_signature[256];
+        for (int i = 0; i < 100000; i++) {
+            get_block_description(completion, decoded_block_signature, sizeof(decoded_block_signature));
+        }
+    }];
+}
+
 @end
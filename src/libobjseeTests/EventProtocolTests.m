@@ -0,0 +1,300 @@
+//
+//  EventProtocolTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/5/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "tracer_internal.h"
+#import "event_protocol.h"
+
+#define MAX_DECODED_EVENTS 8
+
+typedef struct {
+    tracer_event_t events[MAX_DECODED_EVENTS];
+    char descriptions[MAX_DECODED_EVENTS][64];
+    size_t count;
+} decoded_events_t;
+
+static void collect_event(const tracer_event_t *event, void *context) {
+    decoded_events_t *decoded = (decoded_events_t *)context;
+    if (decoded->count >= MAX_DECODED_EVENTS) {
+        return;
+    }
+
+    // Everything but dictionary strings is only valid during the callback
+    size_t index = decoded->count++;
+    decoded->events[index] = *event;
+    decoded->events[index].arguments = NULL;
+    if (event->argument_count > 0 && event->arguments[0].description) {
+        strlcpy(decoded->descriptions[index], event->arguments[0].description, sizeof(decoded->descriptions[index]));
+    }
+}
+
+static void count_dropped(uint64_t count, void *context) {
+    *(uint64_t *)context += count;
+}
+
+static void note_main_thread(uint16_t thread_id, void *context) {
+    *(uint32_t *)context = thread_id;
+}
+
+@interface EventProtocolTests : XCTestCase {
+    tracer_argument_t _arguments[2];
+    tracer_event_t _event;
+    event_encoder_t _encoder;
+    output_buffer_t _stream;
+    decoded_events_t _decoded;
+}
+@end
+
+@implementation EventProtocolTests
+
+- (void)setUp {
+    [super setUp];
+
+    memset(_arguments, 0, sizeof(_arguments));
+    _arguments[0].type_encoding = "@";
+    _arguments[0].objc_class_name = "NSString";
+    _arguments[0].description = "@\"hello\"";
+    _arguments[0].address = (void *)0x1000;
+    _arguments[0].size = 8;
+    _arguments[1].type_encoding = "q";
+    _arguments[1].description = "42";
+    _arguments[1].address = (void *)0x2000;
+    _arguments[1].size = 8;
+
+    memset(&_event, 0, sizeof(_event));
+    _event.class_name = "NSObject";
+    _event.method_name = "initWithFoo:bar:";
+    _event.thread_id = 0x1f;
+    _event.trace_depth = 2;
+    _event.real_depth = 5;
+    _event.timestamp = 1000000;
+    _event.method_signature = "@32@0:8@16q24";
+    _event.arguments = _arguments;
+    _event.argument_count = 2;
+
+    memset(&_encoder, 0, sizeof(_encoder));
+    memset(&_stream, 0, sizeof(_stream));
+    memset(&_decoded, 0, sizeof(_decoded));
+    append_event_stream_preamble(&_stream);
+}
+
+- (void)tearDown {
+    event_encoder_free(&_encoder);
+    output_buffer_free(&_stream);
+    [super tearDown];
+}
+
+- (size_t)appendEvent {
+    size_t start = _stream.length;
+    XCTAssertEqual(append_binary_event(&_encoder, &_event, &_stream), KERN_SUCCESS);
+    return _stream.length - start;
+}
+
+- (kern_return_t)decodeStream {
+    event_decoder_t *decoder = event_decoder_create();
+    size_t consumed = 0;
+    kern_return_t kr = event_decoder_decode(decoder, (const uint8_t *)_stream.data, _stream.length, &consumed, collect_event, &_decoded);
+    XCTAssertEqual(consumed, _stream.length);
+    event_decoder_free(decoder);
+    return kr;
+}
+
+- (void)testRoundTrip {
+    [self appendEvent];
+    _event.is_class_method = true;
+    _event.trace_depth = 1;
+    _event.real_depth = 3;
+    _event.timestamp += 2500;
+    _event.method_signature = NULL;
+    _event.argument_count = 0;
+    [self appendEvent];
+
+    XCTAssertEqual([self decodeStream], KERN_SUCCESS);
+    XCTAssertEqual(_decoded.count, 2);
+
+    tracer_event_t *first = &_decoded.events[0];
+    XCTAssertEqual(strcmp(first->class_name, "NSObject"), 0);
+    XCTAssertEqual(strcmp(first->method_name, "initWithFoo:bar:"), 0);
+    XCTAssertEqual(strcmp(first->method_signature, "@32@0:8@16q24"), 0);
+    XCTAssertEqual(first->thread_id, 0x1f);
+    XCTAssertEqual(first->trace_depth, 2);
+    XCTAssertEqual(first->real_depth, 5);
+    XCTAssertEqual(first->timestamp, 1000000);
+    XCTAssertFalse(first->is_class_method);
+    XCTAssertEqual(first->argument_count, 2);
+    XCTAssertEqual(strcmp(_decoded.descriptions[0], "@\"hello\""), 0);
+
+    // Deltas decode against the previous event from the same thread
+    tracer_event_t *second = &_decoded.events[1];
+    XCTAssertTrue(second->is_class_method);
+    XCTAssertEqual(second->trace_depth, 1);
+    XCTAssertEqual(second->real_depth, 3);
+    XCTAssertEqual(second->timestamp, 1002500);
+    XCTAssertTrue(second->method_signature == NULL);
+    XCTAssertEqual(second->argument_count, 0);
+}
+
+- (void)testStringsAreSentOnce {
+    size_t first = [self appendEvent];
+    size_t second = [self appendEvent];
+    XCTAssertLessThan(second, first);
+    XCTAssertLessThan(second, 40);
+
+    XCTAssertEqual([self decodeStream], KERN_SUCCESS);
+    XCTAssertEqual(_decoded.count, 2);
+    // Dictionary strings are interned, so both events share them
+    XCTAssertEqual(_decoded.events[0].class_name, _decoded.events[1].class_name);
+}
+
+- (void)testSignatureCopiesAreSentOnce {
+    // The tracer copies the signature for every event, so each one arrives at a new address
+    char first_copy[32];
+    char second_copy[32];
+    strlcpy(first_copy, _event.method_signature, sizeof(first_copy));
+    strlcpy(second_copy, _event.method_signature, sizeof(second_copy));
+    _event.argument_count = 0;
+    _event.method_signature = first_copy;
+    size_t first = [self appendEvent];
+    _event.method_signature = second_copy;
+    size_t second = [self appendEvent];
+    XCTAssertLessThan(second, 16);
+    XCTAssertLessThan(second, first);
+
+    XCTAssertEqual([self decodeStream], KERN_SUCCESS);
+    XCTAssertEqual(_decoded.count, 2);
+    XCTAssertEqual(_decoded.events[0].method_signature, _decoded.events[1].method_signature);
+}
+
+- (void)testThreadsKeepSeparateDictionaries {
+    event_encoder_t other = {0};
+    [self appendEvent];
+    _event.thread_id = 0x20;
+    XCTAssertEqual(append_binary_event(&other, &_event, &_stream), KERN_SUCCESS);
+    _event.thread_id = 0x1f;
+    [self appendEvent];
+    event_encoder_free(&other);
+
+    XCTAssertEqual([self decodeStream], KERN_SUCCESS);
+    XCTAssertEqual(_decoded.count, 3);
+    XCTAssertEqual(_decoded.events[1].thread_id, 0x20);
+    XCTAssertEqual(strcmp(_decoded.events[1].method_name, "initWithFoo:bar:"), 0);
+}
+
+- (void)testThreadsSharingAnIdKeepSeparateStreams {
+    event_encoder_t other = {0};
+    [self appendEvent];
+    _event.class_name = "NSArray";
+    XCTAssertEqual(append_binary_event(&other, &_event, &_stream), KERN_SUCCESS);
+    _event.class_name = "NSObject";
+    [self appendEvent];
+    event_encoder_free(&other);
+
+    XCTAssertEqual([self decodeStream], KERN_SUCCESS);
+    XCTAssertEqual(_decoded.count, 3);
+    XCTAssertEqual(_decoded.events[1].thread_id, 0x1f);
+    XCTAssertNotEqual(_decoded.events[0].stream_id, _decoded.events[1].stream_id);
+    XCTAssertEqual(_decoded.events[0].stream_id, _decoded.events[2].stream_id);
+    XCTAssertEqual(strcmp(_decoded.events[1].class_name, "NSArray"), 0);
+    XCTAssertEqual(strcmp(_decoded.events[2].class_name, "NSObject"), 0);
+}
+
+- (void)testDecodesVersionOneStreams {
+    // Records named by thread id, with nothing after it in THREAD_BEGIN
+    const uint8_t stream[] = {
+        '\0', 'O', 'B', 'J', 'S', 'E', 'E', 1,
+        2, EVENT_RECORD_THREAD_BEGIN, 0x1f,
+        4, EVENT_RECORD_STRING, 0x1f, 1, 'A',
+        4, EVENT_RECORD_STRING, 0x1f, 2, 'b',
+        8, EVENT_RECORD_EVENT, 0x1f, 0, 1, 2, 0, 0, 0,
+    };
+    event_decoder_t *decoder = event_decoder_create();
+    size_t consumed = 0;
+    XCTAssertEqual(event_decoder_decode(decoder, stream, sizeof(stream), &consumed, collect_event, &_decoded), KERN_SUCCESS);
+    event_decoder_free(decoder);
+
+    XCTAssertEqual(consumed, sizeof(stream));
+    XCTAssertEqual(_decoded.count, 1);
+    XCTAssertEqual(_decoded.events[0].thread_id, 0x1f);
+    XCTAssertEqual(_decoded.events[0].stream_id, 0x1f);
+    XCTAssertEqual(strcmp(_decoded.events[0].class_name, "A"), 0);
+}
+
+- (void)testDroppedRecords {
+    [self appendEvent];
+    append_dropped_record(&_stream, 300);
+    [self appendEvent];
+
+    uint64_t dropped = 0;
+    event_decoder_t *decoder = event_decoder_create();
+    event_decoder_set_dropped_callback(decoder, count_dropped, &dropped);
+    size_t consumed = 0;
+    XCTAssertEqual(event_decoder_decode(decoder, (const uint8_t *)_stream.data, _stream.length, &consumed, collect_event, &_decoded), KERN_SUCCESS);
+    event_decoder_free(decoder);
+
+    XCTAssertEqual(dropped, 300);
+    // The marker doesn't disturb the thread's delta state
+    XCTAssertEqual(_decoded.count, 2);
+    XCTAssertEqual(_decoded.events[1].timestamp, 1000000);
+
+    // Without a callback the marker is skipped
+    memset(&_decoded, 0, sizeof(_decoded));
+    XCTAssertEqual([self decodeStream], KERN_SUCCESS);
+    XCTAssertEqual(_decoded.count, 2);
+}
+
+- (void)testMainThreadRecord {
+    append_main_thread_record(&_stream, 0x1a2b);
+    [self appendEvent];
+
+    uint32_t main_thread = 0;
+    event_decoder_t *decoder = event_decoder_create();
+    event_decoder_set_main_thread_callback(decoder, note_main_thread, &main_thread);
+    size_t consumed = 0;
+    XCTAssertEqual(event_decoder_decode(decoder, (const uint8_t *)_stream.data, _stream.length, &consumed, collect_event, &_decoded), KERN_SUCCESS);
+    event_decoder_free(decoder);
+
+    XCTAssertEqual(main_thread, 0x1a2b);
+    XCTAssertEqual(_decoded.count, 1);
+}
+
+- (void)testPartialReads {
+    [self appendEvent];
+    [self appendEvent];
+
+    // Feed one byte at a time, carrying over whatever wasn't consumed
+    event_decoder_t *decoder = event_decoder_create();
+    size_t start = 0;
+    for (size_t end = 1; end <= _stream.length; end++) {
+        size_t consumed = 0;
+        XCTAssertEqual(event_decoder_decode(decoder, (const uint8_t *)_stream.data + start, end - start, &consumed, collect_event, &_decoded), KERN_SUCCESS);
+        start += consumed;
+    }
+    event_decoder_free(decoder);
+
+    XCTAssertEqual(start, _stream.length);
+    XCTAssertEqual(_decoded.count, 2);
+}
+
+- (void)testRejectsOtherStreams {
+    const char *json = "{\"class\":\"NSObject\"}\n";
+    event_decoder_t *decoder = event_decoder_create();
+    size_t consumed = 0;
+    XCTAssertEqual(event_decoder_decode(decoder, (const uint8_t *)json, strlen(json), &consumed, collect_event, &_decoded), KERN_INVALID_ARGUMENT);
+    event_decoder_free(decoder);
+}
+
+- (void)testEncodePerformance {
+    _event.argument_count = 0;
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            output_buffer_reset(&self->_stream);
+            append_binary_event(&self->_encoder, &self->_event, &self->_stream);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,99 @@
+//
+//  EventRingTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/6/25.
+//
+
+#import <XCTest/XCTest.h>
+#import <mach/mach.h>
+#import "event_ring.h"
+#import "output_buffer.h"
+
+@interface EventRingTests : XCTestCase {
+    event_ring_t *_ring;
+}
+@end
+
+@implementation EventRingTests
+
+- (void)setUp {
+    [super setUp];
+    _ring = event_ring_create(vm_page_size);
+    XCTAssertTrue(_ring != NULL);
+}
+
+- (void)tearDown {
+    event_ring_destroy(_ring);
+    [super tearDown];
+}
+
+- (void)testRejectsUnalignedCapacity {
+    XCTAssertTrue(event_ring_create(1000) == NULL);
+}
+
+- (void)testReserveAndCommit {
+    size_t available = 0;
+    char *data = event_ring_reserve(_ring, &available);
+    XCTAssertEqual(available, vm_page_size);
+
+    memcpy(data, "hello\n", 6);
+    size_t length = 0;
+    event_ring_peek(_ring, &length);
+    XCTAssertEqual(length, 0);
+
+    event_ring_commit(_ring, 6);
+    const char *readable = event_ring_peek(_ring, &length);
+    XCTAssertEqual(length, 6);
+    XCTAssertEqual(memcmp(readable, "hello\n", 6), 0);
+
+    event_ring_reserve(_ring, &available);
+    XCTAssertEqual(available, vm_page_size - 6);
+
+    event_ring_consume(_ring, 6);
+    event_ring_reserve(_ring, &available);
+    XCTAssertEqual(available, vm_page_size);
+}
+
+- (void)testWritesAcrossTheEndAreContiguous {
+    // Move the producer close to the end of the ring
+    size_t available = 0;
+    event_ring_reserve(_ring, &available);
+    event_ring_commit(_ring, vm_page_size - 4);
+    event_ring_consume(_ring, vm_page_size - 4);
+
+    output_buffer_t out;
+    char *data = event_ring_reserve(_ring, &available);
+    output_buffer_wrap(&out, data, available);
+    output_buffer_append_str(&out, "0123456789");
+    XCTAssertFalse(out.failed);
+    event_ring_commit(_ring, out.length);
+
+    size_t length = 0;
+    const char *readable = event_ring_peek(_ring, &length);
+    XCTAssertEqual(length, 10);
+    XCTAssertEqual(memcmp(readable, "0123456789", 10), 0);
+    // The bytes past the end landed at the start of the ring
+    XCTAssertEqual(memcmp(_ring->data, "456789", 6), 0);
+}
+
+- (void)testFixedBufferFailsWhenFull {
+    size_t available = 0;
+    char *data = event_ring_reserve(_ring, &available);
+    event_ring_commit(_ring, available - 4);
+
+    output_buffer_t out;
+    data = event_ring_reserve(_ring, &available);
+    output_buffer_wrap(&out, data, available);
+    output_buffer_append_str(&out, "too long for the space left");
+    XCTAssertTrue(out.failed);
+}
+
+- (void)testClaimAndRelease {
+    XCTAssertTrue(event_ring_try_claim(_ring));
+    XCTAssertFalse(event_ring_try_claim(_ring));
+    event_ring_release(_ring);
+    XCTAssertTrue(event_ring_try_claim(_ring));
+}
+
+@end
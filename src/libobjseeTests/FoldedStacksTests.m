@@ -0,0 +1,143 @@
+//
+//  FoldedStacksTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/12/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "folded_stacks.h"
+#import "TraceFixtures.h"
+
+@interface FoldedStacksTests : XCTestCase
+@end
+
+@implementation FoldedStacksTests
+
+- (NSString *)foldedOutput:(folded_stacks_t *)stacks {
+    return [self foldedOutput:stacks weight:FOLDED_STACKS_WEIGHT_CALLS];
+}
+
+- (NSString *)foldedOutput:(folded_stacks_t *)stacks weight:(folded_stacks_weight_t)weight {
+    char *output = NULL;
+    size_t length = 0;
+    FILE *file = open_memstream(&output, &length);
+    XCTAssertEqual(folded_stacks_write(stacks, weight, file), KERN_SUCCESS);
+    fclose(file);
+
+    NSString *string = [NSString stringWithUTF8String:output];
+    free(output);
+    return string;
+}
+
+- (void)addEvent:(folded_stacks_t *)stacks class:(int)class_index selector:(int)selector_index depth:(uint32_t)depth thread:(uint16_t)thread_id {
+    tracer_event_t event = trace_fixture_event(class_index, selector_index, thread_id, depth, 0);
+    XCTAssertEqual(folded_stacks_add_event(stacks, &event, true), KERN_SUCCESS);
+}
+
+- (void)testStacksFollowDepth {
+    folded_stacks_t *stacks = folded_stacks_create();
+    [self addEvent:stacks class:0 selector:1 depth:0 thread:1];
+    [self addEvent:stacks class:1 selector:0 depth:1 thread:1];
+    [self addEvent:stacks class:2 selector:2 depth:2 thread:1];
+    // Returns to depth 1, replacing -[UILabel init]
+    [self addEvent:stacks class:1 selector:1 depth:1 thread:1];
+    // Another thread's stack is separate
+    [self addEvent:stacks class:2 selector:0 depth:0 thread:2];
+    [self addEvent:stacks class:1 selector:0 depth:1 thread:1];
+
+    NSString *expected = @"-[NSString init] 1\n"
+        "-[UIView layoutSubviews] 1\n"
+        "-[UIView layoutSubviews];-[UILabel init] 2\n"
+        "-[UIView layoutSubviews];-[UILabel init];-[NSString length] 1\n"
+        "-[UIView layoutSubviews];-[UILabel layoutSubviews] 1\n";
+    XCTAssertEqualObjects([self foldedOutput:stacks], expected);
+    folded_stacks_destroy(stacks);
+}
+
+- (void)testUncountedEventsStillMoveTheStack {
+    folded_stacks_t *stacks = folded_stacks_create();
+    tracer_event_t root = trace_fixture_event(0, 0, 0, 0, 0);
+    XCTAssertEqual(folded_stacks_add_event(stacks, &root, false), KERN_SUCCESS);
+    [self addEvent:stacks class:1 selector:2 depth:1 thread:0];
+
+    XCTAssertEqualObjects([self foldedOutput:stacks], @"-[UIView init];-[UILabel length] 1\n");
+    folded_stacks_destroy(stacks);
+}
+
+- (void)testMergedRunsMatchOneRun {
+    int event_count = 5000;
+    tracer_event_t *events = calloc(event_count, sizeof(tracer_event_t));
+    uint32_t depths[3] = {0};
+    srand(11);
+    for (int i = 0; i < event_count; i++) {
+        int thread = rand() % 3;
+        int step = rand() % 4;
+        depths[thread] = step < 2 ? depths[thread] + 1 : step == 2 && depths[thread] > 0 ? depths[thread] - 1 : depths[thread] / 2;
+        uint32_t class_index = rand() % 3;
+        uint32_t selector_index = rand() % 3;
+        events[i] = trace_fixture_event(class_index, selector_index, (uint16_t)thread, MIN(depths[thread], 20), 1000 + (uint64_t)i * 7);
+    }
+
+    folded_stacks_t *whole = folded_stacks_create();
+    for (int i = 0; i < event_count; i++) {
+        folded_stacks_add_event(whole, &events[i], i % 5 != 0);
+    }
+    NSString *expected = [self foldedOutput:whole];
+    NSString *expected_durations = [self foldedOutput:whole weight:FOLDED_STACKS_WEIGHT_DURATION];
+
+    // Runs that start partway into calls on every thread
+    int bounds[] = {0, 7, 1200, 1201, 3333, event_count};
+    int run_count = sizeof(bounds) / sizeof(bounds[0]) - 1;
+    folded_stacks_t *runs[run_count];
+    for (int run = 0; run < run_count; run++) {
+        runs[run] = folded_stacks_create();
+        for (int i = bounds[run]; i < bounds[run + 1]; i++) {
+            folded_stacks_add_event(runs[run], &events[i], i % 5 != 0);
+        }
+    }
+    for (int run = 1; run < run_count; run++) {
+        XCTAssertEqual(folded_stacks_merge(runs[0], runs[run]), KERN_SUCCESS);
+    }
+    XCTAssertEqualObjects([self foldedOutput:runs[0]], expected);
+    XCTAssertEqualObjects([self foldedOutput:runs[0] weight:FOLDED_STACKS_WEIGHT_DURATION], expected_durations);
+
+    for (int run = 0; run < run_count; run++) {
+        folded_stacks_destroy(runs[run]);
+    }
+    folded_stacks_destroy(whole);
+    free(events);
+}
+
+- (void)testDurationsRunToTheNextEventOnTheThread {
+    folded_stacks_t *stacks = folded_stacks_create();
+    uint32_t depths[] = {0, 1, 1, 0};
+    uint64_t timestamps[] = {100, 130, 160, 200};
+    for (int i = 0; i < 4; i++) {
+        tracer_event_t event = trace_fixture_event(0, i % 2, 1, depths[i], timestamps[i]);
+        XCTAssertEqual(folded_stacks_add_event(stacks, &event, true), KERN_SUCCESS);
+
+        // Another thread's events don't end this thread's calls
+        tracer_event_t other = trace_fixture_event(2, 2, 2, 0, timestamps[i] + 5);
+        XCTAssertEqual(folded_stacks_add_event(stacks, &other, true), KERN_SUCCESS);
+    }
+
+    // The last call on each thread hasn't ended, so it has no time yet
+    NSString *expected = @"-[NSString length] 100\n"
+        "-[UIView init] 30\n"
+        "-[UIView init];-[UIView init] 40\n"
+        "-[UIView init];-[UIView layoutSubviews] 30\n";
+    XCTAssertEqualObjects([self foldedOutput:stacks weight:FOLDED_STACKS_WEIGHT_DURATION], expected);
+    XCTAssertTrue(folded_stacks_has_durations(stacks));
+    folded_stacks_destroy(stacks);
+}
+
+- (void)testRejectsEventsWithoutNames {
+    folded_stacks_t *stacks = folded_stacks_create();
+    tracer_event_t event = { .class_name = trace_fixture_class_names[0] };
+    XCTAssertEqual(folded_stacks_add_event(stacks, &event, true), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(folded_stacks_count(stacks), 0);
+    folded_stacks_destroy(stacks);
+}
+
+@end
@@ -0,0 +1,369 @@
+//
+//  FormatterTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/3/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "tracer_internal.h"
+#import "format.h"
+#import "color_utils.h"
+#import "method_fragments.h"
+
+// The formatter as it was before events were formatted into a reused buffer. New output is checked against it,
+// and it's what the formatter's performance is measured against
+#define BASELINE_FORMAT_BUFFER_SIZE 1024
+
+static bool baseline_append(char **ptr, const char *end, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(*ptr, end - *ptr, format, args);
+    va_end(args);
+    if (written < 0 || written >= end - *ptr) {
+        return false;
+    }
+    *ptr += written;
+    return true;
+}
+
+static bool baseline_append_color(char **ptr, const char *end, uint8_t color) {
+    return baseline_append(ptr, end, "\033[38;5;%dm", color);
+}
+
+static uint32_t baseline_indent_spaces(uint32_t indent_level) {
+    return indent_level < 4 ? 3 : indent_level < 8 ? 2 : 1;
+}
+
+static char *baseline_formatted_event_str(const tracer_event_t *event, tracer_format_options_t format) {
+    char buffer[BASELINE_FORMAT_BUFFER_SIZE] = {0};
+    char method_name[BASELINE_FORMAT_BUFFER_SIZE] = {0};
+    char *ptr = buffer;
+    const char *end = buffer + sizeof(buffer);
+    bool colors = format.include_colors;
+
+    if (format.include_thread_id) {
+        if (colors && !baseline_append_color(&ptr, end, COLOR_THREAD_START + (event->thread_id % (COLOR_THREAD_END - COLOR_THREAD_START)))) {
+            return NULL;
+        }
+        if (!baseline_append(&ptr, end, "[0x%x] ", event->thread_id) || (colors && !baseline_append(&ptr, end, COLOR_RESET))) {
+            return NULL;
+        }
+    }
+
+    if (format.include_indents) {
+        uint8_t depth_color = colors ? COLOR_DEPTH_START + (event->trace_depth % (COLOR_DEPTH_END - COLOR_DEPTH_START)) : 0;
+        for (uint32_t i = 0; i < event->trace_depth; i++) {
+            uint32_t spaces = format.variable_separator_spacing ? baseline_indent_spaces(i) : format.static_separator_spacing;
+            for (uint32_t j = 0; j < spaces; j++) {
+                if (!baseline_append(&ptr, end, "%s", format.indent_char)) {
+                    return NULL;
+                }
+            }
+
+            if (format.include_indent_separators) {
+                if ((colors && !baseline_append_color(&ptr, end, depth_color)) || !baseline_append(&ptr, end, "%s", format.indent_separator_char) ||
+                    (colors && !baseline_append(&ptr, end, COLOR_RESET))) {
+                    return NULL;
+                }
+            }
+        }
+
+        if (event->trace_depth > 0 && !baseline_append(&ptr, end, "%s", format.indent_char)) {
+            return NULL;
+        }
+    }
+
+    if (colors && !baseline_append_color(&ptr, end, get_consistent_color(event->class_name, COLOR_CLASS_START, COLOR_CLASS_RANGE))) {
+        return NULL;
+    }
+    if (!baseline_append(&ptr, end, "%s[%s ", event->is_class_method ? "+" : "-", event->class_name)) {
+        return NULL;
+    }
+
+    strlcpy(method_name, event->method_name, sizeof(method_name));
+    size_t arg_index = 0;
+    for (char *part = strtok(method_name, ":"); part != NULL; part = strtok(NULL, ":")) {
+        if (colors && !baseline_append_color(&ptr, end, get_consistent_color(event->method_name, COLOR_METHOD_START, COLOR_METHOD_RANGE))) {
+            return NULL;
+        }
+        if (!baseline_append(&ptr, end, "%s", part)) {
+            return NULL;
+        }
+        if (strchr(event->method_name + (part - method_name), ':') && !baseline_append(&ptr, end, ":")) {
+            return NULL;
+        }
+
+        if (arg_index < event->argument_count) {
+            const tracer_argument_t *arg = &event->arguments[arg_index];
+            if (colors && !baseline_append(&ptr, end, COLOR_RESET)) {
+                return NULL;
+            }
+
+            const char *type = arg->objc_class_name ? arg->objc_class_name : arg->type_encoding;
+            uint8_t arg_color = colors ? get_consistent_color(type, COLOR_METHOD_START, COLOR_METHOD_RANGE) : 0;
+            if (arg->block_signature && !baseline_append(&ptr, end, " ")) {
+                return NULL;
+            }
+            if (colors && !baseline_append_color(&ptr, end, arg_color)) {
+                return NULL;
+            }
+            const char *text = arg->block_signature ? arg->block_signature : arg->description ? arg->description : "nil";
+            if (!baseline_append(&ptr, end, arg->block_signature ? "(%s)" : "%s", text) || (colors && !baseline_append(&ptr, end, COLOR_RESET))) {
+                return NULL;
+            }
+            if (arg_index + 1 < event->argument_count && !baseline_append(&ptr, end, " ")) {
+                return NULL;
+            }
+            arg_index++;
+        }
+    }
+
+    if (colors && !baseline_append_color(&ptr, end, get_consistent_color(event->class_name, COLOR_CLASS_START, COLOR_CLASS_RANGE))) {
+        return NULL;
+    }
+    if (!baseline_append(&ptr, end, "]") || (format.include_newline_in_formatted_trace && !baseline_append(&ptr, end, "\n")) ||
+        (colors && !baseline_append(&ptr, end, COLOR_RESET))) {
+        return NULL;
+    }
+    return strdup(buffer);
+}
+
+@interface FormatterTests : XCTestCase {
+    tracer_argument_t _arguments[2];
+    tracer_event_t _event;
+    tracer_format_options_t _format;
+}
+@end
+
+@implementation FormatterTests
+
+- (void)setUp {
+    [super setUp];
+
+    memset(_arguments, 0, sizeof(_arguments));
+    _arguments[0].type_encoding = "@";
+    _arguments[0].objc_class_name = "NSString";
+    _arguments[0].description = "@\"hi\"";
+    _arguments[1].type_encoding = "q";
+    _arguments[1].description = "42";
+
+    memset(&_event, 0, sizeof(_event));
+    _event.class_name = "NSObject";
+    _event.method_name = "initWithFoo:bar:";
+    _event.thread_id = 0x1f;
+    _event.arguments = _arguments;
+    _event.argument_count = 2;
+
+    memset(&_format, 0, sizeof(_format));
+    _format.indent_char = " ";
+    _format.indent_separator_char = "|";
+    _format.include_newline_in_formatted_trace = true;
+}
+
+- (void)testNullHandling {
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(NULL, &_format, &out), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(append_formatted_event(&_event, NULL, &out), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(append_formatted_event(&_event, &_format, NULL), KERN_INVALID_ARGUMENT);
+
+    _event.method_name = NULL;
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_INVALID_ARGUMENT);
+    XCTAssertTrue(build_formatted_event_str(&_event, _format) == NULL);
+    XCTAssertEqual(out.length, 0);
+}
+
+- (void)testPlainFormatting {
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(out.data, "-[NSObject initWithFoo:@\"hi\" bar:42]\n"), 0);
+    XCTAssertEqual(out.length, strlen(out.data));
+    output_buffer_free(&out);
+}
+
+- (void)testThreadIdAndIndents {
+    _format.include_thread_id = true;
+    _format.include_indents = true;
+    _format.include_indent_separators = true;
+    _format.variable_separator_spacing = true;
+    _event.trace_depth = 2;
+    _event.is_class_method = true;
+    _event.method_name = "description";
+    _event.argument_count = 0;
+
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(out.data, "[0x1f]    |   | +[NSObject description]\n"), 0);
+
+    // The cached indent prefix must match the baseline's per-character render at every depth
+    for (uint32_t depth = 0; depth < 100; depth++) {
+        _event.trace_depth = depth;
+        output_buffer_reset(&out);
+        XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+
+        char *expected = baseline_formatted_event_str(&_event, _format);
+        XCTAssertTrue(expected != NULL);
+        XCTAssertEqual(strcmp(out.data, expected), 0, @"depth %u", depth);
+        free(expected);
+    }
+    output_buffer_free(&out);
+}
+
+- (void)testMatchesBaselineFormatter {
+    _arguments[1].block_signature = "void (^)(id)";
+    const char *methods[] = {"initWithFoo:bar:baz:", "description", "a::b:", "foo:", "::", "x:y", ":lead"};
+    output_buffer_t out = {0};
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+        for (uint32_t depth = 0; depth < 40; depth += 3) {
+            // Every combination of the boolean options
+            for (int options = 0; options < 64; options++) {
+                _event.method_name = methods[m];
+                _event.argument_count = m % 3;
+                _event.trace_depth = depth;
+                _event.is_class_method = options & 1;
+                _format.include_newline_in_formatted_trace = (options >> 0) & 1;
+                _format.include_colors = (options >> 1) & 1;
+                _format.include_thread_id = (options >> 2) & 1;
+                _format.include_indents = (options >> 3) & 1;
+                _format.include_indent_separators = (options >> 4) & 1;
+                _format.variable_separator_spacing = (options >> 5) & 1;
+                _format.static_separator_spacing = 2;
+
+                output_buffer_reset(&out);
+                XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+                char *expected = baseline_formatted_event_str(&_event, _format);
+                XCTAssertTrue(expected != NULL);
+                XCTAssertEqual(strcmp(out.data, expected), 0, @"%s at depth %u with options %d", methods[m], depth, options);
+                free(expected);
+            }
+        }
+    }
+    output_buffer_free(&out);
+}
+
+- (void)testColorsUseCachedEscapeSequences {
+    size_t length = 0;
+    XCTAssertEqual(strcmp(get_color_escape_sequence(7, &length), "\x1b[38;5;7m"), 0);
+    XCTAssertEqual(length, strlen("\x1b[38;5;7m"));
+    XCTAssertEqual(strcmp(get_color_escape_sequence(255, &length), "\x1b[38;5;255m"), 0);
+    XCTAssertEqual(length, strlen("\x1b[38;5;255m"));
+
+    _format.include_colors = true;
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+
+    uint8_t class_color = get_consistent_color("NSObject", COLOR_CLASS_START, COLOR_CLASS_RANGE);
+    XCTAssertEqual(strncmp(out.data, get_color_escape_sequence(class_color, NULL), strlen(get_color_escape_sequence(class_color, NULL))), 0);
+    XCTAssertTrue(strstr(out.data, "initWithFoo:") != NULL);
+    XCTAssertEqual(strcmp(out.data + out.length - strlen(COLOR_RESET), COLOR_RESET), 0);
+    output_buffer_free(&out);
+}
+
+- (void)testEmptySelectorPartsAreSkipped {
+    _event.method_name = "a::b:";
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(out.data, "-[NSObject a:@\"hi\" b:42]\n"), 0);
+    output_buffer_free(&out);
+}
+
+- (void)testBufferIsReusedAndGrows {
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    char *first_allocation = out.data;
+    size_t first_capacity = out.capacity;
+
+    // Resetting keeps the allocation, so formatting the next event doesn't allocate
+    output_buffer_reset(&out);
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertEqual(out.data, first_allocation);
+    XCTAssertEqual(out.capacity, first_capacity);
+
+    // Events are no longer capped at a fixed size
+    char long_description[4096];
+    memset(long_description, 'x', sizeof(long_description) - 1);
+    long_description[sizeof(long_description) - 1] = '\0';
+    _arguments[0].description = long_description;
+
+    output_buffer_reset(&out);
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertTrue(out.length > sizeof(long_description));
+    XCTAssertTrue(strstr(out.data, long_description) != NULL);
+    output_buffer_free(&out);
+}
+
+- (void)testMethodFragmentsAreSplitAndCached {
+    const char *class_name = "NSObject";
+    const char *method_name = "initWithFoo:bar:";
+
+    const method_fragments_t *fragments = get_method_fragments(class_name, method_name, false, false);
+    XCTAssertTrue(fragments != NULL);
+    XCTAssertEqual(fragments->part_count, 2);
+    XCTAssertEqual(strncmp(fragments->text + fragments->head.offset, "-[NSObject ", fragments->head.length), 0);
+    XCTAssertEqual(strncmp(fragments->text + fragments->parts[0].offset, "initWithFoo:", fragments->parts[0].length), 0);
+    XCTAssertEqual(strncmp(fragments->text + fragments->parts[1].offset, "bar:", fragments->parts[1].length), 0);
+    XCTAssertEqual(strncmp(fragments->text + fragments->tail.offset, "]", fragments->tail.length), 0);
+
+    // Repeated lookups return the same fragments. Colored and class method variants are cached separately
+    XCTAssertEqual(get_method_fragments(class_name, method_name, false, false), fragments);
+    const method_fragments_t *colored = get_method_fragments(class_name, method_name, false, true);
+    XCTAssertTrue(colored != NULL && colored != fragments);
+    XCTAssertTrue(colored->head.length > fragments->head.length);
+    const method_fragments_t *class_method = get_method_fragments(class_name, method_name, true, false);
+    XCTAssertEqual(strncmp(class_method->text + class_method->head.offset, "+[NSObject ", class_method->head.length), 0);
+
+    method_fragments_t *uncached = create_method_fragments(class_name, "::a", false, false);
+    XCTAssertTrue(uncached != NULL);
+    XCTAssertEqual(uncached->part_count, 1);
+    XCTAssertEqual(strncmp(uncached->text + uncached->parts[0].offset, "a", uncached->parts[0].length), 0);
+    free(uncached);
+}
+
+- (void)testArgumentsSplicedIntoFragments {
+    // Fewer captured arguments than selector parts leaves the remaining parts bare
+    _event.argument_count = 1;
+    output_buffer_t out = {0};
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(out.data, "-[NSObject initWithFoo:@\"hi\"bar:]\n"), 0);
+
+    _arguments[1].block_signature = "void (^)(id)";
+    _event.argument_count = 2;
+    output_buffer_reset(&out);
+    XCTAssertEqual(append_formatted_event(&_event, &_format, &out), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(out.data, "-[NSObject initWithFoo:@\"hi\" bar: (void (^)(id))]\n"), 0);
+    output_buffer_free(&out);
+}
+
+- (void)testBaselineFormatterPerformance {
+    _format.include_colors = true;
+    _format.include_indents = true;
+    _format.include_indent_separators = true;
+    _format.variable_separator_spacing = true;
+    _event.trace_depth = 6;
+
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            char *formatted = baseline_formatted_event_str(&self->_event, self->_format);
+            free(formatted);
+        }
+    }];
+}
+
+- (void)testFormatterPerformance {
+    _format.include_colors = true;
+    _format.include_indents = true;
+    _format.include_indent_separators = true;
+    _format.variable_separator_spacing = true;
+    _event.trace_depth = 6;
+
+    __block output_buffer_t out = {0};
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            output_buffer_reset(&out);
+            append_formatted_event(&self->_event, &self->_format, &out);
+        }
+    }];
+    output_buffer_free(&out);
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  JsonReaderTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "json_reader.h"
+
+@interface JsonReaderTests : XCTestCase
+@end
+
+@implementation JsonReaderTests
+
+- (void)testReadsWantedFieldsAndSkipsTheRest {
+    char json[] = "{\"depth\":3,\"event\":{\"args\":[1,\"}\",{\"x\":null}],\"ok\":true},\"thread_id\":259,"
+        "\"formatted_output\":\"\\u001b[33m-[UIView init]\\u001b[0m \\\"a\\\\b\\\"\\n\\ud83d\\ude00\\u00e9\"}";
+    json_field_t fields[] = {
+        { .name = "formatted_output" },
+        { .name = "thread_id" },
+        { .name = "event" },
+        { .name = "missing" },
+    };
+    XCTAssertEqual(json_read_fields(json, strlen(json), fields, 4), KERN_SUCCESS);
+
+    XCTAssertEqual(fields[0].type, JSON_FIELD_STRING);
+    const char *expected = "\x1b[33m-[UIView init]\x1b[0m \"a\\b\"\n\xf0\x9f\x98\x80\xc3\xa9";
+    XCTAssertEqual(fields[0].length, strlen(expected));
+    XCTAssertEqual(strcmp(fields[0].string, expected), 0);
+    // Unescaped where it sat, inside the line
+    XCTAssertTrue(fields[0].string > json && fields[0].string < json + sizeof(json));
+
+    XCTAssertEqual(fields[1].type, JSON_FIELD_NUMBER);
+    XCTAssertEqual(fields[1].number, 259);
+    XCTAssertEqual(fields[2].type, JSON_FIELD_OTHER);
+    XCTAssertEqual(fields[3].type, JSON_FIELD_MISSING);
+}
+
+- (void)testNumbers {
+    char json[] = "{\"a\":-42,\"b\":1.5e2,\"c\":99999999999999999999,\"d\":-0.9}";
+    json_field_t fields[] = { { .name = "a" }, { .name = "b" }, { .name = "c" }, { .name = "d" } };
+    XCTAssertEqual(json_read_fields(json, strlen(json), fields, 4), KERN_SUCCESS);
+    XCTAssertEqual(fields[0].number, -42);
+    XCTAssertEqual(fields[1].number, 150);
+    XCTAssertEqual(fields[2].number, INT64_MAX);
+    XCTAssertEqual(fields[3].number, 0);
+}
+
+- (void)testMalformedLinesAreLeftUntouched {
+    const char *malformed[] = {
+        "",
+        "[1]",
+        "{\"formatted_output\":\"a\\nb\"",
+        "{\"formatted_output\":\"a\\nb\",}",
+        "{\"formatted_output\":\"a\\qb\"}",
+        "{\"formatted_output\":\"\\ud83d\"}",
+        "{\"formatted_output\":\"tab\there\"}",
+        "{\"thread_id\":01}",
+        "{\"thread_id\":1.}",
+        "{\"event\":[1,2}",
+        "{\"formatted_output\":\"a\\nb\"} trailing",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        char json[128];
+        strlcpy(json, malformed[i], sizeof(json));
+        json_field_t fields[] = { { .name = "formatted_output" }, { .name = "thread_id" } };
+        XCTAssertEqual(json_read_fields(json, strlen(json), fields, 2), KERN_INVALID_ARGUMENT, @"%s", malformed[i]);
+        XCTAssertEqual(strcmp(json, malformed[i]), 0);
+    }
+}
+
+- (void)testLastDuplicateWins {
+    char json[] = " { \"n\" : \"first\" , \"n\" : 7 } ";
+    json_field_t field = { .name = "n" };
+    XCTAssertEqual(json_read_fields(json, strlen(json), &field, 1), KERN_SUCCESS);
+    XCTAssertEqual(field.type, JSON_FIELD_NUMBER);
+    XCTAssertEqual(field.number, 7);
+}
+
+@end
@@ -0,0 +1,138 @@
+//
+//  JsonWriterTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/4/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "tracer_internal.h"
+#import "format.h"
+#import "json_writer.h"
+
+@interface JsonWriterTests : XCTestCase {
+    tracer_argument_t _arguments[2];
+    tracer_event_t _event;
+    tracer_t _tracer;
+    output_buffer_t _out;
+    output_buffer_t _scratch;
+}
+@end
+
+@implementation JsonWriterTests
+
+- (void)setUp {
+    [super setUp];
+
+    memset(_arguments, 0, sizeof(_arguments));
+    _arguments[0].type_encoding = "@";
+    _arguments[0].objc_class_name = "NSString";
+    _arguments[0].description = "@\"quoted\"\n";
+    _arguments[0].address = (void *)0x1000;
+    _arguments[0].size = 8;
+    _arguments[1].type_encoding = "q";
+    _arguments[1].description = "42";
+    _arguments[1].address = (void *)0x2000;
+    _arguments[1].size = 8;
+
+    memset(&_event, 0, sizeof(_event));
+    _event.class_name = "NSObject";
+    _event.method_name = "initWithFoo:bar:";
+    _event.thread_id = 0x1f;
+    _event.real_depth = 3;
+    _event.method_signature = "@32@0:8@16q24";
+    _event.arguments = _arguments;
+    _event.argument_count = 2;
+
+    memset(&_tracer, 0, sizeof(_tracer));
+    _tracer.config.format.output_as_json = true;
+    _tracer.config.format.include_event_json = true;
+    _tracer.config.format.args = TRACER_ARG_FORMAT_DESCRIPTIVE;
+
+    memset(&_out, 0, sizeof(_out));
+    memset(&_scratch, 0, sizeof(_scratch));
+}
+
+- (void)tearDown {
+    output_buffer_free(&_out);
+    output_buffer_free(&_scratch);
+    [super tearDown];
+}
+
+- (NSDictionary *)parseOutput {
+    NSData *data = [NSData dataWithBytes:_out.data length:_out.length];
+    return [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+}
+
+- (void)testEscaping {
+    const char *raw = "tab\there \"quote\" back\\slash \x01 and a long clean run of text past sixteen bytes";
+    json_append_escaped(&_out, raw, strlen(raw));
+    XCTAssertEqual(strcmp(_out.data, "tab\\there \\\"quote\\\" back\\\\slash \\u0001 and a long clean run of text past sixteen bytes"), 0);
+}
+
+- (void)testWriterPlacesSeparators {
+    json_writer_t writer;
+    json_writer_init(&writer, &_out);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "a");
+    json_writer_int64(&writer, -5);
+    json_writer_key(&writer, "b");
+    json_writer_begin_array(&writer);
+    json_writer_bool(&writer, true);
+    json_writer_begin_object(&writer);
+    json_writer_end_object(&writer);
+    json_writer_string(&writer, "x");
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    XCTAssertEqual(strcmp(_out.data, "{\"a\":-5,\"b\":[true,{},\"x\"]}"), 0);
+}
+
+- (void)testEventSchema {
+    XCTAssertEqual(append_json_event(&_tracer, &_event, &_out, &_scratch), KERN_SUCCESS);
+
+    NSDictionary *json = [self parseOutput];
+    XCTAssertNotNil(json);
+    XCTAssertEqualObjects(json[@"class"], @"NSObject");
+    XCTAssertEqualObjects(json[@"method"], @"initWithFoo:bar:");
+    XCTAssertEqualObjects(json[@"thread_id"], @(0x1f));
+    XCTAssertEqualObjects(json[@"depth"], @3);
+    XCTAssertEqualObjects(json[@"signature"], @"@32@0:8@16q24");
+
+    // Zero/false fields are omitted, as they were when events were built with json-c
+    XCTAssertNil(json[@"is_class_method"]);
+    XCTAssertNil(json[@"formatted_output"]);
+
+    NSArray *arguments = json[@"arguments"];
+    XCTAssertEqual(arguments.count, 2);
+    XCTAssertEqualObjects(arguments[0][@"class"], @"NSString");
+    XCTAssertEqualObjects(arguments[0][@"objc_class"], @"NSString");
+    XCTAssertEqualObjects(arguments[0][@"description"], @"@\"quoted\"\n");
+    XCTAssertEqualObjects(arguments[0][@"address"], @(0x1000));
+    XCTAssertEqualObjects(arguments[1][@"description"], @"42");
+    XCTAssertEqualObjects(arguments[1][@"size"], @8);
+}
+
+- (void)testFormattedOutputField {
+    _tracer.config.format.include_event_json = false;
+    _tracer.config.format.include_formatted_trace = true;
+    _tracer.config.format.include_newline_in_formatted_trace = true;
+    XCTAssertEqual(append_json_event(&_tracer, &_event, &_out, &_scratch), KERN_SUCCESS);
+
+    NSDictionary *json = [self parseOutput];
+    XCTAssertEqual(json.count, 1);
+    XCTAssertEqualObjects(json[@"formatted_output"], @"-[NSObject initWithFoo:@\"quoted\"\n bar:42]\n");
+}
+
+- (void)testJsonEventPerformance {
+    _tracer.config.format.include_formatted_trace = true;
+    _tracer.config.format.include_colors = true;
+
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            output_buffer_reset(&self->_out);
+            append_json_event(&self->_tracer, &self->_event, &self->_out, &self->_scratch);
+        }
+    }];
+}
+
+@end
@@ -37,14 +37,12 @@
 }
 
 - (void)testNullHandling {
-    const char *result = lookup_description_for_address(NULL, NULL);
-    XCTAssertEqual(result, NULL);
-    
-    result = lookup_description_for_address((__bridge void *)_testObject, NULL);
-    XCTAssertEqual(result, NULL);
-    
-    result = lookup_description_for_address(NULL, [TestObject class]);
-    XCTAssertEqual(result, NULL);
+    char result[256];
+    XCTAssertEqual(lookup_description_for_address(NULL, NULL, result, sizeof(result)), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, NULL, result, sizeof(result)), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(lookup_description_for_address(NULL, [TestObject class], result, sizeof(result)), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], NULL, sizeof(result)), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], result, 0), KERN_INVALID_ARGUMENT);
 }
 
 - (void)testBasicDescriptionLookup {
@@ -52,28 +50,47 @@
     NSString *objcDesc = [_testObject description];
     XCTAssertEqualObjects(objcDesc, @"TestDescription");
     
-    const char *utf8Str = [objcDesc UTF8String];
-    XCTAssertNotEqual(utf8Str, NULL);
-    
-    const char *result = lookup_description_for_address((__bridge void *)_testObject, [TestObject class]);
-    XCTAssertNotEqual(result, NULL);
-    if (result) {
-        XCTAssertEqual(strcmp(result, "TestDescription"), 0);
-    }
+    char result[256];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(result, "TestDescription"), 0);
 }
 
 - (void)testDescriptionCaching {
     _testObject.customDescription = @"CacheTest";
     
-    const char *first = lookup_description_for_address((__bridge void *)_testObject, [TestObject class]);
-    XCTAssertNotEqual(first, NULL);
+    char first[256];
+    char second[256];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], first, sizeof(first)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(first, "CacheTest"), 0);
     
-    if (first) {
-        XCTAssertEqual(strcmp(first, "CacheTest"), 0);
-        
-        const char *second = lookup_description_for_address((__bridge void *)_testObject, [TestObject class]);
-        XCTAssertEqual(first, second);
-    }
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], second, sizeof(second)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(first, second), 0);
+}
+
+- (void)testCachedDescriptionInvalidatedWhenObjectChanges {
+    _testObject.customDescription = @"Before";
+    
+    char result[256];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(result, "Before"), 0);
+    
+    // Same address, different state. The stale description must not be returned
+    _testObject.customDescription = @"After";
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(result, "After"), 0);
+}
+
+- (void)testTruncatesToBufferSize {
+    _testObject.customDescription = @"ABCDEFGHIJ";
+    
+    char result[5];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(result, "ABCD"), 0);
+    
+    // A short read must not have truncated the cached copy
+    char full[64];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)_testObject, [TestObject class], full, sizeof(full)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(full, "ABCDEFGHIJ"), 0);
 }
 
 - (void)testMultipleObjects {
@@ -83,16 +100,33 @@
     obj1.customDescription = @"Description1";
     obj2.customDescription = @"Description2";
     
-    const char *result1 = lookup_description_for_address((__bridge void *)obj1, [TestObject class]);
-    const char *result2 = lookup_description_for_address((__bridge void *)obj2, [TestObject class]);
+    char result1[256];
+    char result2[256];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)obj1, [TestObject class], result1, sizeof(result1)), KERN_SUCCESS);
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)obj2, [TestObject class], result2, sizeof(result2)), KERN_SUCCESS);
     
-    XCTAssertNotEqual(result1, NULL);
-    XCTAssertNotEqual(result2, NULL);
-    XCTAssertNotEqual(result1, result2);
     XCTAssertEqual(strcmp(result1, "Description1"), 0);
     XCTAssertEqual(strcmp(result2, "Description2"), 0);
 }
 
+- (void)testManyObjectsStayWithinCache {
+    NSMutableArray *objects = [NSMutableArray array];
+    for (int i = 0; i < 10000; i++) {
+        TestObject *obj = [[TestObject alloc] init];
+        obj.customDescription = [NSString stringWithFormat:@"Evict%d", i];
+        [objects addObject:obj];
+        
+        char result[64];
+        XCTAssertEqual(lookup_description_for_address((__bridge void *)obj, [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+        XCTAssertEqual(strcmp(result, [obj.customDescription UTF8String]), 0);
+    }
+    
+    // Early objects have likely been evicted, but must still describe correctly
+    char result[64];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)objects[0], [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+    XCTAssertEqual(strcmp(result, "Evict0"), 0);
+}
+
 - (void)testConcurrentAccess {
     dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0);
     dispatch_group_t group = dispatch_group_create();
@@ -100,16 +134,14 @@
     TestObject *obj = [[TestObject alloc] init];
     obj.customDescription = @"ConcurrentTest";
     
-    const char *initialResult = lookup_description_for_address((__bridge void *)obj, [TestObject class]);
-    XCTAssertNotEqual(initialResult, NULL);
+    char initialResult[256];
+    XCTAssertEqual(lookup_description_for_address((__bridge void *)obj, [TestObject class], initialResult, sizeof(initialResult)), KERN_SUCCESS);
     
     for (int i = 0; i < 100; i++) {
         dispatch_group_async(group, queue, ^{
-            const char *result = lookup_description_for_address((__bridge void *)obj, [TestObject class]);
-            XCTAssertNotEqual(result, NULL);
-            if (result != NULL) {
-                XCTAssertEqual(strncmp(result, "ConcurrentTest", strlen("ConcurrentTest")), 0);
-            }
+            char result[256];
+            XCTAssertEqual(lookup_description_for_address((__bridge void *)obj, [TestObject class], result, sizeof(result)), KERN_SUCCESS);
+            XCTAssertEqual(strcmp(result, "ConcurrentTest"), 0);
         });
     }
     
@@ -122,10 +154,23 @@
     for (int i = 0; i < 100; i++) {
         TestObject *obj = [[TestObject alloc] init];
         obj.customDescription = [NSString stringWithFormat:@"IMPTest%d", i];
-        const char *result = lookup_description_for_address((__bridge void *)obj, testClass);
-        XCTAssertNotEqual(result, NULL);
+        char result[256];
+        XCTAssertEqual(lookup_description_for_address((__bridge void *)obj, testClass, result, sizeof(result)), KERN_SUCCESS);
         XCTAssertTrue(strstr(result, "IMPTest") != NULL);
     }
 }
 
+- (void)testCachedLookupPerformance {
+    _testObject.customDescription = @"PerformanceTest";
+    void *address = (__bridge void *)_testObject;
+    Class testClass = [TestObject class];
+    
+    [self measureBlock:^{
+        char result[256];
+        for (int i = 0; i < 100000; i++) {
+            lookup_description_for_address(address, testClass, result, sizeof(result));
+        }
+    }];
+}
+
 @end
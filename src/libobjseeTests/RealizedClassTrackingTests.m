@@ -157,4 +157,50 @@
     dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
 }
 
+- (void)testBulkClassRecording {
+    unsigned int classCount = 0;
+    Class *classes = objc_copyClassList(&classCount);
+    XCTAssertTrue(classes != NULL && classCount > 0);
+    
+    kern_return_t result = record_class_encounters(classes, classCount);
+    XCTAssertEqual(result, KERN_SUCCESS);
+    
+    for (unsigned int i = 0; i < classCount; i++) {
+        XCTAssertEqual(has_seen_class(classes[i]), KERN_SUCCESS);
+    }
+    
+    // Recording the same batch again must not fail
+    result = record_class_encounters(classes, classCount);
+    XCTAssertEqual(result, KERN_SUCCESS);
+    
+    free(classes);
+    
+    XCTAssertEqual(record_class_encounters(NULL, 10), KERN_FAILURE);
+}
+
+- (void)testLookupPerformanceWithManyClasses {
+    // The set is keyed by pointer value and never dereferences entries, so synthetic
+    // aligned addresses stand in for a large app's class list
+    const size_t classCount = 64 * 1024;
+    Class *fakeClasses = (Class *)malloc(classCount * sizeof(Class));
+    for (size_t i = 0; i < classCount; i++) {
+        fakeClasses[i] = (__bridge Class)(void *)(0x7000000000ULL + (i * 0x40));
+    }
+    
+    XCTAssertEqual(record_class_encounters(fakeClasses, classCount), KERN_SUCCESS);
+    
+    [self measureBlock:^{
+        for (int round = 0; round < 16; round++) {
+            for (size_t i = 0; i < classCount; i++) {
+                if (has_seen_class(fakeClasses[i]) != KERN_SUCCESS) {
+                    XCTFail(@"Recorded class was not found");
+                    return;
+                }
+            }
+        }
+    }];
+    
+    free(fakeClasses);
+}
+
 @end
@@ -0,0 +1,172 @@
+//
+//  SegmentLogTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/9/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "segment_log.h"
+
+@interface SegmentLogTests : XCTestCase {
+    char _path[SEGMENT_LOG_PATH_MAX];
+}
+@end
+
+@implementation SegmentLogTests
+
+- (void)setUp {
+    [super setUp];
+    snprintf(_path, sizeof(_path), "%s/objsee.segments.%d", NSTemporaryDirectory().fileSystemRepresentation, getpid());
+}
+
+- (void)tearDown {
+    for (uint64_t index = 1; index < 64; index++) {
+        unlink([self segmentPath:index].fileSystemRepresentation);
+    }
+    [super tearDown];
+}
+
+- (NSString *)segmentPath:(uint64_t)index {
+    char path[SEGMENT_LOG_PATH_MAX];
+    segment_log_segment_path(_path, index, path, sizeof(path));
+    return [NSString stringWithUTF8String:path];
+}
+
+- (NSData *)dataOfSegment:(uint64_t)index footer:(segment_footer_t *)footer {
+    NSData *file = [NSData dataWithContentsOfFile:[self segmentPath:index]];
+    if (file == nil) {
+        return nil;
+    }
+
+    size_t offset = 0;
+    size_t length = 0;
+    XCTAssertEqual(segment_file_data(file.bytes, file.length, &offset, &length, footer), KERN_SUCCESS);
+    return [file subdataWithRange:NSMakeRange(offset, length)];
+}
+
+- (void)testCloseWritesFooter {
+    segment_log_t *log = segment_log_open(_path, NULL);
+    XCTAssertTrue(log != NULL);
+    XCTAssertEqual(segment_log_begin_event(log), 1);
+    XCTAssertEqual(segment_log_append(log, "hello\n", 6, 0), KERN_SUCCESS);
+    XCTAssertEqual(segment_log_append(log, "world\n", 6, 1), KERN_SUCCESS);
+    segment_log_close(log);
+
+    segment_footer_t footer;
+    NSData *data = [self dataOfSegment:1 footer:&footer];
+    XCTAssertEqualObjects(data, [NSData dataWithBytes:"hello\nworld\n" length:12]);
+    XCTAssertEqual(footer.event_count, 2);
+    XCTAssertEqual(footer.dropped, 0);
+    XCTAssertTrue(footer.first_timestamp > 0 && footer.first_timestamp <= footer.last_timestamp);
+
+    // Trimmed down to what was written
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[self segmentPath:1] error:nil];
+    XCTAssertEqual(attributes.fileSize, SEGMENT_LOG_HEADER_SIZE + 12 + sizeof(segment_footer_t));
+}
+
+- (void)testRotatesWhenFullAndKeepsPrologue {
+    segment_log_options_t options = {
+        .segment_size = SEGMENT_LOG_MIN_SIZE,
+    };
+    segment_log_t *log = segment_log_open(_path, &options);
+    XCTAssertEqual(segment_log_set_prologue(log, "PRE", 3), KERN_SUCCESS);
+
+    char message[1024];
+    memset(message, 'x', sizeof(message));
+    for (int i = 0; i < 200; i++) {
+        XCTAssertEqual(segment_log_append(log, message, sizeof(message), 0), KERN_SUCCESS);
+    }
+    XCTAssertTrue(segment_log_begin_event(log) >= 3);
+    segment_log_close(log);
+
+    uint64_t events = 0;
+    segment_footer_t footer;
+    NSData *data = nil;
+    for (uint64_t index = 1; (data = [self dataOfSegment:index footer:&footer]) != nil; index++) {
+        XCTAssertEqual(memcmp(data.bytes, "PRE", 3), 0);
+        XCTAssertEqual(data.length, 3 + footer.event_count * sizeof(message));
+        events += footer.event_count;
+    }
+    XCTAssertEqual(events, 200);
+}
+
+- (void)testMaxSegmentsDeletesOldest {
+    segment_log_options_t options = {
+        .segment_size = SEGMENT_LOG_MIN_SIZE,
+        .max_segments = 2,
+    };
+    segment_log_t *log = segment_log_open(_path, &options);
+
+    char message[1024] = {0};
+    while (segment_log_begin_event(log) < 5) {
+        segment_log_append(log, message, sizeof(message), 0);
+    }
+    segment_log_close(log);
+
+    NSFileManager *manager = [NSFileManager defaultManager];
+    XCTAssertFalse([manager fileExistsAtPath:[self segmentPath:3]]);
+    XCTAssertTrue([manager fileExistsAtPath:[self segmentPath:4]]);
+    XCTAssertTrue([manager fileExistsAtPath:[self segmentPath:5]]);
+}
+
+- (void)testClosedSegmentIndexIsRejected {
+    segment_log_options_t options = {
+        .segment_size = SEGMENT_LOG_MIN_SIZE,
+    };
+    segment_log_t *log = segment_log_open(_path, &options);
+
+    char message[1024] = {0};
+    while (segment_log_begin_event(log) == 1) {
+        segment_log_append(log, message, sizeof(message), 1);
+    }
+    XCTAssertEqual(segment_log_append(log, message, sizeof(message), 1), KERN_ABORTED);
+    XCTAssertEqual(segment_log_append(log, message, SEGMENT_LOG_MIN_SIZE, 0), KERN_INVALID_ARGUMENT);
+    segment_log_close(log);
+
+    // Reported in the footer of the segment that was open when they were dropped
+    segment_footer_t footer;
+    [self dataOfSegment:2 footer:&footer];
+    XCTAssertEqual(footer.dropped, 2);
+}
+
+- (void)testSegmentsFromEarlierRunAreReplaced {
+    segment_log_options_t options = {
+        .segment_size = SEGMENT_LOG_MIN_SIZE,
+    };
+    segment_log_t *log = segment_log_open(_path, &options);
+    char message[1024] = {0};
+    while (segment_log_begin_event(log) < 3) {
+        segment_log_append(log, message, sizeof(message), 0);
+    }
+    segment_log_close(log);
+
+    log = segment_log_open(_path, &options);
+    segment_log_close(log);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[self segmentPath:1]]);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[self segmentPath:2]]);
+}
+
+- (void)testUnclosedSegment {
+    uint8_t file[SEGMENT_LOG_HEADER_SIZE + 256] = {0};
+    segment_header_t header = {
+        .version = SEGMENT_LOG_VERSION,
+        .header_length = SEGMENT_LOG_HEADER_SIZE,
+        .index = 1,
+    };
+    memcpy(header.magic, SEGMENT_LOG_MAGIC, SEGMENT_LOG_MAGIC_LENGTH);
+    memcpy(file, &header, sizeof(header));
+    memcpy(file + SEGMENT_LOG_HEADER_SIZE, "abc\n", 4);
+
+    size_t offset = 0;
+    size_t length = 0;
+    segment_footer_t footer;
+    XCTAssertEqual(segment_file_data(file, sizeof(file), &offset, &length, &footer), KERN_ABORTED);
+    XCTAssertEqual(offset, SEGMENT_LOG_HEADER_SIZE);
+    XCTAssertEqual(length, 4);
+    XCTAssertEqual(footer.event_count, 0);
+
+    XCTAssertEqual(segment_file_data((const uint8_t *)"{\"formatted_output\":1}\n", 23, &offset, &length, &footer), KERN_INVALID_ARGUMENT);
+}
+
+@end
@@ -0,0 +1,91 @@
+//
+//  ShmRingTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/7/25.
+//
+
+#import <XCTest/XCTest.h>
+#import <mach/mach.h>
+#import <sys/mman.h>
+#import "shm_ring.h"
+#import "output_buffer.h"
+
+@interface ShmRingTests : XCTestCase {
+    shm_ring_t *_ring;
+    char _name[SHM_RING_NAME_MAX];
+}
+@end
+
+@implementation ShmRingTests
+
+- (void)setUp {
+    [super setUp];
+    snprintf(_name, sizeof(_name), "/objsee.test.%d", getpid());
+    _ring = shm_ring_create(_name, vm_page_size * 4);
+    XCTAssertTrue(_ring != NULL);
+}
+
+- (void)tearDown {
+    shm_ring_close(_ring);
+    [super tearDown];
+}
+
+- (void)testRejectsUnalignedCapacity {
+    XCTAssertTrue(shm_ring_create("/objsee.test.bad", 1000) == NULL);
+}
+
+- (void)testAttachToMissingRingFails {
+    XCTAssertTrue(shm_ring_attach("/objsee.test.missing") == NULL);
+}
+
+- (void)testWriteFromAttachedRing {
+    shm_ring_t *producer = shm_ring_attach(_name);
+    XCTAssertTrue(producer != NULL);
+    XCTAssertEqual(atomic_load(&_ring->header->producers), 1);
+
+    XCTAssertTrue(shm_ring_write(producer, "hello\n", 6));
+    XCTAssertTrue(shm_ring_write(producer, "world\n", 6));
+
+    output_buffer_t out = {0};
+    XCTAssertEqual(shm_ring_read(_ring, &out), 12);
+    XCTAssertEqual(out.length, 12);
+    XCTAssertEqual(memcmp(out.data, "hello\nworld\n", 12), 0);
+
+    // Nothing is read twice
+    XCTAssertEqual(shm_ring_read(_ring, &out), 0);
+
+    output_buffer_free(&out);
+    shm_ring_close(producer);
+}
+
+- (void)testWriteFailsWhenFull {
+    char message[256];
+    memset(message, 'x', sizeof(message));
+
+    size_t written = 0;
+    while (shm_ring_write(_ring, message, sizeof(message))) {
+        written++;
+    }
+    XCTAssertTrue(written > 0);
+
+    // Reading makes room again, including for records that run off the end
+    output_buffer_t out = {0};
+    XCTAssertEqual(shm_ring_read(_ring, &out), written * sizeof(message));
+    for (size_t i = 0; i < written; i++) {
+        XCTAssertTrue(shm_ring_write(_ring, message, sizeof(message)));
+    }
+    output_buffer_reset(&out);
+    XCTAssertEqual(shm_ring_read(_ring, &out), written * sizeof(message));
+    output_buffer_free(&out);
+}
+
+- (void)testCloseRemovesObject {
+    shm_ring_close(_ring);
+    _ring = NULL;
+
+    XCTAssertTrue(shm_ring_attach(_name) == NULL);
+    XCTAssertEqual(shm_open(_name, O_RDWR, 0), -1);
+}
+
+@end
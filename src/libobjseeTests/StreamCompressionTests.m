@@ -0,0 +1,148 @@
+//
+//  StreamCompressionTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/8/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "stream_compression.h"
+
+@interface StreamCompressionTests : XCTestCase {
+    stream_compressor_t *_compressor;
+}
+@end
+
+@implementation StreamCompressionTests
+
+- (void)setUp {
+    [super setUp];
+    _compressor = stream_compressor_create();
+    XCTAssertTrue(_compressor != NULL);
+}
+
+- (void)tearDown {
+    stream_compressor_free(_compressor);
+    [super tearDown];
+}
+
+- (void)appendLines:(NSUInteger)count toBuffer:(output_buffer_t *)buffer {
+    for (NSUInteger i = 0; i < count; i++) {
+        char line[128];
+        int length = snprintf(line, sizeof(line), "{\"formatted_output\":\"  -[UIView layoutSubviews]\",\"thread_id\":%lu}\n", (unsigned long)(i % 8));
+        output_buffer_append(buffer, line, length);
+    }
+}
+
+- (void)testRoundTrip {
+    output_buffer_t input = {0};
+    [self appendLines:2000 toBuffer:&input];
+
+    output_buffer_t wire = {0};
+    append_compressed_stream_preamble(&wire);
+    struct iovec spans[2] = {
+        { input.data, input.length / 2 },
+        { input.data + input.length / 2, input.length - input.length / 2 },
+    };
+    XCTAssertEqual(append_compressed_frame(_compressor, spans, 2, &wire), KERN_SUCCESS);
+    XCTAssertEqual(append_compressed_frame(_compressor, spans, 1, &wire), KERN_SUCCESS);
+    XCTAssertTrue(wire.length * 10 < input.length);
+
+    stream_decompressor_t decompressor = {0};
+    output_buffer_t output = {0};
+    size_t consumed = 0;
+    XCTAssertEqual(stream_decompress(&decompressor, (const uint8_t *)wire.data, wire.length, &consumed, &output), KERN_SUCCESS);
+    XCTAssertEqual(consumed, wire.length);
+    XCTAssertEqual(output.length, input.length + spans[0].iov_len);
+    XCTAssertEqual(memcmp(output.data, input.data, input.length), 0);
+    XCTAssertEqual(memcmp(output.data + input.length, input.data, spans[0].iov_len), 0);
+
+    output_buffer_free(&input);
+    output_buffer_free(&wire);
+    output_buffer_free(&output);
+}
+
+- (void)testSmallBatchUsesDictionary {
+    const char *line = "{\"formatted_output\":\"-[NSObject description]\",\"thread_id\":1}\n";
+    struct iovec span = { (void *)line, strlen(line) };
+
+    output_buffer_t frame = {0};
+    XCTAssertEqual(append_compressed_frame(_compressor, &span, 1, &frame), KERN_SUCCESS);
+    XCTAssertEqual(frame.data[0], COMPRESSED_FRAME_LZ);
+    XCTAssertTrue(frame.length < strlen(line) / 2);
+    output_buffer_free(&frame);
+}
+
+- (void)testIncompressibleFrameIsStored {
+    uint8_t noise[4096];
+    uint32_t state = 2463534242;
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        noise[i] = (uint8_t)state;
+    }
+
+    struct iovec span = { noise, sizeof(noise) };
+    output_buffer_t wire = {0};
+    append_compressed_stream_preamble(&wire);
+    XCTAssertEqual(append_compressed_frame(_compressor, &span, 1, &wire), KERN_SUCCESS);
+    XCTAssertEqual(wire.data[COMPRESSED_STREAM_PREAMBLE_LENGTH], COMPRESSED_FRAME_STORED);
+
+    stream_decompressor_t decompressor = {0};
+    output_buffer_t output = {0};
+    size_t consumed = 0;
+    XCTAssertEqual(stream_decompress(&decompressor, (const uint8_t *)wire.data, wire.length, &consumed, &output), KERN_SUCCESS);
+    XCTAssertEqual(output.length, sizeof(noise));
+    XCTAssertEqual(memcmp(output.data, noise, sizeof(noise)), 0);
+
+    output_buffer_free(&wire);
+    output_buffer_free(&output);
+}
+
+- (void)testPartialFrameIsLeftForLater {
+    output_buffer_t input = {0};
+    [self appendLines:100 toBuffer:&input];
+    struct iovec span = { input.data, input.length };
+
+    output_buffer_t wire = {0};
+    append_compressed_stream_preamble(&wire);
+    append_compressed_frame(_compressor, &span, 1, &wire);
+
+    stream_decompressor_t decompressor = {0};
+    output_buffer_t output = {0};
+    size_t consumed = 0;
+    XCTAssertEqual(stream_decompress(&decompressor, (const uint8_t *)wire.data, wire.length - 1, &consumed, &output), KERN_SUCCESS);
+    XCTAssertEqual(consumed, COMPRESSED_STREAM_PREAMBLE_LENGTH);
+    XCTAssertEqual(output.length, 0);
+
+    size_t rest = 0;
+    XCTAssertEqual(stream_decompress(&decompressor, (const uint8_t *)wire.data + consumed, wire.length - consumed, &rest, &output), KERN_SUCCESS);
+    XCTAssertEqual(consumed + rest, wire.length);
+    XCTAssertEqual(output.length, input.length);
+
+    output_buffer_free(&input);
+    output_buffer_free(&wire);
+    output_buffer_free(&output);
+}
+
+- (void)testRejectsBadPreamble {
+    stream_decompressor_t decompressor = {0};
+    output_buffer_t output = {0};
+    size_t consumed = 0;
+    const uint8_t binary[] = "\0OBJSEE\1";
+    XCTAssertEqual(stream_decompress(&decompressor, binary, 8, &consumed, &output), KERN_INVALID_ARGUMENT);
+}
+
+- (void)testRejectsCorruptBlock {
+    uint8_t decoded[64];
+    // A match reaching further back than anything written or in the dictionary
+    const uint8_t block[] = { 0x10, 'a', 0x00, 0x10 };
+    XCTAssertEqual(lz_decompress_block(block, sizeof(block), NULL, 0, decoded, 5), KERN_FAILURE);
+    // Decompresses to fewer bytes than promised
+    const uint8_t literals[] = { 0x30, 'a', 'b', 'c' };
+    XCTAssertEqual(lz_decompress_block(literals, sizeof(literals), NULL, 0, decoded, 4), KERN_FAILURE);
+    XCTAssertEqual(lz_decompress_block(literals, sizeof(literals), NULL, 0, decoded, 3), KERN_SUCCESS);
+}
+
+@end
@@ -58,6 +58,16 @@
     XCTAssertEqualObjects(@"struct { long long, long long, double, long long, long long, long long, long long, long long, id, CGSize { double, double}, long long, long long, long long}", [NSString stringWithUTF8String:get_struct_description_from_type_encoding("{?=qqdqqqqq@{CGSize=dd}qqq}")]);
 }
 
+- (void)testUnionsAndArrays {
+    XCTAssertEqualObjects(@"union { int, double}", [NSString stringWithUTF8String:get_struct_description_from_type_encoding("(?=id)")]);
+    XCTAssertEqualObjects(@"Storage { int[4], char}", [NSString stringWithUTF8String:get_struct_description_from_type_encoding("{Storage=[4i]c}")]);
+}
+
+- (void)testNamedFields {
+    XCTAssertEqualObjects(@"CGPoint { double, double}", [NSString stringWithUTF8String:get_struct_description_from_type_encoding("{CGPoint=\"x\"d\"y\"d}")]);
+    XCTAssertEqualObjects(@"Holder { int *, id}", [NSString stringWithUTF8String:get_struct_description_from_type_encoding("{Holder=^i@}")]);
+}
+
 - (void)testEdgeCases {
     XCTAssertEqualObjects(@"invalid_encoding", [NSString stringWithUTF8String:get_struct_description_from_type_encoding("")]);
     XCTAssertEqualObjects(@"invalid_encoding", [NSString stringWithUTF8String:get_struct_description_from_type_encoding(NULL)]);
@@ -0,0 +1,54 @@
+//
+//  SwiftDemangleTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/2/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "swift_demangle.h"
+
+@interface SwiftDemangleTests : XCTestCase
+@end
+
+@implementation SwiftDemangleTests
+
+- (void)testObjcNamesPassThrough {
+    const char *class_name = "NSObject";
+    XCTAssertEqual(get_demangled_class_name(class_name), class_name);
+    XCTAssertEqual(get_demangled_class_name(NULL), NULL);
+}
+
+- (void)testSwiftNameIsDemangledAndCached {
+    const char *mangled = "_TtC7Example14ViewController";
+    const char *demangled = get_demangled_class_name(mangled);
+    XCTAssertTrue(demangled != NULL);
+    
+    // The same interned string is returned on every lookup
+    XCTAssertEqual(get_demangled_class_name(mangled), demangled);
+    
+    // swift_demangle is only present if the Swift runtime is loaded
+    if (demangled != mangled) {
+        XCTAssertEqualObjects(@(demangled), @"Example.ViewController");
+    }
+}
+
+- (void)testConcurrentLookups {
+    const char *mangled = "_TtC7Example16ConcurrentThing";
+    const char *expected = get_demangled_class_name(mangled);
+    
+    dispatch_apply(1000, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t iteration) {
+        XCTAssertEqual(get_demangled_class_name(mangled), expected);
+    });
+}
+
+- (void)testCachedLookupPerformance {
+    const char *mangled = "_TtC7Example15PerformanceTest";
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            get_demangled_class_name(mangled);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,146 @@
+//
+//  TraceColumnsTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "column_scan.h"
+#import "trace_columns.h"
+#import "TraceFixtures.h"
+
+@interface TraceColumnsTests : TraceFileTestCase
+@end
+
+@implementation TraceColumnsTests
+
+- (void)testRoundTripAcrossBlocks {
+    int count = COLUMNS_BLOCK_EVENTS * 2 + 100;
+    trace_column_writer_t *writer = trace_column_writer_create(_path);
+    XCTAssertTrue(writer != NULL);
+    for (int i = 0; i < count; i++) {
+        tracer_event_t event = trace_fixture_event(i / 10, i, (uint16_t)(i / 1000), i % 3, 1000 + (uint64_t)i * 10);
+        XCTAssertEqual(trace_column_writer_add_event(writer, &event), KERN_SUCCESS);
+    }
+    XCTAssertEqual(trace_column_writer_close(writer), KERN_SUCCESS);
+
+    trace_columns_t *columns = trace_columns_open(_path);
+    XCTAssertTrue(columns != NULL);
+    XCTAssertEqual(columns->block_count, 3);
+    XCTAssertEqual(columns->event_count, count);
+    XCTAssertEqual(columns->class_count, 4);
+    XCTAssertEqual(columns->selector_count, 4);
+
+    uint32_t *values = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint32_t));
+    uint64_t *timestamps = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint64_t));
+    int row = 0;
+    for (size_t b = 0; b < columns->block_count; b++) {
+        const column_block_header_t *block = columns->blocks[b];
+        XCTAssertEqual(trace_columns_decode_u32(block, TRACE_COLUMN_CLASS, values), KERN_SUCCESS);
+        XCTAssertEqual(strcmp(columns->class_names[values[0]], trace_fixture_class_names[(row / 10) % TRACE_FIXTURE_NAME_COUNT]), 0);
+        XCTAssertEqual(trace_columns_decode_u32(block, TRACE_COLUMN_SELECTOR, values), KERN_SUCCESS);
+        XCTAssertEqual(strcmp(columns->selectors[values[block->event_count - 1]], trace_fixture_selectors[(row + block->event_count - 1) % TRACE_FIXTURE_NAME_COUNT]), 0);
+        XCTAssertEqual(trace_columns_decode_u32(block, TRACE_COLUMN_THREAD, values), KERN_SUCCESS);
+        XCTAssertEqual(values[block->event_count - 1], (row + block->event_count - 1) / 1000);
+        XCTAssertEqual(trace_columns_decode_u32(block, TRACE_COLUMN_DEPTH, values), KERN_SUCCESS);
+        XCTAssertEqual(values[5], (row + 5) % 3);
+        XCTAssertEqual(trace_columns_decode_u64(block, TRACE_COLUMN_TIMESTAMP, timestamps), KERN_SUCCESS);
+        XCTAssertEqual(timestamps[7], 1000 + (uint64_t)(row + 7) * 10);
+        XCTAssertEqual(block->first_timestamp, timestamps[0]);
+        XCTAssertEqual(trace_columns_decode_u64(block, TRACE_COLUMN_THREAD, timestamps), KERN_INVALID_ARGUMENT);
+        row += block->event_count;
+    }
+    XCTAssertEqual(row, count);
+
+    free(values);
+    free(timestamps);
+    trace_columns_close(columns);
+}
+
+- (void)testDurationsRunToTheNextShallowerCall {
+    uint32_t depths[] = {0, 1, 2, 1, 0};
+    trace_column_writer_t *writer = trace_column_writer_create(_path);
+    for (int i = 0; i < 5; i++) {
+        tracer_event_t event = trace_fixture_event(0, i, 1, depths[i], (uint64_t)i * 10);
+        trace_column_writer_add_event(writer, &event);
+    }
+    // Another thread's calls don't end these
+    tracer_event_t other = trace_fixture_event(1, 0, 2, 0, 45);
+    trace_column_writer_add_event(writer, &other);
+    XCTAssertEqual(trace_column_writer_close(writer), KERN_SUCCESS);
+
+    trace_columns_t *columns = trace_columns_open(_path);
+    uint64_t durations[6];
+    XCTAssertEqual(trace_columns_decode_u64(columns->blocks[0], TRACE_COLUMN_DURATION, durations), KERN_SUCCESS);
+    XCTAssertEqual(durations[0], 40);
+    XCTAssertEqual(durations[1], 20);
+    XCTAssertEqual(durations[2], 10);
+    XCTAssertEqual(durations[3], 10);
+    // Still running when the trace ended
+    XCTAssertEqual(durations[4], 0);
+    XCTAssertEqual(durations[5], 0);
+    trace_columns_close(columns);
+}
+
+- (void)testUnclosedTraceReadsCompleteBlocks {
+    trace_column_writer_t *writer = trace_column_writer_create(_path);
+    for (int i = 0; i < COLUMNS_BLOCK_EVENTS + 10; i++) {
+        tracer_event_t event = trace_fixture_event(0, 0, 0, 0, (uint64_t)i);
+        trace_column_writer_add_event(writer, &event);
+    }
+    XCTAssertEqual(trace_column_writer_close(writer), KERN_SUCCESS);
+
+    trace_columns_t *columns = trace_columns_open(_path);
+    off_t length = (off_t)((const uint8_t *)columns->blocks[1] - columns->base) + 32;
+    trace_columns_close(columns);
+    XCTAssertEqual(truncate(_path, length), 0);
+
+    columns = trace_columns_open(_path);
+    XCTAssertEqual(columns->block_count, 1);
+    XCTAssertEqual(columns->event_count, COLUMNS_BLOCK_EVENTS);
+    trace_columns_close(columns);
+}
+
+- (void)testFiltersMatchScalarEvaluation {
+    uint32_t values[1000];
+    uint64_t wide_values[1000];
+    srand(7);
+    for (int i = 0; i < 1000; i++) {
+        values[i] = (uint32_t)(rand() % 50);
+        wide_values[i] = (uint64_t)(rand() % 50) << 40;
+    }
+
+    uint8_t members[50] = {0};
+    members[3] = members[17] = members[42] = 1;
+    for (size_t count = 1; count <= 1000; count += 37) {
+        uint64_t selection[COLUMN_SELECTION_WORDS(1000)];
+        column_selection_fill(selection, count);
+        column_filter_u32_range(values, count, 10, 45, selection);
+        column_filter_u64_range(wide_values, count, 5ULL << 40, 40ULL << 40, selection);
+
+        size_t expected = 0;
+        for (size_t i = 0; i < count; i++) {
+            expected += values[i] >= 10 && values[i] <= 45 && wide_values[i] >= (5ULL << 40) && wide_values[i] <= (40ULL << 40);
+        }
+        XCTAssertEqual(column_selection_count(selection, count), expected);
+
+        uint64_t counts[50] = {0};
+        column_count_values(values, count, selection, counts, 50);
+        uint64_t counted = 0;
+        for (int i = 0; i < 50; i++) {
+            counted += counts[i];
+        }
+        XCTAssertEqual(counted, expected);
+
+        column_selection_fill(selection, count);
+        column_filter_u32_member(values, count, members, 50, selection);
+        expected = 0;
+        for (size_t i = 0; i < count; i++) {
+            expected += values[i] == 3 || values[i] == 17 || values[i] == 42;
+        }
+        XCTAssertEqual(column_selection_count(selection, count), expected);
+    }
+}
+
+@end
@@ -0,0 +1,141 @@
+//
+//  TraceExportTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "trace_export.h"
+#import "TraceFixtures.h"
+
+@interface TraceExportTests : TraceFileTestCase
+@end
+
+static uint64_t read_varint(const uint8_t **cursor) {
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *(*cursor)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+// The value of a varint field in a message, or UINT64_MAX if it isn't there
+static uint64_t varint_field(const uint8_t *message, size_t length, uint32_t field, const uint8_t **nested, size_t *nested_length) {
+    const uint8_t *cursor = message;
+    while (cursor < message + length) {
+        uint64_t key = read_varint(&cursor);
+        uint64_t value = read_varint(&cursor);
+        if ((key & 7) == 2) {
+            if ((key >> 3) == field && nested) {
+                *nested = cursor;
+                *nested_length = (size_t)value;
+                return 0;
+            }
+            cursor += value;
+        }
+        else if ((key >> 3) == field) {
+            return value;
+        }
+    }
+    return UINT64_MAX;
+}
+
+@implementation TraceExportTests
+
+- (void)exportEvents:(trace_export_format_t)format {
+    // Thread 1 goes 0 -> 1 -> 2, back to 1, then 0. Thread 2 makes one call and never returns
+    uint32_t depths[] = {0, 1, 2, 1, 0};
+    trace_exporter_t *exporter = trace_exporter_create(_path, format);
+    XCTAssertTrue(exporter != NULL);
+    for (int i = 0; i < 5; i++) {
+        tracer_event_t event = trace_fixture_event(i % 3, i % 3, 1, depths[i], 1000 + (uint64_t)i * 1000);
+        XCTAssertEqual(trace_exporter_add_event(exporter, &event), KERN_SUCCESS);
+    }
+    tracer_event_t other = trace_fixture_event(0, 0, 2, 0, 2500);
+    XCTAssertEqual(trace_exporter_add_event(exporter, &other), KERN_SUCCESS);
+
+    tracer_event_t unnamed = { .class_name = trace_fixture_class_names[0] };
+    XCTAssertEqual(trace_exporter_add_event(exporter, &unnamed), KERN_INVALID_ARGUMENT);
+    XCTAssertEqual(trace_exporter_close(exporter), KERN_SUCCESS);
+}
+
+- (void)testChromeSlicesNestByDepth {
+    [self exportEvents:TRACE_EXPORT_CHROME_JSON];
+    NSData *data = [NSData dataWithContentsOfFile:@(_path)];
+    NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+    NSArray *events = trace[@"traceEvents"];
+    XCTAssertTrue(events != nil);
+
+    NSMutableArray *phases = [NSMutableArray array];
+    NSMutableArray *ends = [NSMutableArray array];
+    for (NSDictionary *event in events) {
+        if ([event[@"tid"] intValue] == 1 && ![event[@"ph"] isEqualToString:@"M"]) {
+            [phases addObject:event[@"ph"]];
+            if ([event[@"ph"] isEqualToString:@"E"]) {
+                [ends addObject:event[@"ts"]];
+            }
+        }
+    }
+
+    NSArray *expected = @[@"B", @"B", @"B", @"E", @"E", @"B", @"E", @"E", @"B", @"E"];
+    XCTAssertEqualObjects(phases, expected);
+    // Microseconds. The depth 2 call and its caller end together, when the next depth 1 call starts
+    XCTAssertEqualWithAccuracy([ends[0] doubleValue], 4.0, 0.0001);
+    XCTAssertEqualWithAccuracy([ends[1] doubleValue], 4.0, 0.0001);
+    // The last call is still open at the end, so it runs to the last timestamp
+    XCTAssertEqualWithAccuracy([ends.lastObject doubleValue], 5.0, 0.0001);
+    XCTAssertEqualObjects(events[1][@"name"], @"-[UIView init]");
+}
+
+- (void)testPerfettoPacketsNameEachMethodOnce {
+    [self exportEvents:TRACE_EXPORT_PERFETTO];
+    NSData *data = [NSData dataWithContentsOfFile:@(_path)];
+    const uint8_t *cursor = data.bytes;
+    const uint8_t *end = cursor + data.length;
+
+    int begins = 0;
+    int ends = 0;
+    int names = 0;
+    int tracks = 0;
+    while (cursor < end) {
+        // Every top-level field is a TracePacket
+        XCTAssertEqual(read_varint(&cursor), (uint64_t)(1 << 3 | 2));
+        size_t length = (size_t)read_varint(&cursor);
+        const uint8_t *packet = cursor;
+        cursor += length;
+
+        XCTAssertEqual(varint_field(packet, length, 10, NULL, NULL), 1);
+        const uint8_t *nested = NULL;
+        size_t nested_length = 0;
+        if (varint_field(packet, length, 60, &nested, &nested_length) == 0) {
+            tracks++;
+        }
+        if (varint_field(packet, length, 12, &nested, &nested_length) == 0) {
+            names++;
+        }
+        if (varint_field(packet, length, 11, &nested, &nested_length) == 0) {
+            uint64_t type = varint_field(nested, nested_length, 9, NULL, NULL);
+            begins += type == 1;
+            ends += type == 2;
+        }
+    }
+
+    XCTAssertEqual(cursor, end);
+    // The process and both threads
+    XCTAssertEqual(tracks, 3);
+    XCTAssertEqual(begins, 6);
+    XCTAssertEqual(ends, 6);
+    XCTAssertEqual(names, 3);
+}
+
+- (void)testFormatFollowsExtension {
+    XCTAssertEqual(trace_export_format_for_path("trace.json"), TRACE_EXPORT_CHROME_JSON);
+    XCTAssertEqual(trace_export_format_for_path("trace.perfetto-trace"), TRACE_EXPORT_PERFETTO);
+    XCTAssertEqual(trace_export_format_for_path("json"), TRACE_EXPORT_PERFETTO);
+}
+
+@end
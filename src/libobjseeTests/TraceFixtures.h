@@ -0,0 +1,30 @@
+//
+//  TraceFixtures.h
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "tracer_types.h"
+
+#define TRACE_FIXTURE_NAME_COUNT 4
+
+// The names fixture events are made from. Indices passed to trace_fixture_event wrap around
+extern const char *trace_fixture_class_names[TRACE_FIXTURE_NAME_COUNT];
+extern const char *trace_fixture_selectors[TRACE_FIXTURE_NAME_COUNT];
+
+/**
+ * @brief A synthetic event on thread_id, which is also used as its stream
+ */
+tracer_event_t trace_fixture_event(uint32_t class_index, uint32_t selector_index, uint16_t thread_id, uint32_t depth, uint64_t timestamp);
+
+/**
+ * @brief Base for tests that write a trace file
+ *
+ * _path is a scratch file in the temporary directory, named after the test class and removed after each test
+ */
+@interface TraceFileTestCase : XCTestCase {
+    char _path[1024];
+}
+@end
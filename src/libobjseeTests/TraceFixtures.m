@@ -0,0 +1,36 @@
+//
+//  TraceFixtures.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#import "TraceFixtures.h"
+
+const char *trace_fixture_class_names[TRACE_FIXTURE_NAME_COUNT] = {"UIView", "UILabel", "NSString", "NSArray"};
+const char *trace_fixture_selectors[TRACE_FIXTURE_NAME_COUNT] = {"init", "layoutSubviews", "length", "count"};
+
+tracer_event_t trace_fixture_event(uint32_t class_index, uint32_t selector_index, uint16_t thread_id, uint32_t depth, uint64_t timestamp) {
+    return (tracer_event_t){
+        .class_name = trace_fixture_class_names[class_index % TRACE_FIXTURE_NAME_COUNT],
+        .method_name = trace_fixture_selectors[selector_index % TRACE_FIXTURE_NAME_COUNT],
+        .thread_id = thread_id,
+        .stream_id = thread_id,
+        .trace_depth = depth,
+        .timestamp = timestamp,
+    };
+}
+
+@implementation TraceFileTestCase
+
+- (void)setUp {
+    [super setUp];
+    snprintf(_path, sizeof(_path), "%s/objsee.%s.%d", NSTemporaryDirectory().fileSystemRepresentation, NSStringFromClass([self class]).UTF8String, getpid());
+}
+
+- (void)tearDown {
+    unlink(_path);
+    [super tearDown];
+}
+
+@end
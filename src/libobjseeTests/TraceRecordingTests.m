@@ -0,0 +1,149 @@
+//
+//  TraceRecordingTests.m
+//  libobjseeTests
+//
+//  Created by Ethan Arbuckle on 3/10/25.
+//
+
+#import <XCTest/XCTest.h>
+#import "trace_recording.h"
+#import "TraceFixtures.h"
+
+@interface TraceRecordingTests : TraceFileTestCase
+@end
+
+typedef struct {
+    uint64_t events;
+    uint64_t dropped;
+    uint64_t last_timestamp;
+    bool in_order;
+} recording_counts_t;
+
+static void count_event(const tracer_event_t *event, void *context) {
+    recording_counts_t *counts = (recording_counts_t *)context;
+    counts->in_order &= event->timestamp > counts->last_timestamp;
+    counts->last_timestamp = event->timestamp;
+    counts->events++;
+}
+
+static void count_dropped(uint64_t count, void *context) {
+    ((recording_counts_t *)context)->dropped += count;
+}
+
+@implementation TraceRecordingTests
+
+- (void)recordEvents:(int)count chunkSize:(size_t)chunkSize {
+    trace_recorder_t *recorder = trace_recorder_create(_path, chunkSize);
+    XCTAssertTrue(recorder != NULL);
+    for (int i = 0; i < count; i++) {
+        tracer_event_t event = trace_fixture_event(i / 1000, i, (uint16_t)(i / 2500), i % 8, 1000 + i);
+        XCTAssertEqual(trace_recorder_add_event(recorder, &event), KERN_SUCCESS);
+    }
+    XCTAssertEqual(trace_recorder_add_dropped(recorder, 3), KERN_SUCCESS);
+    XCTAssertEqual(trace_recorder_close(recorder), KERN_SUCCESS);
+}
+
+- (void)testRoundTripAcrossChunks {
+    [self recordEvents:10000 chunkSize:4096];
+
+    trace_recording_t *recording = trace_recording_open(_path);
+    XCTAssertTrue(recording != NULL);
+    XCTAssertTrue(recording->complete);
+    XCTAssertTrue(recording->chunk_count > 1);
+
+    recording_counts_t counts = { .in_order = true };
+    uint64_t indexed_events = 0;
+    for (size_t i = 0; i < recording->chunk_count; i++) {
+        const recording_chunk_header_t *chunk = trace_recording_chunk(recording, i);
+        XCTAssertEqual(trace_recording_decode_chunk(chunk, count_event, count_dropped, &counts), KERN_SUCCESS);
+        XCTAssertTrue(chunk->first_timestamp <= chunk->last_timestamp);
+        indexed_events += chunk->event_count;
+    }
+    XCTAssertEqual(counts.events, 10000);
+    XCTAssertEqual(indexed_events, 10000);
+    XCTAssertEqual(counts.dropped, 3);
+    XCTAssertTrue(counts.in_order);
+    trace_recording_close(recording);
+}
+
+- (void)testChunkIndex {
+    [self recordEvents:2000 chunkSize:1024 * 1024];
+
+    trace_recording_t *recording = trace_recording_open(_path);
+    XCTAssertEqual(recording->chunk_count, 1);
+
+    const recording_chunk_header_t *chunk = trace_recording_chunk(recording, 0);
+    XCTAssertEqual(chunk->first_timestamp, 1000);
+    XCTAssertEqual(chunk->last_timestamp, 2999);
+    XCTAssertEqual(chunk->min_depth, 0);
+    XCTAssertEqual(chunk->max_depth, 7);
+    XCTAssertEqual(chunk->dropped, 3);
+    XCTAssertTrue(recording_chunk_may_have_thread(chunk, 0));
+    XCTAssertFalse(recording_chunk_may_have_thread(chunk, 1));
+
+    // Only the classes and selectors that were seen, each once
+    XCTAssertEqual(chunk->class_count, 2);
+    XCTAssertEqual(chunk->selector_count, 4);
+    const char *name = recording_chunk_names(chunk);
+    XCTAssertEqual(strcmp(name, "UIView"), 0);
+    name += strlen(name) + 1;
+    XCTAssertEqual(strcmp(name, "UILabel"), 0);
+    name += strlen(name) + 1;
+    XCTAssertEqual(strcmp(name, "init"), 0);
+    trace_recording_close(recording);
+}
+
+- (void)testUnclosedRecordingIsWalked {
+    [self recordEvents:10000 chunkSize:4096];
+
+    trace_recording_t *recording = trace_recording_open(_path);
+    size_t chunk_count = recording->chunk_count;
+    // Cut the last chunk short, which also loses the offsets written after it
+    off_t length = (off_t)recording->chunk_offsets[chunk_count - 1] + 100;
+    trace_recording_close(recording);
+    XCTAssertEqual(truncate(_path, length), 0);
+
+    recording = trace_recording_open(_path);
+    XCTAssertTrue(recording != NULL);
+    XCTAssertFalse(recording->complete);
+    XCTAssertEqual(recording->chunk_count, chunk_count - 1);
+
+    recording_counts_t counts = { .in_order = true };
+    for (size_t i = 0; i < recording->chunk_count; i++) {
+        XCTAssertEqual(trace_recording_decode_chunk(trace_recording_chunk(recording, i), count_event, NULL, &counts), KERN_SUCCESS);
+    }
+    XCTAssertTrue(counts.events > 0 && counts.events < 10000);
+    trace_recording_close(recording);
+}
+
+- (void)testMainThreadIsKeptInTheHeader {
+    [self recordEvents:100 chunkSize:4096];
+    trace_recording_t *recording = trace_recording_open(_path);
+    XCTAssertFalse(recording->has_main_thread);
+    trace_recording_close(recording);
+
+    // Set partway through, and never closed
+    trace_recorder_t *recorder = trace_recorder_create(_path, 4096);
+    tracer_event_t event = { .class_name = "UIView", .method_name = "init", .thread_id = 7, .stream_id = 1, .timestamp = 1000 };
+    XCTAssertEqual(trace_recorder_add_event(recorder, &event), KERN_SUCCESS);
+    XCTAssertEqual(trace_recorder_set_main_thread(recorder, 0x1a2b), KERN_SUCCESS);
+    XCTAssertEqual(trace_recorder_add_event(recorder, &event), KERN_SUCCESS);
+
+    recording = trace_recording_open(_path);
+    XCTAssertTrue(recording != NULL);
+    XCTAssertTrue(recording->has_main_thread);
+    XCTAssertEqual(recording->main_thread_id, 0x1a2b);
+    trace_recording_close(recording);
+    XCTAssertEqual(trace_recorder_close(recorder), KERN_SUCCESS);
+}
+
+- (void)testRejectsOtherFiles {
+    FILE *file = fopen(_path, "w");
+    fputs("{\"formatted_output\":\"-[UIView init]\"}\n", file);
+    fclose(file);
+
+    XCTAssertTrue(trace_recording_open(_path) == NULL);
+    XCTAssertFalse(trace_recording_matches((const uint8_t *)"\0OBJSEE\1", 8));
+}
+
+@end
@@ -8,6 +8,7 @@
 #import <XCTest/XCTest.h>
 #import <objc/runtime.h>
 #import "encoding_size.h"
+#import "type_descriptor.h"
 
 @interface TypeEncodingTests : XCTestCase
 @end
@@ -166,4 +167,77 @@
     XCTAssertEqual(get_size_of_type_from_type_encoding("{AS2=cq}"), sizeof(AlignedStruct2));
 }
 
+- (void)testUnionAndArraySizes {
+    typedef union { int a; double b; char c[3]; } TestUnion;
+    XCTAssertEqual(get_size_of_type_from_type_encoding("(TestUnion=id[3c])"), sizeof(TestUnion));
+    XCTAssertEqual(get_size_of_type_from_type_encoding("[4i]"), sizeof(int[4]));
+    
+    typedef struct { char a; char b; char c; } ThreeChars;
+    typedef struct { ThreeChars chars; int value; } Nested;
+    XCTAssertEqual(get_size_of_type_from_type_encoding("{Nested={ThreeChars=ccc}i}"), sizeof(Nested));
+}
+
+- (void)testDescriptorsAreInterned {
+    const type_descriptor_t *point = get_type_descriptor("{CGPoint=dd}");
+    XCTAssertTrue(point != NULL);
+    XCTAssertEqual(point, get_type_descriptor("{CGPoint=dd}"));
+    
+    // Trailing frame offsets don't produce a distinct descriptor
+    XCTAssertEqual(point, get_type_descriptor("{CGPoint=dd}16"));
+    
+    // Nested types share the descriptor of the standalone type
+    const type_descriptor_t *rect = get_type_descriptor("{CGRect={CGPoint=dd}{CGSize=dd}}");
+    XCTAssertEqual(rect->field_count, 2);
+    XCTAssertEqual(rect->fields[0], point);
+}
+
+- (void)testDepthLimitDoesNotLeakIntoShallowerLookups {
+    char deep[64];
+    memset(deep, '^', 40);
+    strcpy(deep + 40, "q");
+    const type_descriptor_t *descriptor = get_type_descriptor(deep);
+    XCTAssertTrue(strstr(descriptor->description, "unknown_type") != NULL);
+    
+    // The tail of the deep encoding was cut off above, but on its own it's well within the limit
+    XCTAssertEqualObjects(@(get_type_descriptor("^^^^^^^^^q")->description), @"long long * * * * * * * * *");
+}
+
+- (void)testDescriptorLayout {
+    typedef struct { char a; double b; int c; } Layout;
+    const type_descriptor_t *descriptor = get_type_descriptor("{Layout=cdi}");
+    XCTAssertEqual(descriptor->kind, TYPE_DESCRIPTOR_KIND_STRUCT);
+    XCTAssertEqual(descriptor->size, sizeof(Layout));
+    XCTAssertEqual(descriptor->alignment, _Alignof(Layout));
+    XCTAssertEqual(descriptor->field_count, 3);
+    XCTAssertEqual(descriptor->field_offsets[0], offsetof(Layout, a));
+    XCTAssertEqual(descriptor->field_offsets[1], offsetof(Layout, b));
+    XCTAssertEqual(descriptor->field_offsets[2], offsetof(Layout, c));
+}
+
+- (void)testSignatureWalk {
+    const char *cursor = "v24@?0@\"NSString\"8^^c16";
+    const type_descriptor_t *types[4] = {NULL};
+    for (int i = 0; i < 4; i++) {
+        types[i] = get_type_descriptor_and_advance(&cursor);
+        while (isdigit(*cursor)) {
+            cursor++;
+        }
+    }
+    XCTAssertEqual(*cursor, '\0');
+    XCTAssertEqual(types[0]->kind, TYPE_DESCRIPTOR_KIND_VOID);
+    XCTAssertEqual(types[1]->kind, TYPE_DESCRIPTOR_KIND_BLOCK);
+    XCTAssertEqual(types[2]->kind, TYPE_DESCRIPTOR_KIND_OBJECT);
+    XCTAssertEqualObjects(@(types[2]->name), @"NSString");
+    XCTAssertEqual(types[3]->kind, TYPE_DESCRIPTOR_KIND_POINTER);
+    XCTAssertEqual(types[3]->element->element->code, 'c');
+}
+
+- (void)testCachedSizeLookupPerformance {
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            get_size_of_type_from_type_encoding("{?=qqdqqqqq@{CGSize=dd}qqq}");
+        }
+    }];
+}
+
 @end
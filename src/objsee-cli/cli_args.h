@@ -10,16 +10,42 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 #include "tracer_types.h"
+#include "trace_query.h"
 
 typedef struct {
     const char *bundle_id;
     const char *file_path;
+    // A recorded trace to print instead of tracing a process
+    const char *read_path;
+    // `objsee replay <file>`: stream a trace file back as if it were live
+    const char *replay_path;
+    // Multiple of real time to replay at. 0 is as fast as possible
+    double replay_speed;
+    // Also save the trace here as an indexed recording
+    const char *record_path;
+    // Also save the trace here in columns, for counting
+    const char *columns_path;
+    // Also keep the trace's stacks written here, for flame graphs
+    const char *folded_path;
+    bool folded_by_calls;
+    // Also export the trace here as a timeline, for Chrome's trace viewer or Perfetto
+    const char *export_path;
+    // Also write everything printed here, without colors
+    const char *log_path;
+    // `objsee query <recording> [predicates]`, or `objsee count <recording or columns> [predicates]` when count_mode is set
+    const char *query_path;
+    bool count_mode;
+    const char *query_predicates[TRACE_QUERY_MAX_PREDICATES];
+    int query_predicate_count;
     pid_t pid;
     bool tui_mode;
     bool show_help;
     bool show_version;
     bool no_color;
     bool run_in_simulator;
+    bool use_shared_memory;
+    bool use_unix_socket;
+    bool use_seqpacket;
     int argc;
     char **argv;
 } cli_options_t;
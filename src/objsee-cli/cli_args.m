@@ -10,6 +10,27 @@
 #include "app_launching.h"
 #include "cli_args.h"
 
+static int backpressure_policy_from_name(const char *name, tracer_backpressure_policy_t *policy) {
+    const struct {
+        const char *name;
+        tracer_backpressure_policy_t policy;
+    } policies[] = {
+        {"drop-newest", TRACER_BACKPRESSURE_DROP_NEWEST},
+        {"block", TRACER_BACKPRESSURE_BLOCK},
+        {"drop-oldest", TRACER_BACKPRESSURE_DROP_OLDEST},
+        {"sample", TRACER_BACKPRESSURE_SAMPLE},
+    };
+    
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i].name) == 0) {
+            *policy = policies[i].policy;
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
 static pid_t pid_from_hint(const char *hint) {
     if (hint == NULL) {
         return -1;
@@ -38,6 +59,37 @@ int parse_cli_arguments(int argc, char *argv[], cli_options_t *options, tracer_c
     options->argv = argv;
     
     for (int i = 1; i < argc; i++) {
+        if (i == 1 && (strcmp(argv[i], "query") == 0 || strcmp(argv[i], "count") == 0)) {
+            if (i + 1 >= argc) {
+                printf("Error: %s needs a trace to read\n", argv[i]);
+                return -1;
+            }
+            options->count_mode = strcmp(argv[i], "count") == 0;
+            options->query_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (i == 1 && strcmp(argv[i], "replay") == 0) {
+            if (i + 1 >= argc) {
+                printf("Error: replay needs a trace to read\n");
+                return -1;
+            }
+            options->replay_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        // Everything after the recording that isn't an option is a predicate
+        if (options->query_path && argv[i][0] != '-') {
+            if (options->query_predicate_count >= TRACE_QUERY_MAX_PREDICATES) {
+                printf("Error: Too many query predicates (max is %d)\n", TRACE_QUERY_MAX_PREDICATES);
+                return -1;
+            }
+            options->query_predicates[options->query_predicate_count++] = argv[i];
+            continue;
+        }
+        
         if (strcmp(argv[i], "-h") == 0) {
             options->show_help = true;
             return 0;
@@ -75,6 +127,105 @@ int parse_cli_arguments(int argc, char *argv[], cli_options_t *options, tracer_c
             continue;
         }
         
+        if (strcmp(argv[i], "--shm") == 0) {
+            options->use_shared_memory = true;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--unix") == 0) {
+            options->use_unix_socket = true;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--seqpacket") == 0) {
+            options->use_unix_socket = true;
+            options->use_seqpacket = true;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--compress") == 0) {
+            config->transport_config.compress = true;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--read") == 0 && i + 1 < argc) {
+            options->read_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            options->replay_speed = strcmp(argv[i + 1], "max") == 0 ? 0 : strtod(argv[i + 1], &end);
+            if (end != NULL && (*end != '\0' || end == argv[i + 1] || options->replay_speed <= 0)) {
+                printf("Error: Invalid replay speed '%s'\n", argv[i + 1]);
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            options->record_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--columns") == 0 && i + 1 < argc) {
+            options->columns_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--folded") == 0 && i + 1 < argc) {
+            options->folded_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            options->export_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            options->log_path = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--folded-weight") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "calls") != 0 && strcmp(argv[i + 1], "time") != 0) {
+                printf("Error: Invalid folded stack weight '%s'\n", argv[i + 1]);
+                return -1;
+            }
+            options->folded_by_calls = strcmp(argv[i + 1], "calls") == 0;
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) {
+            config->transport_config.flush_interval_ms = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--flush-bytes") == 0 && i + 1 < argc) {
+            config->transport_config.flush_bytes = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "--backpressure") == 0 && i + 1 < argc) {
+            if (backpressure_policy_from_name(argv[i + 1], &config->transport_config.backpressure) != 0) {
+                printf("Error: Unknown backpressure policy '%s'\n", argv[i + 1]);
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        
         // arg verbosity: -A0, -A1, -A2, -A3
         if (argv[i][0] == '-' && argv[i][1] == 'A' && argv[i][2] >= '0' && argv[i][2] <= '3') {
             config->format.args = argv[i][2] - '0';
@@ -164,6 +315,8 @@ int apply_defaults_to_config(tracer_config_t *config) {
         .variable_separator_spacing = true,
         .static_separator_spacing = 2,
         .include_newline_in_formatted_trace = false,
+        // Events are formatted by the trace server, using the options above
+        .output_as_binary = true,
         .args = TRACER_ARG_FORMAT_NONE,
     };
     
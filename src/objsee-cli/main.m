@@ -9,6 +9,9 @@
 #include <dlfcn.h>
 #include "config_encode.h"
 #include "trace_server.h"
+#include "trace_output.h"
+#include "trace_query.h"
+#include "trace_stats.h"
 #include "tui_trace_server.h"
 #include "crash_handler.h"
 #include "dylib_injector.h"
@@ -27,7 +30,10 @@ static void print_version(void) {
 }
 
 static void print_usage(void) {
-    printf("Usage: objsee [options] <bundle id>\n\n");
+    printf("Usage: objsee [options] <bundle id>\n");
+    printf("       objsee query <recording> [class=<pattern>] [sel=<pattern>] [thread=<id>|main] [depth<N] [time=<from>..<to>]\n");
+    printf("       objsee replay <file> [--speed <multiple>|max] [-T]\n");
+    printf("       objsee count <recording|columns> [by=selector|class|method|thread|stack] [top=N] [jobs=N] [same predicates as query]\n\n");
     printf("Options:\n");
     printf("  -h, --help                    Show this help message\n");
     printf("  -v, --version                 Show version information\n");
@@ -39,7 +45,23 @@ static void print_usage(void) {
     printf("  -i <pattern>                  Image path pattern\n\n");
     printf("  -p <process hint>             Attach to an existing process\n");
     printf("  --nocolor                     Disable color output\n");
-    printf("  --sim                         Run the app in iOS Simulator\n\n");
+    printf("  --sim                         Run the app in iOS Simulator\n");
+    printf("  --shm                         Receive events through shared memory instead of a socket\n");
+    printf("  --unix                        Receive events over a unix domain socket instead of TCP\n");
+    printf("  --seqpacket                   Like --unix, but each read is a packet of whole events\n");
+    printf("  --compress                    Compress events before they are sent\n");
+    printf("  --read <file>                 Print a trace recorded to a file, compressed or not\n");
+    printf("  --speed <multiple>|max        How fast objsee replay plays a trace back, relative to real time (default max)\n");
+    printf("  --record <file>               Also save the trace as an indexed recording, for objsee query\n");
+    printf("  --columns <file>              Also save the trace in columns, for objsee count\n");
+    printf("  --folded <file>               Also keep the trace's call stacks written to a file, for flame graphs\n");
+    printf("  --folded-weight calls|time    Weigh folded stacks by calls or by nanoseconds spent (default time)\n");
+    printf("  --export <file>               Also export the trace as a timeline: Chrome json for .json, otherwise Perfetto\n");
+    printf("  --log <file>                  Also write the printed trace to a file, without colors\n");
+    printf("  --flush-ms <ms>               Longest an event is held before it is sent (default 5)\n");
+    printf("  --flush-bytes <bytes>         Send as soon as this much output is waiting (default 65536)\n");
+    printf("  --backpressure <policy>       What to do when objsee falls behind the app: drop-newest (default),\n");
+    printf("                                block, drop-oldest or sample\n\n");
     printf("  -A0                           Include no arguments\n");
     printf("  -A1                           Include basic argument detail\n");
     printf("  -A2                           Include class names in argument detail\n");
@@ -111,6 +133,50 @@ int main(int argc, char *argv[]) {
             return 0;
         }
         
+        if (options.query_path && options.count_mode) {
+            return count_trace_file(options.query_path, options.query_predicate_count, options.query_predicates);
+        }
+        
+        if (options.query_path) {
+            return query_trace_recording(&config, options.query_path, options.query_predicate_count, options.query_predicates);
+        }
+        
+        if (options.record_path || options.columns_path || options.folded_path || options.export_path) {
+            // Recordings, stacks and timelines are built from binary events, which the TUI and a directly launched executable don't produce
+            if (options.tui_mode || (options.file_path && options.read_path == NULL)) {
+                printf("Error: --record, --columns, --folded and --export can't be used with -T or an executable\n");
+                return 1;
+            }
+            
+            if ((options.record_path || options.columns_path) && start_trace_recording(options.record_path, options.columns_path) != 0) {
+                return 1;
+            }
+            
+            if (options.folded_path && start_folded_stacks(options.folded_path, options.folded_by_calls) != 0) {
+                return 1;
+            }
+            
+            if (options.export_path && start_trace_export(options.export_path) != 0) {
+                return 1;
+            }
+        }
+        
+        if (options.log_path) {
+            // The TUI draws its own screen, and a directly launched executable prints its events itself
+            if (options.tui_mode || (options.file_path && options.read_path == NULL)) {
+                printf("Error: --log can't be used with -T or an executable\n");
+                return 1;
+            }
+            
+            if (start_trace_log(options.log_path) != 0) {
+                return 1;
+            }
+        }
+        
+        if (options.read_path) {
+            return read_trace_file(&config, options.read_path);
+        }
+        
         if (options.tui_mode) {
             // TUI mode requires some overrrides
             config.format.include_colors = false;
@@ -123,12 +189,38 @@ int main(int argc, char *argv[]) {
             config.format.static_separator_spacing = 0;
             config.format.include_indent_separators = false;
             config.format.include_newline_in_formatted_trace = true;
+            config.format.output_as_binary = false;
+            // The TUI reads plain json lines
+            config.transport_config.compress = false;
         }
         else if (options.file_path) {
             config.transport = TRACER_TRANSPORT_STDOUT;
             config.transport_config.host = NULL;
             config.transport_config.port = 0;
             config.format.output_as_json = false;
+            config.format.output_as_binary = false;
+        }
+        else if (options.use_shared_memory) {
+            config.transport = TRACER_TRANSPORT_SHM;
+            config.transport_config.host = NULL;
+            config.transport_config.port = 0;
+        }
+        else if (options.use_unix_socket) {
+            config.transport = TRACER_TRANSPORT_UNIX;
+            config.transport_config.host = NULL;
+            config.transport_config.port = 0;
+            config.transport_config.seqpacket = options.use_seqpacket;
+        }
+        
+        if (options.replay_path) {
+            if (options.tui_mode) {
+                return run_tui_trace_replay(&config, options.replay_path, options.replay_speed);
+            }
+            
+            trace_replay_options_t replay_options = {
+                .speed = options.replay_speed,
+            };
+            return replay_trace_file(&config, options.replay_path, &replay_options);
         }
         
         NSString *bundleID = nil;
@@ -141,6 +233,11 @@ int main(int argc, char *argv[]) {
             return spawn_process(&options, config);
         }
         
+        // The shared memory ring or unix socket has to exist before the library starts, and its name goes in the config
+        if (prepare_trace_server(&config) != 0) {
+            return 1;
+        }
+        
         // Prepare the encoded config. This will be used for both process launches and attachments.
         // When launching apps, it's provided via an env var. When attaching, it's passed as an arg to the entrypoint function objsee_main()
         char *b64_encoded_config = NULL;
@@ -156,6 +253,11 @@ int main(int argc, char *argv[]) {
                 printf("Cannot attach to running process in simulator\n");
                 return 1;
             }
+            // The library maps the shared memory ring as soon as it starts, so it has to exist first
+            if (open_trace_shm(options.pid) != 0) {
+                return 1;
+            }
+            
             // If attaching to an existing pid:
             // 1. Inject the library dylib into the running process
             // 2. Lookup the address of the entry point function objsee_main()
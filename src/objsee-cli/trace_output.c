@@ -0,0 +1,277 @@
+//
+//  trace_output.c
+//  objsee
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include "event_ring.h"
+#include "output_buffer.h"
+#include "trace_output.h"
+
+// Output the receive loop can get ahead of the terminal by before it has to wait
+#define OUTPUT_RING_CAPACITY (8 * 1024 * 1024)
+// The output thread writes as soon as this much is waiting
+#define OUTPUT_FLUSH_BYTES (256 * 1024)
+// Longest output waits to be written when less than OUTPUT_FLUSH_BYTES is waiting
+#define OUTPUT_FLUSH_INTERVAL_NS (20 * 1000 * 1000)
+// How long either side sleeps when there's nothing for it to do: the output thread when the ring is
+// empty or nothing is due, and the receive loop when the ring is full
+#define OUTPUT_IDLE_SLEEP_US 1000
+// Messages longer than this are formatted on the heap
+#define OUTPUT_MESSAGE_SIZE 512
+
+typedef enum {
+    ANSI_TEXT,
+    // After an ESC
+    ANSI_ESCAPE,
+    // Inside an ESC [ control sequence, up to its final byte
+    ANSI_CONTROL_SEQUENCE,
+} ansi_state_t;
+
+typedef struct {
+    FILE *file;
+    bool strip_ansi;
+    // Carried between writes, so a sequence split across two of them is still removed whole
+    ansi_state_t ansi_state;
+    bool failed;
+} output_sink_t;
+
+static output_sink_t stdout_sink;
+static output_sink_t log_sink;
+static bool sinks_configured = false;
+// Where sequences are stripped out to. Only used by whichever thread is writing to the sinks
+static output_buffer_t stripped;
+
+static event_ring_t *output_ring = NULL;
+static pthread_t output_thread;
+static _Atomic(bool) output_running = false;
+static bool stop_registered = false;
+
+static void configure_stdout_sink(void) {
+    if (sinks_configured) {
+        return;
+    }
+    sinks_configured = true;
+    stdout_sink.file = stdout;
+    stdout_sink.strip_ansi = !isatty(STDOUT_FILENO);
+}
+
+static void write_sink_bytes(output_sink_t *sink, const char *data, size_t length) {
+    if (length > 0 && fwrite(data, 1, length, sink->file) != length) {
+        // A closed pipe or a full disk. Keep the other sink going
+        sink->failed = true;
+    }
+}
+
+// Copy everything that isn't part of an escape sequence. Only ESC [ sequences, which is what colors
+// are, are removed with their parameters. Any other escape loses just the ESC and the byte after it
+static void append_without_ansi(output_sink_t *sink, const char *data, size_t length, output_buffer_t *out) {
+    const char *cursor = data;
+    const char *end = data + length;
+    while (cursor < end) {
+        if (sink->ansi_state == ANSI_TEXT) {
+            const char *escape = memchr(cursor, '\x1b', end - cursor);
+            const char *text_end = escape ? escape : end;
+            output_buffer_append(out, cursor, text_end - cursor);
+            if (escape == NULL) {
+                break;
+            }
+            sink->ansi_state = ANSI_ESCAPE;
+            cursor = escape + 1;
+            continue;
+        }
+
+        unsigned char c = (unsigned char)*cursor++;
+        if (sink->ansi_state == ANSI_ESCAPE) {
+            sink->ansi_state = c == '[' ? ANSI_CONTROL_SEQUENCE : ANSI_TEXT;
+        }
+        else if (c < 0x20 || c > 0x3f) {
+            // Parameter and intermediate bytes are 0x20-0x3f. Anything else ends the sequence
+            sink->ansi_state = ANSI_TEXT;
+        }
+    }
+}
+
+static void write_to_sink(output_sink_t *sink, const char *data, size_t length) {
+    if (sink->file == NULL || sink->failed) {
+        return;
+    }
+
+    // Most writes have no sequences in them at all, or are going to a terminal
+    if (!sink->strip_ansi || (sink->ansi_state == ANSI_TEXT && memchr(data, '\x1b', length) == NULL)) {
+        write_sink_bytes(sink, data, length);
+        return;
+    }
+
+    output_buffer_reset(&stripped);
+    append_without_ansi(sink, data, length, &stripped);
+    if (stripped.failed) {
+        stripped.failed = false;
+        sink->failed = true;
+        return;
+    }
+    write_sink_bytes(sink, stripped.data, stripped.length);
+}
+
+static void write_to_sinks(const char *data, size_t length) {
+    configure_stdout_sink();
+    write_to_sink(&stdout_sink, data, length);
+    write_to_sink(&log_sink, data, length);
+}
+
+static void *output_thread_main(void *context) {
+    // When the oldest unwritten output was first seen, or 0 if nothing is waiting
+    uint64_t pending_since = 0;
+    while (true) {
+        // Sampled before the ring, so everything queued before the thread was told to stop is seen this pass
+        bool running = atomic_load_explicit(&output_running, memory_order_acquire);
+
+        size_t pending = 0;
+        const char *data = event_ring_peek(output_ring, &pending);
+        uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        if (pending > 0 && pending_since == 0) {
+            pending_since = now;
+        }
+
+        bool due = pending > 0 && (!running || pending >= OUTPUT_FLUSH_BYTES || now - pending_since >= OUTPUT_FLUSH_INTERVAL_NS);
+        if (due) {
+            // The ring is mapped twice, so everything waiting is contiguous and goes out in one write per sink
+            write_to_sinks(data, pending);
+            event_ring_consume(output_ring, pending);
+            pending_since = 0;
+        }
+        else if (pending == 0 && !running) {
+            break;
+        }
+        else {
+            usleep(OUTPUT_IDLE_SLEEP_US);
+        }
+    }
+
+    fflush(stdout);
+    if (log_sink.file) {
+        fflush(log_sink.file);
+    }
+    return NULL;
+}
+
+static void close_trace_log(void) {
+    trace_output_stop();
+    if (log_sink.file) {
+        if (fclose(log_sink.file) != 0 || log_sink.failed) {
+            printf("Failed to finish the log\n");
+        }
+        log_sink.file = NULL;
+    }
+    output_buffer_free(&stripped);
+}
+
+int start_trace_log(const char *path) {
+    log_sink.file = fopen(path, "w");
+    if (log_sink.file == NULL) {
+        printf("Failed to create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    log_sink.strip_ansi = true;
+    atexit(close_trace_log);
+    return 0;
+}
+
+bool trace_output_has_log(void) {
+    return log_sink.file != NULL;
+}
+
+int trace_output_start(void) {
+    if (output_ring) {
+        return 0;
+    }
+
+    configure_stdout_sink();
+    output_ring = event_ring_create(OUTPUT_RING_CAPACITY);
+    if (output_ring == NULL) {
+        printf("Failed to create the output queue, output will be written as it arrives\n");
+        return 1;
+    }
+
+    // Anything printed before now has to come out first
+    fflush(stdout);
+    atomic_store_explicit(&output_running, true, memory_order_release);
+    if (pthread_create(&output_thread, NULL, output_thread_main, NULL) != 0) {
+        atomic_store_explicit(&output_running, false, memory_order_release);
+        event_ring_destroy(output_ring);
+        output_ring = NULL;
+        printf("Failed to start the output thread, output will be written as it arrives\n");
+        return 1;
+    }
+
+    // Whatever is still queued gets written if the process exits before the server stops the thread
+    if (!stop_registered) {
+        stop_registered = true;
+        atexit(trace_output_stop);
+    }
+    return 0;
+}
+
+void trace_output_stop(void) {
+    if (output_ring == NULL) {
+        return;
+    }
+
+    atomic_store_explicit(&output_running, false, memory_order_release);
+    pthread_join(output_thread, NULL);
+    event_ring_destroy(output_ring);
+    output_ring = NULL;
+}
+
+void trace_output_write(const char *data, size_t length) {
+    if (output_ring == NULL) {
+        write_to_sinks(data, length);
+        return;
+    }
+
+    // Output larger than the free space goes in as room is made, so any length fits
+    while (length > 0) {
+        size_t available = 0;
+        char *space = event_ring_reserve(output_ring, &available);
+        if (available == 0) {
+            usleep(OUTPUT_IDLE_SLEEP_US);
+            continue;
+        }
+
+        size_t chunk = MIN(available, length);
+        memcpy(space, data, chunk);
+        event_ring_commit(output_ring, chunk);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void trace_output_printf(const char *format, ...) {
+    char message[OUTPUT_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+
+    if ((size_t)length < sizeof(message)) {
+        trace_output_write(message, length);
+        return;
+    }
+
+    char *long_message = malloc((size_t)length + 1);
+    if (long_message == NULL) {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(long_message, (size_t)length + 1, format, args);
+    va_end(args);
+    trace_output_write(long_message, length);
+    free(long_message);
+}
@@ -0,0 +1,67 @@
+//
+//  trace_output.h
+//  objsee
+//
+//  Created by Ethan Arbuckle on 3/13/25.
+//
+
+#ifndef TRACE_OUTPUT_H
+#define TRACE_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Where traced output goes: stdout, and optionally a log file
+
+    While the trace server runs, output is queued in a single-producer, single-consumer ring and written by
+    an output thread, so a slow terminal doesn't hold up reading events from the traced process. The thread
+    writes in large blocks, once enough has built up or once the oldest output has waited long enough, and
+    only blocks the receive loop if the whole ring fills up. Outside the trace server, like when reading a
+    trace file, output is written straight away by the caller.
+
+    ANSI escape sequences are stripped from anything that isn't a terminal: stdout when it's redirected, and
+    always from the log.
+*/
+
+/**
+ * Also write everything that's printed to a log file, without colors. The log is closed when the process exits
+ *
+ * @param path Where to write the log. Anything already there is replaced
+ * @return 0 on success, 1 on error
+ */
+int start_trace_log(const char *path);
+
+/**
+ * @return Whether a log is being written
+ */
+bool trace_output_has_log(void);
+
+/**
+ * Start the output thread. Until trace_output_stop() is called, output is queued for it rather than written by the caller
+ *
+ * @return 0 on success, 1 if the thread couldn't be started, in which case output is still written directly
+ */
+int trace_output_start(void);
+
+/**
+ * Write everything still queued and stop the output thread. Safe to call when it isn't running
+ */
+void trace_output_stop(void);
+
+/**
+ * Print bytes to stdout and the log, queued if the output thread is running
+ *
+ * @param data The bytes
+ * @param length Number of bytes
+ */
+void trace_output_write(const char *data, size_t length);
+
+/**
+ * Print a message through the same queue as traced output, so it lands in order with the events around it
+ *
+ * @param format printf format
+ */
+void trace_output_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif // TRACE_OUTPUT_H
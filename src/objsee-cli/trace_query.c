@@ -0,0 +1,425 @@
+//
+//  trace_query.c
+//  objsee
+//
+//  Created by Ethan Arbuckle on 3/10/25.
+//
+
+#include <fnmatch.h>
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+#include "trace_query.h"
+#include "trace_recording.h"
+
+typedef struct {
+    trace_query_matcher_t matcher;
+    const tracer_format_options_t *format;
+    output_buffer_t line;
+    bool print_dropped;
+    uint64_t matched;
+} query_context_t;
+
+static bool parse_uint(const char *string, int base, uint64_t *out) {
+    char *end = NULL;
+    if (*string == '\0' || *string == '-') {
+        return false;
+    }
+
+    *out = strtoull(string, &end, base);
+    return *end == '\0';
+}
+
+// A duration like 250ms or 1.5 (seconds)
+static bool parse_duration(const char *string, size_t length, uint64_t *out_ns) {
+    char number[64];
+    if (length == 0 || length >= sizeof(number)) {
+        return false;
+    }
+    memcpy(number, string, length);
+    number[length] = '\0';
+
+    char *unit = NULL;
+    double value = strtod(number, &unit);
+    if (unit == number || value < 0) {
+        return false;
+    }
+
+    double scale;
+    if (*unit == '\0' || strcmp(unit, "s") == 0) {
+        scale = 1e9;
+    }
+    else if (strcmp(unit, "ms") == 0) {
+        scale = 1e6;
+    }
+    else if (strcmp(unit, "us") == 0) {
+        scale = 1e3;
+    }
+    else if (strcmp(unit, "ns") == 0) {
+        scale = 1;
+    }
+    else {
+        return false;
+    }
+
+    *out_ns = (uint64_t)(value * scale);
+    return true;
+}
+
+static bool parse_time_range(const char *range, trace_query_t *query) {
+    const char *separator = strstr(range, "..");
+    if (separator == NULL) {
+        return false;
+    }
+
+    uint64_t start = 0;
+    uint64_t end = UINT64_MAX;
+    if (separator > range && !parse_duration(range, separator - range, &start)) {
+        return false;
+    }
+    const char *end_string = separator + 2;
+    if (*end_string != '\0' && !parse_duration(end_string, strlen(end_string), &end)) {
+        return false;
+    }
+
+    query->start_ns = MAX(query->start_ns, start);
+    query->end_ns = MIN(query->end_ns, end);
+    return true;
+}
+
+static bool parse_depth(const char *comparison, trace_query_t *query) {
+    uint64_t depth = 0;
+    if (strncmp(comparison, "<=", 2) == 0 && parse_uint(comparison + 2, 10, &depth)) {
+        query->max_depth = (uint32_t)MIN(query->max_depth, depth);
+    }
+    else if (strncmp(comparison, ">=", 2) == 0 && parse_uint(comparison + 2, 10, &depth)) {
+        query->min_depth = (uint32_t)MAX(query->min_depth, MIN(depth, UINT32_MAX));
+    }
+    else if (comparison[0] == '<' && parse_uint(comparison + 1, 10, &depth)) {
+        if (depth == 0) {
+            // Nothing is shallower than 0
+            query->min_depth = 1;
+            query->max_depth = 0;
+        }
+        else {
+            query->max_depth = (uint32_t)MIN(query->max_depth, depth - 1);
+        }
+    }
+    else if (comparison[0] == '>' && parse_uint(comparison + 1, 10, &depth)) {
+        query->min_depth = (uint32_t)MAX(query->min_depth, MIN(depth + 1, UINT32_MAX));
+    }
+    else if (comparison[0] == '=' && parse_uint(comparison + 1, 10, &depth)) {
+        query->min_depth = (uint32_t)MAX(query->min_depth, MIN(depth, UINT32_MAX));
+        query->max_depth = (uint32_t)MIN(query->max_depth, depth);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static bool add_pattern(const char **patterns, int *count, const char *pattern) {
+    if (*count >= TRACE_QUERY_MAX_PREDICATES || *pattern == '\0') {
+        return false;
+    }
+    patterns[(*count)++] = pattern;
+    return true;
+}
+
+static bool parse_predicate(const char *predicate, trace_query_t *query) {
+    if (strncmp(predicate, "class=", 6) == 0) {
+        return add_pattern(query->class_patterns, &query->class_pattern_count, predicate + 6);
+    }
+
+    const char *selector_prefixes[] = {"sel=", "selector=", "method="};
+    for (size_t i = 0; i < sizeof(selector_prefixes) / sizeof(selector_prefixes[0]); i++) {
+        size_t length = strlen(selector_prefixes[i]);
+        if (strncmp(predicate, selector_prefixes[i], length) == 0) {
+            return add_pattern(query->selector_patterns, &query->selector_pattern_count, predicate + length);
+        }
+    }
+
+    if (strncmp(predicate, "thread=", 7) == 0) {
+        uint64_t thread_id = 0;
+        if (query->has_thread) {
+            return false;
+        }
+        query->has_thread = true;
+        if (strcmp(predicate + 7, "main") == 0) {
+            query->main_thread = true;
+            return true;
+        }
+        if (!parse_uint(predicate + 7, 0, &thread_id) || thread_id > UINT16_MAX) {
+            return false;
+        }
+        query->thread_id = (uint16_t)thread_id;
+        return true;
+    }
+
+    if (strncmp(predicate, "depth", 5) == 0) {
+        return parse_depth(predicate + 5, query);
+    }
+
+    if (strncmp(predicate, "time=", 5) == 0) {
+        return parse_time_range(predicate + 5, query);
+    }
+    return false;
+}
+
+bool trace_query_name_matches(const char *const *patterns, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (fnmatch(patterns[i], name, 0) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int parse_trace_query(int predicate_count, const char **predicates, trace_query_t *query) {
+    *query = (trace_query_t){
+        .max_depth = UINT32_MAX,
+        .end_ns = UINT64_MAX,
+    };
+    for (int i = 0; i < predicate_count; i++) {
+        if (!parse_predicate(predicates[i], query)) {
+            printf("Error: Invalid query predicate '%s'\n", predicates[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static bool name_cache_grow(trace_query_name_cache_t *cache) {
+    size_t new_capacity = cache->capacity ? cache->capacity * 2 : 256;
+    const char **names = calloc(new_capacity, sizeof(const char *));
+    bool *matches = calloc(new_capacity, sizeof(bool));
+    if (names == NULL || matches == NULL) {
+        free(names);
+        free(matches);
+        return false;
+    }
+
+    for (size_t i = 0; i < cache->capacity; i++) {
+        if (cache->names[i] == NULL) {
+            continue;
+        }
+
+        size_t index = ((uintptr_t)cache->names[i] >> 3) & (new_capacity - 1);
+        while (names[index] != NULL) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        names[index] = cache->names[i];
+        matches[index] = cache->matches[i];
+    }
+
+    free(cache->names);
+    free(cache->matches);
+    cache->names = names;
+    cache->matches = matches;
+    cache->capacity = new_capacity;
+    return true;
+}
+
+static bool name_matches(trace_query_name_cache_t *cache, const char *const *patterns, int count, const char *name) {
+    if (count == 0) {
+        return true;
+    }
+
+    if ((cache->count + 1) * 2 > cache->capacity && !name_cache_grow(cache)) {
+        return trace_query_name_matches(patterns, count, name);
+    }
+
+    size_t mask = cache->capacity - 1;
+    size_t index = ((uintptr_t)name >> 3) & mask;
+    while (cache->names[index] != NULL) {
+        if (cache->names[index] == name) {
+            return cache->matches[index];
+        }
+        index = (index + 1) & mask;
+    }
+
+    cache->names[index] = name;
+    cache->matches[index] = trace_query_name_matches(patterns, count, name);
+    cache->count++;
+    return cache->matches[index];
+}
+
+void trace_query_matcher_free(trace_query_matcher_t *matcher) {
+    free(matcher->classes.names);
+    free(matcher->classes.matches);
+    free(matcher->selectors.names);
+    free(matcher->selectors.matches);
+}
+
+// Whether any one of the chunk's `count` names, starting at `name`, matches every pattern. Returns the name after the last
+static const char *chunk_has_match(const char *name, uint32_t count, const char *const *patterns, int pattern_count, bool *out_found) {
+    *out_found = pattern_count == 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!*out_found && trace_query_name_matches(patterns, pattern_count, name)) {
+            *out_found = true;
+        }
+        name += strlen(name) + 1;
+    }
+    return name;
+}
+
+bool trace_query_chunk_may_match(const recording_chunk_header_t *chunk, const trace_query_t *query, uint64_t recording_start) {
+    if (chunk->event_count == 0) {
+        // Only holds dropped event reports
+        return true;
+    }
+
+    uint64_t first = chunk->first_timestamp - recording_start;
+    uint64_t last = chunk->last_timestamp - recording_start;
+    if (last < query->start_ns || first > query->end_ns) {
+        return false;
+    }
+
+    if (chunk->max_depth < query->min_depth || chunk->min_depth > query->max_depth) {
+        return false;
+    }
+
+    if (query->has_thread && !recording_chunk_may_have_thread(chunk, query->thread_id)) {
+        return false;
+    }
+
+    bool found = false;
+    const char *selectors = chunk_has_match(recording_chunk_names(chunk), chunk->class_count, query->class_patterns, query->class_pattern_count, &found);
+    if (!found) {
+        return false;
+    }
+
+    chunk_has_match(selectors, chunk->selector_count, query->selector_patterns, query->selector_pattern_count, &found);
+    return found;
+}
+
+bool trace_query_event_matches(trace_query_matcher_t *matcher, const tracer_event_t *event) {
+    const trace_query_t *query = matcher->query;
+    uint64_t time = event->timestamp - matcher->recording_start;
+    if (time < query->start_ns || time > query->end_ns || event->trace_depth < query->min_depth || event->trace_depth > query->max_depth) {
+        return false;
+    }
+
+    if (query->has_thread && event->thread_id != query->thread_id) {
+        return false;
+    }
+
+    return name_matches(&matcher->classes, query->class_patterns, query->class_pattern_count, event->class_name) &&
+        name_matches(&matcher->selectors, query->selector_patterns, query->selector_pattern_count, event->method_name);
+}
+
+static void print_matching_event(const tracer_event_t *event, void *context) {
+    query_context_t *query_context = (query_context_t *)context;
+    if (!trace_query_event_matches(&query_context->matcher, event)) {
+        return;
+    }
+
+    output_buffer_t *line = &query_context->line;
+    output_buffer_reset(line);
+    if (append_formatted_event(event, query_context->format, line) != KERN_SUCCESS) {
+        return;
+    }
+
+    if (line->length == 0 || line->data[line->length - 1] != '\n') {
+        output_buffer_append_char(line, '\n');
+    }
+    fwrite(line->data, 1, line->length, stdout);
+    query_context->matched++;
+}
+
+static void print_dropped_record(uint64_t count, void *context) {
+    query_context_t *query_context = (query_context_t *)context;
+    if (query_context->print_dropped) {
+        printf("[objsee] %llu events dropped\n", (unsigned long long)count);
+    }
+}
+
+int prepare_trace_query(const trace_recording_t *recording, trace_query_t *query, uint64_t *out_recording_start, uint64_t *out_dropped) {
+    // Times in the query are relative to the first event
+    uint64_t recording_start = UINT64_MAX;
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < recording->chunk_count; i++) {
+        const recording_chunk_header_t *chunk = trace_recording_chunk(recording, i);
+        if (chunk->event_count > 0 && chunk->first_timestamp < recording_start) {
+            recording_start = chunk->first_timestamp;
+        }
+        dropped += chunk->dropped;
+    }
+
+    *out_recording_start = recording_start == UINT64_MAX ? 0 : recording_start;
+    *out_dropped = dropped;
+    if (query->main_thread) {
+        // Only the traced process knows which thread is main, so it has to be in the recording
+        if (!recording->has_main_thread) {
+            printf("The recording doesn't say which thread is main, so thread=main can't be used with it\n");
+            return 1;
+        }
+        query->thread_id = recording->main_thread_id;
+    }
+    return 0;
+}
+
+int query_trace_recording(tracer_config_t *config, const char *path, int predicate_count, const char **predicates) {
+    trace_query_t query;
+    if (parse_trace_query(predicate_count, predicates, &query) != 0) {
+        return 1;
+    }
+
+    trace_recording_t *recording = trace_recording_open(path);
+    if (recording == NULL) {
+        printf("Failed to open %s as a recording\n", path);
+        return 1;
+    }
+
+    uint64_t recording_start = 0;
+    uint64_t dropped = 0;
+    if (prepare_trace_query(recording, &query, &recording_start, &dropped) != 0) {
+        trace_recording_close(recording);
+        return 1;
+    }
+
+    query_context_t context = {
+        .matcher = {
+            .query = &query,
+            .recording_start = recording_start,
+        },
+        .format = &config->format,
+        // Dropped events can't be attributed to a class or time, so they're only reported inline when printing everything
+        .print_dropped = predicate_count == 0,
+    };
+
+    int status = 0;
+    size_t scanned = 0;
+    for (size_t i = 0; i < recording->chunk_count; i++) {
+        const recording_chunk_header_t *chunk = trace_recording_chunk(recording, i);
+        if (!trace_query_chunk_may_match(chunk, &query, recording_start)) {
+            continue;
+        }
+
+        scanned++;
+        if (trace_recording_decode_chunk(chunk, print_matching_event, print_dropped_record, &context) != KERN_SUCCESS) {
+            printf("Failed to decode chunk %zu of %s\n", i, path);
+            status = 1;
+            break;
+        }
+    }
+
+    if (predicate_count > 0) {
+        fprintf(stderr, "[objsee] %llu events matched, %zu of %zu chunks read", (unsigned long long)context.matched, scanned, recording->chunk_count);
+        if (dropped > 0) {
+            fprintf(stderr, ", %llu events were dropped while recording", (unsigned long long)dropped);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (!recording->complete) {
+        fprintf(stderr, "[objsee] %s was never closed, so the end of the trace may be missing\n", path);
+    }
+
+    trace_query_matcher_free(&context.matcher);
+    output_buffer_free(&context.line);
+    trace_recording_close(recording);
+    return status;
+}
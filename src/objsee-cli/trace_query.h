@@ -0,0 +1,109 @@
+//
+//  trace_query.h
+//  objsee
+//
+//  Created by Ethan Arbuckle on 3/10/25.
+//
+
+#ifndef TRACE_QUERY_H
+#define TRACE_QUERY_H
+
+#include "trace_recording.h"
+#include "tracer_types.h"
+
+// Most predicates a single query can have
+#define TRACE_QUERY_MAX_PREDICATES 16
+
+typedef struct {
+    const char *class_patterns[TRACE_QUERY_MAX_PREDICATES];
+    int class_pattern_count;
+    const char *selector_patterns[TRACE_QUERY_MAX_PREDICATES];
+    int selector_pattern_count;
+    bool has_thread;
+    // Set for thread=main, until the reader looks up its thread_id in the file's header
+    bool main_thread;
+    uint16_t thread_id;
+    // Inclusive ranges. Time is relative to the first event in the trace
+    uint32_t min_depth;
+    uint32_t max_depth;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} trace_query_t;
+
+// Whether a name matched, keyed by pointer. Decoded names are interned, so each distinct name has one pointer
+typedef struct {
+    const char **names;
+    bool *matches;
+    size_t capacity;
+    size_t count;
+} trace_query_name_cache_t;
+
+// Checks events against a query. Each thread needs its own
+typedef struct {
+    const trace_query_t *query;
+    // Timestamp of the recording's first event
+    uint64_t recording_start;
+    trace_query_name_cache_t classes;
+    trace_query_name_cache_t selectors;
+} trace_query_matcher_t;
+
+/**
+ * Print the events in a recording that match every predicate, reading only the chunks whose index says they
+ * might have a match. Predicates:
+ *
+ *   class=<pattern>            Class name, with * and ? wildcards
+ *   sel=<pattern>              Selector, also method= or selector=
+ *   thread=<id>|main           Thread id as printed in the trace, like 0x1a2b. main is the traced process's main thread
+ *   depth<N, depth<=N, depth>N, depth>=N, depth=N
+ *   time=<from>..<to>          Since the first event. Either end can be left out. Units are ns, us, ms or s (the default)
+ *
+ * @param config The configuration to format events with
+ * @param path The recording
+ * @param predicate_count Number of predicates
+ * @param predicates The predicates. With none, every event is printed
+ * @return 0 on success, 1 on error
+ */
+int query_trace_recording(tracer_config_t *config, const char *path, int predicate_count, const char **predicates);
+
+/**
+ * Parse predicates in the form query_trace_recording() takes, printing an error for any that are invalid
+ *
+ * @param predicate_count Number of predicates
+ * @param predicates The predicates
+ * @param query Receives the query
+ * @return 0 on success, 1 on error
+ */
+int parse_trace_query(int predicate_count, const char **predicates, trace_query_t *query);
+
+/**
+ * Whether a name matches every one of a query's patterns for it
+ */
+bool trace_query_name_matches(const char *const *patterns, int count, const char *name);
+
+/**
+ * Find when a recording starts and resolve thread=main, which are both needed before matching events
+ *
+ * @param recording The recording
+ * @param query The query. Its thread_id is set if it asks for the main thread
+ * @param out_recording_start Receives the timestamp of the first event
+ * @param out_dropped Receives the number of events the traced process dropped while recording
+ * @return 0 on success, 1 after printing an error if the query asks for the main thread and the recording doesn't say which it is
+ */
+int prepare_trace_query(const trace_recording_t *recording, trace_query_t *query, uint64_t *out_recording_start, uint64_t *out_dropped);
+
+/**
+ * Whether a chunk might hold an event that matches, going by its index alone
+ */
+bool trace_query_chunk_may_match(const recording_chunk_header_t *chunk, const trace_query_t *query, uint64_t recording_start);
+
+/**
+ * Whether an event matches every predicate
+ */
+bool trace_query_event_matches(trace_query_matcher_t *matcher, const tracer_event_t *event);
+
+/**
+ * Release the names a matcher has cached
+ */
+void trace_query_matcher_free(trace_query_matcher_t *matcher);
+
+#endif // TRACE_QUERY_H
@@ -8,23 +8,186 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <json-c/json_tokener.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#if defined(__APPLE__)
+#include <sys/event.h>
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #include "format.h"
+#include "event_protocol.h"
+#include "folded_stacks.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "shm_ring.h"
+#include "segment_log.h"
+#include "stream_compression.h"
+#include "trace_columns.h"
+#include "trace_export.h"
+#include "trace_output.h"
+#include "trace_query.h"
+#include "trace_recording.h"
+#include "trace_server.h"
 
 // Max time to wait for a client (the process being traced) to connect
 #define ACCEPT_TIMEOUT_SECONDS 20
+// Free space in the receive buffer before each recv. The buffer grows past this to hold a message that's larger.
+// Also larger than any SOCK_SEQPACKET packet, which has to be read whole or the rest of it is lost
+#define RECV_BUFFER_SIZE (1024 * 1024)
+// Longest the server waits for input before seeing to anything else, like rewriting the folded stacks or, when the
+// traced process's exit can't be waited on, checking whether it's still alive
+#define SERVER_WAKE_INTERVAL_MS 100
+// How much of a trace file is handed to the decoder at a time
+#define FILE_CHUNK_SIZE (1024 * 1024)
+// Longest the shared memory reader sleeps before checking that the traced process is still alive
+#define SHM_WAIT_TIMEOUT_MS 100
+#define UNIX_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+// Replays write to stdout in blocks this size, flushed whenever the replay waits for the next event to be due
+#define REPLAY_STDOUT_BUFFER_SIZE (1024 * 1024)
+// Longest a paced replay sleeps between polls for input
+#define REPLAY_MAX_SLEEP_NS (10 * 1000 * 1000)
+// Events between polls for input when the replay isn't waiting
+#define REPLAY_POLL_EVENTS 4096
+// How often the folded stacks file is rewritten while a trace is running
+#define FOLDED_WRITE_INTERVAL_NS (5ULL * 1000 * 1000 * 1000)
+
+typedef struct {
+    const trace_replay_options_t *options;
+    bool started;
+    bool stopped;
+    // When the first paced event was replayed, and when it was recorded
+    uint64_t started_at;
+    uint64_t first_timestamp;
+    uint64_t event_count;
+} trace_replay_t;
+
+typedef struct {
+    const tracer_format_options_t *format;
+    output_buffer_t line;
+    // Set when replaying a file rather than printing it
+    trace_replay_t *replay;
+    // A replayed binary event as a json stream would have sent it, for a replay's line handler
+    output_buffer_t json;
+} trace_render_context_t;
+
+typedef struct {
+    output_buffer_t received;
+    bool compression_known;
+    bool compressed;
+    stream_decompressor_t decompressor;
+    // What's been decompressed but not printed yet, when the stream is compressed
+    output_buffer_t decompressed;
+    bool type_known;
+    event_decoder_t *decoder;
+    trace_render_context_t render;
+} trace_stream_t;
 
 static volatile int running = 1;
 static int server_fd = -1;
 static int client_fd = -1;
+static shm_ring_t *trace_shm = NULL;
+static char trace_shm_name[SHM_RING_NAME_MAX];
+static char trace_socket_path[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+static trace_recorder_t *trace_recorder = NULL;
+static trace_column_writer_t *trace_column_writer = NULL;
+static folded_stacks_t *folded_stacks = NULL;
+static const char *folded_path = NULL;
+static folded_stacks_weight_t folded_weight = FOLDED_STACKS_WEIGHT_DURATION;
+static uint64_t folded_written_at = 0;
+static trace_exporter_t *trace_exporter = NULL;
 
 static void handle_signal(int sig) {
     running = 0;
 }
 
-static void print_json_event_formatted_output(const char *json_str, int len) {
+static void finish_trace_recording(void) {
+    if (trace_recorder && trace_recorder_close(trace_recorder) != KERN_SUCCESS) {
+        printf("Failed to finish the recording\n");
+    }
+    trace_recorder = NULL;
+    
+    if (trace_column_writer && trace_column_writer_close(trace_column_writer) != KERN_SUCCESS) {
+        printf("Failed to finish the columnar trace\n");
+    }
+    trace_column_writer = NULL;
+}
+
+// Replace the folded stacks file with the stacks so far. It's written beside the old one and renamed over it,
+// so whatever is reading it never sees half a file
+static void write_folded_stacks(void) {
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", folded_path);
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        printf("Failed to write %s: %s\n", temp_path, strerror(errno));
+        return;
+    }
+    
+    // Events without timestamps only have calls to go by
+    folded_stacks_weight_t weight = folded_stacks_has_durations(folded_stacks) ? folded_weight : FOLDED_STACKS_WEIGHT_CALLS;
+    kern_return_t kr = folded_stacks_write(folded_stacks, weight, file);
+    if (fclose(file) != 0 || kr != KERN_SUCCESS || rename(temp_path, folded_path) != 0) {
+        printf("Failed to write %s\n", folded_path);
+        unlink(temp_path);
+    }
+    folded_written_at = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+static void write_folded_stacks_if_due(void) {
+    if (folded_stacks && clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - folded_written_at >= FOLDED_WRITE_INTERVAL_NS) {
+        write_folded_stacks();
+    }
+}
+
+static void finish_folded_stacks(void) {
+    if (folded_stacks) {
+        write_folded_stacks();
+        folded_stacks_destroy(folded_stacks);
+    }
+    folded_stacks = NULL;
+}
+
+static void finish_trace_export(void) {
+    if (trace_exporter && trace_exporter_close(trace_exporter) != KERN_SUCCESS) {
+        printf("Failed to finish the timeline export\n");
+    }
+    trace_exporter = NULL;
+}
+
+// The traced process reports events it couldn't send in time, so gaps in the trace aren't silent
+static void print_dropped_events(uint64_t count, void *context) {
+    if (trace_recorder) {
+        trace_recorder_add_dropped(trace_recorder, count);
+    }
+    
+    // A replay's line handler gets the report the way a json stream would have sent it
+    trace_render_context_t *render = (trace_render_context_t *)context;
+    if (render && render->replay && render->replay->options->handle_line) {
+        char line[64];
+        int length = snprintf(line, sizeof(line), "{\"dropped_events\":%llu}", (unsigned long long)count);
+        render->replay->options->handle_line(line, length, render->replay->options->context);
+        return;
+    }
+    trace_output_printf("[objsee] %llu events dropped\n", (unsigned long long)count);
+}
+
+// Recordings keep the main thread in their headers, so thread=main queries don't have to guess it
+static void record_main_thread(uint16_t thread_id, void *context) {
+    if ((trace_recorder && trace_recorder_set_main_thread(trace_recorder, thread_id) != KERN_SUCCESS) ||
+        (trace_column_writer && trace_column_writer_set_main_thread(trace_column_writer, thread_id) != KERN_SUCCESS)) {
+        trace_output_printf("Failed to write to the recording, it will end here\n");
+        finish_trace_recording();
+    }
+}
+
+// The slow path, for lines the json reader doesn't accept
+static void print_json_event_with_tokener(const char *json_str, int len) {
     struct json_tokener *tokener = json_tokener_new();
     if (tokener == NULL) {
-        printf("Failed to create JSON tokener\n");
+        trace_output_printf("Failed to create JSON tokener\n");
         return;
     }
     
@@ -32,7 +195,7 @@ static void print_json_event_formatted_output(const char *json_str, int len) {
     enum json_tokener_error jerr = json_tokener_get_error(tokener);
     if (jerr != json_tokener_success) {
         if (jerr != json_tokener_continue) {
-            printf("Failed to parse JSON: %s\n%s\n", json_tokener_error_desc(jerr), json_str);
+            trace_output_printf("Failed to parse JSON: %s\n%s\n", json_tokener_error_desc(jerr), json_str);
         }
         
         json_tokener_free(tokener);
@@ -40,19 +203,177 @@ static void print_json_event_formatted_output(const char *json_str, int len) {
     }
 
     json_object *formatted_obj;
-    if (json_object_object_get_ex(trace, "formatted_output", &formatted_obj)) {
+    json_object *dropped_obj;
+    if (json_object_object_get_ex(trace, "dropped_events", &dropped_obj)) {
+        print_dropped_events((uint64_t)json_object_get_int64(dropped_obj), NULL);
+    }
+    else if (json_object_object_get_ex(trace, "formatted_output", &formatted_obj)) {
         const char *formatted = json_object_get_string(formatted_obj);
-        printf("%s\n", formatted);
+        trace_output_printf("%s\n", formatted);
     }
     else {
         // Fall back to printing the entire JSON object
-        printf("%s\n", json_str);
+        trace_output_printf("%s\n", json_str);
     }
     
     json_object_put(trace);
     json_tokener_free(tokener);
 }
 
+// Print one NUL-terminated json line. The fields that are printed are unescaped where they sit, so the line is changed
+static void print_json_event_formatted_output(char *json_str, int len) {
+    json_field_t fields[] = {
+        { .name = "formatted_output" },
+        { .name = "dropped_events" },
+    };
+    if (json_read_fields(json_str, len, fields, 2) != KERN_SUCCESS) {
+        print_json_event_with_tokener(json_str, len);
+        return;
+    }
+    
+    if (fields[1].type == JSON_FIELD_NUMBER) {
+        print_dropped_events((uint64_t)fields[1].number, NULL);
+    }
+    else if (fields[0].type == JSON_FIELD_STRING) {
+        // Stops at an escaped NUL, like printing json-c's string did
+        trace_output_write(fields[0].string, strlen(fields[0].string));
+        trace_output_write("\n", 1);
+    }
+    else if (fields[0].type == JSON_FIELD_MISSING) {
+        // Fall back to printing the entire JSON object
+        trace_output_printf("%s\n", json_str);
+    }
+    else {
+        // json-c prints values of other types as json
+        print_json_event_with_tokener(json_str, len);
+    }
+}
+
+// Hold a replayed event back until it's due. Returns false once the replay has been stopped
+static bool pace_replay(trace_replay_t *replay, uint64_t timestamp) {
+    const trace_replay_options_t *options = replay->options;
+    if (replay->stopped || !running) {
+        replay->stopped = true;
+        return false;
+    }
+    
+    replay->event_count++;
+    if (options->poll && replay->event_count % REPLAY_POLL_EVENTS == 0 && !options->poll(options->context)) {
+        replay->stopped = true;
+        return false;
+    }
+    
+    if (options->speed <= 0 || timestamp == 0) {
+        return true;
+    }
+    
+    if (!replay->started) {
+        replay->started = true;
+        replay->started_at = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        replay->first_timestamp = timestamp;
+        return true;
+    }
+    
+    uint64_t offset = timestamp > replay->first_timestamp ? (uint64_t)((double)(timestamp - replay->first_timestamp) / options->speed) : 0;
+    uint64_t due = replay->started_at + offset;
+    for (uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW); now < due; now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW)) {
+        // Everything before this event is shown while waiting for it
+        fflush(stdout);
+        if (!running || (options->poll && !options->poll(options->context))) {
+            replay->stopped = true;
+            return false;
+        }
+        usleep((useconds_t)(MIN(due - now, REPLAY_MAX_SLEEP_NS) / 1000));
+    }
+    return true;
+}
+
+// Binary protocol events arrive as raw data. All formatting happens here, in the CLI
+static void print_decoded_event(const tracer_event_t *event, void *context) {
+    trace_render_context_t *render = (trace_render_context_t *)context;
+    if (render->replay && !pace_replay(render->replay, event->timestamp)) {
+        return;
+    }
+    
+    if ((trace_recorder && trace_recorder_add_event(trace_recorder, event) == KERN_FAILURE) ||
+        (trace_column_writer && trace_column_writer_add_event(trace_column_writer, event) == KERN_FAILURE)) {
+        trace_output_printf("Failed to write to the recording, it will end here\n");
+        finish_trace_recording();
+    }
+    
+    // Events that can't be placed on a stack, like ones deeper than it allows, are left out
+    if (folded_stacks && folded_stacks_add_event(folded_stacks, event, true) == KERN_RESOURCE_SHORTAGE) {
+        trace_output_printf("Ran out of memory for the folded stacks, they will end here\n");
+        finish_folded_stacks();
+    }
+    
+    kern_return_t export_kr = trace_exporter ? trace_exporter_add_event(trace_exporter, event) : KERN_SUCCESS;
+    if (export_kr == KERN_FAILURE || export_kr == KERN_RESOURCE_SHORTAGE) {
+        trace_output_printf("Failed to write the timeline export, it will end here\n");
+        finish_trace_export();
+    }
+    
+    output_buffer_reset(&render->line);
+    if (append_formatted_event(event, render->format, &render->line) != KERN_SUCCESS) {
+        return;
+    }
+    
+    if (render->replay && render->replay->options->handle_line) {
+        size_t length = render->line.length;
+        if (length > 0 && render->line.data[length - 1] == '\n') {
+            length--;
+        }
+        
+        output_buffer_reset(&render->json);
+        json_writer_t writer;
+        json_writer_init(&writer, &render->json);
+        json_writer_begin_object(&writer);
+        json_writer_key(&writer, "formatted_output");
+        json_writer_string_with_length(&writer, render->line.data, length);
+        json_writer_key(&writer, "thread_id");
+        json_writer_int64(&writer, event->thread_id);
+        json_writer_key(&writer, "depth");
+        json_writer_int64(&writer, event->real_depth);
+        json_writer_end_object(&writer);
+        if (render->json.failed) {
+            render->json.failed = false;
+            return;
+        }
+        
+        const trace_replay_options_t *options = render->replay->options;
+        options->handle_line(render->json.data, (int)render->json.length, options->context);
+        return;
+    }
+    
+    if (render->line.length == 0 || render->line.data[render->line.length - 1] != '\n') {
+        output_buffer_append_char(&render->line, '\n');
+    }
+    trace_output_write(render->line.data, render->line.length);
+}
+
+// Print each complete line, returning the number of bytes consumed
+static size_t print_json_lines(trace_render_context_t *render, char *buffer, size_t length) {
+    char *json_start = buffer;
+    char *json_end = buffer;
+    while ((json_end = memchr(json_start, '\n', buffer + length - json_start)) != NULL) {
+        size_t json_len = json_end - json_start;
+        // Json events don't carry a timestamp, so they're replayed as fast as possible
+        if (json_len > 0 && (render->replay == NULL || pace_replay(render->replay, 0))) {
+            *json_end = '\0';
+            if (render->replay && render->replay->options->handle_line) {
+                render->replay->options->handle_line(json_start, (int)json_len, render->replay->options->context);
+            }
+            else {
+                print_json_event_formatted_output(json_start, (int)json_len);
+            }
+            *json_end = '\n';
+        }
+        json_start = json_end + 1;
+    }
+    
+    return json_start - buffer;
+}
+
 static bool pid_exists(pid_t pid) {
     if (pid == 0) {
         return false;
@@ -66,6 +387,84 @@ static bool pid_exists(pid_t pid) {
     }
 }
 
+// Tells the server when the traced process exits, without checking on it every time around the loop
+typedef struct {
+    pid_t pid;
+    // Becomes readable once the process exits: a kqueue watching it, or a pidfd. -1 when neither is available,
+    // and the process is checked on with kill() whenever a wait times out instead
+    int fd;
+    bool exited;
+} process_watch_t;
+
+static void process_watch_open(process_watch_t *watch, pid_t pid) {
+    watch->pid = pid;
+    watch->fd = -1;
+    watch->exited = pid == 0;
+    if (watch->exited) {
+        return;
+    }
+    
+#if defined(__APPLE__)
+    int kq = kqueue();
+    if (kq < 0) {
+        return;
+    }
+    
+    struct kevent change;
+    EV_SET(&change, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+    if (kevent(kq, &change, 1, NULL, 0, NULL) == 0) {
+        watch->fd = kq;
+        return;
+    }
+    
+    watch->exited = errno == ESRCH;
+    close(kq);
+#elif defined(__linux__) && defined(SYS_pidfd_open)
+    watch->fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    watch->exited = watch->fd < 0 && errno == ESRCH;
+#endif
+}
+
+static void process_watch_close(process_watch_t *watch) {
+    if (watch->fd >= 0) {
+        close(watch->fd);
+    }
+    watch->fd = -1;
+}
+
+// Whether the process has exited, without waiting. For loops that only look when they have nothing else to do
+static bool process_exited(process_watch_t *watch) {
+    if (!watch->exited && watch->fd >= 0) {
+        struct pollfd exit_fd = { .fd = watch->fd, .events = POLLIN };
+        watch->exited = poll(&exit_fd, 1, 0) > 0;
+    }
+    else if (!watch->exited) {
+        watch->exited = !pid_exists(watch->pid);
+    }
+    return watch->exited;
+}
+
+// Wait until `fd` is readable, the process exits or the timeout passes. Returns false if the wait failed
+static bool wait_for_input(process_watch_t *watch, int fd, int timeout_ms) {
+    struct pollfd fds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = watch->exited ? -1 : watch->fd, .events = POLLIN },
+    };
+    int ready = poll(fds, 2, timeout_ms);
+    if (ready < 0) {
+        // A signal, which the loop will see in `running`
+        return errno == EINTR;
+    }
+    
+    if (fds[1].revents != 0) {
+        watch->exited = true;
+    }
+    else if (ready == 0 && watch->fd < 0 && !watch->exited) {
+        watch->exited = !pid_exists(watch->pid);
+    }
+    return true;
+}
+
 static int setup_socket(tracer_transport_config_t config) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
@@ -110,48 +509,217 @@ static int setup_socket(tracer_transport_config_t config) {
     return fd;
 }
 
-int run_trace_server(tracer_config_t *config, pid_t traced_pid) {
-    setbuf(stdout, NULL);
+// Listen on a unix domain socket before the traced process starts, so it can connect on its first try
+static int setup_unix_socket(tracer_transport_config_t *config) {
+    int fd = -1;
+    if (config->seqpacket) {
+        fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (fd < 0) {
+            printf("SOCK_SEQPACKET is not supported, using a stream socket\n");
+            config->seqpacket = false;
+        }
+    }
+    if (fd < 0) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    if (fd < 0) {
+        printf("Socket creation failed\n");
+        return -1;
+    }
     
-    struct sigaction sa = {
-        .sa_handler = handle_signal,
-        .sa_flags = 0,
+    int buffer_size = UNIX_SOCKET_BUFFER_SIZE;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) < 0) {
+        printf("setsockopt(SO_RCVBUF) failed\n");
+    }
+    
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
     };
-    sigemptyset(&sa.sa_mask);
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
+    strlcpy(addr.sun_path, config->socket_path, sizeof(addr.sun_path));
+    
+    // Left behind by an earlier run that didn't exit cleanly
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("Bind failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    // The traced app usually runs as a different user than the CLI. Connections are checked against its pid instead
+    chmod(addr.sun_path, 0777);
+    if (listen(fd, 4) < 0) {
+        printf("Listen failed\n");
+        close(fd);
+        unlink(addr.sun_path);
+        return -1;
+    }
+    
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    return fd;
+}
+
+static pid_t socket_peer_pid(int fd) {
+#if defined(LOCAL_PEERPID)
+    pid_t pid = -1;
+    socklen_t length = sizeof(pid);
+    if (getsockopt(fd, SOL_LOCAL, LOCAL_PEERPID, &pid, &length) == 0) {
+        return pid;
+    }
+#elif defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+        return credentials.pid;
+    }
+#endif
+    return -1;
+}
+
+// Drop the first `consumed` bytes of a buffer, keeping the rest for the next read
+static void discard_consumed(output_buffer_t *buffer, size_t consumed) {
+    size_t remaining = buffer->length - consumed;
+    if (remaining > 0 && consumed > 0) {
+        memmove(buffer->data, buffer->data + consumed, remaining);
+    }
+    buffer->length = remaining;
+    if (buffer->data) {
+        buffer->data[buffer->length] = '\0';
+    }
+}
+
+// Print every complete message in `received`, keeping any partial one for the next read
+static bool process_messages(trace_stream_t *stream, output_buffer_t *received) {
+    if (received->length == 0) {
+        return true;
+    }
+    
+    if (!stream->type_known) {
+        stream->type_known = true;
+        if (received->data[0] == '\0') {
+            stream->decoder = event_decoder_create();
+            if (stream->decoder == NULL) {
+                trace_output_printf("Failed to create event decoder\n");
+                return false;
+            }
+            event_decoder_set_dropped_callback(stream->decoder, print_dropped_events, &stream->render);
+            event_decoder_set_main_thread_callback(stream->decoder, record_main_thread, NULL);
+        }
+        else if (trace_recorder || trace_column_writer) {
+            trace_output_printf("Only binary traces can be recorded, so this one won't be\n");
+            finish_trace_recording();
+        }
+        
+        if (stream->decoder == NULL && folded_stacks) {
+            trace_output_printf("Only binary traces have the names and depths folded stacks need, so none will be written\n");
+            folded_stacks_destroy(folded_stacks);
+            folded_stacks = NULL;
+        }
+        
+        if (stream->decoder == NULL && trace_exporter) {
+            trace_output_printf("Only binary traces have the timestamps a timeline needs, so the export will be empty\n");
+            finish_trace_export();
+        }
+    }
+    
+    size_t consumed = 0;
+    if (stream->decoder) {
+        kern_return_t kr = event_decoder_decode(stream->decoder, (const uint8_t *)received->data, received->length, &consumed, print_decoded_event, &stream->render);
+        if (kr != KERN_SUCCESS) {
+            trace_output_printf("Failed to decode event stream: %d\n", kr);
+            return false;
+        }
+    }
+    else {
+        consumed = print_json_lines(&stream->render, received->data, received->length);
+    }
+    
+    // Keep any partial message for the next read
+    discard_consumed(received, consumed);
+    return true;
+}
+
+// Print every complete message received so far, decompressing first if the stream is compressed
+static bool process_received(trace_stream_t *stream) {
+    output_buffer_t *received = &stream->received;
+    if (!stream->compression_known && received->length > 0) {
+        // Compressed and binary streams both start with a NUL, followed by magics of the same length
+        if (received->data[0] == '\0' && received->length < COMPRESSED_STREAM_MAGIC_LENGTH) {
+            return true;
+        }
+        
+        stream->compression_known = true;
+        stream->compressed = received->data[0] == '\0' && memcmp(received->data, COMPRESSED_STREAM_MAGIC, COMPRESSED_STREAM_MAGIC_LENGTH) == 0;
+    }
+    
+    if (!stream->compressed) {
+        return process_messages(stream, received);
+    }
+    
+    size_t consumed = 0;
+    kern_return_t kr = stream_decompress(&stream->decompressor, (const uint8_t *)received->data, received->length, &consumed, &stream->decompressed);
+    if (kr != KERN_SUCCESS) {
+        trace_output_printf("Failed to decompress event stream: %d\n", kr);
+        return false;
+    }
     
-    server_fd = setup_socket(config->transport_config);
+    discard_consumed(received, consumed);
+    return process_messages(stream, &stream->decompressed);
+}
+
+static int receive_from_socket(trace_stream_t *stream, tracer_config_t *config, pid_t traced_pid) {
+    bool unix_socket = config->transport == TRACER_TRANSPORT_UNIX;
+    if (!unix_socket) {
+        server_fd = setup_socket(config->transport_config);
+    }
     if (server_fd < 0) {
         return 1;
     }
     
+    process_watch_t watch;
+    process_watch_open(&watch, traced_pid);
+    
     // Accept client connection
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
     time_t start_time = time(NULL);
-    while (pid_exists(traced_pid) && (time(NULL) - start_time) < ACCEPT_TIMEOUT_SECONDS) {
-        client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
+    while (running && !watch.exited && (time(NULL) - start_time) < ACCEPT_TIMEOUT_SECONDS) {
+        if (!wait_for_input(&watch, server_fd, SERVER_WAKE_INTERVAL_MS)) {
+            printf("Waiting for a connection failed: %s\n", strerror(errno));
+            break;
+        }
+        
+        client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd >= 0 && unix_socket) {
+            // Anyone on the machine can reach the socket. Only the traced process gets to send events
+            pid_t peer_pid = socket_peer_pid(client_fd);
+            if (peer_pid != traced_pid) {
+                printf("Rejected connection from pid %d\n", peer_pid);
+                close(client_fd);
+                client_fd = -1;
+                continue;
+            }
+        }
+        
         if (client_fd >= 0) {
             printf("Client connected successfully\n");
             break;
         }
         
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
             printf("Accept failed with error: %s\n", strerror(errno));
             break;
         }
-        usleep(10000);
     }
     
     if (client_fd < 0) {
-        if (!pid_exists(traced_pid)) {
+        if (process_exited(&watch)) {
             printf("Target process %d terminated before connection could be established\n", traced_pid);
         }
         else {
             printf("Target process %d is running but a connection could not be established\n", traced_pid);
         }
+        process_watch_close(&watch);
         close(server_fd);
+        server_fd = -1;
         return 1;
     }
     
@@ -159,50 +727,46 @@ int run_trace_server(tracer_config_t *config, pid_t traced_pid) {
     int flags = fcntl(client_fd, F_GETFL, 0);
     fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
     
-    char buffer[8192] = {0};
-    size_t buffer_pos = 0;
-
-    while (running && pid_exists(traced_pid)) {
+    // Sleeps until there's something to read or the process exits, then reads as much as has arrived at once
+    output_buffer_t *received = &stream->received;
+    while (running) {
+        if (!wait_for_input(&watch, client_fd, SERVER_WAKE_INTERVAL_MS)) {
+            trace_output_printf("Waiting for events failed: %s\n", strerror(errno));
+            break;
+        }
+        
+        if (!output_buffer_reserve(received, RECV_BUFFER_SIZE)) {
+            trace_output_printf("Failed to allocate receive buffer\n");
+            break;
+        }
 
-        ssize_t bytes_read = recv(client_fd, buffer + buffer_pos, sizeof(buffer) - buffer_pos - 1, 0);
+        ssize_t bytes_read = recv(client_fd, received->data + received->length, RECV_BUFFER_SIZE, 0);
         if (bytes_read > 0) {
             
-            buffer_pos += bytes_read;
-            buffer[buffer_pos] = '\0';
-            
-            char *json_start = buffer;
-            char *json_end = buffer;
-            while ((json_end = strchr(json_start, '\n')) != NULL) {
-                size_t json_len = json_end - json_start;
-                if (json_len > 0) {
-                    *json_end = '\0';
-                    print_json_event_formatted_output(json_start, (int)json_len);
-                    *json_end = '\n';
-                }
-                json_start = json_end + 1;
-            }
+            received->length += bytes_read;
+            received->data[received->length] = '\0';
             
-            size_t remaining = buffer + buffer_pos - json_start;
-            if (remaining > 0 && remaining < sizeof(buffer)) {
-                memmove(buffer, json_start, remaining);
-                buffer_pos = remaining;
-            }
-            else {
-                buffer_pos = 0;
+            if (!process_received(stream)) {
+                break;
             }
         }
         else if (bytes_read == 0) {
-            printf("Traced process disconnected\n");
+            trace_output_printf("Traced process disconnected\n");
             break;
         }
-        else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            printf("recv failed\n");
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            trace_output_printf("recv failed\n");
+            break;
+        }
+        else if (watch.exited) {
+            // Everything it sent before it exited has been read
             break;
         }
         
-        usleep(1000);
+        write_folded_stacks_if_due();
     }
     
+    process_watch_close(&watch);
     if (client_fd >= 0) {
         close(client_fd);
     }
@@ -213,3 +777,393 @@ int run_trace_server(tracer_config_t *config, pid_t traced_pid) {
     
     return 0;
 }
+
+static int receive_from_shm(trace_stream_t *stream, pid_t traced_pid) {
+    shm_ring_header_t *header = trace_shm->header;
+    process_watch_t watch;
+    process_watch_open(&watch, traced_pid);
+    
+    // The traced process maps the ring when its tracer starts
+    time_t start_time = time(NULL);
+    while (running && atomic_load_explicit(&header->producers, memory_order_relaxed) == 0) {
+        if (process_exited(&watch)) {
+            printf("Target process %d terminated before it mapped the shared memory ring\n", traced_pid);
+            process_watch_close(&watch);
+            return 1;
+        }
+        
+        if ((time(NULL) - start_time) >= ACCEPT_TIMEOUT_SECONDS) {
+            printf("Target process %d is running but did not map the shared memory ring\n", traced_pid);
+            process_watch_close(&watch);
+            return 1;
+        }
+        usleep(10000);
+    }
+    printf("Client connected successfully\n");
+    
+    uint64_t dropped_reported = 0;
+    while (running) {
+        if (shm_ring_read(trace_shm, &stream->received) == 0) {
+            // Only checked once the ring is empty, so everything the process wrote before it exited is still printed.
+            // Its last writes can land between the read and the check, so the ring is read once more after it exits
+            if (!process_exited(&watch)) {
+                shm_ring_wait(trace_shm, SHM_WAIT_TIMEOUT_MS);
+                write_folded_stacks_if_due();
+                continue;
+            }
+            
+            if (shm_ring_read(trace_shm, &stream->received) == 0) {
+                break;
+            }
+        }
+        
+        if (stream->received.failed) {
+            trace_output_printf("Failed to allocate receive buffer\n");
+            break;
+        }
+        else if (!process_received(stream)) {
+            break;
+        }
+        
+        // Producers count drops in the ring itself, since there was no room to tell us
+        uint64_t dropped = atomic_load_explicit(&header->dropped, memory_order_relaxed);
+        if (dropped != dropped_reported) {
+            print_dropped_events(dropped - dropped_reported, NULL);
+            dropped_reported = dropped;
+        }
+        
+        write_folded_stacks_if_due();
+    }
+    
+    process_watch_close(&watch);
+    return 0;
+}
+
+static void close_trace_shm(void) {
+    shm_ring_close(trace_shm);
+    trace_shm = NULL;
+}
+
+static void remove_trace_socket(void) {
+    unlink(trace_socket_path);
+}
+
+static int prepare_unix_socket(tracer_config_t *config) {
+    snprintf(trace_socket_path, sizeof(trace_socket_path), "/tmp/objsee.%d.sock", getpid());
+    config->transport_config.socket_path = trace_socket_path;
+    server_fd = setup_unix_socket(&config->transport_config);
+    if (server_fd < 0) {
+        return 1;
+    }
+    
+    atexit(remove_trace_socket);
+    return 0;
+}
+
+int prepare_trace_server(tracer_config_t *config) {
+    if (config->transport == TRACER_TRANSPORT_UNIX) {
+        return prepare_unix_socket(config);
+    }
+    
+    if (config->transport != TRACER_TRANSPORT_SHM) {
+        return 0;
+    }
+    
+    // The ring itself is created by open_trace_shm(), once it's known which user the traced process runs as
+    snprintf(trace_shm_name, sizeof(trace_shm_name), "/objsee.%d", getpid());
+    config->transport_config.shm_name = trace_shm_name;
+    return 0;
+}
+
+static bool process_uid(pid_t pid, uid_t *out_uid) {
+#if defined(__APPLE__)
+    int mib[] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+    struct kinfo_proc info;
+    size_t size = sizeof(info);
+    if (sysctl(mib, 4, &info, &size, NULL, 0) != 0 || size == 0) {
+        return false;
+    }
+    *out_uid = info.kp_eproc.e_ucred.cr_uid;
+    return true;
+#else
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d", pid);
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return false;
+    }
+    *out_uid = info.st_uid;
+    return true;
+#endif
+}
+
+int open_trace_shm(pid_t traced_pid) {
+    if (trace_shm_name[0] == '\0' || trace_shm) {
+        return 0;
+    }
+    
+    uid_t cli_uid = geteuid();
+    uid_t traced_uid = cli_uid;
+    if (traced_pid > 0 && !process_uid(traced_pid, &traced_uid)) {
+        printf("Failed to look up which user process %d runs as\n", traced_pid);
+        return 1;
+    }
+    
+    // The traced app usually runs as a different user than the CLI. Rather than opening the ring up to everyone,
+    // root creates it as the app's user, then goes back to being root. Root can still map it after that
+    if (traced_uid != cli_uid && (cli_uid != 0 || seteuid(traced_uid) != 0)) {
+        printf("Process %d runs as another user, so only root can give it a shared memory ring\n", traced_pid);
+        return 1;
+    }
+    trace_shm = shm_ring_create(trace_shm_name, SHM_RING_DEFAULT_CAPACITY);
+    int create_errno = errno;
+    if (traced_uid != cli_uid && seteuid(cli_uid) != 0) {
+        printf("Failed to switch back to user %u: %s\n", cli_uid, strerror(errno));
+        exit(1);
+    }
+    
+    if (trace_shm == NULL) {
+        printf("Failed to create shared memory ring: %s\n", strerror(create_errno));
+        return 1;
+    }
+    
+    // Don't leave the shared memory object behind on any exit path
+    atexit(close_trace_shm);
+    return 0;
+}
+
+static void free_trace_stream(trace_stream_t *stream) {
+    event_decoder_free(stream->decoder);
+    output_buffer_free(&stream->render.line);
+    output_buffer_free(&stream->render.json);
+    output_buffer_free(&stream->received);
+    output_buffer_free(&stream->decompressed);
+}
+
+int start_trace_recording(const char *record_path, const char *columns_path) {
+    if (record_path) {
+        trace_recorder = trace_recorder_create(record_path, 0);
+        if (trace_recorder == NULL) {
+            printf("Failed to create recording %s: %s\n", record_path, strerror(errno));
+            return 1;
+        }
+    }
+    
+    if (columns_path) {
+        trace_column_writer = trace_column_writer_create(columns_path);
+        if (trace_column_writer == NULL) {
+            printf("Failed to create columnar trace %s: %s\n", columns_path, strerror(errno));
+            return 1;
+        }
+    }
+    
+    // Runs however the trace ends, so the chunk index and the last blocks are always written
+    atexit(finish_trace_recording);
+    return 0;
+}
+
+int start_folded_stacks(const char *path, bool weight_by_calls) {
+    folded_stacks = folded_stacks_create();
+    if (folded_stacks == NULL) {
+        printf("Failed to allocate folded stacks\n");
+        return 1;
+    }
+    
+    folded_path = path;
+    folded_weight = weight_by_calls ? FOLDED_STACKS_WEIGHT_CALLS : FOLDED_STACKS_WEIGHT_DURATION;
+    folded_written_at = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    atexit(finish_folded_stacks);
+    return 0;
+}
+
+int start_trace_export(const char *path) {
+    trace_exporter = trace_exporter_create(path, trace_export_format_for_path(path));
+    if (trace_exporter == NULL) {
+        printf("Failed to create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    
+    // Slices still open when the trace ends are closed and the file finished however the process exits
+    atexit(finish_trace_export);
+    return 0;
+}
+
+// Print or replay each chunk of a recording in order, through the same path as events received live
+static int replay_recording(trace_stream_t *stream, const char *path) {
+    trace_recording_t *recording = trace_recording_open(path);
+    if (recording == NULL) {
+        printf("Failed to open %s as a recording\n", path);
+        return 1;
+    }
+    
+    if (recording->has_main_thread) {
+        record_main_thread(recording->main_thread_id, NULL);
+    }
+    
+    trace_replay_t *replay = stream->render.replay;
+    int status = 0;
+    for (size_t i = 0; i < recording->chunk_count && !(replay && replay->stopped); i++) {
+        if (trace_recording_decode_chunk(trace_recording_chunk(recording, i), print_decoded_event, print_dropped_events, &stream->render) != KERN_SUCCESS) {
+            printf("Failed to decode chunk %zu of %s\n", i, path);
+            status = 1;
+            break;
+        }
+        write_folded_stacks_if_due();
+    }
+    
+    if (status == 0 && !recording->complete && (replay == NULL || replay->options->handle_line == NULL)) {
+        printf("[objsee] %s was never closed, so the end of the trace may be missing\n", path);
+    }
+    trace_recording_close(recording);
+    return status;
+}
+
+// Print a trace file, or replay it when `replay` is set
+static int read_trace(tracer_config_t *config, const char *path, trace_replay_t *replay) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    
+    size_t file_size = (size_t)file_stat.st_size;
+    const uint8_t *file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        printf("Failed to read %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    
+    trace_stream_t stream = {
+        .render = {
+            .format = &config->format,
+            .replay = replay,
+        },
+    };
+    
+    if (trace_recording_matches(file, file_size)) {
+        munmap((void *)file, file_size);
+        // Folded stacks, exports and the log are built from the events as they're printed, which a query doesn't do
+        if (replay == NULL && folded_stacks == NULL && trace_exporter == NULL && !trace_output_has_log()) {
+            return query_trace_recording(config, path, 0, NULL);
+        }
+        
+        int status = replay_recording(&stream, path);
+        free_trace_stream(&stream);
+        return status;
+    }
+    
+    // A segment file holds the stream between its header and footer
+    size_t offset = 0;
+    size_t length = file_size;
+    segment_footer_t footer;
+    kern_return_t segment = segment_file_data(file, file_size, &offset, &length, &footer);
+    if (segment == KERN_INVALID_ARGUMENT) {
+        offset = 0;
+        length = file_size;
+    }
+    
+    int status = 0;
+    output_buffer_t *received = &stream.received;
+    for (size_t position = offset; position < offset + length && !(replay && replay->stopped); position += FILE_CHUNK_SIZE) {
+        size_t chunk = MIN((size_t)FILE_CHUNK_SIZE, offset + length - position);
+        if (!output_buffer_reserve(received, chunk)) {
+            printf("Failed to allocate receive buffer\n");
+            status = 1;
+            break;
+        }
+        
+        output_buffer_append(received, (const char *)file + position, chunk);
+        if (!process_received(&stream)) {
+            status = 1;
+            break;
+        }
+        write_folded_stacks_if_due();
+    }
+    
+    if (status == 0 && segment == KERN_SUCCESS && footer.dropped > 0) {
+        print_dropped_events(footer.dropped, &stream.render);
+    }
+    else if (status == 0 && segment == KERN_ABORTED && (replay == NULL || replay->options->handle_line == NULL)) {
+        printf("[objsee] %s was never closed, so the end of the trace may be missing\n", path);
+    }
+    
+    munmap((void *)file, file_size);
+    free_trace_stream(&stream);
+    return status;
+}
+
+int read_trace_file(tracer_config_t *config, const char *path) {
+    return read_trace(config, path, NULL);
+}
+
+int replay_trace_file(tracer_config_t *config, const char *path, const trace_replay_options_t *options) {
+    // A caller that polls decides for itself when to stop
+    if (options->poll == NULL) {
+        struct sigaction sa = {
+            .sa_handler = handle_signal,
+            .sa_flags = 0,
+        };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+    
+    // Rendered events are written out in blocks rather than one write per event
+    if (options->handle_line == NULL) {
+        setvbuf(stdout, NULL, _IOFBF, REPLAY_STDOUT_BUFFER_SIZE);
+    }
+    
+    trace_replay_t replay = {
+        .options = options,
+    };
+    uint64_t started_at = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    int status = read_trace(config, path, &replay);
+    fflush(stdout);
+    
+    double seconds = (double)(clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - started_at) / 1e9;
+    if (status == 0 && options->handle_line == NULL) {
+        fprintf(stderr, "[objsee] Replayed %llu events in %.2f s (%.0f events/s)\n", (unsigned long long)replay.event_count, seconds,
+                seconds > 0 ? (double)replay.event_count / seconds : 0);
+    }
+    return status;
+}
+
+int run_trace_server(tracer_config_t *config, pid_t traced_pid) {
+    // Events are written by the output thread. Anything else is printed as it happens
+    setbuf(stdout, NULL);
+    
+    struct sigaction sa = {
+        .sa_handler = handle_signal,
+        .sa_flags = 0,
+    };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    
+    // The stream type is known from its first byte. The binary preamble starts with a NUL, which json never does
+    trace_stream_t stream = {
+        .render = {
+            .format = &config->format,
+        },
+    };
+    
+    int status;
+    trace_output_start();
+    if (config->transport == TRACER_TRANSPORT_SHM) {
+        status = open_trace_shm(traced_pid) == 0 ? receive_from_shm(&stream, traced_pid) : 1;
+    }
+    else {
+        status = receive_from_socket(&stream, config, traced_pid);
+    }
+    
+    trace_output_stop();
+    free_trace_stream(&stream);
+    return status;
+}
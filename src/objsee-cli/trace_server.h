@@ -8,6 +8,97 @@
 #ifndef TRACE_SERVER_H
 #define TRACE_SERVER_H
 
+/**
+ * Set up anything the traced process needs before it starts. For shared memory transport this
+ * picks the ring's name and stores it in the config. For unix sockets it starts listening and stores the path.
+ * Either way it must be called before the config is encoded
+ *
+ * @param config The configuration to use for the server
+ * @return 0 on success, 1 on error
+ */
+int prepare_trace_server(tracer_config_t *config);
+
+/**
+ * Create the shared memory ring for the traced process, once its pid is known. The ring is only accessible to
+ * the user that creates it, so when the CLI runs as root it's created as the traced process's user. The traced
+ * process waits a few seconds for the ring to appear, so this can be called just after it starts.
+ * Does nothing for other transports, or once the ring exists
+ *
+ * @param traced_pid The pid of the process to trace, or 0 if it runs as the same user as the CLI
+ * @return 0 on success, 1 on error
+ */
+int open_trace_shm(pid_t traced_pid);
+
+/**
+ * Record every event the trace server receives to an indexed recording, which `objsee query` can search,
+ * and/or a columnar trace, which `objsee count` can aggregate. Both are finished when the process exits
+ *
+ * @param record_path Where to write the recording, or NULL
+ * @param columns_path Where to write the columnar trace, or NULL
+ * @return 0 on success, 1 on error
+ */
+int start_trace_recording(const char *record_path, const char *columns_path);
+
+/**
+ * Build flame graph stacks from every event the trace server receives, replays or reads from a file, and keep
+ * them written to a file in "folded" form. The file is rewritten every few seconds, and a last time when the
+ * process exits. Only the distinct stacks are kept, not the events
+ *
+ * @param path Where to write the stacks
+ * @param weight_by_calls Weigh each stack by its number of calls rather than the time spent in it
+ * @return 0 on success, 1 on error
+ */
+int start_folded_stacks(const char *path, bool weight_by_calls);
+
+/**
+ * Export every event the trace server receives, replays or reads from a file as a timeline, with each call
+ * a slice on its thread's track. Paths ending in ".json" get Chrome's trace format, anything else Perfetto's.
+ * The file is streamed as events arrive, and finished when the process exits
+ *
+ * @param path Where to write the timeline
+ * @return 0 on success, 1 on error
+ */
+int start_trace_export(const char *path);
+
+/**
+ * Print a trace that was written to a file, a segment file or a recording, compressed or not
+ *
+ * @param config The configuration to format events with
+ * @param path The file to read
+ * @return 0 on success, 1 on error
+ */
+int read_trace_file(tracer_config_t *config, const char *path);
+
+/**
+ * Receives each line of a replayed trace, NUL-terminated, as json. Binary events are formatted with the config's options
+ * and handed over with their thread and depth, the same fields a live json stream carries. The line isn't needed
+ * afterwards, so the handler may change it, like when reading fields out of it in place
+ */
+typedef void (*trace_replay_line_handler_t)(char *line, int length, void *context);
+
+typedef struct {
+    // Multiple of real time to replay at, going by the events' timestamps. 0 replays as fast as possible.
+    // Json traces have no timestamps, so they're always replayed as fast as possible
+    double speed;
+    // Where each line goes. NULL prints them just like live tracing does
+    trace_replay_line_handler_t handle_line;
+    // Called while waiting for the next event to be due, and every so often when not waiting. Returns false to stop the replay
+    bool (*poll)(void *context);
+    void *context;
+} trace_replay_options_t;
+
+/**
+ * Stream a trace file back through the same rendering as live tracing, either as fast as possible or paced
+ * by the recorded timestamps. Reads the same files as read_trace_file(), but replays recordings in full
+ * rather than querying them
+ *
+ * @param config The configuration to format events with
+ * @param path The file to replay
+ * @param options How fast, and where to
+ * @return 0 on success, 1 on error
+ */
+int replay_trace_file(tracer_config_t *config, const char *path, const trace_replay_options_t *options);
+
 /**
  * Run the trace server on specified port
  *
@@ -0,0 +1,786 @@
+//
+//  trace_stats.c
+//  objsee
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#include <pthread.h>
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "column_scan.h"
+#include "folded_stacks.h"
+#include "trace_columns.h"
+#include "trace_query.h"
+#include "trace_recording.h"
+#include "trace_stats.h"
+
+// Most workers a recording is split between
+#define COUNT_MAX_WORKERS 64
+#define COUNT_THREAD_IDS (UINT16_MAX + 1)
+
+typedef enum {
+    COUNT_BY_SELECTOR,
+    COUNT_BY_CLASS,
+    COUNT_BY_THREAD,
+    // Recordings only: columnar traces don't pair classes with selectors, or keep the order calls were made in
+    COUNT_BY_METHOD,
+    COUNT_BY_STACK,
+} count_grouping_t;
+
+typedef struct {
+    count_grouping_t grouping;
+    // Print only the largest groups. 0 prints them all
+    size_t top;
+    // Workers for a recording. 0 uses one per core
+    size_t jobs;
+    const char *predicates[TRACE_QUERY_MAX_PREDICATES];
+    int predicate_count;
+} count_options_t;
+
+typedef struct {
+    uint32_t value;
+    uint64_t count;
+} stats_group_t;
+
+// Ids matching a query's patterns. A single id is filtered by equality, which is vectorized
+typedef struct {
+    bool active;
+    uint8_t *members;
+    uint32_t member_count;
+    uint32_t matched;
+    uint32_t only_match;
+} id_filter_t;
+
+typedef struct {
+    trace_query_t query;
+    size_t top;
+    trace_column_t group_column;
+    uint32_t group_limit;
+    // Indexed by the grouping column's value
+    uint64_t *counts;
+    id_filter_t class_filter;
+    id_filter_t selector_filter;
+    // One block's worth of each column
+    uint32_t *classes;
+    uint32_t *selectors;
+    uint32_t *threads;
+    uint32_t *depths;
+    uint64_t *timestamps;
+    uint64_t *selection;
+    uint64_t matched;
+    size_t blocks_read;
+} column_count_t;
+
+// Calls counted by method, keyed by pointer. Decoded names are interned, so every worker sees the same pointers
+typedef struct {
+    const char *class_name;
+    const char *method_name;
+    bool is_class_method;
+    uint64_t count;
+} method_count_t;
+
+typedef struct {
+    method_count_t *entries;
+    size_t capacity;
+    size_t count;
+} method_counts_t;
+
+// One worker's share of a recording: chunks [first_chunk, end_chunk), and what it has counted so far
+typedef struct {
+    const trace_recording_t *recording;
+    size_t first_chunk;
+    size_t end_chunk;
+    count_grouping_t grouping;
+    trace_query_matcher_t matcher;
+    // Only the one the grouping needs is used
+    method_counts_t methods;
+    uint64_t *thread_counts;
+    folded_stacks_t *stacks;
+    uint64_t matched;
+    size_t chunks_read;
+    kern_return_t kr;
+    size_t failed_chunk;
+} recording_worker_t;
+
+static bool build_id_filter(id_filter_t *filter, const char *const *names, uint32_t name_count, const char *const *patterns, int pattern_count) {
+    if (pattern_count == 0) {
+        return true;
+    }
+
+    filter->active = true;
+    filter->member_count = name_count;
+    filter->members = calloc(name_count ? name_count : 1, 1);
+    if (filter->members == NULL) {
+        return false;
+    }
+
+    for (uint32_t id = 0; id < name_count; id++) {
+        if (trace_query_name_matches(patterns, pattern_count, names[id])) {
+            filter->members[id] = 1;
+            filter->only_match = id;
+            filter->matched++;
+        }
+    }
+    return true;
+}
+
+static void apply_id_filter(const id_filter_t *filter, const uint32_t *ids, size_t count, uint64_t *selection) {
+    if (filter->matched == 1) {
+        column_filter_u32_range(ids, count, filter->only_match, filter->only_match, selection);
+    }
+    else {
+        column_filter_u32_member(ids, count, filter->members, filter->member_count, selection);
+    }
+}
+
+static int compare_groups(const void *a, const void *b) {
+    const stats_group_t *left = (const stats_group_t *)a;
+    const stats_group_t *right = (const stats_group_t *)b;
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+    return left->value < right->value ? -1 : left->value > right->value;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static bool parse_grouping(const char *grouping, count_grouping_t *out_grouping) {
+    if (strcmp(grouping, "selector") == 0 || strcmp(grouping, "sel") == 0) {
+        *out_grouping = COUNT_BY_SELECTOR;
+    }
+    else if (strcmp(grouping, "class") == 0) {
+        *out_grouping = COUNT_BY_CLASS;
+    }
+    else if (strcmp(grouping, "thread") == 0) {
+        *out_grouping = COUNT_BY_THREAD;
+    }
+    else if (strcmp(grouping, "method") == 0) {
+        *out_grouping = COUNT_BY_METHOD;
+    }
+    else if (strcmp(grouping, "stack") == 0) {
+        *out_grouping = COUNT_BY_STACK;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_positive(const char *string, size_t *out) {
+    char *end = NULL;
+    if (*string < '1' || *string > '9') {
+        return false;
+    }
+    *out = strtoul(string, &end, 10);
+    return *end == '\0';
+}
+
+// by=, top= and jobs= shape the counting. Everything else is a query predicate
+static bool parse_count_options(int predicate_count, const char **predicates, count_options_t *options) {
+    for (int i = 0; i < predicate_count; i++) {
+        const char *predicate = predicates[i];
+        if (strncmp(predicate, "by=", 3) == 0) {
+            if (!parse_grouping(predicate + 3, &options->grouping)) {
+                printf("Error: Can't count by '%s'. Use by=selector, by=class, by=method, by=thread or by=stack\n", predicate + 3);
+                return false;
+            }
+        }
+        else if (strncmp(predicate, "top=", 4) == 0) {
+            if (!parse_positive(predicate + 4, &options->top)) {
+                printf("Error: Invalid count '%s'\n", predicate);
+                return false;
+            }
+        }
+        else if (strncmp(predicate, "jobs=", 5) == 0) {
+            if (!parse_positive(predicate + 5, &options->jobs)) {
+                printf("Error: Invalid count '%s'\n", predicate);
+                return false;
+            }
+        }
+        else if (options->predicate_count == TRACE_QUERY_MAX_PREDICATES) {
+            printf("Error: Too many query predicates, at most %d can be given\n", TRACE_QUERY_MAX_PREDICATES);
+            return false;
+        }
+        else {
+            options->predicates[options->predicate_count++] = predicate;
+        }
+    }
+
+    if (options->grouping == COUNT_BY_STACK && options->top > 0) {
+        printf("Error: top= doesn't apply to by=stack\n");
+        return false;
+    }
+    return true;
+}
+
+static bool prepare_column_count(column_count_t *count, const trace_columns_t *columns) {
+    trace_column_t group = count->group_column;
+    count->group_limit = group == TRACE_COLUMN_SELECTOR ? columns->selector_count : group == TRACE_COLUMN_CLASS ? columns->class_count : UINT16_MAX + 1;
+    count->counts = calloc(count->group_limit ? count->group_limit : 1, sizeof(uint64_t));
+    count->classes = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint32_t));
+    count->selectors = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint32_t));
+    count->threads = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint32_t));
+    count->depths = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint32_t));
+    count->timestamps = malloc(COLUMNS_BLOCK_EVENTS * sizeof(uint64_t));
+    count->selection = malloc(COLUMN_SELECTION_WORDS(COLUMNS_BLOCK_EVENTS) * sizeof(uint64_t));
+    if (count->counts == NULL || count->classes == NULL || count->selectors == NULL || count->threads == NULL || count->depths == NULL ||
+        count->timestamps == NULL || count->selection == NULL) {
+        return false;
+    }
+
+    const trace_query_t *query = &count->query;
+    return build_id_filter(&count->class_filter, columns->class_names, columns->class_count, query->class_patterns, query->class_pattern_count) &&
+        build_id_filter(&count->selector_filter, columns->selectors, columns->selector_count, query->selector_patterns, query->selector_pattern_count);
+}
+
+static void free_column_count(column_count_t *count) {
+    free(count->class_filter.members);
+    free(count->selector_filter.members);
+    free(count->classes);
+    free(count->selectors);
+    free(count->threads);
+    free(count->depths);
+    free(count->timestamps);
+    free(count->selection);
+    free(count->counts);
+}
+
+// Narrow one block down to the rows that match, then count them by the grouping column
+static bool count_block(column_count_t *count, const column_block_header_t *block, uint64_t start_time, uint64_t end_time) {
+    const trace_query_t *query = &count->query;
+    size_t rows = block->event_count;
+    bool decoded = true;
+
+    // Each column is decoded at most once, and only if something needs it
+    bool class_decoded = false;
+    bool selector_decoded = false;
+    bool thread_decoded = false;
+    column_selection_fill(count->selection, rows);
+    if (count->class_filter.active) {
+        decoded &= trace_columns_decode_u32(block, TRACE_COLUMN_CLASS, count->classes) == KERN_SUCCESS;
+        apply_id_filter(&count->class_filter, count->classes, rows, count->selection);
+        class_decoded = true;
+    }
+    if (count->selector_filter.active) {
+        decoded &= trace_columns_decode_u32(block, TRACE_COLUMN_SELECTOR, count->selectors) == KERN_SUCCESS;
+        apply_id_filter(&count->selector_filter, count->selectors, rows, count->selection);
+        selector_decoded = true;
+    }
+    if (query->has_thread) {
+        decoded &= trace_columns_decode_u32(block, TRACE_COLUMN_THREAD, count->threads) == KERN_SUCCESS;
+        column_filter_u32_range(count->threads, rows, query->thread_id, query->thread_id, count->selection);
+        thread_decoded = true;
+    }
+    if (query->min_depth > 0 || query->max_depth < UINT32_MAX) {
+        decoded &= trace_columns_decode_u32(block, TRACE_COLUMN_DEPTH, count->depths) == KERN_SUCCESS;
+        column_filter_u32_range(count->depths, rows, query->min_depth, query->max_depth, count->selection);
+    }
+    if (query->start_ns > 0 || query->end_ns < UINT64_MAX) {
+        decoded &= trace_columns_decode_u64(block, TRACE_COLUMN_TIMESTAMP, count->timestamps) == KERN_SUCCESS;
+        column_filter_u64_range(count->timestamps, rows, start_time, end_time, count->selection);
+    }
+
+    uint32_t *values = count->selectors;
+    bool values_decoded = selector_decoded;
+    if (count->group_column == TRACE_COLUMN_CLASS) {
+        values = count->classes;
+        values_decoded = class_decoded;
+    }
+    else if (count->group_column == TRACE_COLUMN_THREAD) {
+        values = count->threads;
+        values_decoded = thread_decoded;
+    }
+    if (!values_decoded) {
+        decoded &= trace_columns_decode_u32(block, count->group_column, values) == KERN_SUCCESS;
+    }
+
+    if (!decoded) {
+        return false;
+    }
+
+    column_count_values(values, rows, count->selection, count->counts, count->group_limit);
+    count->matched += column_selection_count(count->selection, rows);
+    count->blocks_read++;
+    return true;
+}
+
+static bool count_blocks(column_count_t *count, const trace_columns_t *columns, const char *path) {
+    // Times in the query are relative to the first event
+    uint64_t trace_start = UINT64_MAX;
+    for (size_t i = 0; i < columns->block_count; i++) {
+        if (columns->blocks[i]->event_count > 0 && columns->blocks[i]->first_timestamp < trace_start) {
+            trace_start = columns->blocks[i]->first_timestamp;
+        }
+    }
+    if (trace_start == UINT64_MAX) {
+        trace_start = 0;
+    }
+
+    trace_query_t *query = &count->query;
+    uint64_t start_time = query->start_ns > UINT64_MAX - trace_start ? UINT64_MAX : trace_start + query->start_ns;
+    uint64_t end_time = query->end_ns > UINT64_MAX - trace_start ? UINT64_MAX : trace_start + query->end_ns;
+
+    if (query->main_thread) {
+        if (!columns->has_main_thread) {
+            printf("%s doesn't say which thread is main, so thread=main can't be used with it\n", path);
+            return false;
+        }
+        query->thread_id = columns->main_thread_id;
+    }
+
+    for (size_t i = 0; i < columns->block_count; i++) {
+        const column_block_header_t *block = columns->blocks[i];
+        if (block->event_count == 0 || block->last_timestamp < start_time || block->first_timestamp > end_time) {
+            continue;
+        }
+
+        if (!count_block(count, block, start_time, end_time)) {
+            printf("Failed to decode block %zu of %s\n", i, path);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Print the non-zero counts, largest first. Values are names[value], or thread ids if there are no names
+static bool print_counts(const uint64_t *counts, uint32_t limit, const char *const *names, size_t top) {
+    size_t group_count = 0;
+    stats_group_t *groups = malloc((limit ? limit : 1) * sizeof(stats_group_t));
+    if (groups == NULL) {
+        return false;
+    }
+
+    for (uint32_t value = 0; value < limit; value++) {
+        if (counts[value] > 0) {
+            groups[group_count++] = (stats_group_t){ .value = value, .count = counts[value] };
+        }
+    }
+    qsort(groups, group_count, sizeof(stats_group_t), compare_groups);
+
+    if (top > 0 && group_count > top) {
+        group_count = top;
+    }
+    for (size_t i = 0; i < group_count; i++) {
+        if (names == NULL) {
+            printf("%12llu  0x%x\n", (unsigned long long)groups[i].count, groups[i].value);
+        }
+        else {
+            printf("%12llu  %s\n", (unsigned long long)groups[i].count, names[groups[i].value]);
+        }
+    }
+    free(groups);
+    return true;
+}
+
+static bool print_groups(const column_count_t *count, const trace_columns_t *columns) {
+    const char *const *names = NULL;
+    if (count->group_column == TRACE_COLUMN_CLASS) {
+        names = columns->class_names;
+    }
+    else if (count->group_column == TRACE_COLUMN_SELECTOR) {
+        names = columns->selectors;
+    }
+    return print_counts(count->counts, count->group_limit, names, count->top);
+}
+
+static int count_columns(trace_columns_t *columns, const char *path, const count_options_t *options, const trace_query_t *query) {
+    if (options->grouping == COUNT_BY_METHOD || options->grouping == COUNT_BY_STACK) {
+        printf("Error: Counting by method or stack needs a recording, made with --record\n");
+        return 1;
+    }
+
+    column_count_t count = {
+        .query = *query,
+        .top = options->top,
+        .group_column = options->grouping == COUNT_BY_CLASS ? TRACE_COLUMN_CLASS : options->grouping == COUNT_BY_THREAD ? TRACE_COLUMN_THREAD : TRACE_COLUMN_SELECTOR,
+    };
+
+    int status = 0;
+    uint64_t started_at = monotonic_ns();
+    if (!prepare_column_count(&count, columns)) {
+        printf("Failed to allocate memory for counting\n");
+        status = 1;
+    }
+    else if (!count_blocks(&count, columns, path) || !print_groups(&count, columns)) {
+        status = 1;
+    }
+    else {
+        fprintf(stderr, "[objsee] %llu of %llu events matched, %zu of %zu blocks read in %.1f ms\n", (unsigned long long)count.matched,
+                (unsigned long long)columns->event_count, count.blocks_read, columns->block_count, (double)(monotonic_ns() - started_at) / 1e6);
+    }
+
+    free_column_count(&count);
+    return status;
+}
+
+static size_t hash_method(const method_count_t *method) {
+    uint64_t value = (uint64_t)(uintptr_t)method->class_name * 0x9e3779b97f4a7c15ULL;
+    value ^= ((uint64_t)(uintptr_t)method->method_name | method->is_class_method) * 0xc2b2ae3d27d4eb4fULL;
+    return (size_t)(value ^ (value >> 32));
+}
+
+static bool method_counts_grow(method_counts_t *table) {
+    size_t new_capacity = table->capacity ? table->capacity * 2 : 1024;
+    method_count_t *entries = calloc(new_capacity, sizeof(method_count_t));
+    if (entries == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].count == 0) {
+            continue;
+        }
+
+        size_t index = hash_method(&table->entries[i]) & (new_capacity - 1);
+        while (entries[index].count != 0) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        entries[index] = table->entries[i];
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = new_capacity;
+    return true;
+}
+
+// Add to a method's count. Either name can be NULL, to count by the other alone
+static bool method_counts_add(method_counts_t *table, const char *class_name, const char *method_name, bool is_class_method, uint64_t count) {
+    if ((table->count + 1) * 2 > table->capacity && !method_counts_grow(table)) {
+        return false;
+    }
+
+    method_count_t key = {
+        .class_name = class_name,
+        .method_name = method_name,
+        .is_class_method = is_class_method,
+    };
+    size_t mask = table->capacity - 1;
+    size_t index = hash_method(&key) & mask;
+    while (table->entries[index].count != 0) {
+        method_count_t *entry = &table->entries[index];
+        if (entry->class_name == class_name && entry->method_name == method_name && entry->is_class_method == is_class_method) {
+            entry->count += count;
+            return true;
+        }
+        index = (index + 1) & mask;
+    }
+
+    key.count = count;
+    table->entries[index] = key;
+    table->count++;
+    return true;
+}
+
+static int compare_names(const char *a, const char *b) {
+    if (a == NULL || b == NULL) {
+        return (a != NULL) - (b != NULL);
+    }
+    return strcmp(a, b);
+}
+
+// Largest first, then by name, so the order doesn't depend on where the names happen to live in memory
+static int compare_methods(const void *a, const void *b) {
+    const method_count_t *left = (const method_count_t *)a;
+    const method_count_t *right = (const method_count_t *)b;
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+
+    int order = compare_names(left->class_name, right->class_name);
+    if (order == 0) {
+        order = compare_names(left->method_name, right->method_name);
+    }
+    return order != 0 ? order : left->is_class_method - right->is_class_method;
+}
+
+static void count_recorded_event(const tracer_event_t *event, void *context) {
+    recording_worker_t *worker = (recording_worker_t *)context;
+    bool matches = trace_query_event_matches(&worker->matcher, event);
+    if (worker->grouping == COUNT_BY_STACK) {
+        // Every event moves its thread's stack, whether it's counted or not
+        kern_return_t kr = folded_stacks_add_event(worker->stacks, event, matches);
+        if (kr != KERN_SUCCESS && worker->kr == KERN_SUCCESS) {
+            worker->kr = kr;
+        }
+    }
+    else if (!matches) {
+        return;
+    }
+    else if (worker->grouping == COUNT_BY_THREAD) {
+        worker->thread_counts[event->thread_id]++;
+    }
+    else if (!method_counts_add(&worker->methods, event->class_name, event->method_name, event->is_class_method, 1)) {
+        worker->kr = KERN_RESOURCE_SHORTAGE;
+    }
+    worker->matched += matches;
+}
+
+static void *run_recording_worker(void *context) {
+    recording_worker_t *worker = (recording_worker_t *)context;
+    for (size_t i = worker->first_chunk; i < worker->end_chunk && worker->kr == KERN_SUCCESS; i++) {
+        const recording_chunk_header_t *chunk = trace_recording_chunk(worker->recording, i);
+        // Stacks are built from every event, so no chunk can be skipped when counting them
+        if (worker->grouping != COUNT_BY_STACK && !trace_query_chunk_may_match(chunk, worker->matcher.query, worker->matcher.recording_start)) {
+            continue;
+        }
+
+        worker->chunks_read++;
+        kern_return_t kr = trace_recording_decode_chunk(chunk, count_recorded_event, NULL, worker);
+        if (kr != KERN_SUCCESS) {
+            worker->kr = kr;
+            worker->failed_chunk = i;
+        }
+    }
+    return NULL;
+}
+
+static bool prepare_recording_worker(recording_worker_t *worker, count_grouping_t grouping) {
+    worker->grouping = grouping;
+    worker->failed_chunk = SIZE_MAX;
+    if (grouping == COUNT_BY_STACK) {
+        worker->stacks = folded_stacks_create();
+        return worker->stacks != NULL;
+    }
+    if (grouping == COUNT_BY_THREAD) {
+        worker->thread_counts = calloc(COUNT_THREAD_IDS, sizeof(uint64_t));
+        return worker->thread_counts != NULL;
+    }
+    return true;
+}
+
+static void free_recording_worker(recording_worker_t *worker) {
+    trace_query_matcher_free(&worker->matcher);
+    folded_stacks_destroy(worker->stacks);
+    free(worker->thread_counts);
+    free(worker->methods.entries);
+}
+
+// Fold a worker's results into the first worker's. Workers are merged in the order of their chunks
+static kern_return_t merge_recording_worker(recording_worker_t *into, const recording_worker_t *worker) {
+    into->matched += worker->matched;
+    into->chunks_read += worker->chunks_read;
+    if (worker->stacks != NULL) {
+        return folded_stacks_merge(into->stacks, worker->stacks);
+    }
+
+    if (worker->thread_counts != NULL) {
+        for (size_t i = 0; i < COUNT_THREAD_IDS; i++) {
+            into->thread_counts[i] += worker->thread_counts[i];
+        }
+        return KERN_SUCCESS;
+    }
+
+    for (size_t i = 0; i < worker->methods.capacity; i++) {
+        const method_count_t *entry = &worker->methods.entries[i];
+        if (entry->count > 0 && !method_counts_add(&into->methods, entry->class_name, entry->method_name, entry->is_class_method, entry->count)) {
+            return KERN_RESOURCE_SHORTAGE;
+        }
+    }
+    return KERN_SUCCESS;
+}
+
+// Each chunk is a complete stream, so contiguous runs of them are handed to workers that decode, filter and count
+// on their own. Splitting by position rather than interleaving keeps each worker's stacks continuous
+static bool run_recording_workers(recording_worker_t *workers, size_t worker_count, const trace_recording_t *recording, const char *path) {
+    pthread_t threads[COUNT_MAX_WORKERS];
+    bool started[COUNT_MAX_WORKERS] = {false};
+    for (size_t i = 0; i < worker_count; i++) {
+        workers[i].first_chunk = recording->chunk_count * i / worker_count;
+        workers[i].end_chunk = recording->chunk_count * (i + 1) / worker_count;
+        // The first runs on this thread
+        started[i] = i > 0 && pthread_create(&threads[i], NULL, run_recording_worker, &workers[i]) == 0;
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            run_recording_worker(&workers[i]);
+        }
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        if (workers[i].failed_chunk != SIZE_MAX) {
+            printf("Failed to decode chunk %zu of %s\n", workers[i].failed_chunk, path);
+            return false;
+        }
+        if (workers[i].kr != KERN_SUCCESS) {
+            printf("Failed to count %s: %s\n", path, mach_error_string(workers[i].kr));
+            return false;
+        }
+    }
+
+    for (size_t i = 1; i < worker_count; i++) {
+        kern_return_t kr = merge_recording_worker(&workers[0], &workers[i]);
+        if (kr != KERN_SUCCESS) {
+            printf("Failed to count %s: %s\n", path, mach_error_string(kr));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool print_method_counts(const method_counts_t *methods, count_grouping_t grouping, size_t top) {
+    // Classes and selectors are counted by method, then added up here
+    method_counts_t grouped = {0};
+    const method_counts_t *table = methods;
+    if (grouping != COUNT_BY_METHOD) {
+        for (size_t i = 0; i < methods->capacity; i++) {
+            const method_count_t *entry = &methods->entries[i];
+            if (entry->count == 0) {
+                continue;
+            }
+
+            bool added = grouping == COUNT_BY_CLASS ? method_counts_add(&grouped, entry->class_name, NULL, false, entry->count) :
+                method_counts_add(&grouped, NULL, entry->method_name, false, entry->count);
+            if (!added) {
+                free(grouped.entries);
+                return false;
+            }
+        }
+        table = &grouped;
+    }
+
+    method_count_t *sorted = malloc((table->count ? table->count : 1) * sizeof(method_count_t));
+    if (sorted == NULL) {
+        free(grouped.entries);
+        return false;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].count > 0) {
+            sorted[count++] = table->entries[i];
+        }
+    }
+    qsort(sorted, count, sizeof(method_count_t), compare_methods);
+
+    if (top > 0 && count > top) {
+        count = top;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const method_count_t *entry = &sorted[i];
+        if (grouping == COUNT_BY_METHOD) {
+            printf("%12llu  %c[%s %s]\n", (unsigned long long)entry->count, entry->is_class_method ? '+' : '-', entry->class_name, entry->method_name);
+        }
+        else {
+            printf("%12llu  %s\n", (unsigned long long)entry->count, entry->class_name ? entry->class_name : entry->method_name);
+        }
+    }
+
+    free(sorted);
+    free(grouped.entries);
+    return true;
+}
+
+static int count_recording(trace_recording_t *recording, const char *path, const count_options_t *options, trace_query_t *query) {
+    uint64_t recording_start = 0;
+    uint64_t dropped = 0;
+    if (prepare_trace_query(recording, query, &recording_start, &dropped) != 0) {
+        return 1;
+    }
+
+    uint64_t event_count = 0;
+    for (size_t i = 0; i < recording->chunk_count; i++) {
+        event_count += trace_recording_chunk(recording, i)->event_count;
+    }
+
+    size_t worker_count = options->jobs;
+    if (worker_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? (size_t)cores : 1;
+    }
+    worker_count = MIN(worker_count, MIN(MAX(recording->chunk_count, 1), COUNT_MAX_WORKERS));
+
+    recording_worker_t workers[COUNT_MAX_WORKERS];
+    memset(workers, 0, sizeof(workers));
+    bool prepared = true;
+    for (size_t i = 0; i < worker_count; i++) {
+        workers[i].recording = recording;
+        workers[i].matcher.query = query;
+        workers[i].matcher.recording_start = recording_start;
+        prepared &= prepare_recording_worker(&workers[i], options->grouping);
+    }
+
+    int status = 0;
+    uint64_t started_at = monotonic_ns();
+    if (!prepared) {
+        printf("Failed to allocate memory for counting\n");
+        status = 1;
+    }
+    else if (!run_recording_workers(workers, worker_count, recording, path)) {
+        status = 1;
+    }
+    else {
+        bool printed = false;
+        if (options->grouping == COUNT_BY_STACK) {
+            printed = folded_stacks_write(workers[0].stacks, FOLDED_STACKS_WEIGHT_CALLS, stdout) == KERN_SUCCESS;
+        }
+        else if (options->grouping == COUNT_BY_THREAD) {
+            printed = print_counts(workers[0].thread_counts, COUNT_THREAD_IDS, NULL, options->top);
+        }
+        else {
+            printed = print_method_counts(&workers[0].methods, options->grouping, options->top);
+        }
+
+        if (!printed) {
+            printf("Failed to print the counts for %s\n", path);
+            status = 1;
+        }
+        else {
+            fprintf(stderr, "[objsee] %llu of %llu events matched, %zu of %zu chunks read by %zu workers in %.1f ms", (unsigned long long)workers[0].matched,
+                    (unsigned long long)event_count, workers[0].chunks_read, recording->chunk_count, worker_count, (double)(monotonic_ns() - started_at) / 1e6);
+            if (dropped > 0) {
+                fprintf(stderr, ", %llu events were dropped while recording", (unsigned long long)dropped);
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+
+    if (!recording->complete) {
+        fprintf(stderr, "[objsee] %s was never closed, so the end of the trace may be missing\n", path);
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        free_recording_worker(&workers[i]);
+    }
+    return status;
+}
+
+int count_trace_file(const char *path, int predicate_count, const char **predicates) {
+    count_options_t options = {
+        .grouping = COUNT_BY_SELECTOR,
+    };
+    trace_query_t query;
+    if (!parse_count_options(predicate_count, predicates, &options) || parse_trace_query(options.predicate_count, options.predicates, &query) != 0) {
+        return 1;
+    }
+
+    trace_columns_t *columns = trace_columns_open(path);
+    if (columns != NULL) {
+        int status = count_columns(columns, path, &options, &query);
+        trace_columns_close(columns);
+        return status;
+    }
+
+    trace_recording_t *recording = trace_recording_open(path);
+    if (recording != NULL) {
+        int status = count_recording(recording, path, &options, &query);
+        trace_recording_close(recording);
+        return status;
+    }
+
+    printf("Failed to open %s as a recording or columnar trace\n", path);
+    return 1;
+}
@@ -0,0 +1,31 @@
+//
+//  trace_stats.h
+//  objsee
+//
+//  Created by Ethan Arbuckle on 3/11/25.
+//
+
+#ifndef TRACE_STATS_H
+#define TRACE_STATS_H
+
+/**
+ * Count the calls in a recording or columnar trace. Takes the same predicates as query_trace_recording(), plus:
+ *
+ *   by=selector|class|thread   What to count by. Selector is the default
+ *   by=method                  By class and selector together. Recordings only
+ *   by=stack                   By call stack, printed in flame graph "folded" form. Recordings only
+ *   top=<N>                    Only print the N largest groups
+ *   jobs=<N>                   Split a recording's chunks between N threads. Defaults to one per core
+ *
+ * A columnar trace is read a column at a time, decoding only what the predicates and grouping need. A recording
+ * is split into runs of chunks that are decoded and counted in parallel, then merged in order, so the output is
+ * the same however many threads there are
+ *
+ * @param path The recording or columnar trace
+ * @param predicate_count Number of predicates
+ * @param predicates The predicates
+ * @return 0 on success, 1 on error
+ */
+int count_trace_file(const char *path, int predicate_count, const char **predicates);
+
+#endif // TRACE_STATS_H
@@ -7,7 +7,10 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <json-c/json_tokener.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include "format.h"
+#include "json_reader.h"
+#include "trace_server.h"
 
 #if TARGET_OS_MAC && !TARGET_OS_IPHONE
 #include <curses.h>
@@ -36,6 +39,10 @@
 #define COLOR_PAIR_DEPTH 13
 #define COLOR_PAIR_HEADER 14
 #define COLOR_MEMORY_SIZE 3
+// Free space in the receive buffer before each recv
+#define TUI_RECV_BUFFER_SIZE (1024 * 1024)
+// Longest the tui waits for a trace before checking for input again
+#define TUI_WAKE_INTERVAL_MS 100
 
 typedef struct {
     WINDOW *win;
@@ -67,6 +74,9 @@ static int last_used_colors[COLOR_MEMORY_SIZE] = {0};
 static int color_memory_index = 0;
 static int update_counter = 0;
 static tracer_ui_t *g_ui = NULL;
+// Replays redraw in batches, from poll_replay(), rather than as lines arrive
+static bool batch_redraws = false;
+static bool redraw_pending = false;
 
 static void redraw_thread_window(thread_view_t *tv);
 
@@ -463,7 +473,38 @@ static void redraw_all_windows(void) {
     doupdate();
 }
 
-static void process_trace(const char *json_str) {
+static void show_trace_line(uint16_t thread_id, const char *formatted) {
+    if (thread_id == 0) {
+        return;
+    }
+    
+    bool did_create_tv = false;
+    thread_view_t *tv = get_or_create_thread_view(thread_id, &did_create_tv);
+    if (tv == NULL) {
+        return;
+    }
+    
+    if (formatted) {
+        record_line_for_thread(tv, formatted);
+        update_counter++;
+
+        if (batch_redraws) {
+            redraw_pending = true;
+        }
+        else if (did_create_tv || tv->current_line <= 25) {
+            redraw_thread_window(tv);
+            cleanup_inactive_threads();
+        }
+        else if (update_counter >= UPDATE_THRESHOLD_EVENT_COUNT) {
+            update_counter = 0;
+            redraw_all_windows();
+            cleanup_inactive_threads();
+        }
+    }
+}
+
+// The slow path, for lines the json reader doesn't accept
+static void process_trace_with_tokener(const char *json_str) {
     json_object *trace = json_tokener_parse(json_str);
     if (trace == NULL) {
         return;
@@ -476,36 +517,37 @@ static void process_trace(const char *json_str) {
         event.thread_id = json_object_get_int64(obj);
     }
     
-    if (event.thread_id == 0) {
-        json_object_put(trace);
-        return;
+    const char *formatted = NULL;
+    if (json_object_object_get_ex(trace, "formatted_output", &obj)) {
+        formatted = json_object_get_string(obj);
     }
-    
-    bool did_create_tv = false;
-    thread_view_t *tv = get_or_create_thread_view(event.thread_id, &did_create_tv);
-    if (tv == NULL) {
-        json_object_put(trace);
+    show_trace_line(event.thread_id, formatted);
+    json_object_put(trace);
+}
+
+static void process_trace(char *json_str, size_t length) {
+    json_field_t fields[] = {
+        { .name = "thread_id" },
+        { .name = "formatted_output" },
+    };
+    if (json_read_fields(json_str, length, fields, 2) != KERN_SUCCESS) {
+        process_trace_with_tokener(json_str);
         return;
     }
     
-    if (json_object_object_get_ex(trace, "formatted_output", &obj)) {
-        const char *formatted = json_object_get_string(obj);
-        if (formatted) {
-            record_line_for_thread(tv, formatted);
-            update_counter++;
-
-            if (did_create_tv || tv->current_line <= 25) {
-                redraw_thread_window(tv);
-                cleanup_inactive_threads();
-            }
-            else if (update_counter >= UPDATE_THRESHOLD_EVENT_COUNT) {
-                update_counter = 0;
-                redraw_all_windows();
-                cleanup_inactive_threads();
-            }
-        }
+    // Streams always write these as a number and a string. Anything else is treated as missing
+    tracer_event_t event = {0};
+    event.thread_id = fields[0].type == JSON_FIELD_NUMBER ? fields[0].number : 0;
+    show_trace_line(event.thread_id, fields[1].type == JSON_FIELD_STRING ? fields[1].string : NULL);
+}
+
+// Show everything that arrived since the last redraw, when redraws are batched
+static void flush_redraws(void) {
+    if (redraw_pending) {
+        redraw_pending = false;
+        redraw_all_windows();
+        cleanup_inactive_threads();
     }
-    json_object_put(trace);
 }
 
 static void handle_signal(int sig) {
@@ -545,7 +587,7 @@ static void cleanup_ui(void) {
     g_ui = NULL;
 }
 
-int run_tui_trace_server(tracer_config_t *config) {
+static bool setup_ui(void) {
     initscr();
     cbreak();
     noecho();
@@ -559,14 +601,14 @@ int run_tui_trace_server(tracer_config_t *config) {
     g_ui = calloc(1, sizeof(tracer_ui_t));
     if (g_ui == NULL) {
         endwin();
-        return 1;
+        return false;
     }
     
     g_ui->threads = calloc(30, sizeof(thread_view_t *));
     if (g_ui->threads == NULL) {
         free(g_ui);
         endwin();
-        return 1;
+        return false;
     }
     g_ui->thread_count = 0;
     g_ui->active_thread = 0;
@@ -587,6 +629,75 @@ int run_tui_trace_server(tracer_config_t *config) {
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    return true;
+}
+
+static void handle_input(void) {
+    int ch = getch();
+    if (ch != ERR) {
+        thread_view_t *active_tv = g_ui->threads[g_ui->active_thread];
+        bool need_redraw = false;
+        
+        switch (ch) {
+            case 'q': {
+                g_ui->running = false;
+                break;
+            }
+                
+            case KEY_RIGHT: {
+                if (g_ui->active_thread < g_ui->thread_count - 1) {
+                    g_ui->active_thread++;
+                    need_redraw = true;
+                }
+                break;
+            }
+                
+            case KEY_LEFT: {
+                if (g_ui->active_thread > 0) {
+                    g_ui->active_thread--;
+                    need_redraw = true;
+                }
+                break;
+            }
+                
+            case KEY_DOWN: {
+                if (active_tv && active_tv->scroll_pos + active_tv->max_lines < active_tv->buffer_size) {
+                    active_tv->scroll_pos += active_tv->max_lines / 2;
+                    if (active_tv->scroll_pos > active_tv->buffer_size - active_tv->max_lines) {
+                        active_tv->scroll_pos = active_tv->buffer_size - active_tv->max_lines;
+                    }
+                    need_redraw = true;
+                }
+                break;
+            }
+                
+            case KEY_UP: {
+                if (active_tv && active_tv->scroll_pos > 0) {
+                    active_tv->scroll_pos -= active_tv->max_lines / 2;
+                    if (active_tv->scroll_pos < 0) {
+                        active_tv->scroll_pos = 0;
+                    }
+                    need_redraw = true;
+                }
+                break;
+            }
+        }
+        
+        if (need_redraw) {
+            for (size_t i = 0; i < g_ui->thread_count; i++) {
+                redraw_thread_window(g_ui->threads[i]);
+            }
+        }
+    }
+}
+
+int run_tui_trace_server(tracer_config_t *config) {
+    if (!setup_ui()) {
+        return 1;
+    }
+    
+    int max_x, _;
+    getmaxyx(stdscr, _, max_x);
     
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
@@ -639,8 +750,9 @@ int run_tui_trace_server(tracer_config_t *config) {
     fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
     
     bool connection_active = true;
-    char buffer[8192];
-    size_t buffer_pos = 0;
+    output_buffer_t received = {0};
+    // Lines are drawn as they arrive, and the screen redrawn once per read rather than once per line
+    batch_redraws = true;
     
     wattron(g_ui->header, COLOR_PAIR(COLOR_PAIR_HEADER) | A_BOLD);
     mvwprintw(g_ui->header, 0, 0, " Connected to process - Press 'q' to quit ");
@@ -648,91 +760,49 @@ int run_tui_trace_server(tracer_config_t *config) {
     wrefresh(g_ui->header);
     
     while (g_ui->running) {
-        int ch = getch();
-        if (ch != ERR) {
-            thread_view_t *active_tv = g_ui->threads[g_ui->active_thread];
-            bool need_redraw = false;
+        handle_input();
+        
+        // Sleeps until there's a trace or a key to read
+        struct pollfd fds[2] = {
+            { .fd = connection_active ? client_fd : -1, .events = POLLIN },
+            { .fd = STDIN_FILENO, .events = POLLIN },
+        };
+        if (poll(fds, 2, TUI_WAKE_INTERVAL_MS) <= 0 || fds[0].revents == 0) {
+            continue;
+        }
+        
+        // The buffer grows to hold lines of any length
+        if (!output_buffer_reserve(&received, TUI_RECV_BUFFER_SIZE)) {
+            break;
+        }
+        
+        ssize_t bytes_read = recv(client_fd, received.data + received.length, TUI_RECV_BUFFER_SIZE, 0);
+        if (bytes_read > 0) {
+            received.length += bytes_read;
             
-            switch (ch) {
-                case 'q': {
-                    g_ui->running = false;
-                    break;
-                }
-                    
-                case KEY_RIGHT: {
-                    if (g_ui->active_thread < g_ui->thread_count - 1) {
-                        g_ui->active_thread++;
-                        need_redraw = true;
-                    }
-                    break;
-                }
-                    
-                case KEY_LEFT: {
-                    if (g_ui->active_thread > 0) {
-                        g_ui->active_thread--;
-                        need_redraw = true;
-                    }
-                    break;
-                }
-                    
-                case KEY_DOWN: {
-                    if (active_tv && active_tv->scroll_pos + active_tv->max_lines < active_tv->buffer_size) {
-                        active_tv->scroll_pos += active_tv->max_lines / 2;
-                        if (active_tv->scroll_pos > active_tv->buffer_size - active_tv->max_lines) {
-                            active_tv->scroll_pos = active_tv->buffer_size - active_tv->max_lines;
-                        }
-                        need_redraw = true;
-                    }
-                    break;
-                }
-                    
-                case KEY_UP: {
-                    if (active_tv && active_tv->scroll_pos > 0) {
-                        active_tv->scroll_pos -= active_tv->max_lines / 2;
-                        if (active_tv->scroll_pos < 0) {
-                            active_tv->scroll_pos = 0;
-                        }
-                        need_redraw = true;
-                    }
-                    break;
-                }
+            char *line_start = received.data;
+            char *line_end;
+            while ((line_end = memchr(line_start, '\n', received.data + received.length - line_start))) {
+                *line_end = '\0';
+                process_trace(line_start, line_end - line_start);
+                line_start = line_end + 1;
             }
             
-            if (need_redraw) {
-                for (size_t i = 0; i < g_ui->thread_count; i++) {
-                    redraw_thread_window(g_ui->threads[i]);
-                }
-            }
+            size_t remaining = received.data + received.length - line_start;
+            memmove(received.data, line_start, remaining);
+            received.length = remaining;
+            flush_redraws();
         }
-        
-        if (connection_active) {
-            ssize_t bytes_read = recv(client_fd, buffer + buffer_pos, sizeof(buffer) - buffer_pos, 0);
-            if (bytes_read > 0) {
-                buffer[buffer_pos + bytes_read] = '\0';
-                
-                char *line_start = buffer;
-                char *line_end;
-                while ((line_end = strchr(line_start, '\n'))) {
-                    *line_end = '\0';
-                    process_trace(line_start);
-                    line_start = line_end + 1;
-                }
-                
-                buffer_pos = strlen(line_start);
-                if (buffer_pos > 0) {
-                    memmove(buffer, line_start, buffer_pos);
-                }
-            }
-            else if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-                time_t now = time(NULL);
-                char timestr[64];
-                strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&now));
-                mvwprintw(g_ui->header, 0, max_x - 20, "[Detached: %s]", timestr);
-                wrefresh(g_ui->header);
-            }
+        else if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            connection_active = false;
+            time_t now = time(NULL);
+            char timestr[64];
+            strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&now));
+            mvwprintw(g_ui->header, 0, max_x - 20, "[Detached: %s]", timestr);
+            wrefresh(g_ui->header);
         }
-        usleep(1000);
     }
+    output_buffer_free(&received);
     
     if (g_ui->running == 1) {
         
@@ -749,3 +819,50 @@ int run_tui_trace_server(tracer_config_t *config) {
     cleanup_ui();
     return 0;
 }
+
+static void replay_line(char *line, int length, void *context) {
+    process_trace(line, length);
+}
+
+// Between batches of replayed events: take input and show what arrived since the last batch
+static bool poll_replay(void *context) {
+    handle_input();
+    flush_redraws();
+    return g_ui->running;
+}
+
+int run_tui_trace_replay(tracer_config_t *config, const char *path, double speed) {
+    if (!setup_ui()) {
+        return 1;
+    }
+    
+    wattron(g_ui->header, COLOR_PAIR(COLOR_PAIR_HEADER) | A_BOLD);
+    mvwprintw(g_ui->header, 0, 0, " Replaying %s - Press 'q' to quit ", path);
+    wattroff(g_ui->header, COLOR_PAIR(COLOR_PAIR_HEADER) | A_BOLD);
+    wrefresh(g_ui->header);
+    
+    trace_replay_options_t options = {
+        .speed = speed,
+        .handle_line = replay_line,
+        .poll = poll_replay,
+    };
+    batch_redraws = true;
+    int status = replay_trace_file(config, path, &options);
+    poll_replay(NULL);
+    
+    // Keep the replayed trace on screen until it's dismissed
+    if (g_ui->running) {
+        wattron(g_ui->header, COLOR_PAIR(COLOR_PAIR_HEADER) | A_BOLD);
+        mvwprintw(g_ui->header, 0, 0, " Replay finished - Press 'q' to quit ");
+        wclrtoeol(g_ui->header);
+        wattroff(g_ui->header, COLOR_PAIR(COLOR_PAIR_HEADER) | A_BOLD);
+        wrefresh(g_ui->header);
+    }
+    while (g_ui->running) {
+        handle_input();
+        usleep(10000);
+    }
+    
+    cleanup_ui();
+    return status;
+}
@@ -16,4 +16,14 @@
  */
 int run_tui_trace_server(tracer_config_t *config);
 
+/**
+ * Replay a trace file into the tui, as if it were arriving live
+ *
+ * @param config The configuration to format binary events with. It must be set up for the tui, like a live session's
+ * @param path The file to replay
+ * @param speed Multiple of real time to replay at, or 0 for as fast as possible
+ * @return 0 on success, 1 on error
+ */
+int run_tui_trace_replay(tracer_config_t *config, const char *path, double speed);
+
 #endif /* tui_trace_server_h */